@@ -10,8 +10,8 @@
 *					tweaked, as this was geared towards compilation on a C++ compiler.
 *
 *		Notes:		Add your Trace Entrances/Exits and Debug Checks
-*					If you are reading in your IPs, ports, etc. I would add that 
-*					routine here, and call it whenever your process starts.
+*					IPs, ports, timeouts and the like can be read from a
+*					configuration file at startup; see STARTUP CONFIGURATION.
 *
 *		
 *
@@ -19,6 +19,22 @@
 *		VERSION		DATE	     COMMENTS
 *		-------    ------       ---------------------------------------------------
 *		1.0.0	  1/28/18		Initial Release
+*		1.1.0	 10/18/26		Traffic capture and time-scaled replay
+*		1.2.0	 10/18/26		Open-loop load generator, latency histograms
+*		1.3.0	 10/18/26		Busy-poll receive mode with adaptive backoff
+*		1.4.0	 10/18/26		Batched accept draining
+*		1.5.0	 10/18/26		Idle-connection reaper and keepalive settings
+*		1.6.0	 10/18/26		Socket tuning profiles
+*		1.7.0	 10/18/26		Adaptive, pooled receive buffers
+*		1.8.0	 10/18/26		Client-side endpoint load balancer
+*		1.9.0	 10/18/26		Managed reconnect with backoff and circuit breaker
+*		1.10.0	 10/18/26		Overload admission control and load shedding
+*		1.11.0	 10/18/26		Delimiter framing with SIMD scanning
+*		1.12.0	 10/18/26		Length framing with CRC32C integrity checking
+*		1.13.0	 10/18/26		Negotiated per-message compression
+*		1.14.0	 10/18/26		Hot restart by handing sockets to a new process
+*		1.15.0	 10/18/26		Thread-per-core runtime
+*		1.16.0	 10/18/26		Startup configuration loader with pre-warming
 *************************************************************************************/
 
 #ifdef __TANDEM
@@ -33,6 +49,25 @@
 extern "C" {
 #endif
 
+/*
+ * Process-wide state (the capture, the tuning profile table and the default receive
+ * pool) can be reached from several runtime cores at once, so it is kept under a lock.
+ * A Guardian process has a single thread, and there the locks compile away.
+ */
+#ifdef __TANDEM
+#define SHARED_LOCK(lock)
+#define SHARED_UNLOCK(lock)
+#else
+#define SHARED_LOCK(lock)       pthread_mutex_lock ( &lock )
+#define SHARED_UNLOCK(lock)     pthread_mutex_unlock ( &lock )
+#endif
+
+/* for the helpers kept here as examples, which nothing in the library calls */
+#ifdef __GNUC__
+#define NSCC_UNUSED             __attribute__ ( ( unused ) )
+#else
+#define NSCC_UNUSED
+#endif
 
 /***************************************************************************************
 *						FUNCTION PROTOTYPES AND DEFINITIONS
@@ -60,7 +95,7 @@ extern "C" {
 *
 * @return short             The status of the FILE_GET_INFO
 ***************************************************************/
-static void await_completion (
+static NSCC_UNUSED void await_completion (
           signed long      *sock_fn
         , short            *buffer_addr
         , signed short     buffer_size
@@ -69,695 +104,7843 @@ static void await_completion (
         , signed long      timeout
         , signed short     *error_code)
 {
+    short   file_num;
+
     memset ( buffer_addr, 0, sizeof ( buffer_size ) );
 
-    AWAITIOX ( &sock_fn
-             , ( signed long * )    &buffer_addr
-             , ( unsigned short * ) &count_trnsfr
-             , &tag
+    file_num = ( short ) *sock_fn;
+    AWAITIOX ( &file_num
+             , ( signed long * )    buffer_addr
+             , ( unsigned short * ) count_trnsfr
+             , tag
              , timeout);
 
-    FILE_GETINFO_ ( sock_fn, &error_code );
+    *sock_fn = file_num;
+    FILE_GETINFO_ ( file_num, error_code );
 }
 
 /* Add them here if you make some new routines */
 
 /***************************************************************
 *
-* @fn                       Set_Proc
-*
-* FUNCTION:                 Specifies the name of the NonStop TCPIP
-*                           or TCP6SAM process, which the socket
-*                           will be using.
+* @fn                       Get_Timestamp
 *
-* NOTE:                     ex. $ZB27D, $ZB26C
+* FUNCTION:                 Returns the current time in microseconds.
+*                           Only differences between two calls are
+*                           meaningful.
 *
-* @param process_name       The NS process name
-* @return void
+* @return TIMESTAMP         The current time in microseconds
 ***************************************************************/
-static void Set_Inet_Name( INET_NAME process_name )
+static TIMESTAMP Get_Timestamp ( void )
 {
-    socket_set_inet_name(process_name);
-}
+#ifdef __TANDEM
+    return ( TIMESTAMP ) JULIANTIMESTAMP ( 0 );
+#else
+    struct timeval  now;
 
+    gettimeofday ( &now, NULL );
 
-/*************************************************************************
+    return ( ( TIMESTAMP ) now.tv_sec * 1000000 ) + now.tv_usec;
+#endif
+}
+
+/***************************************************************
 *
-* @fn                   Get_Sock
+* @fn                       Get_Cpu_Micros
 *
-* FUNCTION:             Builds the sockaddr structure. The sockaddr structure
-*                       holds all information required to perform operations
-*                       w/ a client/server. It holds the IP, Port, Addr family
-*                       in a network readible format.
+* FUNCTION:                 CPU time used so far, in microseconds,
+*                           for timing work that may be preempted.
 *
-* NOTE:                 ex. of address_family : AF_INET, PF_INET, etc.
+* NOTE:                     Guardian only keeps it per process, so
+*                           there another thread's work counts too.
 *
-* @param connection     The connection information needed in making a connection
-* @param address_family The AF used to create a socket
-* @return  void
-*************************************************************************/
-static void Set_SockAddr ( TCP_CONNECTION_INFO *connection, short address_family )
+* @return TIMESTAMP         The CPU time used, in microseconds
+***************************************************************/
+static TIMESTAMP Get_Cpu_Micros ( void )
 {
-    /* allocate memory for the socket address structure */
-    connection->sockaddr = malloc(sizeof(connection->sockaddr));
-    /* zero it out */
-    memset(connection->sockaddr, 0, sizeof(*connection->sockaddr));
-    /* sometimes sa_data fills with junk which makes the server refuse the connection,*/
-    /* so to be safe we zero it out                                                   */
-    memset(connection->sockaddr->sa_data, '\0', sizeof(connection->sockaddr->sa_data));
-    /* here is where we set the values in the structure into a network readable format*/
-    connection->sockaddr->sin_family = address_family;
-    connection->sockaddr->sin_port = htons(connection->port);
-    connection->sockaddr->sin_addr.s_addr = inet_addr(connection->ipaddr);
+#ifdef __TANDEM
+    return ( TIMESTAMP ) MYPROCESSTIME ( );
+#else
+    struct timespec used;
+
+    if ( clock_gettime ( CLOCK_THREAD_CPUTIME_ID, &used ) < 0 )
+        return 0;
+
+    return ( ( TIMESTAMP ) used.tv_sec * 1000000 ) + used.tv_nsec / 1000;
+#endif
 }
 
-/*******************************************************************
+/***************************************************************
 *
-* @fn                     NewSocket
+* @fn                       Sleep_Micros
 *
-* FUNCTION:               Creates a new Socket/FD
+* FUNCTION:                 Suspends the process for roughly the
+*                           given number of microseconds.
 *
-* NOTE:
+* NOTE:                     DELAY on Guardian works in centiseconds,
+*                           so shorter waits are rounded up to 10ms.
 *
-* @param connection       The connection information used to create the socket
-* @param address_family   The address family of the socket connection
-* @param socket_type      The type of socket this will be
-* @param protocol         The protocol we would like to implement
-* @return socket fn       The file descriptor (socket number)
-*******************************************************************/
-static int Create_Socket (TCP_CONNECTION_INFO *connection, int address_family, int socket_type, int protocol)
+* @param micros             How long to sleep
+* @return void
+***************************************************************/
+static void Sleep_Micros ( TIMESTAMP micros )
 {
-    int socket_num;
-
-    /* Don't forge to call the freeing proc when done */
-    memset( &connection->sock, '\0', sizeof ( *connection->sock ) );
-    connection->sock = ( int * ) malloc ( sizeof ( int ) );
+    if ( micros <= 0 )
+        return;
+#ifdef __TANDEM
+    DELAY ( ( long ) ( ( micros + 9999 ) / 10000 ) );
+#else
+    usleep ( ( useconds_t ) micros );
+#endif
+}
 
-    socket_num = socket( address_family
-                       , socket_type
-                       , protocol );
+/***************************************************************
+*
+* @fn                       Next_Random
+*
+* FUNCTION:                 A small xorshift generator, so schedules
+*                           and jitter are cheap and reproducible from
+*                           a seed.
+*
+* @param state              The generator state; must not be 0
+* @return double            A value in (0, 1]
+***************************************************************/
+static double Next_Random ( unsigned long long *state )
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
 
-    return socket_num;
+    return ( ( *state >> 11 ) + 1 ) * ( 1.0 / 9007199254740992.0 );
 }
 
-/*******************************************************************
+/***************************************************************************************
+*						TRAFFIC CAPTURE
 *
-* @fn                     Get_Sock_NW
+*   Every payload going through New_Send/New_Recv (and the nowait variants) can be
+*   recorded to an append-only unstructured file. Records are staged in one of two
+*   buffers; when the active buffer fills it is handed to the writer and the other
+*   buffer takes over, so the sending path never waits on the disk. If the previous
+*   write is still in flight when the next buffer fills, the payload is dropped and
+*   counted rather than stalling the caller. A payload too big for a staging buffer
+*   is the exception: it is written through, piece by piece, and its caller waits.
 *
-* FUNCTION:               Creates a new NOWAIT Socket/FD
+*   Off Guardian the writer is a thread of its own. A Guardian process has no threads,
+*   so there the buffer goes to a nowait WRITEX instead.
 *
-* NOTE:
+*   A nowait send or receive is recorded when it completes, with the count the stack
+*   actually transferred; see Complete_NW.
 *
-* @param connection       The connection information used to create the socket
-* @param address_family   The address family of the socket connection
-* @param socket_type      The type of socket this will be
-* @param protocol         The protocol we would like to implement
-* @param sync             Input value: NOT SUPPORTED ON GUARDIAN, MUST USE 0
-* @return socket fn       The file descriptor (socket number)
-*******************************************************************/
-static int Get_Sock_NW( TCP_CONNECTION_INFO *connection, int address_family, int socket_type, int protocol, int sync )
-{
-    int socket_num;
+*   NOTE: On Guardian the capture file's nowait write completes through AWAITIOX like
+*         any other, so an AWAITIOX on -1 may take it. Await_Spin and Loadgen_Run
+*         hand such completions to Capture_Take_Completion; a caller with its own
+*         AWAITIOX on -1 must do the same, or the capture stops at its next swap.
+***************************************************************************************/
+#define CAPTURE_PAD(n)  ( ( ( n ) + 1 ) & ~1 )
 
-    socket_num = socket_nw ( address_family
-                           , socket_type
-                           , protocol
-                           , connection->flags
-                           , sync );
+typedef struct _capture_state
+{
+    BOOLEAN         active;
+    short           file_num;
+    BOOLEAN         write_pending;
+    char            buffers[2][CAPTURE_BUFFER_SIZE];
+    int             fill;
+    int             current;
+    int32_t         next_id;
+    CAPTURE_STATS   stats;
+#ifndef __TANDEM
+    pthread_t       writer;
+    BOOLEAN         writer_stop;
+    int             write_buffer;
+    int             write_count;
+#endif
+} CAPTURE_STATE;
 
-    return socket_num;
-}
+static CAPTURE_STATE capture;
+#ifndef __TANDEM
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t capture_cond = PTHREAD_COND_INITIALIZER;
+#endif
 
-/*******************************************************************
+#ifndef __TANDEM
+/***************************************************************
 *
-* @fn                      Set_Bind
+* @fn                       Capture_Writer
 *
-* FUNCTION:                associates a socket with a specific
-*                          local internet address and port
-*                          This is primarily a server func but
-*                          is optional on most client connections
+* FUNCTION:                 The writer thread: writes each buffer
+*                           Capture_Swap hands it, until Capture_Stop
+*                           tells it to finish.
 *
-* NOTE:
-* @param connection       The connection information used to create the socket
-* @return                 The error code returned
-*******************************************************************/
-static int Set_Bind (TCP_CONNECTION_INFO *connection)
+* @param arg                Unused
+* @return void *            0
+***************************************************************/
+static void *Capture_Writer ( void *arg )
 {
-    int status;
+    unsigned short  written;
+    short           error;
+    char            *buffer;
+    int             count;
 
-    status = bind ( *connection->sock
-                  , ( struct sockaddr * ) connection->sockaddr
-                  , connection->sockaddr_len );
+    ( void ) arg;
 
-    return status;
-}
+    pthread_mutex_lock ( &capture_lock );
+    for ( ;; )
+    {
+        while ( !capture.write_pending && !capture.writer_stop )
+            pthread_cond_wait ( &capture_cond, &capture_lock );
+        if ( !capture.write_pending )
+            break;
 
+        /* the recorder keeps off this buffer until write_pending clears */
+        buffer = capture.buffers[capture.write_buffer];
+        count = capture.write_count;
+        pthread_mutex_unlock ( &capture_lock );
 
-/*******************************************************************
-*
-* @fn                     Set_Bind_NW
+        written = 0;
+        error = WRITEX ( capture.file_num, buffer, ( unsigned short ) count, &written, 0 );
+
+        pthread_mutex_lock ( &capture_lock );
+        if ( error == 0 && written == count )
+            capture.stats.writes++;
+        else
+            capture.stats.errors++;
+        capture.write_pending = FAIL;
+        pthread_cond_broadcast ( &capture_cond );
+    }
+    pthread_mutex_unlock ( &capture_lock );
+
+    return 0;
+}
+#endif
+
+/***************************************************************
 *
-* FUNCTION:               associates a socket with a specific
-*                         local internet address and port
-*                         This is primarily a server func but
-*                         is optional on most client connections
+* @fn                       Capture_Write_Done
 *
-*                         This is a NOWAIT call
+* FUNCTION:                 Checks, or waits for, completion of the
+*                           outstanding write on the capture file.
+*                           Called with capture_lock held.
 *
-* @param connection       The connection information used to create the socket
-* @param tag              The tag parameter to be used for the nowait operation.
-* @return                 The error code returned
-*******************************************************************/
-static int Set_Bind_NW ( TCP_CONNECTION_INFO *connection, signed long *tag )
+* @param timeout            AWAITIOX timelimit; 0 to only check, -1 to wait
+* @return BOOLEAN           SUCCESS when no write is outstanding any longer
+***************************************************************/
+static BOOLEAN Capture_Write_Done ( signed long timeout )
 {
-    int status;
+#ifdef __TANDEM
+    short           file_num;
+    short           error;
+    long            buffer_addr;
+    unsigned short  count;
+    long            tag;
 
-    status = bind_nw ( *connection->sock
-                     , ( struct sockaddr * ) connection->sockaddr
-                     , connection->sockaddr_len
-                     , &tag );
+    if ( !capture.write_pending )
+        return SUCCESS;
 
-    return status;
-}
+    file_num = capture.file_num;
+    AWAITIOX ( &file_num, &buffer_addr, &count, &tag, timeout );
+    FILE_GETINFO_ ( file_num, &error );
 
+    if ( error == ERR_TIMEOUT )
+        return FAIL;
 
-/*******************************************************************
-*
-* @fn                     Make_Connect
+    capture.write_pending = FAIL;
+    if ( error == 0 )
+        capture.stats.writes++;
+    else
+        capture.stats.errors++;
+
+    return SUCCESS;
+#else
+    while ( timeout != 0 && capture.write_pending )
+        pthread_cond_wait ( &capture_cond, &capture_lock );
+
+    return capture.write_pending ? FAIL : SUCCESS;
+#endif
+}
+
+/***************************************************************
 *
-* FUNCTION:               Connects to specified address
+* @fn                       Capture_Take_Completion
 *
-* NOTE:                   Must be called AFTER newSocket()
+* FUNCTION:                 Claims a completion taken by an AWAITIOX
+*                           on -1 if it belongs to the capture file,
+*                           so the caller does not mistake it for one
+*                           of its own.
 *
-* @param connection       The connection information used to create the socket
-* @return                 The error code returned
-*******************************************************************/
-static int Make_Connect ( TCP_CONNECTION_INFO *connection )
+* @param file_num           The file AWAITIOX returned
+* @param error              Its FILE_GETINFO_ error
+* @return BOOLEAN           SUCCESS when it was the capture's write; the
+*                           caller should then wait again
+***************************************************************/
+static BOOLEAN Capture_Take_Completion ( short file_num, short error )
 {
-    int status;
+#ifdef __TANDEM
+    if ( !capture.write_pending || file_num != capture.file_num )
+        return FAIL;
 
-    /* we have to set sa_data, if not, seems like junk fills it
-    * , which makes the server refuse the connection */
-    memset ( connection->sockaddr->sa_data
-           , '\0'
-           , sizeof ( connection->sockaddr->sa_data ) );
+    capture.write_pending = FAIL;
+    if ( error == 0 )
+        capture.stats.writes++;
+    else
+        capture.stats.errors++;
 
-    status = connect ( *connection->sock
-                     , ( struct sockaddr * ) connection->sockaddr
-                     , sizeof ( *connection->sockaddr ) );
+    return SUCCESS;
+#else
+    /* the writer thread writes the file waited; it never completes through AWAITIOX */
+    ( void ) file_num;
+    ( void ) error;
 
-    return status;
+    return FAIL;
+#endif
 }
 
-/*******************************************************************
-*
-* @fn                     Make_Connect_NW
+/***************************************************************
 *
-* FUNCTION:               Connects to specified address NO Waited
+* @fn                       Capture_Swap
 *
-* NOTE:                   Must be called AFTER newSocket_nw()
+* FUNCTION:                 Hands the active staging buffer to the writer
+*                           and switches to the other buffer.
 *
-* @param connection       The connection information used to create the socket
-* @param tag              The tag parameter to be used for the nowait operation.
-* @return                 The error code returned
-*******************************************************************/
-static int Make_Connect_NW ( TCP_CONNECTION_INFO *connection, signed long *tag )
+* @return BOOLEAN           FAIL when the other buffer is still being written
+***************************************************************/
+static BOOLEAN Capture_Swap ( void )
 {
-    int status;
+    if ( capture.fill == 0 )
+        return SUCCESS;
 
-    /* we have to set sa_data, if not, seems like junk fills it, which makes the server refuse the connection */
-    memset ( connection->sockaddr->sa_data
-           , '\0'
-           , sizeof( connection->sockaddr->sa_data ) );
+    if ( !Capture_Write_Done ( 0 ) )
+        return FAIL;
 
-    status = connect_nw ( *connection->sock
-                        , ( struct sockaddr * ) &connection->sockaddr
-                        , connection->sockaddr_len
-                        , &tag );
+#ifdef __TANDEM
+    WRITEX ( capture.file_num
+           , capture.buffers[capture.current]
+           , ( unsigned short ) capture.fill
+           , ( unsigned short * ) 0
+           , 0 );
+#else
+    capture.write_buffer = capture.current;
+    capture.write_count = capture.fill;
+    pthread_cond_broadcast ( &capture_cond );
+#endif
 
-    return status;
+    capture.write_pending = SUCCESS;
+    capture.current ^= 1;
+    capture.fill = 0;
+
+    return SUCCESS;
 }
 
-/*******************************************************************
+/***************************************************************
 *
-* @fn                     Set_Listen
+* @fn                       Capture_Put_Header
 *
-* FUNCTION:               A server based func. Listens
-*                         for incoming connections
+* FUNCTION:                 Writes a record header in its file layout:
+*                           big-endian fields, no padding.
 *
-* NOTE:
+* @param out                Receives CAPTURE_HEADER_SIZE bytes
+* @param record             The header
+* @return void
+***************************************************************/
+static void Capture_Put_Header ( unsigned char *out, CAPTURE_RECORD *record )
+{
+    int i;
+
+    for ( i = 0; i < 8; i++ )
+        out[i] = ( unsigned char ) ( ( uint64_t ) record->timestamp >> ( 56 - i * 8 ) );
+    for ( i = 0; i < 4; i++ )
+        out[8 + i] = ( unsigned char ) ( ( uint32_t ) record->conn_id >> ( 24 - i * 8 ) );
+    out[12] = ( unsigned char ) ( ( uint16_t ) record->direction >> 8 );
+    out[13] = ( unsigned char ) record->direction;
+    out[14] = ( unsigned char ) ( ( uint16_t ) record->reserved >> 8 );
+    out[15] = ( unsigned char ) record->reserved;
+    for ( i = 0; i < 4; i++ )
+        out[16 + i] = ( unsigned char ) ( ( uint32_t ) record->length >> ( 24 - i * 8 ) );
+}
+
+/***************************************************************
 *
-* @param connection       The connection information used to create the socket
-* @return                 The error code returned
-* *******************************************************************/
-static int Set_Listen (TCP_CONNECTION_INFO *connection )
+* @fn                       Capture_Get_Header
+*
+* FUNCTION:                 Reads a record header written by
+*                           Capture_Put_Header.
+*
+* @param in                 CAPTURE_HEADER_SIZE bytes from the file
+* @param record             Receives the header
+* @return void
+***************************************************************/
+static void Capture_Get_Header ( unsigned char *in, CAPTURE_RECORD *record )
 {
-    int status;
+    uint64_t    timestamp;
+    uint32_t    conn_id;
+    uint32_t    length;
+    int         i;
 
-    status = listen ( *connection->sock
-                    , connection->queue_len );
+    timestamp = 0;
+    for ( i = 0; i < 8; i++ )
+        timestamp = ( timestamp << 8 ) | in[i];
+    conn_id = 0;
+    length = 0;
+    for ( i = 0; i < 4; i++ )
+    {
+        conn_id = ( conn_id << 8 ) | in[8 + i];
+        length = ( length << 8 ) | in[16 + i];
+    }
 
-    return status;
+    record->timestamp = ( int64_t ) timestamp;
+    record->conn_id = ( int32_t ) conn_id;
+    record->direction = ( int16_t ) ( ( in[12] << 8 ) | in[13] );
+    record->reserved = ( int16_t ) ( ( in[14] << 8 ) | in[15] );
+    record->length = ( int32_t ) length;
 }
 
-/*******************************************************************
-*
-* @fn                     New_Accept
+/***************************************************************
 *
-* FUNCTION:               Checks for connections on an existing waited
-*                         socket. When a connection requestarrives,
-*                         accept creates a new socket to use for data
-*                         transfer and accepts the connection on the
-*                         new socket
+* @fn                       Capture_Write_Through
 *
+* FUNCTION:                 Stages bytes that may not fit the staging
+*                           buffer, swapping buffers and waiting for the
+*                           writer as each one fills.
 *
-* @param connection       The connection information used to create the socket
-* @return                 The error code returned
-* *******************************************************************/
-static int New_Accept ( TCP_CONNECTION_INFO *connection, int *from_len_ptr )
+* @param data               The bytes
+* @param length             How many
+* @return void
+***************************************************************/
+static void Capture_Write_Through ( char *data, int length )
 {
-    int status;
+    int piece;
 
-    status = accept ( *connection->sock
-                    , ( struct sockaddr * ) connection->sockaddr
-                    , from_len_ptr );
+    while ( length > 0 )
+    {
+        if ( capture.fill == CAPTURE_BUFFER_SIZE )
+        {
+            Capture_Write_Done ( -1 );
+            Capture_Swap ( );
+        }
 
-    return status;
+        piece = CAPTURE_BUFFER_SIZE - capture.fill;
+        if ( piece > length )
+            piece = length;
+
+        memcpy ( capture.buffers[capture.current] + capture.fill, data, piece );
+        capture.fill += piece;
+        data += piece;
+        length -= piece;
+    }
 }
 
-/*******************************************************************
+/***************************************************************
 *
-* @fn                     New_Accept_NW
+* @fn                       Capture_Record
 *
-* FUNCTION:               Checks for connections on an existing no waited
-*                         socket. When a connection requestarrives,
-*                         accept creates a new socket to use for data
-*                         transfer and accepts the connection on the
-*                         new socket
+* FUNCTION:                 Stages a single payload in the capture buffer.
+*                           One bigger than a staging buffer is written
+*                           through, and the caller waits for it.
 *
-* NOTE:
-*
-* @param connection       The connection information used to create the socket
-* @param tag             The tag parameter to be used for the nowait operation.
-* @return                 The error code returned
-* *******************************************************************/
-static int New_Accept_NW ( TCP_CONNECTION_INFO *connection, signed long *tag )
+* @param connection         The connection the payload went through
+* @param direction          CAPTURE_SEND or CAPTURE_RECV
+* @param buffer_ptr         The payload
+* @param length             The number of payload bytes
+* @return void
+***************************************************************/
+static void Capture_Record ( TCP_CONNECTION_INFO *connection, short direction, char *buffer_ptr, int length )
 {
-    int status;
+    CAPTURE_RECORD  record;
+    unsigned char   header[CAPTURE_HEADER_SIZE];
+    int             needed;
+    char            *fill_ptr;
 
-    status = accept_nw ( *connection->sock
-                       , ( struct sockaddr * ) connection->sockaddr
-                       , &connection->sockaddr_len
-                       , &tag );
+    /* the unlocked look only saves the lock when nothing is being captured */
+    if ( !capture.active || length <= 0 )
+        return;
 
-    return status;
+    SHARED_LOCK ( capture_lock );
+
+    needed = CAPTURE_HEADER_SIZE + CAPTURE_PAD ( length );
+
+    if ( !capture.active
+      || ( needed <= CAPTURE_BUFFER_SIZE && capture.fill + needed > CAPTURE_BUFFER_SIZE && !Capture_Swap ( ) ) )
+    {
+        if ( capture.active )
+            capture.stats.dropped++;
+        SHARED_UNLOCK ( capture_lock );
+        return;
+    }
+
+    /* numbered on first sight; Close_Sock gives the next socket a new number */
+    if ( connection->capture_id == 0 )
+        connection->capture_id = ++capture.next_id;
+
+    record.timestamp = Get_Timestamp ( );
+    record.conn_id = connection->capture_id;
+    record.direction = direction;
+    record.reserved = 0;
+    record.length = length;
+
+    if ( needed > CAPTURE_BUFFER_SIZE )
+    {
+        Capture_Put_Header ( header, &record );
+        Capture_Write_Through ( ( char * ) header, CAPTURE_HEADER_SIZE );
+        Capture_Write_Through ( buffer_ptr, length );
+        if ( needed - CAPTURE_HEADER_SIZE > length )
+            Capture_Write_Through ( "", 1 );
+    }
+    else
+    {
+        fill_ptr = capture.buffers[capture.current] + capture.fill;
+        Capture_Put_Header ( ( unsigned char * ) fill_ptr, &record );
+        memcpy ( fill_ptr + CAPTURE_HEADER_SIZE, buffer_ptr, length );
+        capture.fill += needed;
+    }
+
+    capture.stats.records++;
+    capture.stats.bytes += length;
+
+    SHARED_UNLOCK ( capture_lock );
 }
 
-/*********************************************************************
+/***************************************************************
 *
-* @fn                     New_Accept_NW1
+* @fn                       Capture_Start
 *
-* FUNCTION:               Used instead of accept_nw; use accept_nw1
-*                         to set the maximum connections in the queue
-*                         awaiting acceptance on a socket.
+* FUNCTION:                 Opens (creating if needed) the capture file
+*                           and begins recording traffic. New records are
+*                           appended after anything already in the file.
 *
-* NOTE:
+* NOTE:                     ex. $DATA01.CAPTURE.TRAFFIC
 *
-* @param connection       The connection information used to create the socket
-* @param tag              The tag parameter to be used for the nowait operation.
-* @return                 The error code returned
-* *******************************************************************/
-static int New_Accept_NW1 ( TCP_CONNECTION_INFO *connection, signed long *tag )
+* @param file_name          The Guardian file name of the capture file
+* @return                   The file-system error, 0 on success
+***************************************************************/
+static int Capture_Start ( char *file_name )
+{
+    short   error;
+    short   name_len;
+    short   file_num;
+    BOOLEAN created;
+    int32_t next_id;
+
+    SHARED_LOCK ( capture_lock );
+
+    if ( capture.active )
+    {
+        SHARED_UNLOCK ( capture_lock );
+        return 0;
+    }
+#ifndef __TANDEM
+    /* a Capture_Stop still waiting for its writer */
+    if ( capture.writer_stop )
+    {
+        SHARED_UNLOCK ( capture_lock );
+        return EBUSY;
+    }
+#endif
+
+    name_len = ( short ) strlen ( file_name );
+
+    /* create an unstructured file; error 10 means it is already there */
+    error = FILE_CREATE_ ( file_name, name_len, &name_len );
+    if ( error == 0 || error == 10 )
+    {
+        created = ( error == 0 ) ? SUCCESS : FAIL;
+
+        /* open for writing; nowait, with a depth of 1, where there is no writer thread */
+#ifdef __TANDEM
+        error = FILE_OPEN_ ( file_name, name_len, &file_num, 2, 0, 1 );
+#else
+        error = FILE_OPEN_ ( file_name, name_len, &file_num, 2, 0, 0 );
+#endif
+    }
+    if ( error != 0 )
+    {
+        SHARED_UNLOCK ( capture_lock );
+        return error;
+    }
+
+    /* append-only: always start from the end of file */
+    POSITION ( file_num, -1L );
+
+    /* connection numbers carry on, so a restarted capture doesn't reuse them */
+    next_id = capture.next_id;
+    memset ( &capture, 0, sizeof ( capture ) );
+    capture.next_id = next_id;
+    capture.file_num = file_num;
+
+    if ( created )
+    {
+        memcpy ( capture.buffers[0], CAPTURE_MAGIC, strlen ( CAPTURE_MAGIC ) );
+        capture.fill = strlen ( CAPTURE_MAGIC );
+    }
+
+#ifndef __TANDEM
+    error = ( short ) pthread_create ( &capture.writer, 0, Capture_Writer, 0 );
+    if ( error != 0 )
+    {
+        FILE_CLOSE_ ( file_num );
+        SHARED_UNLOCK ( capture_lock );
+        return error;
+    }
+#endif
+
+    capture.active = SUCCESS;
+
+    SHARED_UNLOCK ( capture_lock );
+
+    return 0;
+}
+
+/***************************************************************
+*
+* @fn                       Capture_Stop
+*
+* FUNCTION:                 Writes out whatever is still staged, waits
+*                           for the writes to complete and closes the file.
+*
+* @return                   The status of the FILE_CLOSE_
+***************************************************************/
+static int Capture_Stop ( void )
 {
     int status;
 
-    status = accept_nw1 ( *connection->sock
-                        , ( struct sockaddr * ) connection->sockaddr
-                        , &connection->sockaddr_len
-                        , &tag
-                        , ( short ) connection->queue_len);
+    SHARED_LOCK ( capture_lock );
+
+    if ( !capture.active )
+    {
+        SHARED_UNLOCK ( capture_lock );
+        return 0;
+    }
+
+    capture.active = FAIL;
+
+    Capture_Write_Done ( -1 );
+    Capture_Swap ( );
+    Capture_Write_Done ( -1 );
+
+#ifndef __TANDEM
+    /* the writer needs the lock to finish */
+    capture.writer_stop = SUCCESS;
+    pthread_cond_broadcast ( &capture_cond );
+    SHARED_UNLOCK ( capture_lock );
+    pthread_join ( capture.writer, 0 );
+    SHARED_LOCK ( capture_lock );
+    capture.writer_stop = FAIL;
+#endif
+
+    status = FILE_CLOSE_ ( capture.file_num );
+
+    SHARED_UNLOCK ( capture_lock );
 
     return status;
 }
 
-/*********************************************************************
+static void Rearm_Quickack ( TCP_CONNECTION_INFO *connection );
+
+/***************************************************************
 *
-* @fn                     New_Accept_NW2
+* @fn                       Complete_NW
 *
-* FUNCTION:               Accepts a connection on a new socket created
- *                        for nowait data transfer. Beforecalling this
- *                        procedure, a program should call accept_nw
- *                        on an existing socket and then call socket_nw
- *                        tocreate the new socket to be used by accept_nw2.
+* FUNCTION:                 Finishes the book-keeping for a completed
+*                           New_Send_NW or New_Recv_NW: last_activity is
+*                           stamped, so Reap_Idle sees when the I/O
+*                           finished rather than when it was started,
+*                           and the bytes actually transferred are
+*                           captured.
+*                           Await_Completion_Spin and the load generator
+*                           call this themselves; call it after taking a
+*                           completion with your own AWAITIOX.
 *
-* NOTE:
+* @param connection         The connection the I/O completed on
+* @param buffer_addr        The buffer address returned by AWAITIOX
+* @param count_trnsfr       The count returned by AWAITIOX
+* @return void
+***************************************************************/
+static void Complete_NW ( TCP_CONNECTION_INFO *connection, long buffer_addr, int count_trnsfr )
+{
+    char    *buffer_ptr;
+
+    buffer_ptr = ( char * ) buffer_addr;
+    connection->last_activity = Get_Timestamp ( );
+
+    if ( buffer_ptr && buffer_ptr == connection->nw_recv_buffer )
+    {
+        connection->nw_recv_buffer = 0;
+        Rearm_Quickack ( connection );
+        Capture_Record ( connection, CAPTURE_RECV, buffer_ptr, count_trnsfr );
+    }
+    else if ( buffer_ptr && buffer_ptr == connection->nw_send_buffer )
+    {
+        connection->nw_send_buffer = 0;
+        Capture_Record ( connection, CAPTURE_SEND, buffer_ptr, count_trnsfr );
+    }
+}
+
+/***************************************************************
 *
-* @param connection       The connection information used to create the socket
-* @param tag              The tag parameter to be used for the nowait operation.
-* @return                 The error code returned
-* *******************************************************************/
-static int New_Accept_NW2 ( TCP_CONNECTION_INFO *connection, signed long *tag )
+* @fn                       Capture_Get_Stats
+*
+* FUNCTION:                 Copies out the capture counters
+*
+* @param stats              Receives the counters
+* @return void
+***************************************************************/
+static void Capture_Get_Stats ( CAPTURE_STATS *stats )
 {
-    int status;
+    SHARED_LOCK ( capture_lock );
+    *stats = capture.stats;
+    SHARED_UNLOCK ( capture_lock );
+}
 
-    status = accept_nw2 ( *connection->sock
-                        , ( struct sockaddr * ) connection->sockaddr
-                        , &tag );
+/***************************************************************
+*
+* @fn                       Set_Proc
+*
+* FUNCTION:                 Specifies the name of the NonStop TCPIP
+*                           or TCP6SAM process, which the socket
+*                           will be using.
+*
+* NOTE:                     ex. $ZB27D, $ZB26C
+*
+* @param process_name       The NS process name
+* @return void
+***************************************************************/
+static void Set_Inet_Name( INET_NAME process_name )
+{
+    socket_set_inet_name(process_name);
+}
 
-    return status;
+
+/*************************************************************************
+*
+* @fn                   Get_Sock
+*
+* FUNCTION:             Builds the sockaddr structure. The sockaddr structure
+*                       holds all information required to perform operations
+*                       w/ a client/server. It holds the IP, Port, Addr family
+*                       in a network readible format.
+*
+* NOTE:                 ex. of address_family : AF_INET, PF_INET, etc.
+*
+* @param connection     The connection information needed in making a connection
+* @param address_family The AF used to create a socket
+* @return  void
+*************************************************************************/
+static void Set_SockAddr ( TCP_CONNECTION_INFO *connection, short address_family )
+{
+    /* allocate memory for the socket address structure */
+    connection->sockaddr = malloc(sizeof(*connection->sockaddr));
+    /* zero it out */
+    memset(connection->sockaddr, 0, sizeof(*connection->sockaddr));
+    /* sometimes sin_zero fills with junk which makes the server refuse the connection,*/
+    /* so to be safe we zero it out                                                   */
+    memset(connection->sockaddr->sin_zero, '\0', sizeof(connection->sockaddr->sin_zero));
+    /* here is where we set the values in the structure into a network readable format*/
+    connection->sockaddr->sin_family = address_family;
+    connection->sockaddr->sin_port = htons(connection->port);
+    connection->sockaddr->sin_addr.s_addr = inet_addr(connection->ipaddr);
 }
 
-/*********************************************************************
+/***************************************************************************************
+*						SOCKET TUNING PROFILES
 *
-* @fn                     New_Accept_NW3
+*   A profile is a named set of socket options. Give a connection a profile with
+*   Set_Tuning_Profile and Get_Sock / Get_Sock_NW apply it as the socket is created;
+*   if any option is refused the socket is closed again, so a socket either comes back
+*   fully tuned or not at all. An option left at TUNING_DEFAULT is not touched.
+***************************************************************************************/
+static SOCK_TUNING tuning_profiles[TUNING_MAX_PROFILES] =
+{
+    /*  name               nodelay  sndbuf   rcvbuf   quickack user_to  linger_on linger_secs fastopen ka_idle ka_intvl ka_probes */
+    { "default",           -1,      -1,      -1,      -1,      -1,      -1,       -1,         -1,      -1,     -1,      -1 },
+    { "low-latency",        1,      -1,      -1,       1,      -1,      -1,       -1,         -1,      -1,     -1,      -1 },
+    { "bulk-throughput",    0,      1048576, 1048576, -1,      -1,      -1,       -1,         -1,      -1,     -1,      -1 },
+    { "many-idle",         -1,      8192,    8192,    -1,      30000,   -1,       -1,         -1,      60,     10,       5 }
+};
+static int tuning_profile_count = 4;
+#ifndef __TANDEM
+static pthread_mutex_t tuning_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/***************************************************************
 *
-* FUNCTION:
+* @fn                       Trim
 *
-* NOTE:
+* FUNCTION:                 Strips leading and trailing white space
+*                           (and a trailing newline) in place.
 *
-* @param connection       The connection information used to create the socket
-* @param me_ptr           Points to the local address and port number used by bind_nw.
-* @param tag              The tag parameter to be used for the nowait operation.
-* @return                 The error code returned
-* *******************************************************************/
-static int New_Accept_NW3 (TCP_CONNECTION_INFO *connection, struct sockaddr *me_ptr, signed long *tag )
+* @param text               The string to trim
+* @return char *            The first non-blank character of text
+***************************************************************/
+static char *Trim ( char *text )
 {
-    int status;
+    char *end;
 
-    status = accept_nw3 ( *connection->sock
-                        , ( struct sockaddr * ) connection->sockaddr
-                        , me_ptr
-                        , &tag );
+    while ( *text == ' ' || *text == '\t' )
+        text++;
 
-    return status;
+    end = text + strlen ( text );
+    while ( end > text && ( end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r' ) )
+        *--end = '\0';
+
+    return text;
 }
 
-/**********************************************************************
+/***************************************************************
 *
-* @fn                     New_Send
+* @fn                       Parse_Config_Line
 *
-* FUNCTION:               Sends data on a connected socket
+* FUNCTION:                 Splits a "key = value" line. Blank lines and
+*                           lines starting with '#' are skipped.
 *
-* NOTE:
+* @param line               The line; modified in place
+* @param key                Returns the key
+* @param value              Returns the value
+* @return BOOLEAN           SUCCESS when the line held a key and value
+***************************************************************/
+static BOOLEAN Parse_Config_Line ( char *line, char **key, char **value )
+{
+    char *equals;
+
+    line = Trim ( line );
+    if ( *line == '\0' || *line == '#' )
+        return FAIL;
+
+    equals = strchr ( line, '=' );
+    if ( !equals )
+        return FAIL;
+
+    *equals = '\0';
+    *key = Trim ( line );
+    *value = Trim ( equals + 1 );
+
+    return SUCCESS;
+}
+
+/***************************************************************
 *
-* @param connection       The connection information used to create the socket
-* @param buffer_ptr       Points to the data to be sent..
-* @param buffer_length    The size of the buffer pointed to by buffer_ptr.
-* @return                 The error code returned
-* *******************************************************************/
-static int New_Send (TCP_CONNECTION_INFO *connection, char *buffer_ptr, int buffer_length )
+* @fn                       Parse_Number
+*
+* FUNCTION:                 Converts a whole decimal number, refusing
+*                           trailing junk and values out of range.
+*
+* @param text               The number, as text
+* @param min                The smallest acceptable value
+* @param max                The largest acceptable value
+* @param number             Receives the value
+* @return BOOLEAN           SUCCESS when text held an acceptable number
+***************************************************************/
+static BOOLEAN Parse_Number ( char *text, long min, long max, long *number )
 {
-    int status;
+    char    *end;
+    long    value;
 
-    status = send ( *connection->sock
-                  , buffer_ptr
-                  , buffer_length
-                  , connection->flags );
+    if ( *text == '\0' )
+        return FAIL;
 
-    return status;
+    errno = 0;
+    value = strtol ( text, &end, 10 );
+    if ( *end != '\0' || errno == ERANGE || value < min || value > max )
+        return FAIL;
+
+    *number = value;
+
+    return SUCCESS;
 }
 
-/*******************************************************************************
+/***************************************************************
 *
-* @fn                     New_Send_NW
+* @fn                       Tuning_Lookup
 *
-* FUNCTION:               This is a NOWAIT operation.
-*                         Sends data on a connected socket
+* FUNCTION:                 Looks a profile up by name, with tuning_lock
+*                           already held
 *
-* NOTE:
+* @param name               The profile name
+* @return SOCK_TUNING *     The profile, 0 if there is none by that name
+***************************************************************/
+static SOCK_TUNING *Tuning_Lookup ( char *name )
+{
+    int i;
+
+    for ( i = 0; i < tuning_profile_count; i++ )
+    {
+        if ( strcmp ( tuning_profiles[i].name, name ) == 0 )
+            return &tuning_profiles[i];
+    }
+
+    return 0;
+}
+
+/***************************************************************
 *
-* @param connection       The connection information used to create the socket
-* @param buffer_ptr       Points to the data to be sent..
-* @param buffer_length    The size of the buffer pointed to by buffer_ptr.
-* @param tag              The tag parameter to be used for the nowait operation.
-* @return                 The error code returned
-* *****************************************************************************/
-static int New_Send_NW ( TCP_CONNECTION_INFO *connection, char *buffer_ptr, int buffer_length, signed long *tag )
+* @fn                       Find_Tuning_Profile
+*
+* FUNCTION:                 Looks a profile up by name. Profiles are never
+*                           removed, so the pointer stays good.
+*
+* @param name               The profile name
+* @return SOCK_TUNING *     The profile, 0 if there is none by that name
+***************************************************************/
+static SOCK_TUNING *Find_Tuning_Profile ( char *name )
 {
-    int status;
+    SOCK_TUNING *profile;
+
+    SHARED_LOCK ( tuning_lock );
+    profile = Tuning_Lookup ( name );
+    SHARED_UNLOCK ( tuning_lock );
+
+    return profile;
+}
+
+/***************************************************************
+*
+* @fn                       Tuning_Field
+*
+* FUNCTION:                 Finds a profile option by name, with the
+*                           range of values the stack will take for it.
+*
+* @param profile            The profile
+* @param option             The option name
+* @param max                Receives the largest acceptable value
+* @return int *             The option, 0 if there is none by that name
+***************************************************************/
+static int *Tuning_Field ( SOCK_TUNING *profile, char *option, long *max )
+{
+    *max = 1;
+    if ( strcmp ( option, "nodelay" ) == 0 )            return &profile->nodelay;
+    if ( strcmp ( option, "quickack" ) == 0 )           return &profile->quickack;
+    if ( strcmp ( option, "linger" ) == 0 )             return &profile->linger_on;
+
+    *max = 1 << 30;
+    if ( strcmp ( option, "sndbuf" ) == 0 )             return &profile->sndbuf;
+    if ( strcmp ( option, "rcvbuf" ) == 0 )             return &profile->rcvbuf;
+    if ( strcmp ( option, "user_timeout" ) == 0 )       return &profile->user_timeout_ms;
+
+    *max = 65535;
+    if ( strcmp ( option, "linger_secs" ) == 0 )        return &profile->linger_secs;
+    if ( strcmp ( option, "fastopen" ) == 0 )           return &profile->fastopen;
+
+    /* the limits Linux puts on the keepalive timers */
+    *max = 32767;
+    if ( strcmp ( option, "keepalive_idle" ) == 0 )     return &profile->keepalive_idle;
+    if ( strcmp ( option, "keepalive_interval" ) == 0 ) return &profile->keepalive_interval;
+    *max = 127;
+    if ( strcmp ( option, "keepalive_probes" ) == 0 )   return &profile->keepalive_probes;
+
+    return 0;
+}
+
+/***************************************************************
+*
+* @fn                       Set_Tuning_Option
+*
+* FUNCTION:                 Sets one option of a profile, creating the
+*                           profile (with every option at TUNING_DEFAULT)
+*                           if it does not exist yet.
+*
+* NOTE:                     ex. "low-latency.nodelay", "1"
+*                           Every option takes -1 (TUNING_DEFAULT) or a
+*                           whole number in the option's range.
+*
+* @param key                "profile.option"
+* @param value              The value, as text
+* @return int               0 on success, -1 for an unknown option, a
+*                           bad value, or when the profile table is full
+***************************************************************/
+static int Set_Tuning_Option ( char *key, char *value )
+{
+    SOCK_TUNING *profile;
+    SOCK_TUNING check;
+    char        name[TUNING_NAME_LEN];
+    char        *option;
+    long        number;
+    long        max;
+
+    option = strchr ( key, '.' );
+    if ( !option || option - key >= TUNING_NAME_LEN )
+        return -1;
+
+    memcpy ( name, key, option - key );
+    name[option - key] = '\0';
+    option++;
+
+    /* check before a new profile is made for it */
+    if ( !Tuning_Field ( &check, option, &max ) || !Parse_Number ( value, TUNING_DEFAULT, max, &number ) )
+        return -1;
+
+    SHARED_LOCK ( tuning_lock );
+
+    profile = Tuning_Lookup ( name );
+    if ( !profile && tuning_profile_count < TUNING_MAX_PROFILES )
+    {
+        profile = &tuning_profiles[tuning_profile_count];
+        memset ( profile, 0xff, sizeof ( SOCK_TUNING ) );
+        strcpy ( profile->name, name );
+        tuning_profile_count++;
+    }
+    if ( profile )
+        *Tuning_Field ( profile, option, &max ) = ( int ) number;
+
+    SHARED_UNLOCK ( tuning_lock );
+
+    return profile ? 0 : -1;
+}
+
+/***************************************************************
+*
+* @fn                       Load_Tuning_Profiles
+*
+* FUNCTION:                 Reads profiles from a file at startup. Each
+*                           line is "profile.option = value"; options of
+*                           the built-in profiles may be overridden and new
+*                           profiles defined.
+*
+* NOTE:                     ex.   # tighter buffers for the feed links
+*                                 feed.nodelay = 1
+*                                 feed.rcvbuf  = 65536
+*
+* @param file_name          The file to read
+* @return int               0 on success, otherwise the line number of
+*                           the first bad line (-1 if the file can't be opened)
+***************************************************************/
+static int Load_Tuning_Profiles ( char *file_name )
+{
+    FILE    *file;
+    char    line[256];
+    char    *key;
+    char    *value;
+    int     line_num;
+    int     status;
+
+    file = fopen ( file_name, "r" );
+    if ( !file )
+        return -1;
+
+    status = 0;
+    for ( line_num = 1; fgets ( line, sizeof ( line ), file ); line_num++ )
+    {
+        if ( !Parse_Config_Line ( line, &key, &value ) )
+            continue;
+
+        if ( Set_Tuning_Option ( key, value ) < 0 && status == 0 )
+            status = line_num;
+    }
+
+    fclose ( file );
+
+    return status;
+}
+
+/***************************************************************
+*
+* @fn                       Set_Tuning_Profile
+*
+* FUNCTION:                 Selects the profile Get_Sock / Get_Sock_NW
+*                           will apply to this connection's sockets.
+*
+* @param connection         The connection information used to create the socket
+* @param name               The profile name, or 0 for none
+* @return int               0 on success, -1 if there is no such profile
+***************************************************************/
+static int Set_Tuning_Profile ( TCP_CONNECTION_INFO *connection, char *name )
+{
+    if ( !name )
+    {
+        connection->tuning = 0;
+        return 0;
+    }
+
+    connection->tuning = Find_Tuning_Profile ( name );
+
+    return connection->tuning ? 0 : -1;
+}
+
+/***************************************************************
+*
+* @fn                       Set_Sock_Opt
+*
+* FUNCTION:                 setsockopt for a waited or a nowait socket.
+*                           A nowait socket needs setsockopt_nw and a
+*                           completion, which is waited for here.
+*
+* @param socket_num         The socket
+* @param nowait             SUCCESS when the socket was created nowait
+* @param level              The option level
+* @param option             The option name
+* @param value              The option value
+* @param value_len          The size of value
+* @param timeout            AWAITIOX timelimit for a nowait socket
+* @return int               The error code returned
+***************************************************************/
+static int Set_Sock_Opt ( int socket_num, BOOLEAN nowait, int level, int option, char *value, int value_len, TIMEOUT timeout )
+{
+    short           file_num;
+    short           error;
+    long            buffer_addr;
+    unsigned short  count;
+    signed long     tag;
+
+    if ( !nowait )
+        return setsockopt ( socket_num, level, option, value, value_len );
+
+    tag = 0;
+    if ( setsockopt_nw ( socket_num, level, option, value, value_len, tag ) < 0 )
+        return -1;
+
+    file_num = ( short ) socket_num;
+    AWAITIOX ( &file_num, &buffer_addr, &count, &tag, timeout );
+    FILE_GETINFO_ ( file_num, &error );
+
+    return error == 0 ? 0 : -1;
+}
+
+/***************************************************************
+*
+* @fn                       Set_Keepalive_Opts
+*
+* FUNCTION:                 Turns on TCP keepalive for a socket, with
+*                           the given timings where the stack supports
+*                           setting them per socket.
+*
+* @param socket_num         The socket
+* @param nowait             SUCCESS when the socket was created nowait
+* @param idle_secs          Idle time before the first probe; <= 0 for the default
+* @param interval_secs      Time between probes; <= 0 for the default
+* @param probes             Unanswered probes before the drop; <= 0 for the default
+* @param timeout            AWAITIOX timelimit for a nowait socket
+* @return int               The error code returned
+***************************************************************/
+static int Set_Keepalive_Opts ( int socket_num, BOOLEAN nowait, int idle_secs, int interval_secs, int probes, TIMEOUT timeout )
+{
+    int status;
+    int on;
+
+    on = 1;
+    status = Set_Sock_Opt ( socket_num, nowait, SOL_SOCKET, SO_KEEPALIVE, ( char * ) &on, sizeof ( on ), timeout );
+
+#ifdef TCP_KEEPIDLE
+    if ( status >= 0 && idle_secs > 0 )
+        status = Set_Sock_Opt ( socket_num, nowait, IPPROTO_TCP, TCP_KEEPIDLE, ( char * ) &idle_secs, sizeof ( int ), timeout );
+#endif
+#ifdef TCP_KEEPINTVL
+    if ( status >= 0 && interval_secs > 0 )
+        status = Set_Sock_Opt ( socket_num, nowait, IPPROTO_TCP, TCP_KEEPINTVL, ( char * ) &interval_secs, sizeof ( int ), timeout );
+#endif
+#ifdef TCP_KEEPCNT
+    if ( status >= 0 && probes > 0 )
+        status = Set_Sock_Opt ( socket_num, nowait, IPPROTO_TCP, TCP_KEEPCNT, ( char * ) &probes, sizeof ( int ), timeout );
+#endif
+
+    return status;
+}
+
+/***************************************************************
+*
+* @fn                       Apply_Tuning
+*
+* FUNCTION:                 Applies the connection's tuning profile to a
+*                           newly created socket. Options the stack does
+*                           not know are skipped. Keepalive is turned on
+*                           when any of its three timings is given; the
+*                           ones not given keep the stack's values.
+*
+* @param connection         The connection information used to create the socket
+* @param socket_num         The new socket
+* @param nowait             SUCCESS when the socket was created nowait
+* @return int               0 on success, -1 if an option was refused
+***************************************************************/
+static int Apply_Tuning ( TCP_CONNECTION_INFO *connection, int socket_num, BOOLEAN nowait )
+{
+    SOCK_TUNING     tuning;
+    struct linger   linger_opt;
+    TIMEOUT         timeout;
+    int             status;
+
+    if ( !connection->tuning )
+        return 0;
+
+    /* a copy, so a profile being reloaded is never applied half old, half new */
+    SHARED_LOCK ( tuning_lock );
+    tuning = *connection->tuning;
+    SHARED_UNLOCK ( tuning_lock );
+
+    /* an unset socket_to (0) would make AWAITIOX only check, and a nowait
+     * setsockopt would then look like it timed out */
+    timeout = connection->timeout_opts.socket_to;
+    if ( timeout == 0 )
+        timeout = -1;
+    status = 0;
+
+    if ( status >= 0 && tuning.nodelay != TUNING_DEFAULT )
+        status = Set_Sock_Opt ( socket_num, nowait, IPPROTO_TCP, TCP_NODELAY, ( char * ) &tuning.nodelay, sizeof ( int ), timeout );
+    if ( status >= 0 && tuning.sndbuf != TUNING_DEFAULT )
+        status = Set_Sock_Opt ( socket_num, nowait, SOL_SOCKET, SO_SNDBUF, ( char * ) &tuning.sndbuf, sizeof ( int ), timeout );
+    if ( status >= 0 && tuning.rcvbuf != TUNING_DEFAULT )
+        status = Set_Sock_Opt ( socket_num, nowait, SOL_SOCKET, SO_RCVBUF, ( char * ) &tuning.rcvbuf, sizeof ( int ), timeout );
+    if ( status >= 0 && tuning.linger_on != TUNING_DEFAULT )
+    {
+        linger_opt.l_onoff = tuning.linger_on;
+        linger_opt.l_linger = tuning.linger_secs > 0 ? tuning.linger_secs : 0;
+        status = Set_Sock_Opt ( socket_num, nowait, SOL_SOCKET, SO_LINGER, ( char * ) &linger_opt, sizeof ( linger_opt ), timeout );
+    }
+#ifdef TCP_QUICKACK
+    if ( status >= 0 && tuning.quickack != TUNING_DEFAULT )
+        status = Set_Sock_Opt ( socket_num, nowait, IPPROTO_TCP, TCP_QUICKACK, ( char * ) &tuning.quickack, sizeof ( int ), timeout );
+#endif
+#ifdef TCP_USER_TIMEOUT
+    if ( status >= 0 && tuning.user_timeout_ms != TUNING_DEFAULT )
+        status = Set_Sock_Opt ( socket_num, nowait, IPPROTO_TCP, TCP_USER_TIMEOUT, ( char * ) &tuning.user_timeout_ms, sizeof ( int ), timeout );
+#endif
+#ifdef TCP_FASTOPEN
+    /* the queue length of pending fast-open requests on a listener */
+    if ( status >= 0 && tuning.fastopen != TUNING_DEFAULT )
+        status = Set_Sock_Opt ( socket_num, nowait, IPPROTO_TCP, TCP_FASTOPEN, ( char * ) &tuning.fastopen, sizeof ( int ), timeout );
+#endif
+    if ( status >= 0 && ( tuning.keepalive_idle != TUNING_DEFAULT || tuning.keepalive_interval != TUNING_DEFAULT
+                       || tuning.keepalive_probes != TUNING_DEFAULT ) )
+        status = Set_Keepalive_Opts ( socket_num, nowait, tuning.keepalive_idle, tuning.keepalive_interval
+                                    , tuning.keepalive_probes, timeout );
+
+    return status < 0 ? -1 : 0;
+}
+
+/***************************************************************
+*
+* @fn                       Rearm_Quickack
+*
+* FUNCTION:                 Turns TCP_QUICKACK back on after a receive
+*                           for a connection whose profile asks for it.
+*                           Linux clears the option again as soon as it
+*                           falls back to delayed acks, so setting it
+*                           once when the socket is created doesn't last.
+*
+* @param connection         The connection that just received
+* @return void
+***************************************************************/
+static void Rearm_Quickack ( TCP_CONNECTION_INFO *connection )
+{
+#ifdef TCP_QUICKACK
+    int on;
+
+    if ( !connection->tuning || connection->tuning->quickack != 1 )
+        return;
+
+    on = 1;
+    setsockopt ( *connection->sock, IPPROTO_TCP, TCP_QUICKACK, ( char * ) &on, sizeof ( on ) );
+#endif
+}
+
+/*******************************************************************
+*
+* @fn                     Close_Socket_Num
+*
+* FUNCTION:               Closes a socket by its number
+*
+* NOTE:                   FILE_CLOSE_ takes a short. Off Guardian a
+*                         descriptor can be numbered past that, and those
+*                         are closed with close() rather than truncated.
+*
+* @param socket_num       The socket
+* @return                 The error code returned
+*******************************************************************/
+static int Close_Socket_Num ( int socket_num )
+{
+#ifndef __TANDEM
+    if ( socket_num >= GUARDIAN_MAX_FILES )
+        return close ( socket_num );
+#endif
+
+    return FILE_CLOSE_ ( ( signed short ) socket_num );
+}
+
+/*******************************************************************
+*
+* @fn                     NewSocket
+*
+* FUNCTION:               Creates a new Socket/FD
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @param address_family   The address family of the socket connection
+* @param socket_type      The type of socket this will be
+* @param protocol         The protocol we would like to implement
+* @return socket fn       The file descriptor (socket number), -1 if the
+*                         connection's tuning profile could not be applied
+*******************************************************************/
+static int Create_Socket (TCP_CONNECTION_INFO *connection, int address_family, int socket_type, int protocol)
+{
+    int socket_num;
+
+    /* Don't forge to call the freeing proc when done */
+    memset( &connection->sock, '\0', sizeof ( *connection->sock ) );
+    connection->sock = ( int * ) malloc ( sizeof ( int ) );
+
+    socket_num = socket( address_family
+                       , socket_type
+                       , protocol );
+
+    /* a socket that can't take its profile is no use to the caller */
+    if ( socket_num >= 0 && Apply_Tuning ( connection, socket_num, FAIL ) < 0 )
+    {
+        Close_Socket_Num ( socket_num );
+        socket_num = -1;
+    }
+
+    return socket_num;
+}
+
+/*******************************************************************
+*
+* @fn                     Get_Sock_NW
+*
+* FUNCTION:               Creates a new NOWAIT Socket/FD
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @param address_family   The address family of the socket connection
+* @param socket_type      The type of socket this will be
+* @param protocol         The protocol we would like to implement
+* @param sync             Input value: NOT SUPPORTED ON GUARDIAN, MUST USE 0
+* @return socket fn       The file descriptor (socket number), -1 if the
+*                         connection's tuning profile could not be applied
+*******************************************************************/
+static int Get_Sock_NW( TCP_CONNECTION_INFO *connection, int address_family, int socket_type, int protocol, int sync )
+{
+    int socket_num;
+
+    socket_num = socket_nw ( address_family
+                           , socket_type
+                           , protocol
+                           , connection->flags
+                           , sync );
+
+    if ( socket_num >= 0 && Apply_Tuning ( connection, socket_num, SUCCESS ) < 0 )
+    {
+        Close_Socket_Num ( socket_num );
+        socket_num = -1;
+    }
+
+    return socket_num;
+}
+
+/*******************************************************************
+*
+* @fn                      Set_Bind
+*
+* FUNCTION:                associates a socket with a specific
+*                          local internet address and port
+*                          This is primarily a server func but
+*                          is optional on most client connections
+*
+* NOTE:
+* @param connection       The connection information used to create the socket
+* @return                 The error code returned
+*******************************************************************/
+static int Set_Bind (TCP_CONNECTION_INFO *connection)
+{
+    int status;
+
+    status = bind ( *connection->sock
+                  , ( struct sockaddr * ) connection->sockaddr
+                  , connection->sockaddr_len );
+
+    return status;
+}
+
+
+/*******************************************************************
+*
+* @fn                     Set_Bind_NW
+*
+* FUNCTION:               associates a socket with a specific
+*                         local internet address and port
+*                         This is primarily a server func but
+*                         is optional on most client connections
+*
+*                         This is a NOWAIT call
+*
+* @param connection       The connection information used to create the socket
+* @param tag              The tag parameter to be used for the nowait operation.
+* @return                 The error code returned
+*******************************************************************/
+static int Set_Bind_NW ( TCP_CONNECTION_INFO *connection, signed long *tag )
+{
+    int status;
+
+    status = bind_nw ( *connection->sock
+                     , ( struct sockaddr * ) connection->sockaddr
+                     , connection->sockaddr_len
+                     , *tag );
+
+    return status;
+}
+
+
+/*******************************************************************
+*
+* @fn                     Make_Connect
+*
+* FUNCTION:               Connects to specified address
+*
+* NOTE:                   Must be called AFTER newSocket()
+*
+* @param connection       The connection information used to create the socket
+* @return                 The error code returned
+*******************************************************************/
+static int Make_Connect ( TCP_CONNECTION_INFO *connection )
+{
+    int status;
+
+    /* we have to set sin_zero, if not, seems like junk fills it
+    * , which makes the server refuse the connection */
+    memset ( connection->sockaddr->sin_zero
+           , '\0'
+           , sizeof ( connection->sockaddr->sin_zero ) );
+
+    status = connect ( *connection->sock
+                     , ( struct sockaddr * ) connection->sockaddr
+                     , sizeof ( *connection->sockaddr ) );
+
+    return status;
+}
+
+/*******************************************************************
+*
+* @fn                     Make_Connect_Timed
+*
+* FUNCTION:               Connects a waited socket, giving up after a timeout
+*
+* NOTE:                   Must be called AFTER newSocket(). The socket is left
+*                         blocking again; on timeout errno is ETIMEDOUT.
+*
+* @param connection       The connection information used to create the socket
+* @param timeout          Centiseconds to wait, -1 to wait forever
+* @return                 The error code returned
+*******************************************************************/
+static int Make_Connect_Timed ( TCP_CONNECTION_INFO *connection, TIMEOUT timeout )
+{
+    struct pollfd   writable;
+    int             nonblocking;
+    int             error;
+    int             error_len;
+    int             status;
+
+    if ( timeout < 0 )
+        return Make_Connect ( connection );
+
+    nonblocking = 1;
+    if ( ioctl ( *connection->sock, FIONBIO, ( char * ) &nonblocking ) < 0 )
+        return -1;
+
+    status = Make_Connect ( connection );
+    if ( status < 0 && ( errno == EINPROGRESS || errno == EWOULDBLOCK ) )
+    {
+        /* poll, not select: a process holding many connections has sockets
+         * numbered past FD_SETSIZE */
+        writable.fd = *connection->sock;
+        writable.events = POLLOUT;
+        writable.revents = 0;
+
+        status = poll ( &writable, 1, timeout * 10 );
+        if ( status > 0 )
+        {
+            error = 0;
+            error_len = sizeof ( error );
+            status = getsockopt ( *connection->sock, SOL_SOCKET, SO_ERROR, ( char * ) &error, ( void * ) &error_len );
+            if ( status == 0 && error != 0 )
+            {
+                errno = error;
+                status = -1;
+            }
+        }
+        else if ( status == 0 )
+        {
+            errno = ETIMEDOUT;
+            status = -1;
+        }
+    }
+
+    error = errno;
+    nonblocking = 0;
+    ioctl ( *connection->sock, FIONBIO, ( char * ) &nonblocking );
+    errno = error;
+
+    return status;
+}
+
+/*******************************************************************
+*
+* @fn                     Make_Connect_NW
+*
+* FUNCTION:               Connects to specified address NO Waited
+*
+* NOTE:                   Must be called AFTER newSocket_nw()
+*
+* @param connection       The connection information used to create the socket
+* @param tag              The tag parameter to be used for the nowait operation.
+* @return                 The error code returned
+*******************************************************************/
+static int Make_Connect_NW ( TCP_CONNECTION_INFO *connection, signed long *tag )
+{
+    int status;
+
+    /* we have to set sin_zero, if not, seems like junk fills it, which makes the server refuse the connection */
+    memset ( connection->sockaddr->sin_zero
+           , '\0'
+           , sizeof( connection->sockaddr->sin_zero ) );
+
+    status = connect_nw ( *connection->sock
+                        , ( struct sockaddr * ) connection->sockaddr
+                        , connection->sockaddr_len
+                        , *tag );
+
+    return status;
+}
+
+/*******************************************************************
+*
+* @fn                     Set_Listen
+*
+* FUNCTION:               A server based func. Listens
+*                         for incoming connections
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @return                 The error code returned
+* *******************************************************************/
+static int Set_Listen (TCP_CONNECTION_INFO *connection )
+{
+    int status;
+
+    status = listen ( *connection->sock
+                    , connection->queue_len );
+
+    return status;
+}
+
+/*******************************************************************
+*
+* @fn                     New_Accept
+*
+* FUNCTION:               Checks for connections on an existing waited
+*                         socket. When a connection requestarrives,
+*                         accept creates a new socket to use for data
+*                         transfer and accepts the connection on the
+*                         new socket
+*
+*
+* @param connection       The connection information used to create the socket
+* @return                 The error code returned
+* *******************************************************************/
+static int New_Accept ( TCP_CONNECTION_INFO *connection, int *from_len_ptr )
+{
+    int         status;
+    socklen_t   from_len;
+
+    /* accept wants a socklen_t, which need not be an int */
+    from_len = ( socklen_t ) *from_len_ptr;
+
+    status = accept ( *connection->sock
+                    , ( struct sockaddr * ) connection->sockaddr
+                    , &from_len );
+
+    *from_len_ptr = ( int ) from_len;
+
+    return status;
+}
+
+/*********************************************************************
+*
+* @fn                     Accept_Batch_Create
+*
+* FUNCTION:               Allocates a batch able to hold "capacity" accepted
+*                         connections, with every record pre-allocated.
+*
+* @param capacity         The most connections one drain may return
+* @return                 The batch, free with Accept_Batch_Free
+* *******************************************************************/
+static ACCEPT_BATCH *Accept_Batch_Create ( int capacity )
+{
+    ACCEPT_BATCH    *batch;
+    int             i;
+
+    batch = ( ACCEPT_BATCH * ) malloc ( sizeof ( ACCEPT_BATCH ) );
+    memset ( batch, 0, sizeof ( ACCEPT_BATCH ) );
+
+    batch->capacity = capacity;
+    batch->conns = ( TCP_CONNECTION_INFO * ) malloc ( sizeof ( TCP_CONNECTION_INFO ) * capacity );
+    memset ( batch->conns, 0, sizeof ( TCP_CONNECTION_INFO ) * capacity );
+
+    for ( i = 0; i < capacity; i++ )
+    {
+        batch->conns[i].sock = ( int * ) malloc ( sizeof ( int ) );
+        batch->conns[i].sockaddr = ( struct sockaddr_in * ) malloc ( sizeof ( struct sockaddr_in ) );
+    }
+
+    return batch;
+}
+
+/*********************************************************************
+*
+* @fn                     New_Accept_Batch
+*
+* FUNCTION:               Drains up to "max" pending connections from a
+*                         listening socket in one go. Each accepted socket is
+*                         made non-blocking as it is accepted (accept4 where
+*                         the stack has it) and filled into the batch.
+*
+* NOTE:                   The drain is also capped by the listener's queue_len,
+*                         the same backlog given to Set_Listen / New_Accept_NW1,
+*                         since no more than that can be waiting.
+*                         The listening socket is left in non-blocking mode.
+*
+* @param connection       The listening connection
+* @param batch            Receives the accepted connections
+* @param max              The most connections to accept
+* @return                 The number accepted, -1 on error with none accepted
+* *******************************************************************/
+static int New_Accept_Batch ( TCP_CONNECTION_INFO *connection, ACCEPT_BATCH *batch, int max )
+{
+    TCP_CONNECTION_INFO *conn;
+    int                 nonblocking;
+    int                 from_len;
+    int                 sock;
+
+    batch->count = 0;
+
+    if ( max > batch->capacity )
+        max = batch->capacity;
+    if ( connection->queue_len > 0 && max > connection->queue_len )
+        max = connection->queue_len;
+
+    nonblocking = 1;
+    if ( ioctl ( *connection->sock, FIONBIO, ( char * ) &nonblocking ) < 0 )
+        return -1;
+
+    while ( batch->count < max )
+    {
+        conn = &batch->conns[batch->count];
+        from_len = sizeof ( struct sockaddr_in );
+
+#ifdef SOCK_NONBLOCK
+        sock = accept4 ( *connection->sock
+                       , ( struct sockaddr * ) conn->sockaddr
+                       , ( socklen_t * ) &from_len
+                       , SOCK_NONBLOCK | SOCK_CLOEXEC );
+#else
+        sock = accept ( *connection->sock
+                      , ( struct sockaddr * ) conn->sockaddr
+                      , &from_len );
+        if ( sock >= 0 )
+            ioctl ( sock, FIONBIO, ( char * ) &nonblocking );
+#endif
+
+        if ( sock < 0 )
+        {
+            /* a client that gave up while queued; keep draining */
+            if ( errno == EINTR || errno == ECONNABORTED )
+                continue;
+            if ( errno == EWOULDBLOCK || errno == EAGAIN || batch->count > 0 )
+                break;
+            return -1;
+        }
+
+        *conn->sock = sock;
+        strcpy ( conn->ipaddr, inet_ntoa ( conn->sockaddr->sin_addr ) );
+        strcpy ( conn->process_name, connection->process_name );
+        conn->port = ntohs ( conn->sockaddr->sin_port );
+        conn->sockaddr_len = from_len;
+        conn->timeout_opts = connection->timeout_opts;
+        conn->flags = 0;
+        conn->queue_len = 0;
+        conn->tag = 0;
+
+        batch->count++;
+    }
+
+    batch->batches++;
+    batch->accepted += batch->count;
+
+    return batch->count;
+}
+
+/*********************************************************************
+*
+* @fn                     Accept_Batch_Take
+*
+* FUNCTION:               Hands an accepted connection over to the caller,
+*                         who becomes responsible for Clean_Conn_Info on it.
+*                         The slot is given a fresh sock and sockaddr for
+*                         the next drain.
+*
+* @param batch            The batch filled by New_Accept_Batch
+* @param index            Which of the batch->count entries to take
+* @param out              Receives the connection
+* @return                 void
+* *******************************************************************/
+static void Accept_Batch_Take ( ACCEPT_BATCH *batch, int index, TCP_CONNECTION_INFO *out )
+{
+    *out = batch->conns[index];
+
+    batch->conns[index].sock = ( int * ) malloc ( sizeof ( int ) );
+    batch->conns[index].sockaddr = ( struct sockaddr_in * ) malloc ( sizeof ( struct sockaddr_in ) );
+}
+
+/*********************************************************************
+*
+* @fn                     Accept_Batch_Free
+*
+* FUNCTION:               Releases a batch. Connections still in it that
+*                         were not taken are not closed.
+*
+* @param batch            The batch to release
+* @return                 void
+* *******************************************************************/
+static void Accept_Batch_Free ( ACCEPT_BATCH *batch )
+{
+    int i;
+
+    for ( i = 0; i < batch->capacity; i++ )
+    {
+        free ( batch->conns[i].sock );
+        free ( batch->conns[i].sockaddr );
+    }
+
+    free ( batch->conns );
+    free ( batch );
+}
+
+/*******************************************************************
+*
+* @fn                     New_Accept_NW
+*
+* FUNCTION:               Checks for connections on an existing no waited
+*                         socket. When a connection requestarrives,
+*                         accept creates a new socket to use for data
+*                         transfer and accepts the connection on the
+*                         new socket
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @param tag             The tag parameter to be used for the nowait operation.
+* @return                 The error code returned
+* *******************************************************************/
+static int New_Accept_NW ( TCP_CONNECTION_INFO *connection, signed long *tag )
+{
+    int status;
+
+    status = accept_nw ( *connection->sock
+                       , ( struct sockaddr * ) connection->sockaddr
+                       , &connection->sockaddr_len
+                       , *tag );
+
+    return status;
+}
+
+/*********************************************************************
+*
+* @fn                     New_Accept_NW1
+*
+* FUNCTION:               Used instead of accept_nw; use accept_nw1
+*                         to set the maximum connections in the queue
+*                         awaiting acceptance on a socket.
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @param tag              The tag parameter to be used for the nowait operation.
+* @return                 The error code returned
+* *******************************************************************/
+static int New_Accept_NW1 ( TCP_CONNECTION_INFO *connection, signed long *tag )
+{
+    int status;
+
+    status = accept_nw1 ( *connection->sock
+                        , ( struct sockaddr * ) connection->sockaddr
+                        , &connection->sockaddr_len
+                        , *tag
+                        , ( short ) connection->queue_len);
+
+    return status;
+}
+
+/*********************************************************************
+*
+* @fn                     New_Accept_NW2
+*
+* FUNCTION:               Accepts a connection on a new socket created
+ *                        for nowait data transfer. Beforecalling this
+ *                        procedure, a program should call accept_nw
+ *                        on an existing socket and then call socket_nw
+ *                        tocreate the new socket to be used by accept_nw2.
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @param tag              The tag parameter to be used for the nowait operation.
+* @return                 The error code returned
+* *******************************************************************/
+static int New_Accept_NW2 ( TCP_CONNECTION_INFO *connection, signed long *tag )
+{
+    int status;
+
+    status = accept_nw2 ( *connection->sock
+                        , ( struct sockaddr * ) connection->sockaddr
+                        , *tag );
+
+    return status;
+}
+
+/*********************************************************************
+*
+* @fn                     New_Accept_NW3
+*
+* FUNCTION:
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @param me_ptr           Points to the local address and port number used by bind_nw.
+* @param tag              The tag parameter to be used for the nowait operation.
+* @return                 The error code returned
+* *******************************************************************/
+static int New_Accept_NW3 (TCP_CONNECTION_INFO *connection, struct sockaddr *me_ptr, signed long *tag )
+{
+    int status;
+
+    status = accept_nw3 ( *connection->sock
+                        , ( struct sockaddr * ) connection->sockaddr
+                        , me_ptr
+                        , *tag );
+
+    return status;
+}
+
+/**********************************************************************
+*
+* @fn                     New_Send
+*
+* FUNCTION:               Sends data on a connected socket
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @param buffer_ptr       Points to the data to be sent..
+* @param buffer_length    The size of the buffer pointed to by buffer_ptr.
+* @return                 The error code returned
+* *******************************************************************/
+static int New_Send (TCP_CONNECTION_INFO *connection, char *buffer_ptr, int buffer_length )
+{
+    int status;
+
+    status = send ( *connection->sock
+                  , buffer_ptr
+                  , buffer_length
+                  , connection->flags );
+
+    connection->last_activity = Get_Timestamp ( );
+    Capture_Record ( connection, CAPTURE_SEND, buffer_ptr, status );
+
+    return status;
+}
+
+/*******************************************************************************
+*
+* @fn                     New_Send_NW
+*
+* FUNCTION:               This is a NOWAIT operation.
+*                         Sends data on a connected socket
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @param buffer_ptr       Points to the data to be sent..
+* @param buffer_length    The size of the buffer pointed to by buffer_ptr.
+* @param tag              The tag parameter to be used for the nowait operation.
+* @return                 The error code returned
+* *****************************************************************************/
+static int New_Send_NW ( TCP_CONNECTION_INFO *connection, char *buffer_ptr, int buffer_length, signed long *tag )
+{
+    int status;
+
+    status = send_nw ( *connection->sock
+            , buffer_ptr
+            , buffer_length
+            , connection->flags
+            , *tag );
+
+    /* the stack may take only part of it; Complete_NW records what it took */
+    if ( status >= 0 )
+        connection->nw_send_buffer = buffer_ptr;
+
+    return status;
+}
+
+/*********************************************************************************
+*
+* @fn                     New_Recv
+*
+* FUNCTION:               Receives data on a connected socket
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @param buffer_ptr       Points to the data to be sent..
+* @param buffer_length    The size of the buffer pointed to by buffer_ptr.
+* @param nrcvd            the number of bytes received by the recv function.
+*                         This is the return value for recv.A zero length message
+*                         indicates end of file (EOF).
+* @return                 The error code returned
+* *******************************************************************************/
+static int New_Recv (TCP_CONNECTION_INFO *connection, char *buffer_ptr, int buff_length, int nrcvd )
+{
+    nrcvd = recv ( *connection->sock
+                  , buffer_ptr
+                  , buff_length
+                  , connection->flags );
+
+    if ( nrcvd < 0 )
+        return -1;
+
+    connection->last_activity = Get_Timestamp ( );
+    Rearm_Quickack ( connection );
+    Capture_Record ( connection, CAPTURE_RECV, buffer_ptr, nrcvd );
+
+    return nrcvd;
+}
+
+/*******************************************************************************
+*
+* @fn                     New_Recv_NW
+*
+* FUNCTION:               This is a NOWAIT operation.
+*                         Receives data on a connected socket.
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @param buffer_ptr       Points to the data to be sent..
+* @param buffer_length    The size of the buffer pointed to by buffer_ptr.
+* @param length           The size of the buffer pointed to by buffer_ptr.
+* @param tag              The tag parameter to be used for the nowait operation.
+* @param nrcvd            the number of bytes received by the recv function.
+*                         This is the return value for recv.A zero length message
+*                         indicates end of file (EOF).
+* @return                 The error code returned
+*
+* NOTE:                   Call Complete_NW once the receive completes,
+*                         unless Await_Completion_Spin took the completion.
+* *****************************************************************************/
+static int New_Recv_NW (TCP_CONNECTION_INFO *connection, char *buffer_ptr, int length, signed long *tag, int nrcvd)
+{
+    nrcvd = recv_nw ( *connection->sock
+                     , buffer_ptr
+                     , length
+                     , connection->flags
+                     , *tag );
+
+    if ( nrcvd < 0 )
+        return -1;
+
+    connection->nw_recv_buffer = buffer_ptr;
+
+    return nrcvd;
+}
+
+/***************************************************************************************
+*						BUSY POLLING
+*
+*   For latency-critical connections the cost of being woken from a blocking recv or
+*   AWAITIOX can dominate. Spinning trades CPU for that wakeup: poll without blocking
+*   for a bounded idle budget, and block only once the budget is spent.
+*
+*   The budget adapts per connection between SPIN_MIN_BUDGET_US and idle_budget_us.
+*   Data arriving soon after the spin gave up means a longer spin would have caught
+*   it, so the budget doubles; a wait that ran past the full budget means spinning
+*   was wasted, so it halves.
+***************************************************************************************/
+
+/*********************************************************************************
+*
+* @fn                     Spin_Budget
+*
+* FUNCTION:               The spin budget to use for the next wait
+*
+* @param opts             The spin settings
+* @param stats            Holds the adapted budget
+* @return                 The budget in microseconds
+* *******************************************************************************/
+static TIMESTAMP Spin_Budget ( SPIN_OPTS *opts, SPIN_STATS *stats )
+{
+    if ( stats->budget_us <= 0 || stats->budget_us > opts->idle_budget_us )
+        stats->budget_us = opts->idle_budget_us;
+
+    return stats->budget_us;
+}
+
+/*********************************************************************************
+*
+* @fn                     Spin_Adapt
+*
+* FUNCTION:               Adjusts the spin budget after a wait that had to block
+*
+* @param opts             The spin settings
+* @param stats            Holds the adapted budget
+* @param blocked_us       How long the wait blocked for after spinning
+* @return                 void
+* *******************************************************************************/
+static void Spin_Adapt ( SPIN_OPTS *opts, SPIN_STATS *stats, TIMESTAMP blocked_us )
+{
+    TIMESTAMP   floor_us;
+
+    floor_us = opts->idle_budget_us < SPIN_MIN_BUDGET_US ? opts->idle_budget_us : SPIN_MIN_BUDGET_US;
+
+    if ( blocked_us < opts->idle_budget_us )
+    {
+        stats->budget_us *= 2;
+        if ( stats->budget_us > opts->idle_budget_us )
+            stats->budget_us = opts->idle_budget_us;
+    }
+    else
+    {
+        stats->budget_us /= 2;
+        if ( stats->budget_us < floor_us )
+            stats->budget_us = floor_us;
+    }
+}
+
+/*********************************************************************************
+*
+* @fn                     Set_Spin_Opts
+*
+* FUNCTION:               Turns busy polling on or off for a connection. For a
+*                         waited socket this also puts the socket in non-blocking
+*                         mode, which New_Recv_Spin relies on.
+*
+* NOTE:                   Must be called AFTER the socket has been created. If
+*                         the settings can't be applied the connection is left
+*                         as it was.
+*
+* @param connection       The connection information used to create the socket
+* @param opts             The spin settings to use
+* @return                 The error code returned
+* *******************************************************************************/
+static int Set_Spin_Opts ( TCP_CONNECTION_INFO *connection, SPIN_OPTS *opts )
+{
+    int status;
+    int nonblocking;
+
+    nonblocking = opts->enabled ? 1 : 0;
+    status = ioctl ( *connection->sock, FIONBIO, ( char * ) &nonblocking );
+
+#ifdef SO_BUSY_POLL
+    if ( status >= 0 && opts->enabled && opts->busy_poll_us > 0 )
+    {
+        /* raising it past net.core.busy_read needs privilege; undo FIONBIO then */
+        status = setsockopt ( *connection->sock
+                            , SOL_SOCKET
+                            , SO_BUSY_POLL
+                            , ( char * ) &opts->busy_poll_us
+                            , sizeof ( opts->busy_poll_us ) );
+        if ( status < 0 )
+        {
+            nonblocking = connection->spin_opts.enabled ? 1 : 0;
+            ioctl ( *connection->sock, FIONBIO, ( char * ) &nonblocking );
+        }
+    }
+#endif
+
+    if ( status < 0 )
+        return status;
+
+    connection->spin_opts = *opts;
+    memset ( &connection->spin_stats, 0, sizeof ( SPIN_STATS ) );
+
+    return status;
+}
+
+/*********************************************************************************
+*
+* @fn                     New_Recv_Spin
+*
+* FUNCTION:               Receives data on a connected, waited socket, spinning on
+*                         a non-blocking recv for up to the connection's idle
+*                         budget before falling back to a blocking recv.
+*
+* NOTE:                   Without spin_opts.enabled this is a plain New_Recv.
+*
+* @param connection       The connection information used to create the socket
+* @param buffer_ptr       Points to the buffer to receive into
+* @param buffer_length    The size of the buffer pointed to by buffer_ptr.
+* @return                 The number of bytes received, 0 at EOF, -1 on error
+* *******************************************************************************/
+static int New_Recv_Spin ( TCP_CONNECTION_INFO *connection, char *buffer_ptr, int buffer_length )
+{
+    SPIN_STATS  *stats;
+    TIMESTAMP   start;
+    TIMESTAMP   now;
+    TIMESTAMP   budget;
+    TIMESTAMP   blocked;
+    int         nrcvd;
+    int         nonblocking;
+
+    if ( !connection->spin_opts.enabled )
+        return New_Recv ( connection, buffer_ptr, buffer_length, 0 );
+
+    stats = &connection->spin_stats;
+    budget = Spin_Budget ( &connection->spin_opts, stats );
+    start = Get_Timestamp ( );
+
+    for ( ;; )
+    {
+        nrcvd = recv ( *connection->sock, buffer_ptr, buffer_length, connection->flags );
+        stats->polls++;
+        now = Get_Timestamp ( );
+
+        if ( nrcvd >= 0 || ( errno != EWOULDBLOCK && errno != EAGAIN ) )
+        {
+            stats->spin_us += now - start;
+            if ( nrcvd < 0 )
+                return -1;
+            stats->spin_hits++;
+            connection->last_activity = now;
+            Rearm_Quickack ( connection );
+            Capture_Record ( connection, CAPTURE_RECV, buffer_ptr, nrcvd );
+            return nrcvd;
+        }
+
+        if ( now - start >= budget )
+            break;
+    }
+
+    stats->spin_us += now - start;
+
+    /* out of budget: block until data arrives, then go back to spinning */
+    nonblocking = 0;
+    ioctl ( *connection->sock, FIONBIO, ( char * ) &nonblocking );
+
+    nrcvd = New_Recv ( connection, buffer_ptr, buffer_length, 0 );
+
+    nonblocking = 1;
+    ioctl ( *connection->sock, FIONBIO, ( char * ) &nonblocking );
+
+    blocked = Get_Timestamp ( ) - now;
+    stats->blocked_us += blocked;
+    stats->block_hits++;
+    Spin_Adapt ( &connection->spin_opts, stats, blocked );
+
+    return nrcvd;
+}
+
+/*********************************************************************************
+*
+* @fn                     Await_Spin
+*
+* FUNCTION:               AWAITIOX with busy polling. The completion is checked
+*                         with a zero timelimit for up to the idle budget, then
+*                         waited for with the given timeout. Passing -1 as the
+*                         file number lets an event loop spin over all of its
+*                         nowait files at once.
+*
+* @param file_num         The file to wait on, or -1 for any; returns the file
+*                         that completed
+* @param buffer_addr      Returns the buffer address of the completed I/O
+* @param count_trnsfr     Returns the count of bytes transferred
+* @param tag              Returns the tag of the completed I/O
+* @param timeout          AWAITIOX timelimit once the budget is spent
+* @param opts             The spin settings; not spinning when disabled
+* @param stats            Accumulates where the time went
+* @return                 The FILE_GETINFO_ error for the completion,
+*                         ERR_TIMEOUT if nothing completed
+* *******************************************************************************/
+static short Await_Spin ( short *file_num, long *buffer_addr, unsigned short *count_trnsfr, signed long *tag
+                        , signed long timeout, SPIN_OPTS *opts, SPIN_STATS *stats )
+{
+    TIMESTAMP   start;
+    TIMESTAMP   now;
+    TIMESTAMP   budget;
+    TIMESTAMP   blocked;
+    short       wanted;
+    short       error;
+
+    wanted = *file_num;
+    budget = opts->enabled ? Spin_Budget ( opts, stats ) : 0;
+    start = Get_Timestamp ( );
+    now = start;
+
+    while ( opts->enabled )
+    {
+        *file_num = wanted;
+        AWAITIOX ( file_num, buffer_addr, count_trnsfr, tag, 0 );
+        FILE_GETINFO_ ( *file_num, &error );
+        stats->polls++;
+        now = Get_Timestamp ( );
+
+        if ( error != ERR_TIMEOUT && wanted < 0 && Capture_Take_Completion ( *file_num, error ) )
+            error = ERR_TIMEOUT;
+
+        if ( error != ERR_TIMEOUT )
+        {
+            stats->spin_us += now - start;
+            stats->spin_hits++;
+            return error;
+        }
+
+        if ( now - start >= budget )
+            break;
+    }
+
+    stats->spin_us += now - start;
+
+    /* the capture has one write outstanding at most, so this goes round twice at most */
+    do
+    {
+        *file_num = wanted;
+        AWAITIOX ( file_num, buffer_addr, count_trnsfr, tag, timeout );
+        FILE_GETINFO_ ( *file_num, &error );
+    } while ( error != ERR_TIMEOUT && wanted < 0 && Capture_Take_Completion ( *file_num, error ) );
+
+    blocked = Get_Timestamp ( ) - now;
+    stats->blocked_us += blocked;
+    if ( error != ERR_TIMEOUT )
+        stats->block_hits++;
+    if ( opts->enabled )
+        Spin_Adapt ( opts, stats, error == ERR_TIMEOUT ? opts->idle_budget_us : blocked );
+
+    return error;
+}
+
+/*********************************************************************************
+*
+* @fn                     Await_Completion_Spin
+*
+* FUNCTION:               Waits for the outstanding nowait operation on a
+*                         connection using the connection's spin settings,
+*                         blocking for at most timeout_opts.recv_to afterwards.
+*
+* @param connection       The connection information used to create the socket
+* @param count_trnsfr     Returns the count of bytes transferred
+* @param tag              Returns the tag of the completed I/O
+* @return                 The FILE_GETINFO_ error for the completion
+* *******************************************************************************/
+static short Await_Completion_Spin ( TCP_CONNECTION_INFO *connection, unsigned short *count_trnsfr, signed long *tag )
+{
+    short   file_num;
+    short   error;
+    long    buffer_addr;
+
+    file_num = ( short ) *connection->sock;
+
+    error = Await_Spin ( &file_num
+                       , &buffer_addr
+                       , count_trnsfr
+                       , tag
+                       , connection->timeout_opts.recv_to
+                       , &connection->spin_opts
+                       , &connection->spin_stats );
+
+    if ( error == 0 )
+        Complete_NW ( connection, buffer_addr, *count_trnsfr );
+
+    return error;
+}
+
+/***************************************************************************************
+*						MANAGED RECEIVE BUFFERS
+*
+*   Rather than every connection holding a buffer sized for its worst-case message, a
+*   connection using New_Recv_Managed borrows a buffer from a shared pool of size
+*   classes. The size is chosen per receive from the bytes the stack already holds
+*   (FIONREAD) and a running average of message sizes, so a large message is sized for
+*   up front instead of taking extra recv calls, and a connection that goes quiet gives
+*   its buffer back. Freed buffers are cached per class up to max_free, and returned to
+*   the heap beyond that.
+***************************************************************************************/
+static const int recv_class_sizes[RECV_POOL_CLASSES] = { 256, 1024, 4096, 16384, 65536 };
+
+static RECV_POOL default_recv_pool = { { 0 }, { 0 }, { 0 }, 0, 0, RECV_POOL_MAX_FREE, 0 };
+#ifndef __TANDEM
+static pthread_mutex_t recv_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* only the process-wide pool is shared; a runtime core's own pool is not locked */
+#define RECV_POOL_LOCK(pool)    if ( ( pool ) == &default_recv_pool ) SHARED_LOCK ( recv_pool_lock )
+#define RECV_POOL_UNLOCK(pool)  if ( ( pool ) == &default_recv_pool ) SHARED_UNLOCK ( recv_pool_lock )
+
+/*********************************************************************************
+*
+* @fn                     Recv_Class_For
+*
+* FUNCTION:               The smallest size class holding "bytes"
+*
+* @param bytes            The number of bytes wanted
+* @return                 The size class, capped at the largest
+* *******************************************************************************/
+static int Recv_Class_For ( int bytes )
+{
+    int size_class;
+
+    for ( size_class = 0; size_class < RECV_POOL_CLASSES - 1; size_class++ )
+    {
+        if ( recv_class_sizes[size_class] >= bytes )
+            break;
+    }
+
+    return size_class;
+}
+
+/*********************************************************************************
+*
+* @fn                     Recv_Pool_Create
+*
+* FUNCTION:               Creates a buffer pool. Connections with no pool of
+*                         their own share a process-wide default.
+*
+* @param max_free         Free buffers to keep cached per size class
+* @return                 The pool
+* *******************************************************************************/
+static RECV_POOL *Recv_Pool_Create ( int max_free )
+{
+    RECV_POOL *pool;
+
+    pool = ( RECV_POOL * ) malloc ( sizeof ( RECV_POOL ) );
+    memset ( pool, 0, sizeof ( RECV_POOL ) );
+    pool->max_free = max_free;
+
+    return pool;
+}
+
+/*********************************************************************************
+*
+* @fn                     Recv_Pool_Get
+*
+* FUNCTION:               Takes a buffer of a size class from the pool,
+*                         allocating one if none is cached
+*
+* @param pool             The pool
+* @param size_class       The size class wanted
+* @return                 The buffer, NULL if none could be allocated
+* *******************************************************************************/
+static char *Recv_Pool_Get ( RECV_POOL *pool, int size_class )
+{
+    char *buffer;
+
+    RECV_POOL_LOCK ( pool );
+
+    buffer = ( char * ) pool->free_list[size_class];
+    if ( buffer )
+    {
+        pool->free_list[size_class] = *( void ** ) buffer;
+        pool->free_count[size_class]--;
+        pool->bytes_cached -= recv_class_sizes[size_class];
+    }
+
+    RECV_POOL_UNLOCK ( pool );
+
+    if ( !buffer )
+    {
+        buffer = ( char * ) malloc ( recv_class_sizes[size_class] );
+        if ( !buffer )
+            return 0;
+    }
+
+    RECV_POOL_LOCK ( pool );
+    pool->in_use[size_class]++;
+    pool->bytes_in_use += recv_class_sizes[size_class];
+    RECV_POOL_UNLOCK ( pool );
+
+    return buffer;
+}
+
+/*********************************************************************************
+*
+* @fn                     Recv_Pool_Put
+*
+* FUNCTION:               Gives a buffer back to the pool
+*
+* @param pool             The pool
+* @param size_class       The buffer's size class
+* @param buffer           The buffer
+* @return                 void
+* *******************************************************************************/
+static void Recv_Pool_Put ( RECV_POOL *pool, int size_class, char *buffer )
+{
+    RECV_POOL_LOCK ( pool );
+
+    pool->in_use[size_class]--;
+    pool->bytes_in_use -= recv_class_sizes[size_class];
+
+    if ( pool->free_count[size_class] < pool->max_free )
+    {
+        *( void ** ) buffer = pool->free_list[size_class];
+        pool->free_list[size_class] = buffer;
+        pool->free_count[size_class]++;
+        pool->bytes_cached += recv_class_sizes[size_class];
+        buffer = 0;
+    }
+
+    RECV_POOL_UNLOCK ( pool );
+
+    free ( buffer );
+}
+
+/*********************************************************************************
+*
+* @fn                     Recv_Buffer_Release
+*
+* FUNCTION:               Returns a connection's receive buffer to its pool
+*
+* @param connection       The connection information used to create the socket
+* @return                 The number of bytes released
+* *******************************************************************************/
+static long Recv_Buffer_Release ( TCP_CONNECTION_INFO *connection )
+{
+    RECV_BUFFER *recv_buf;
+    long        released;
+
+    recv_buf = &connection->recv_buf;
+    if ( !recv_buf->data )
+        return 0;
+
+    released = recv_class_sizes[recv_buf->size_class];
+    Recv_Pool_Put ( connection->recv_pool ? connection->recv_pool : &default_recv_pool
+                  , recv_buf->size_class
+                  , recv_buf->data );
+
+    recv_buf->data = 0;
+    recv_buf->size = 0;
+
+    return released;
+}
+
+/*********************************************************************************
+*
+* @fn                     Recv_Average
+*
+* FUNCTION:               Folds a message size into a running average over
+*                         roughly the last 8 messages. The first message sets
+*                         the average outright rather than creeping up from 0.
+*
+* @param average          The average, in RECV_AVG_SCALE units
+* @param nrcvd            The size of the message just received
+* @return                 void
+* *******************************************************************************/
+static void Recv_Average ( int *average, int nrcvd )
+{
+    if ( *average == 0 )
+        *average = nrcvd * RECV_AVG_SCALE;
+    else
+        *average += ( nrcvd * RECV_AVG_SCALE - *average ) / 8;
+}
+
+/*********************************************************************************
+*
+* @fn                     New_Recv_Managed
+*
+* FUNCTION:               Receives data on a connected socket into a buffer the
+*                         library manages. The buffer is sized from what the
+*                         stack is holding and the connection's recent message
+*                         sizes, and moved to a smaller class once messages
+*                         shrink. With nothing queued yet the connection waits
+*                         in a buffer sized for its average message, or the
+*                         pool's average until it has one of its own.
+*
+* NOTE:                   *buffer_ptr stays valid until the next call on this
+*                         connection, Recv_Buffer_Trim or Clean_Conn_Info.
+*                         More queued than the largest class holds is not
+*                         read in pieces: it fails with EMSGSIZE and stays
+*                         queued, for the caller to take with New_Recv into
+*                         a buffer of its own. ENOMEM if no buffer could be
+*                         allocated.
+*
+* @param connection       The connection information used to create the socket
+* @param buffer_ptr       Returns the data received
+* @return                 The number of bytes received, 0 at EOF, -1 on error
+* *******************************************************************************/
+static int New_Recv_Managed ( TCP_CONNECTION_INFO *connection, char **buffer_ptr )
+{
+    RECV_BUFFER *recv_buf;
+    RECV_POOL   *pool;
+    int         available;
+    int         average;
+    int         wanted;
+    int         size_class;
+    int         nrcvd;
+
+    recv_buf = &connection->recv_buf;
+    pool = connection->recv_pool ? connection->recv_pool : &default_recv_pool;
+
+    available = 0;
+#ifdef FIONREAD
+    if ( ioctl ( *connection->sock, FIONREAD, ( char * ) &available ) < 0 )
+        available = 0;
+#endif
+
+    if ( available > recv_class_sizes[RECV_POOL_CLASSES - 1] )
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    average = recv_buf->avg_msg;
+    if ( !average )
+    {
+        RECV_POOL_LOCK ( pool );
+        average = pool->avg_msg;
+        RECV_POOL_UNLOCK ( pool );
+    }
+    average = ( average + RECV_AVG_SCALE - 1 ) / RECV_AVG_SCALE;
+    wanted = available > average ? available : average;
+    size_class = Recv_Class_For ( wanted );
+
+    /* grow right away; only shrink when two classes too big, to avoid flapping */
+    if ( recv_buf->data && ( size_class > recv_buf->size_class || size_class + 1 < recv_buf->size_class ) )
+        Recv_Buffer_Release ( connection );
+
+    if ( !recv_buf->data )
+    {
+        recv_buf->data = Recv_Pool_Get ( pool, size_class );
+        if ( !recv_buf->data )
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        recv_buf->size_class = size_class;
+        recv_buf->size = recv_class_sizes[size_class];
+    }
+
+    nrcvd = New_Recv ( connection, recv_buf->data, recv_buf->size, 0 );
+    if ( nrcvd < 0 )
+        return -1;
+
+    if ( nrcvd > 0 )
+    {
+        Recv_Average ( &recv_buf->avg_msg, nrcvd );
+        RECV_POOL_LOCK ( pool );
+        Recv_Average ( &pool->avg_msg, nrcvd );
+        RECV_POOL_UNLOCK ( pool );
+    }
+    recv_buf->last_used = connection->last_activity;
+
+    *buffer_ptr = recv_buf->data;
+
+    return nrcvd;
+}
+
+/*********************************************************************************
+*
+* @fn                     Recv_Buffer_Trim
+*
+* FUNCTION:               Gives a connection's receive buffer back to the pool if
+*                         it has not been used for idle_us. The next receive will
+*                         borrow a fresh one.
+*
+* @param connection       The connection information used to create the socket
+* @param idle_us          How long the buffer may sit unused
+* @return                 The number of bytes released
+* *******************************************************************************/
+static long Recv_Buffer_Trim ( TCP_CONNECTION_INFO *connection, TIMESTAMP idle_us )
+{
+    if ( !connection->recv_buf.data
+      || Get_Timestamp ( ) - connection->recv_buf.last_used < idle_us )
+        return 0;
+
+    return Recv_Buffer_Release ( connection );
+}
+
+/*********************************************************************************
+*
+* @fn                     Recv_Pool_Get_Stats
+*
+* FUNCTION:               Reports the memory held by a pool
+*
+* @param pool             The pool, or 0 for the process-wide default
+* @param bytes_in_use     Returns the bytes lent out to connections
+* @param bytes_cached     Returns the bytes held free in the pool
+* @return                 void
+* *******************************************************************************/
+static void Recv_Pool_Get_Stats ( RECV_POOL *pool, long long *bytes_in_use, long long *bytes_cached )
+{
+    if ( !pool )
+        pool = &default_recv_pool;
+
+    RECV_POOL_LOCK ( pool );
+    *bytes_in_use = pool->bytes_in_use;
+    *bytes_cached = pool->bytes_cached;
+    RECV_POOL_UNLOCK ( pool );
+}
+
+/*********************************************************************************
+*
+* @fn                     Recv_Pool_Free
+*
+* FUNCTION:               Releases a pool made by Recv_Pool_Create and the
+*                         buffers cached in it. Buffers still lent out must
+*                         not be given back to it afterwards.
+*
+* @param pool             The pool
+* @return                 void
+* *******************************************************************************/
+static void Recv_Pool_Free ( RECV_POOL *pool )
+{
+    void    *buffer;
+    int     i;
+
+    for ( i = 0; i < RECV_POOL_CLASSES; i++ )
+    {
+        while ( ( buffer = pool->free_list[i] ) != 0 )
+        {
+            pool->free_list[i] = *( void ** ) buffer;
+            free ( buffer );
+        }
+    }
+
+    free ( pool );
+}
+
+/*********************************************************************************
+*
+* @fn                     Recv_Pool_Prewarm
+*
+* FUNCTION:               Allocates buffers into a pool ahead of need, touching
+*                         each so its pages are really there, so early requests
+*                         don't pay for the allocations. No more than the pool's
+*                         max_free are kept per class.
+*
+* @param pool             The pool, or 0 for the process-wide default
+* @param size_class       The size class to fill
+* @param count            How many buffers to add
+* @return                 The number of bytes added; fewer than asked if memory ran
+*                         out
+* *******************************************************************************/
+static long Recv_Pool_Prewarm ( RECV_POOL *pool, int size_class, int count )
+{
+    char    *buffer;
+    long    added;
+
+    if ( !pool )
+        pool = &default_recv_pool;
+
+    RECV_POOL_LOCK ( pool );
+
+    for ( added = 0; count > 0 && pool->free_count[size_class] < pool->max_free; count-- )
+    {
+        buffer = ( char * ) malloc ( recv_class_sizes[size_class] );
+        if ( !buffer )
+            break;
+        memset ( buffer, 0, recv_class_sizes[size_class] );
+
+        *( void ** ) buffer = pool->free_list[size_class];
+        pool->free_list[size_class] = buffer;
+        pool->free_count[size_class]++;
+        pool->bytes_cached += recv_class_sizes[size_class];
+        added += recv_class_sizes[size_class];
+    }
+
+    RECV_POOL_UNLOCK ( pool );
+
+    return added;
+}
+
+/***************************************************************************************
+*						DELIMITER FRAMING
+*
+*   For peers that mark the end of a message with a byte (LF, CR/LF, ETX, ...) rather
+*   than sending its length. Finding the delimiter is the hot loop, so it is done 16 or
+*   32 bytes at a time with SSE2 or AVX2 where the processor has them (checked once, on
+*   first use), and with memchr elsewhere.
+***************************************************************************************/
+
+/*********************************************************************************
+*
+* @fn                     Scan_Byte_Scalar
+*
+* FUNCTION:               Finds the first occurrence of a byte
+*
+* @param data             The bytes to search
+* @param length           How many bytes to search
+* @param c                The byte to find
+* @return                 Its offset, or length if it is not there
+* *******************************************************************************/
+static unsigned long Scan_Byte_Scalar ( const char *data, unsigned long length, char c )
+{
+    const char *found;
+
+    found = ( const char * ) memchr ( data, c, length );
+
+    return found ? ( unsigned long ) ( found - data ) : length;
+}
+
+#ifdef NSCC_X86_SIMD
+/*********************************************************************************
+*
+* @fn                     Scan_Byte_SSE2
+*
+* FUNCTION:               Scan_Byte_Scalar, 16 bytes per compare
+*
+* *******************************************************************************/
+__attribute__ ( ( target ( "sse2" ) ) )
+static unsigned long Scan_Byte_SSE2 ( const char *data, unsigned long length, char c )
+{
+    __m128i         needle;
+    unsigned long   i;
+    int             mask;
+
+    needle = _mm_set1_epi8 ( c );
+
+    for ( i = 0; i + 16 <= length; i += 16 )
+    {
+        mask = _mm_movemask_epi8 ( _mm_cmpeq_epi8 ( _mm_loadu_si128 ( ( const __m128i * ) ( data + i ) ), needle ) );
+        if ( mask )
+            return i + __builtin_ctz ( mask );
+    }
+
+    return i + Scan_Byte_Scalar ( data + i, length - i, c );
+}
+
+/*********************************************************************************
+*
+* @fn                     Scan_Byte_AVX2
+*
+* FUNCTION:               Scan_Byte_Scalar, 64 bytes per loop in two 32 byte
+*                         compares
+*
+* *******************************************************************************/
+__attribute__ ( ( target ( "avx2" ) ) )
+static unsigned long Scan_Byte_AVX2 ( const char *data, unsigned long length, char c )
+{
+    __m256i         needle;
+    __m256i         lo;
+    __m256i         hi;
+    unsigned long   i;
+    unsigned int    mask;
+
+    needle = _mm256_set1_epi8 ( c );
+
+    for ( i = 0; i + 64 <= length; i += 64 )
+    {
+        lo = _mm256_cmpeq_epi8 ( _mm256_loadu_si256 ( ( const __m256i * ) ( data + i ) ), needle );
+        hi = _mm256_cmpeq_epi8 ( _mm256_loadu_si256 ( ( const __m256i * ) ( data + i + 32 ) ), needle );
+
+        if ( _mm256_testz_si256 ( _mm256_or_si256 ( lo, hi ), _mm256_or_si256 ( lo, hi ) ) )
+            continue;
+
+        mask = ( unsigned int ) _mm256_movemask_epi8 ( lo );
+        if ( mask )
+            return i + __builtin_ctz ( mask );
+
+        return i + 32 + __builtin_ctz ( ( unsigned int ) _mm256_movemask_epi8 ( hi ) );
+    }
+
+    return i + Scan_Byte_SSE2 ( data + i, length - i, c );
+}
+#endif
+
+static unsigned long Scan_Byte_Detect ( const char *data, unsigned long length, char c );
+
+static unsigned long ( *scan_byte ) ( const char *, unsigned long, char ) = Scan_Byte_Detect;
+static const char *scan_byte_impl = "scalar";
+
+/*********************************************************************************
+*
+* @fn                     Scan_Byte_Detect
+*
+* FUNCTION:               Picks the fastest scanner this processor supports,
+*                         installs it for every later call, and runs it.
+*
+* *******************************************************************************/
+static unsigned long Scan_Byte_Detect ( const char *data, unsigned long length, char c )
+{
+    scan_byte = Scan_Byte_Scalar;
+
+#ifdef NSCC_X86_SIMD
+    __builtin_cpu_init ( );
+    if ( __builtin_cpu_supports ( "avx2" ) )
+    {
+        scan_byte = Scan_Byte_AVX2;
+        scan_byte_impl = "avx2";
+    }
+    else if ( __builtin_cpu_supports ( "sse2" ) )
+    {
+        scan_byte = Scan_Byte_SSE2;
+        scan_byte_impl = "sse2";
+    }
+#endif
+
+    return scan_byte ( data, length, c );
+}
+
+/*********************************************************************************
+*
+* @fn                     Delim_Scan_Impl
+*
+* FUNCTION:               Names the scanner in use: "avx2", "sse2" or "scalar"
+*
+* @return                 The scanner name
+* *******************************************************************************/
+static const char *Delim_Scan_Impl ( void )
+{
+    if ( scan_byte == Scan_Byte_Detect )
+        Scan_Byte_Detect ( "", 0, 0 );
+
+    return scan_byte_impl;
+}
+
+/*********************************************************************************
+*
+* @fn                     Delim_Ring_Create
+*
+* FUNCTION:               Allocates a receive ring for a delimiter-framed
+*                         connection
+*
+* NOTE:                   A message longer than the ring can't be framed; make
+*                         the ring at least twice the longest expected message.
+*
+* @param size             The ring size; rounded up to a power of two
+* @param mode             DELIM_LINE, DELIM_BYTE or DELIM_STX_ETX
+* @param delim            The delimiter for DELIM_BYTE
+* @return                 The ring, free with Delim_Ring_Free
+* *******************************************************************************/
+static DELIM_RING *Delim_Ring_Create ( int size, int mode, char delim )
+{
+    DELIM_RING      *ring;
+    unsigned long   ring_size;
+
+    for ( ring_size = 256; ring_size < ( unsigned long ) size; ring_size <<= 1 )
+        ;
+
+    ring = ( DELIM_RING * ) malloc ( sizeof ( DELIM_RING ) );
+    memset ( ring, 0, sizeof ( DELIM_RING ) );
+
+    ring->data = ( char * ) malloc ( ring_size );
+    ring->size = ring_size;
+    ring->mode = mode;
+    ring->delim = mode == DELIM_LINE ? '\n' : ( mode == DELIM_STX_ETX ? DELIM_ETX : delim );
+
+    return ring;
+}
+
+/*********************************************************************************
+*
+* @fn                     Delim_Ring_Free
+*
+* FUNCTION:               Releases a delimiter ring
+*
+* @param ring             The ring
+* @return                 void
+* *******************************************************************************/
+static void Delim_Ring_Free ( DELIM_RING *ring )
+{
+    free ( ring->data );
+    free ( ring );
+}
+
+/*********************************************************************************
+*
+* @fn                     New_Recv_Delim
+*
+* FUNCTION:               Receives data on a connected socket straight into the
+*                         free space of a delimiter ring. Only the contiguous
+*                         free space is filled, so near the end of the ring a
+*                         second call picks up from the start.
+*
+* @param connection       The connection information used to create the socket
+* @param ring             The connection's ring
+* @return                 The number of bytes received, 0 at EOF, -1 on error
+*                         or when the ring is full of an unfinished message,
+*                         which is then discarded
+* *******************************************************************************/
+static int New_Recv_Delim ( TCP_CONNECTION_INFO *connection, DELIM_RING *ring )
+{
+    unsigned long   offset;
+    unsigned long   space;
+    int             nrcvd;
+
+    space = ring->size - ( ring->tail - ring->head );
+    if ( space == 0 )
+    {
+        ring->overflows++;
+        ring->head = ring->tail;
+        ring->scanned = 0;
+        return -1;
+    }
+
+    offset = ring->tail & ( ring->size - 1 );
+    if ( space > ring->size - offset )
+        space = ring->size - offset;
+
+    nrcvd = New_Recv ( connection, ring->data + offset, ( int ) space, 0 );
+    if ( nrcvd > 0 )
+        ring->tail += nrcvd;
+
+    return nrcvd;
+}
+
+/*********************************************************************************
+*
+* @fn                     Delim_Find
+*
+* FUNCTION:               Finds a byte in the ring between two positions, in at
+*                         most two scans either side of the wrap
+*
+* @param ring             The ring
+* @param from             The first position to look at
+* @param to               One past the last position to look at
+* @param c                The byte to find
+* @return                 Its position, or "to" if it is not there
+* *******************************************************************************/
+static unsigned long Delim_Find ( DELIM_RING *ring, unsigned long from, unsigned long to, char c )
+{
+    unsigned long   offset;
+    unsigned long   first;
+    unsigned long   found;
+
+    if ( from >= to )
+        return to;
+
+    offset = from & ( ring->size - 1 );
+    first = ring->size - offset;
+    if ( first > to - from )
+        first = to - from;
+
+    found = scan_byte ( ring->data + offset, first, c );
+    if ( found < first )
+        return from + found;
+
+    if ( from + first == to )
+        return to;
+
+    return from + first + scan_byte ( ring->data, to - from - first, c );
+}
+
+/*********************************************************************************
+*
+* @fn                     Delim_Next
+*
+* FUNCTION:               Hands out the next complete message in the ring as a
+*                         view, without the delimiters, and moves past it. For
+*                         DELIM_STX_ETX anything before the STX is discarded.
+*
+* @param ring             The ring
+* @param view             Receives the message
+* @return                 SUCCESS if a message was found, FAIL if the ring holds
+*                         no complete message yet
+* *******************************************************************************/
+static int Delim_Next ( DELIM_RING *ring, MSG_VIEW *view )
+{
+    unsigned long   start;
+    unsigned long   end;
+    unsigned long   offset;
+    unsigned long   length;
+
+    if ( ring->mode == DELIM_STX_ETX && ring->scanned == 0 )
+    {
+        start = Delim_Find ( ring, ring->head, ring->tail, DELIM_STX );
+        ring->head = start;
+        if ( start == ring->tail )
+            return FAIL;
+    }
+
+    end = Delim_Find ( ring, ring->head + ring->scanned, ring->tail, ring->delim );
+    if ( end == ring->tail )
+    {
+        ring->scanned = ring->tail - ring->head;
+        return FAIL;
+    }
+
+    start = ring->head;
+    if ( ring->mode == DELIM_STX_ETX )
+        start++;
+
+    length = end - start;
+    if ( ring->mode == DELIM_LINE && length > 0
+      && ring->data[( end - 1 ) & ( ring->size - 1 )] == '\r' )
+        length--;
+
+    offset = start & ( ring->size - 1 );
+    view->part[0] = ring->data + offset;
+    view->len[0] = ( int ) ( length < ring->size - offset ? length : ring->size - offset );
+    view->part[1] = ring->data;
+    view->len[1] = ( int ) length - view->len[0];
+    view->total = ( int ) length;
+
+    ring->head = end + 1;
+    ring->scanned = 0;
+    ring->messages++;
+
+    return SUCCESS;
+}
+
+/***************************************************************************************
+*						CRC32C
+*
+*   CRC32C (Castagnoli), the checksum used by iSCSI and SCTP. Processors with SSE4.2
+*   compute it with the crc32 instruction, 8 bytes at a time; elsewhere a slicing-by-8
+*   table does the same 8 bytes per step. The choice is made once, on first use.
+***************************************************************************************/
+#define CRC32C_POLY     0x82F63B78
+
+static uint32_t crc32c_table[8][256];
+
+static uint32_t Crc32c_Detect ( uint32_t crc, const char *data, unsigned long length );
+
+static uint32_t ( *crc32c_update ) ( uint32_t, const char *, unsigned long ) = Crc32c_Detect;
+
+/*********************************************************************************
+*
+* @fn                     Crc32c_Table_Update
+*
+* FUNCTION:               Portable CRC32C, slicing by 8
+*
+* @param crc              The running CRC, inverted
+* @param data             The bytes to add
+* @param length           How many bytes
+* @return                 The running CRC, inverted
+* *******************************************************************************/
+static uint32_t Crc32c_Table_Update ( uint32_t crc, const char *data, unsigned long length )
+{
+    const unsigned char *next;
+    uint32_t            low;
+    uint32_t            high;
+
+    next = ( const unsigned char * ) data;
+
+    for ( ; length >= 8; length -= 8, next += 8 )
+    {
+        low = crc ^ ( next[0] | ( next[1] << 8 ) | ( next[2] << 16 ) | ( ( uint32_t ) next[3] << 24 ) );
+        high = next[4] | ( next[5] << 8 ) | ( next[6] << 16 ) | ( ( uint32_t ) next[7] << 24 );
+
+        crc = crc32c_table[7][low & 0xff]         ^ crc32c_table[6][( low >> 8 ) & 0xff]
+            ^ crc32c_table[5][( low >> 16 ) & 0xff] ^ crc32c_table[4][low >> 24]
+            ^ crc32c_table[3][high & 0xff]        ^ crc32c_table[2][( high >> 8 ) & 0xff]
+            ^ crc32c_table[1][( high >> 16 ) & 0xff] ^ crc32c_table[0][high >> 24];
+    }
+
+    for ( ; length > 0; length--, next++ )
+        crc = crc32c_table[0][( crc ^ *next ) & 0xff] ^ ( crc >> 8 );
+
+    return crc;
+}
+
+#ifdef NSCC_X86_SIMD
+/*********************************************************************************
+*
+* @fn                     Crc32c_SSE42_Update
+*
+* FUNCTION:               Crc32c_Table_Update using the SSE4.2 crc32 instruction
+*
+* *******************************************************************************/
+__attribute__ ( ( target ( "sse4.2" ) ) )
+static uint32_t Crc32c_SSE42_Update ( uint32_t crc, const char *data, unsigned long length )
+{
+#ifdef __x86_64__
+    unsigned long long  crc64;
+    unsigned long long  word;
+
+    crc64 = crc;
+    for ( ; length >= 8; length -= 8, data += 8 )
+    {
+        memcpy ( &word, data, 8 );
+        crc64 = _mm_crc32_u64 ( crc64, word );
+    }
+    crc = ( uint32_t ) crc64;
+#endif
+
+    for ( ; length > 0; length--, data++ )
+        crc = _mm_crc32_u8 ( crc, ( unsigned char ) *data );
+
+    return crc;
+}
+#endif
+
+/*********************************************************************************
+*
+* @fn                     Crc32c_Detect
+*
+* FUNCTION:               Builds the tables, picks the fastest CRC32C this
+*                         processor supports for every later call, and runs it
+*
+* *******************************************************************************/
+static uint32_t Crc32c_Detect ( uint32_t crc, const char *data, unsigned long length )
+{
+    uint32_t    value;
+    int         i;
+    int         j;
+
+    for ( i = 0; i < 256; i++ )
+    {
+        for ( value = i, j = 0; j < 8; j++ )
+            value = ( value & 1 ) ? ( value >> 1 ) ^ CRC32C_POLY : value >> 1;
+        crc32c_table[0][i] = value;
+    }
+    for ( i = 0; i < 256; i++ )
+    {
+        for ( j = 1; j < 8; j++ )
+            crc32c_table[j][i] = ( crc32c_table[j - 1][i] >> 8 ) ^ crc32c_table[0][crc32c_table[j - 1][i] & 0xff];
+    }
+
+    crc32c_update = Crc32c_Table_Update;
+#ifdef NSCC_X86_SIMD
+    __builtin_cpu_init ( );
+    if ( __builtin_cpu_supports ( "sse4.2" ) )
+        crc32c_update = Crc32c_SSE42_Update;
+#endif
+
+    return crc32c_update ( crc, data, length );
+}
+
+/*********************************************************************************
+*
+* @fn                     Crc32c
+*
+* FUNCTION:               Adds bytes to a CRC32C. Start with 0 and pass each
+*                         result back in with the next piece; the CRC of the
+*                         pieces is the CRC of the whole.
+*
+* NOTE:                   ex. Crc32c ( 0, "123456789", 9 ) == 0xE3069283
+*
+* @param crc              The CRC of the bytes so far, 0 to start
+* @param data             The bytes to add
+* @param length           How many bytes
+* @return                 The CRC of everything so far
+* *******************************************************************************/
+static uint32_t Crc32c ( uint32_t crc, const char *data, unsigned long length )
+{
+    return ~crc32c_update ( ~crc, data, length );
+}
+
+/***************************************************************************************
+*						LZ COMPRESSION
+*
+*   A small greedy LZ77 compressor writing the LZ4 block format, so frames can be read
+*   by any LZ4 block decoder. It favours speed over ratio: one hash probe per position,
+*   and it strides ahead faster the longer it goes without a match, so incompressible
+*   data is passed over quickly.
+***************************************************************************************/
+#define LZ_BOUND(n)     ( ( n ) + ( n ) / 255 + 16 )
+
+/*********************************************************************************
+*
+* @fn                     Lz_Put_Length
+*
+* FUNCTION:               Writes the part of a length that didn't fit in its
+*                         4 bit token field
+*
+* @param op               Where to write
+* @param length           The full length, already known to be 15 or more
+* @return                 The next free byte
+* *******************************************************************************/
+static unsigned char *Lz_Put_Length ( unsigned char *op, int length )
+{
+    for ( length -= 15; length >= 255; length -= 255 )
+        *op++ = 255;
+    *op++ = ( unsigned char ) length;
+
+    return op;
+}
+
+/*********************************************************************************
+*
+* @fn                     Lz_Compress
+*
+* FUNCTION:               Compresses a buffer into an LZ4-format block
+*
+* @param ctx              The connection's compression context
+* @param src              The bytes to compress
+* @param length           How many bytes
+* @param dst              Where to write the block
+* @param dst_cap          The most bytes to write; give less than length to
+*                         stop early once compression isn't paying
+* @return                 The size of the block, -1 if it didn't fit in dst_cap
+* *******************************************************************************/
+static int Lz_Compress ( COMPRESS_CTX *ctx, const unsigned char *src, int length, unsigned char *dst, int dst_cap )
+{
+    const unsigned char *ip;
+    const unsigned char *anchor;
+    const unsigned char *ref;
+    const unsigned char *end;
+    unsigned char       *op;
+    unsigned char       *op_end;
+    unsigned char       *token;
+    uint32_t            sequence;
+    uint32_t            hash;
+    uint32_t            stored;
+    int                 literals;
+    int                 match;
+
+    if ( ctx->base > 0x7fffffff - ( uint32_t ) length )
+    {
+        memset ( ctx->table, 0, sizeof ( ctx->table ) );
+        ctx->base = 1;
+    }
+
+    ip = src;
+    anchor = src;
+    end = src + length;
+    op = dst;
+    op_end = dst + dst_cap;
+
+    /* the format wants the last match to start 12 bytes and end 5 bytes before the end */
+    while ( length >= 13 && ip < end - 12 )
+    {
+        memcpy ( &sequence, ip, 4 );
+        hash = ( sequence * 2654435761U ) >> ( 32 - COMPRESS_HASH_BITS );
+        stored = ctx->table[hash];
+        ctx->table[hash] = ctx->base + ( uint32_t ) ( ip - src );
+
+        /* a slot left by an earlier message points before src; don't form it */
+        ref = stored < ctx->base ? 0 : src + ( stored - ctx->base );
+        if ( !ref || ip - ref > 65535 || memcmp ( ref, ip, 4 ) != 0 )
+        {
+            ip += 1 + ( ( ip - anchor ) >> 6 );
+            continue;
+        }
+
+        for ( match = 4; ip + match < end - 5 && ref[match] == ip[match]; match++ )
+            ;
+
+        literals = ( int ) ( ip - anchor );
+        if ( op + 1 + literals + literals / 255 + 1 + 2 + match / 255 + 1 > op_end )
+            return -1;
+
+        token = op++;
+        *token = ( unsigned char ) ( ( literals >= 15 ? 15 : literals ) << 4 );
+        if ( literals >= 15 )
+            op = Lz_Put_Length ( op, literals );
+        memcpy ( op, anchor, literals );
+        op += literals;
+
+        *op++ = ( unsigned char ) ( ( ip - ref ) & 0xff );
+        *op++ = ( unsigned char ) ( ( ip - ref ) >> 8 );
+
+        *token |= ( unsigned char ) ( match - 4 >= 15 ? 15 : match - 4 );
+        if ( match - 4 >= 15 )
+            op = Lz_Put_Length ( op, match - 4 );
+
+        ip += match;
+        anchor = ip;
+    }
+
+    literals = ( int ) ( end - anchor );
+    if ( op + 1 + literals + literals / 255 + 1 > op_end )
+        return -1;
+
+    token = op++;
+    *token = ( unsigned char ) ( ( literals >= 15 ? 15 : literals ) << 4 );
+    if ( literals >= 15 )
+        op = Lz_Put_Length ( op, literals );
+    memcpy ( op, anchor, literals );
+    op += literals;
+
+    ctx->base += ( uint32_t ) length + 1;
+
+    return ( int ) ( op - dst );
+}
+
+/*********************************************************************************
+*
+* @fn                     Lz_Decompress
+*
+* FUNCTION:               Expands an LZ4-format block. Every length and offset is
+*                         checked, so a corrupt block fails rather than writing
+*                         outside dst.
+*
+* @param src              The block
+* @param length           The size of the block
+* @param dst              Where to expand it
+* @param dst_cap          The size of dst
+* @return                 The expanded size, -1 if the block is malformed
+* *******************************************************************************/
+static int Lz_Decompress ( const unsigned char *src, int length, unsigned char *dst, int dst_cap )
+{
+    const unsigned char *ip;
+    const unsigned char *end;
+    const unsigned char *match;
+    unsigned char       *op;
+    unsigned char       *op_end;
+    unsigned int        token;
+    unsigned int        extra;
+    long                literals;
+    long                match_len;
+    long                offset;
+
+    ip = src;
+    end = src + length;
+    op = dst;
+    op_end = dst + dst_cap;
+
+    while ( ip < end )
+    {
+        token = *ip++;
+
+        literals = token >> 4;
+        if ( literals == 15 )
+        {
+            do
+            {
+                if ( ip >= end )
+                    return -1;
+                extra = *ip++;
+                literals += extra;
+            } while ( extra == 255 && literals < length );
+        }
+        if ( literals > end - ip || literals > op_end - op )
+            return -1;
+
+        memcpy ( op, ip, literals );
+        op += literals;
+        ip += literals;
+
+        /* the last sequence is literals only */
+        if ( ip == end )
+            break;
+
+        if ( end - ip < 2 )
+            return -1;
+        offset = ip[0] | ( ip[1] << 8 );
+        ip += 2;
+        if ( offset == 0 || offset > op - dst )
+            return -1;
+
+        match_len = token & 15;
+        if ( match_len == 15 )
+        {
+            do
+            {
+                if ( ip >= end )
+                    return -1;
+                extra = *ip++;
+                match_len += extra;
+            } while ( extra == 255 && match_len < dst_cap );
+        }
+        match_len += 4;
+        if ( match_len > op_end - op )
+            return -1;
+
+        /* byte by byte only when the match overlaps what it is producing */
+        match = op - offset;
+        if ( offset >= match_len )
+        {
+            memcpy ( op, match, match_len );
+            op += match_len;
+        }
+        else
+        {
+            for ( ; match_len > 0; match_len-- )
+                *op++ = *match++;
+        }
+    }
+
+    return ( int ) ( op - dst );
+}
+
+/*********************************************************************************
+*
+* @fn                     Compress_Enable
+*
+* FUNCTION:               Gives a connection a compression context. Frames are
+*                         only sent compressed once FRAME_F_COMPRESSED is also in
+*                         the connection's frame_opts, normally by Frame_Negotiate.
+*
+* @param connection       The connection information used to create the socket
+* @param threshold        The smallest payload worth compressing
+* @return                 void
+* *******************************************************************************/
+static void Compress_Enable ( TCP_CONNECTION_INFO *connection, int threshold )
+{
+    if ( !connection->compress )
+    {
+        connection->compress = ( COMPRESS_CTX * ) malloc ( sizeof ( COMPRESS_CTX ) );
+        memset ( connection->compress, 0, sizeof ( COMPRESS_CTX ) );
+        connection->compress->base = 1;
+    }
+
+    connection->compress->threshold = threshold;
+}
+
+/*********************************************************************************
+*
+* @fn                     Compress_Free
+*
+* FUNCTION:               Releases a connection's compression context
+*
+* @param connection       The connection information used to create the socket
+* @return                 void
+* *******************************************************************************/
+static void Compress_Free ( TCP_CONNECTION_INFO *connection )
+{
+    if ( !connection->compress )
+        return;
+
+    free ( connection->compress->scratch );
+    free ( connection->compress->recv_scratch );
+    free ( connection->compress->gather );
+    free ( connection->compress );
+    connection->compress = 0;
+}
+
+/*********************************************************************************
+*
+* @fn                     Compress_Scratch
+*
+* FUNCTION:               Grows one of the context's scratch buffers as needed
+*
+* @param buffer           The buffer
+* @param size             Its current size
+* @param wanted           The size needed
+* @return                 The buffer
+* *******************************************************************************/
+static char *Compress_Scratch ( char **buffer, int *size, int wanted )
+{
+    if ( *size < wanted )
+    {
+        free ( *buffer );
+        *buffer = ( char * ) malloc ( wanted );
+        *size = wanted;
+    }
+
+    return *buffer;
+}
+
+/*********************************************************************************
+*
+* @fn                     Compress_Get_Stats
+*
+* FUNCTION:               Reports the compression ratio and cost for a connection
+*
+* @param connection       The connection information used to create the socket
+* @param stats            Receives the counters; all 0 without a context
+* @return                 void
+* *******************************************************************************/
+static void Compress_Get_Stats ( TCP_CONNECTION_INFO *connection, COMPRESS_STATS *stats )
+{
+    if ( connection->compress )
+        *stats = connection->compress->stats;
+    else
+        memset ( stats, 0, sizeof ( COMPRESS_STATS ) );
+}
+
+/***************************************************************************************
+*						LENGTH FRAMING
+*
+*   Each message goes out as a FRAME_HDR, the payload, and, when the frame carries
+*   FRAME_F_CRC32C, a trailer holding the payload's CRC32C in network order. The CRC is
+*   taken over each piece as it is handed to the stack, so it costs no extra pass over
+*   the data however the send is split.
+***************************************************************************************/
+
+/*********************************************************************************
+*
+* @fn                     Send_All
+*
+* FUNCTION:               Sends every byte of a buffer, carrying on after partial
+*                         sends
+*
+* @param connection       The connection information used to create the socket
+* @param buffer_ptr       The bytes to send
+* @param length           How many bytes
+* @param crc              If not 0, the CRC32C of what was sent is added to it
+* @return                 0 when all was sent, -1 on error
+* *******************************************************************************/
+static int Send_All ( TCP_CONNECTION_INFO *connection, char *buffer_ptr, int length, uint32_t *crc )
+{
+    int sent;
+
+    while ( length > 0 )
+    {
+        sent = New_Send ( connection, buffer_ptr, length );
+        if ( sent <= 0 )
+            return -1;
+
+        if ( crc )
+            *crc = Crc32c ( *crc, buffer_ptr, sent );
+
+        buffer_ptr += sent;
+        length -= sent;
+    }
+
+    return 0;
+}
+
+/*********************************************************************************
+*
+* @fn                     Recv_All
+*
+* FUNCTION:               Receives exactly "length" bytes, carrying on after
+*                         partial receives
+*
+* @param connection       The connection information used to create the socket
+* @param buffer_ptr       Where to put the bytes
+* @param length           How many bytes
+* @param crc              If not 0, the CRC32C of what arrived is added to it
+* @return                 0 when all arrived, -1 on error or EOF
+* *******************************************************************************/
+static int Recv_All ( TCP_CONNECTION_INFO *connection, char *buffer_ptr, int length, uint32_t *crc )
+{
+    int nrcvd;
+
+    while ( length > 0 )
+    {
+        nrcvd = New_Recv ( connection, buffer_ptr, length, 0 );
+        if ( nrcvd <= 0 )
+            return -1;
+
+        if ( crc )
+            *crc = Crc32c ( *crc, buffer_ptr, nrcvd );
+
+        buffer_ptr += nrcvd;
+        length -= nrcvd;
+    }
+
+    return 0;
+}
+
+/*********************************************************************************
+*
+* @fn                     Send_Frame
+*
+* FUNCTION:               Sends one frame made up of several pieces. A CRC32C
+*                         trailer is added when the connection's frame_opts has
+*                         FRAME_F_CRC32C. Small frames are assembled and sent in
+*                         one send; larger ones go piece by piece.
+*
+* @param connection       The connection information used to create the socket
+* @param iov              The pieces of the payload, in order
+* @param iov_count        How many pieces
+* @param flags            FRAME_F_ flags describing the payload
+* @return                 0 on success, -1 on error
+* *******************************************************************************/
+static int Send_Frame ( TCP_CONNECTION_INFO *connection, FRAME_IOV *iov, int iov_count, uint32_t flags )
+{
+    FRAME_HDR   header;
+    char        coalesced[FRAME_COALESCE];
+    uint32_t    crc;
+    uint32_t    trailer;
+    BOOLEAN     checksum;
+    int         length;
+    int         fill;
+    int         i;
+
+    for ( i = 0, length = 0; i < iov_count; i++ )
+        length += iov[i].length;
+
+    checksum = ( connection->frame_opts & FRAME_F_CRC32C ) ? SUCCESS : FAIL;
+    header.length = htonl ( ( uint32_t ) length );
+    header.flags = htonl ( flags | ( checksum ? FRAME_F_CRC32C : 0 ) );
+    crc = 0;
+
+    if ( sizeof ( FRAME_HDR ) + length + sizeof ( trailer ) <= FRAME_COALESCE )
+    {
+        memcpy ( coalesced, &header, sizeof ( FRAME_HDR ) );
+        fill = sizeof ( FRAME_HDR );
+        for ( i = 0; i < iov_count; i++ )
+        {
+            memcpy ( coalesced + fill, iov[i].base, iov[i].length );
+            fill += iov[i].length;
+        }
+        if ( checksum )
+        {
+            trailer = htonl ( Crc32c ( 0, coalesced + sizeof ( FRAME_HDR ), length ) );
+            memcpy ( coalesced + fill, &trailer, sizeof ( trailer ) );
+            fill += sizeof ( trailer );
+        }
+
+        return Send_All ( connection, coalesced, fill, 0 );
+    }
+
+    if ( Send_All ( connection, ( char * ) &header, sizeof ( FRAME_HDR ), 0 ) < 0 )
+        return -1;
+
+    for ( i = 0; i < iov_count; i++ )
+    {
+        if ( Send_All ( connection, iov[i].base, iov[i].length, checksum ? &crc : 0 ) < 0 )
+            return -1;
+    }
+
+    if ( !checksum )
+        return 0;
+
+    trailer = htonl ( crc );
+
+    return Send_All ( connection, ( char * ) &trailer, sizeof ( trailer ), 0 );
+}
+
+/*********************************************************************************
+*
+* @fn                     New_Send_Framev
+*
+* FUNCTION:               Sends one framed message made up of several pieces.
+*                         When compression has been negotiated and the payload
+*                         is over the threshold it is compressed first, unless
+*                         that saves too little to be worth it, in which case it
+*                         goes as it is.
+*
+* @param connection       The connection information used to create the socket
+* @param iov              The pieces of the payload, in order
+* @param iov_count        How many pieces
+* @return                 0 on success, -1 on error
+* *******************************************************************************/
+static int New_Send_Framev ( TCP_CONNECTION_INFO *connection, FRAME_IOV *iov, int iov_count )
+{
+    COMPRESS_CTX    *ctx;
+    FRAME_IOV       packed;
+    TIMESTAMP       start;
+    uint32_t        original;
+    char            *input;
+    int             length;
+    int             fill;
+    int             size;
+    int             i;
+
+    ctx = connection->compress;
+    if ( !ctx || !( connection->frame_opts & FRAME_F_COMPRESSED ) )
+        return Send_Frame ( connection, iov, iov_count, 0 );
+
+    for ( i = 0, length = 0; i < iov_count; i++ )
+        length += iov[i].length;
+
+    ctx->stats.bytes_in += length;
+
+    if ( length < ctx->threshold || ctx->skip > 0 )
+    {
+        if ( length >= ctx->threshold )
+        {
+            ctx->skip--;
+            ctx->stats.skipped++;
+        }
+        ctx->stats.bytes_out += length;
+        return Send_Frame ( connection, iov, iov_count, 0 );
+    }
+
+    start = Get_Cpu_Micros ( );
+
+    input = iov[0].base;
+    if ( iov_count > 1 )
+    {
+        input = Compress_Scratch ( &ctx->gather, &ctx->gather_size, length );
+        for ( i = 0, fill = 0; i < iov_count; i++ )
+        {
+            memcpy ( input + fill, iov[i].base, iov[i].length );
+            fill += iov[i].length;
+        }
+    }
+
+    /* only worth it if it saves at least 1/16th */
+    Compress_Scratch ( &ctx->scratch, &ctx->scratch_size, sizeof ( uint32_t ) + LZ_BOUND ( length ) );
+    size = Lz_Compress ( ctx
+                       , ( const unsigned char * ) input
+                       , length
+                       , ( unsigned char * ) ctx->scratch + sizeof ( uint32_t )
+                       , length - length / 16 - ( int ) sizeof ( uint32_t ) );
+
+    ctx->stats.cpu_us += Get_Cpu_Micros ( ) - start;
+
+    if ( size < 0 )
+    {
+        /* several misses in a row: stop trying for a while */
+        ctx->stats.incompressible++;
+        if ( ++ctx->misses >= 8 )
+        {
+            ctx->skip = 32;
+            ctx->misses = 0;
+        }
+        ctx->stats.bytes_out += length;
+        return Send_Frame ( connection, iov, iov_count, 0 );
+    }
+
+    ctx->misses = 0;
+    ctx->stats.compressed++;
+
+    original = htonl ( ( uint32_t ) length );
+    memcpy ( ctx->scratch, &original, sizeof ( original ) );
+    packed.base = ctx->scratch;
+    packed.length = size + sizeof ( uint32_t );
+    ctx->stats.bytes_out += packed.length;
+
+    return Send_Frame ( connection, &packed, 1, FRAME_F_COMPRESSED );
+}
+
+/*********************************************************************************
+*
+* @fn                     New_Send_Frame
+*
+* FUNCTION:               Sends one framed message from a single buffer
+*
+* @param connection       The connection information used to create the socket
+* @param buffer_ptr       Points to the data to be sent
+* @param buffer_length    The size of the buffer pointed to by buffer_ptr
+* @return                 0 on success, -1 on error
+* *******************************************************************************/
+static int New_Send_Frame ( TCP_CONNECTION_INFO *connection, char *buffer_ptr, int buffer_length )
+{
+    FRAME_IOV iov;
+
+    iov.base = buffer_ptr;
+    iov.length = buffer_length;
+
+    return New_Send_Framev ( connection, &iov, 1 );
+}
+
+/*********************************************************************************
+*
+* @fn                     New_Recv_Frame
+*
+* FUNCTION:               Receives one framed message, checking its CRC32C
+*                         trailer if it has one and expanding it if it was
+*                         sent compressed.
+*
+* NOTE:                   After ERR_FRAME_SIZE or ERR_FRAME_FLAGS the payload is
+*                         still on the connection, which is best closed.
+*
+* @param connection       The connection information used to create the socket
+* @param buffer_ptr       Where to put the payload
+* @param buffer_length    The size of the buffer pointed to by buffer_ptr
+* @param msg_length       Returns the payload length
+* @return                 0 on success, -1 on error or EOF, ERR_FRAME_SIZE,
+*                         ERR_CHECKSUM if the trailer did not match,
+*                         ERR_DECOMPRESS, or ERR_FRAME_FLAGS for a compressed
+*                         frame when compression was not negotiated
+* *******************************************************************************/
+static int New_Recv_Frame ( TCP_CONNECTION_INFO *connection, char *buffer_ptr, int buffer_length, int *msg_length )
+{
+    FRAME_HDR   header;
+    COMPRESS_CTX *ctx;
+    TIMESTAMP   start;
+    uint32_t    crc;
+    uint32_t    trailer;
+    uint32_t    flags;
+    uint32_t    original;
+    char        *payload;
+    int         length;
+
+    if ( Recv_All ( connection, ( char * ) &header, sizeof ( FRAME_HDR ), 0 ) < 0 )
+        return -1;
+
+    length = ( int ) ntohl ( header.length );
+    flags = ntohl ( header.flags );
+    *msg_length = length;
+
+    ctx = 0;
+    payload = buffer_ptr;
+    if ( flags & FRAME_F_COMPRESSED )
+    {
+        /* only a peer that agreed compression in Frame_Negotiate may send it */
+        if ( !( connection->frame_opts & FRAME_F_COMPRESSED ) || !connection->compress )
+            return ERR_FRAME_FLAGS;
+        if ( length < ( int ) sizeof ( uint32_t ) || length > ( int ) sizeof ( uint32_t ) + LZ_BOUND ( buffer_length ) )
+            return ERR_FRAME_SIZE;
+
+        ctx = connection->compress;
+        payload = Compress_Scratch ( &ctx->recv_scratch, &ctx->recv_scratch_size, length );
+    }
+    else if ( length < 0 || length > buffer_length )
+        return ERR_FRAME_SIZE;
+
+    crc = 0;
+    if ( Recv_All ( connection, payload, length, ( flags & FRAME_F_CRC32C ) ? &crc : 0 ) < 0 )
+        return -1;
+
+    if ( flags & FRAME_F_CRC32C )
+    {
+        if ( Recv_All ( connection, ( char * ) &trailer, sizeof ( trailer ), 0 ) < 0 )
+            return -1;
+        if ( ntohl ( trailer ) != crc )
+            return ERR_CHECKSUM;
+    }
+
+    if ( !ctx )
+        return 0;
+
+    memcpy ( &original, payload, sizeof ( original ) );
+    *msg_length = ( int ) ntohl ( original );
+    if ( *msg_length < 0 || *msg_length > buffer_length )
+        return ERR_FRAME_SIZE;
+
+    start = Get_Cpu_Micros ( );
+    length = Lz_Decompress ( ( const unsigned char * ) payload + sizeof ( uint32_t )
+                           , length - sizeof ( uint32_t )
+                           , ( unsigned char * ) buffer_ptr
+                           , *msg_length );
+    ctx->stats.cpu_us += Get_Cpu_Micros ( ) - start;
+    ctx->stats.decompressed++;
+
+    return length == *msg_length ? 0 : ERR_DECOMPRESS;
+}
+
+/*********************************************************************************
+*
+* @fn                     Frame_Negotiate
+*
+* FUNCTION:               Agrees framing features with the peer. Both ends send
+*                         the FRAME_F_ flags they want and keep those both asked
+*                         for in frame_opts, so neither sends a feature the other
+*                         can't handle. A compression context is set up if
+*                         compression was agreed.
+*
+* NOTE:                   Both ends must call this, straight after connect /
+*                         accept and before any other frame.
+*
+* @param connection       The connection information used to create the socket
+* @param wanted           The FRAME_F_ flags this end would like
+* @return                 The agreed flags, -1 on error or if the peer does not
+*                         speak this protocol
+* *******************************************************************************/
+static int Frame_Negotiate ( TCP_CONNECTION_INFO *connection, uint32_t wanted )
+{
+    uint32_t hello[2];
+
+    hello[0] = htonl ( FRAME_HELLO_MAGIC );
+    hello[1] = htonl ( wanted );
+
+    if ( Send_All ( connection, ( char * ) hello, sizeof ( hello ), 0 ) < 0
+      || Recv_All ( connection, ( char * ) hello, sizeof ( hello ), 0 ) < 0
+      || ntohl ( hello[0] ) != FRAME_HELLO_MAGIC )
+        return -1;
+
+    connection->frame_opts = wanted & ntohl ( hello[1] );
+
+    if ( connection->frame_opts & FRAME_F_COMPRESSED )
+        Compress_Enable ( connection, connection->compress ? connection->compress->threshold : COMPRESS_THRESHOLD );
+
+    return ( int ) connection->frame_opts;
+}
+
+/*********************************************************************************
+*
+* @fn                   Shutdown_Sock
+*
+* FUNCTION:             shuts down data transfer, partially
+*                       or completely, on an actively connected
+*                       TCP socket
+*
+* NOTE:                 for the "how"
+*                       0 = stops recieving data over socket
+*                       1 = stops sending data over socket
+*                       3 = stops sends and recieves over socket
+*
+* @param connection     The connection information used to create the socket
+* @param how            Specifies what kind of operations on the socket are to
+*                       be shut down
+* @return               The error code returned
+* *******************************************************************************/
+static int Shutdown_Sock (TCP_CONNECTION_INFO *connection, int how )
+{
+    int status;
+
+    status = shutdown( *connection->sock, how );
+
+    return status;
+}
+
+/*********************************************************************************
+*
+* @fn                   Shutdown_Sock
+*
+* FUNCTION:             shuts down data transfer, partially
+*                       or completely, on an actively connected
+*                       TCP socket
+*
+* NOTE:                 for the "how"
+*                       0 = stops recieving data over socket
+*                       1 = stops sending data over socket
+*                       3 = stops sends and recieves over socket
+*
+* @param connection     The connection information used to create the socket
+* @param how            Specifies what kind of operations on the socket are to
+*                       be shut down
+* @param tag            The tag parameter to be used for the nowait operation.
+* @return               The error code returned
+* *******************************************************************************/
+static int Shutdown_Sock_NW (TCP_CONNECTION_INFO *connection, int how, signed long *tag )
+{
+    int status;
+
+    status = shutdown_nw ( *connection->sock
+                         , how
+                         , *tag );
+
+    return status;
+}
+
+/*********************************************************************************
+*
+* @fn                     Close_Sock
+*
+* FUNCTION:               closes the socket/fd. & sets it
+*                         back to NULL
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @return                 The error code returned
+* *******************************************************************************/
+static int Close_Sock (TCP_CONNECTION_INFO *connection )
+{
+    int status;
+
+    if ( !connection->sock || *connection->sock < 0 )
+    {
+        status = 0;
+        return status;
+    }
+
+    /* We use the nonstop call here you can use close(), but sometimes its finickey*/
+    status = Close_Socket_Num ( *connection->sock );
+
+    /* clear the socket number, not the pointer; Clean_Conn_Info still frees it.
+     * 0 is a file number like any other, so a closed socket is -1 */
+    *connection->sock = -1;
+
+    /* whatever is opened on this connection next is a new one to capture */
+    connection->capture_id = 0;
+    connection->nw_send_buffer = 0;
+    connection->nw_recv_buffer = 0;
+
+    return status;
+}
+
+/***************************************************************************************
+*						MANAGED RECONNECT
+***************************************************************************************/
+
+/*******************************************************************
+*
+* @fn                     Breaker_Init
+*
+* FUNCTION:               Sets up a closed circuit breaker
+*
+* @param breaker          The breaker
+* @param policy           The retry and breaker settings
+* @return                 void
+*******************************************************************/
+static void Breaker_Init ( CIRCUIT_BREAKER *breaker, RECONNECT_POLICY *policy )
+{
+    memset ( breaker, 0, sizeof ( CIRCUIT_BREAKER ) );
+
+    breaker->policy = *policy;
+    breaker->state = BREAKER_CLOSED;
+    breaker->seed = ( unsigned long long ) Get_Timestamp ( ) | 1;
+}
+
+/*******************************************************************
+*
+* @fn                     Breaker_Allow
+*
+* FUNCTION:               Whether a connect may be tried now. An open
+*                         breaker refuses until open_us has passed, then
+*                         goes half-open and lets a single trial through;
+*                         other callers are refused until that trial is
+*                         recorded with Breaker_Record.
+*
+* @param breaker          The breaker
+* @return                 SUCCESS if the connect may go ahead
+*******************************************************************/
+static BOOLEAN Breaker_Allow ( CIRCUIT_BREAKER *breaker )
+{
+    if ( breaker->state == BREAKER_OPEN
+      && Get_Timestamp ( ) - breaker->opened_at >= breaker->policy.open_us )
+    {
+        breaker->state = BREAKER_HALF_OPEN;
+        breaker->trial_pending = SUCCESS;
+        return SUCCESS;
+    }
+
+    if ( breaker->state == BREAKER_OPEN
+      || ( breaker->state == BREAKER_HALF_OPEN && breaker->trial_pending ) )
+    {
+        breaker->rejected++;
+        return FAIL;
+    }
+
+    return SUCCESS;
+}
+
+/*******************************************************************
+*
+* @fn                     Breaker_Record
+*
+* FUNCTION:               Records the outcome of a connect. A failed
+*                         half-open trial, or failure_threshold failures
+*                         in a row, opens the breaker; a success closes it
+*                         and, if the endpoint had been failing, calls
+*                         on_restore.
+*
+* @param breaker          The breaker
+* @param connection       The connection that was attempted
+* @param ok               SUCCESS if it connected
+* @return                 void
+*******************************************************************/
+static void Breaker_Record ( CIRCUIT_BREAKER *breaker, TCP_CONNECTION_INFO *connection, BOOLEAN ok )
+{
+    BOOLEAN was_failing;
+
+    breaker->attempts++;
+    breaker->trial_pending = FAIL;
+
+    if ( ok )
+    {
+        was_failing = ( breaker->consecutive_failures > 0 || breaker->state != BREAKER_CLOSED ) ? SUCCESS : FAIL;
+        breaker->state = BREAKER_CLOSED;
+        breaker->consecutive_failures = 0;
+
+        if ( was_failing )
+        {
+            breaker->restores++;
+            if ( breaker->on_restore )
+                breaker->on_restore ( connection, breaker->context );
+        }
+        return;
+    }
+
+    breaker->failures++;
+    breaker->consecutive_failures++;
+
+    if ( breaker->state == BREAKER_HALF_OPEN
+      || ( breaker->policy.failure_threshold > 0
+        && breaker->consecutive_failures >= breaker->policy.failure_threshold ) )
+    {
+        breaker->state = BREAKER_OPEN;
+        breaker->opened_at = Get_Timestamp ( );
+    }
+}
+
+/*******************************************************************
+*
+* @fn                     Reconnect_Delay
+*
+* FUNCTION:               How long to wait before the next attempt,
+*                         given the failures so far
+*
+* @param breaker          The breaker
+* @return                 The wait in microseconds, at least
+*                         RECONNECT_MIN_DELAY_US before jitter
+*******************************************************************/
+static TIMESTAMP Reconnect_Delay ( CIRCUIT_BREAKER *breaker )
+{
+    RECONNECT_POLICY    *policy;
+    double              delay;
+    int                 i;
+
+    policy = &breaker->policy;
+    delay = ( double ) policy->base_us;
+
+    for ( i = 1; i < breaker->consecutive_failures && delay < policy->max_us; i++ )
+        delay *= policy->multiplier;
+
+    if ( delay > policy->max_us )
+        delay = ( double ) policy->max_us;
+    if ( delay < RECONNECT_MIN_DELAY_US )
+        delay = ( double ) RECONNECT_MIN_DELAY_US;
+
+    return ( TIMESTAMP ) ( delay * ( 1.0 - policy->jitter )
+                         + delay * policy->jitter * Next_Random ( &breaker->seed ) );
+}
+
+/*******************************************************************
+*
+* @fn                     Make_Connect_Managed
+*
+* FUNCTION:               Connects to the specified address, creating the
+*                         socket (and sockaddr, if not yet built) itself
+*                         and retrying with jittered exponential backoff
+*                         until it connects, the connection's breaker
+*                         opens or the policy's max_attempts are used up.
+*                         While the breaker is open it fails fast without
+*                         touching the peer.
+*
+* NOTE:                   Blocks across the backoff waits, and each connect
+*                         for up to the connection's connect timeout (if it
+*                         has one). Nowait callers can drive Breaker_Allow /
+*                         Breaker_Record / Reconnect_Delay around
+*                         make_connect_nw instead. Without a breaker this is
+*                         a single attempt.
+*
+* @param connection       The connection information used to create the socket
+* @return                 0 when connected, ERR_CIRCUIT_OPEN when failing
+*                         fast, -1 when the attempts ran out
+*******************************************************************/
+static int Make_Connect_Managed ( TCP_CONNECTION_INFO *connection )
+{
+    CIRCUIT_BREAKER *breaker;
+    TIMEOUT         timeout;
+    int             socket_num;
+    int             attempt;
+    BOOLEAN         ok;
+
+    breaker = connection->breaker;
+    timeout = connection->timeout_opts.connect_to > 0 ? connection->timeout_opts.connect_to : -1;
+
+    if ( !connection->sockaddr )
+    {
+        Set_SockAddr ( connection, AF_INET );
+        connection->sockaddr_len = sizeof ( struct sockaddr_in );
+    }
+
+    for ( attempt = 1; ; attempt++ )
+    {
+        if ( breaker && !Breaker_Allow ( breaker ) )
+            return ERR_CIRCUIT_OPEN;
+
+        /* a socket that failed to connect can't be reused */
+        if ( connection->sock )
+        {
+            Close_Sock ( connection );
+            free ( connection->sock );
+            connection->sock = 0;
+        }
+
+        ok = FAIL;
+        socket_num = Create_Socket ( connection, AF_INET, SOCK_STREAM, 0 );
+        if ( socket_num >= 0 )
+        {
+            *connection->sock = socket_num;
+            ok = Make_Connect_Timed ( connection, timeout ) == 0 ? SUCCESS : FAIL;
+        }
+
+        if ( !breaker )
+            return ok ? 0 : -1;
+
+        Breaker_Record ( breaker, connection, ok );
+        if ( ok )
+            return 0;
+
+        if ( breaker->state == BREAKER_OPEN )
+            break;
+
+        /* without either limit nothing would ever stop the retries */
+        if ( breaker->policy.max_attempts > 0 ? attempt >= breaker->policy.max_attempts
+                                              : breaker->policy.failure_threshold <= 0 )
+            break;
+
+        Sleep_Micros ( Reconnect_Delay ( breaker ) );
+    }
+
+    if ( connection->sock )
+        Close_Sock ( connection );
+
+    return -1;
+}
+
+/*********************************************************************************
+*
+* @fn                     Get_Sock_Name
+*
+* FUNCTION:               Get the address and port
+*                         number to which a socket isbound
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @return                 The error code returned
+* *******************************************************************************/
+static int Get_Sock_Name (TCP_CONNECTION_INFO *connection )
+{
+    int         status;
+    socklen_t   addr_len;
+
+    /* sockaddr_len is a long; getsockname fills a socklen_t, which may be shorter */
+    addr_len = ( socklen_t ) connection->sockaddr_len;
+
+    status = getsockname ( *connection->sock
+                         , ( struct sockaddr * ) connection->sockaddr
+                         , &addr_len );
+
+    connection->sockaddr_len = ( long ) addr_len;
+
+    return status;
+}
+
+/*********************************************************************************
+*
+* @fn                     Get_Sock_Name_NW
+*
+* FUNCTION:               Get the address and port
+*                         number to which a socket isbound
+*
+* NOTE:
+*
+* @param connection       The connection information used to create the socket
+* @param tag              The tag parameter to be used for the nowait operation.
+* @return                 The error code returned
+* *******************************************************************************/
+static int Get_Sock_Name_NW ( TCP_CONNECTION_INFO *connection, signed long *tag )
+{
+    int status;
+
+    status = getsockname_nw ( *connection->sock
+                            , ( struct sockaddr * ) connection->sockaddr
+                            , &connection->sockaddr_len
+                            , *tag );
+
+    return status;
+}
+
+/******************************************************************************************
+*
+* @fn                     Clean_Conn_Info
+*
+* FUNCTION:               Clean up memory allocated for sockaddr structure and socket.
+*                         Will also zero out some other elements, for the next transaction.
+*
+* @param connection       The connection information used to create the socket
+* @return                 void
+******************************************************************************************/
+static void Clean_Conn_Info ( TCP_CONNECTION_INFO *connection )
+{
+    if (connection->sockaddr != 0)
+    {
+        free(connection->sockaddr);
+        connection->sockaddr = 0;
+    }
+    if (connection->sock != 0)
+    {
+        free(connection->sock);
+        connection->sock = 0;
+    }
+    Recv_Buffer_Release ( connection );
+    connection->recv_buf.avg_msg = 0;
+    Compress_Free ( connection );
+    connection->frame_opts = 0;
+    connection->capture_id = 0;
+    connection->nw_send_buffer = 0;
+    connection->nw_recv_buffer = 0;
+
+    /* cleanup all data which is set each time a socket is created */
+    connection->queue_len = '\0';
+    connection->flags = '\0';
+    connection->sockaddr_len = '\0';
+    connection->tag = '\0';
+}
+
+/******************************************************************************************
+*
+* @fn                     Tcp_Set_Options
+*
+* FUNCTION:               Set's the rest of the addition elements for later use in calling
+*                         process
+*
+* @param connection       The connection information used to create the socket
+* @param flags
+* @param queue_length
+* @param sockaddr_len
+* @return                 void
+*****************************************************************************************/
+static void Tcp_Set_Options ( TCP_CONNECTION_INFO *connection, int flags, int queue_length, long sockaddr_len)
+{
+    /* pre-set some additional data for later use in calling process */
+    connection->flags = flags;
+    connection->queue_len = queue_length;
+    connection->sockaddr_len = sockaddr_len;
+}
+
+/***************************************************************************************
+*						CONNECTION REGISTRY AND IDLE REAPER
+*
+*   Connections added to a registry are owned by it. Reap_Idle walks the registry from
+*   where the last call stopped and closes connections that have been idle too long or
+*   whose peer has gone away, a bounded batch at a time. Guardian has no threads, so
+*   call it from the main loop on a timer (SIGNALTIMEOUT) rather than keeping a timer
+*   per connection. Idleness is measured from last_activity, which nowait I/O only
+*   updates on completion, through Complete_NW.
+***************************************************************************************/
+
+/******************************************************************************************
+*
+* @fn                     Registry_Create
+*
+* FUNCTION:               Allocates an empty connection registry
+*
+* @param capacity         The initial number of slots; it grows as needed
+* @return                 The registry, free with Registry_Free
+*****************************************************************************************/
+static CONN_REGISTRY *Registry_Create ( int capacity )
+{
+    CONN_REGISTRY *registry;
+
+    if ( capacity < 1 )
+        capacity = 16;
+
+    registry = ( CONN_REGISTRY * ) malloc ( sizeof ( CONN_REGISTRY ) );
+    memset ( registry, 0, sizeof ( CONN_REGISTRY ) );
+
+    registry->capacity = capacity;
+    registry->conns = ( TCP_CONNECTION_INFO ** ) malloc ( sizeof ( TCP_CONNECTION_INFO * ) * capacity );
+
+    return registry;
+}
+
+/******************************************************************************************
+*
+* @fn                     Registry_Add
+*
+* FUNCTION:               Hands a connection to the registry. It must have been
+*                         malloc'd; the registry frees it when it is reaped.
+*
+* @param registry         The registry
+* @param connection       The connection to track
+* @return                 void
+*****************************************************************************************/
+static void Registry_Add ( CONN_REGISTRY *registry, TCP_CONNECTION_INFO *connection )
+{
+    if ( registry->count == registry->capacity )
+    {
+        registry->capacity *= 2;
+        registry->conns = ( TCP_CONNECTION_INFO ** ) realloc ( registry->conns
+                                                             , sizeof ( TCP_CONNECTION_INFO * ) * registry->capacity );
+    }
+
+    if ( connection->last_activity == 0 )
+        connection->last_activity = Get_Timestamp ( );
+
+    registry->conns[registry->count++] = connection;
+}
+
+/******************************************************************************************
+*
+* @fn                     Registry_Remove
+*
+* FUNCTION:               Stops tracking a connection without closing or freeing it
+*
+* @param registry         The registry
+* @param connection       The connection to forget
+* @return                 void
+*****************************************************************************************/
+static void Registry_Remove ( CONN_REGISTRY *registry, TCP_CONNECTION_INFO *connection )
+{
+    int i;
+
+    for ( i = 0; i < registry->count; i++ )
+    {
+        if ( registry->conns[i] == connection )
+        {
+            registry->conns[i] = registry->conns[--registry->count];
+            return;
+        }
+    }
+}
+
+/******************************************************************************************
+*
+* @fn                     Registry_Free
+*
+* FUNCTION:               Releases the registry itself. Connections still in it are
+*                         left open and are not freed.
+*
+* @param registry         The registry
+* @return                 void
+*****************************************************************************************/
+static void Registry_Free ( CONN_REGISTRY *registry )
+{
+    free ( registry->conns );
+    free ( registry );
+}
+
+/******************************************************************************************
+*
+* @fn                     Set_Keepalive
+*
+* FUNCTION:               Turns on TCP keepalive for a connection, so a peer that
+*                         vanished without a FIN is noticed by the stack and shows up
+*                         as a socket error for Reap_Idle to collect.
+*
+* NOTE:                   The timings are applied where the stack supports setting
+*                         them per socket; elsewhere the stack defaults are used.
+*
+* @param connection       The connection information used to create the socket
+* @param idle_secs        Idle time before the first probe
+* @param interval_secs    Time between probes
+* @param probes           Unanswered probes before the connection is dropped
+* @return                 The error code returned
+*****************************************************************************************/
+static int Set_Keepalive ( TCP_CONNECTION_INFO *connection, int idle_secs, int interval_secs, int probes )
+{
+    return Set_Keepalive_Opts ( *connection->sock, FAIL, idle_secs, interval_secs, probes, 0 );
+}
+
+/******************************************************************************************
+*
+* @fn                     Conn_Is_Dead
+*
+* FUNCTION:               Checks whether the peer has gone: a pending socket error
+*                         (e.g. a keepalive timeout) or, where the stack allows a
+*                         non-blocking peek, an orderly close nobody has read yet.
+*
+* @param connection       The connection to check
+* @return                 SUCCESS when the connection is dead
+*****************************************************************************************/
+static BOOLEAN Conn_Is_Dead ( TCP_CONNECTION_INFO *connection )
+{
+    int     error;
+    int     error_len;
+#ifdef MSG_DONTWAIT
+    char    peek;
+#endif
+
+    error = 0;
+    error_len = sizeof ( error );
+    if ( getsockopt ( *connection->sock, SOL_SOCKET, SO_ERROR, ( char * ) &error, ( void * ) &error_len ) < 0
+      || error != 0 )
+        return SUCCESS;
+
+#ifdef MSG_DONTWAIT
+    if ( recv ( *connection->sock, &peek, 1, MSG_PEEK | MSG_DONTWAIT ) == 0 )
+        return SUCCESS;
+#endif
+
+    return FAIL;
+}
+
+/******************************************************************************************
+*
+* @fn                     Reap_Idle
+*
+* FUNCTION:               Closes, in one bounded batch, connections idle for longer
+*                         than idle_timeout_us and connections whose peer is gone. Each
+*                         goes through Shutdown_Sock, Close_Sock and Clean_Conn_Info, is
+*                         passed to the registry's on_reap callback (if set) so the
+*                         owner can release its own buffers, and is then freed.
+*
+* @param registry         The registry to sweep
+* @param idle_timeout_us  How long a connection may go without traffic; 0 only
+*                         reaps dead connections
+* @param max_batch        The most connections to close in this call
+* @param stats            Receives what this call did; may be 0
+* @return                 The number of connections closed
+*****************************************************************************************/
+static int Reap_Idle ( CONN_REGISTRY *registry, TIMESTAMP idle_timeout_us, int max_batch, REAP_STATS *stats )
+{
+    TCP_CONNECTION_INFO *connection;
+    REAP_STATS          batch;
+    TIMESTAMP           now;
+    int                 scanned;
+    BOOLEAN             idle;
+
+    memset ( &batch, 0, sizeof ( REAP_STATS ) );
+    now = Get_Timestamp ( );
+
+    for ( scanned = 0; scanned < registry->count && batch.idle_closed + batch.dead_closed < max_batch; scanned++ )
+    {
+        if ( registry->cursor >= registry->count )
+            registry->cursor = 0;
+
+        connection = registry->conns[registry->cursor];
+        batch.scanned++;
+
+        idle = ( idle_timeout_us > 0 && now - connection->last_activity > idle_timeout_us ) ? SUCCESS : FAIL;
+        if ( !idle && !Conn_Is_Dead ( connection ) )
+        {
+            registry->cursor++;
+            continue;
+        }
+
+        if ( idle )
+            batch.idle_closed++;
+        else
+            batch.dead_closed++;
+
+        /* the last slot moves into this one, so the cursor stays put */
+        registry->conns[registry->cursor] = registry->conns[--registry->count];
+
+        Shutdown_Sock ( connection, 2 );
+        Close_Sock ( connection );
+        batch.reclaimed_bytes += Recv_Buffer_Release ( connection );
+        Clean_Conn_Info ( connection );
+        batch.reclaimed_bytes += sizeof ( TCP_CONNECTION_INFO ) + sizeof ( int ) + sizeof ( struct sockaddr_in );
+
+        if ( registry->on_reap )
+            batch.reclaimed_bytes += registry->on_reap ( connection );
+
+        free ( connection );
+    }
+
+    registry->totals.scanned += batch.scanned;
+    registry->totals.idle_closed += batch.idle_closed;
+    registry->totals.dead_closed += batch.dead_closed;
+    registry->totals.reclaimed_bytes += batch.reclaimed_bytes;
+
+    if ( stats )
+        *stats = batch;
+
+    return ( int ) ( batch.idle_closed + batch.dead_closed );
+}
+
+/******************************************************************************************
+*
+* @fn                     Registry_Trim_Buffers
+*
+* FUNCTION:               Runs Recv_Buffer_Trim over every connection in the registry,
+*                         so quiet connections hold no receive buffer at all. Cheap
+*                         enough to call on the same timer as Reap_Idle.
+*
+* @param registry         The registry to sweep
+* @param idle_us          How long a buffer may sit unused
+* @return                 The number of bytes given back to the pools
+*****************************************************************************************/
+static long long Registry_Trim_Buffers ( CONN_REGISTRY *registry, TIMESTAMP idle_us )
+{
+    long long   released;
+    int         i;
+
+    for ( i = 0, released = 0; i < registry->count; i++ )
+        released += Recv_Buffer_Trim ( registry->conns[i], idle_us );
+
+    return released;
+}
+
+/***************************************************************************************
+*						ENDPOINT LOAD BALANCER
+*
+*   Spreads connections, or requests, over several backends and several TCP/IP
+*   processes. Callers bracket each request with Balancer_Begin/Balancer_End (or use
+*   Balancer_Connect, which does the Begin for a new connection) so the balancer knows
+*   what is outstanding where and which endpoints keep failing.
+***************************************************************************************/
+
+/******************************************************************************************
+*
+* @fn                     Balancer_Create
+*
+* FUNCTION:               Creates an empty endpoint pool
+*
+* @param policy           BALANCE_LEAST_OUTSTANDING or BALANCE_P2C
+* @param eject_after      Consecutive failures before an endpoint is ejected
+* @param probe_interval_us How often an ejected endpoint is probed
+* @return                 The pool, free with Balancer_Free
+*****************************************************************************************/
+static ENDPOINT_POOL *Balancer_Create ( int policy, int eject_after, TIMESTAMP probe_interval_us )
+{
+    ENDPOINT_POOL *pool;
+
+    pool = ( ENDPOINT_POOL * ) malloc ( sizeof ( ENDPOINT_POOL ) );
+    memset ( pool, 0, sizeof ( ENDPOINT_POOL ) );
+
+    pool->capacity = 8;
+    pool->endpoints = ( ENDPOINT ** ) malloc ( sizeof ( ENDPOINT * ) * pool->capacity );
+    pool->policy = policy;
+    pool->eject_after = eject_after > 0 ? eject_after : 1;
+    pool->probe_interval_us = probe_interval_us;
+    pool->connect_to = BALANCE_CONNECT_TO;
+    pool->seed = ( unsigned long long ) Get_Timestamp ( ) | 1;
+
+    return pool;
+}
+
+/******************************************************************************************
+*
+* @fn                     Balancer_Add_Endpoint
+*
+* FUNCTION:               Adds a backend to the pool
+*
+* NOTE:                   ex. "10.1.1.20", 5000, "$ZB27D"
+*                         Endpoints are allocated one by one, so an ENDPOINT*
+*                         stays valid as more are added.
+*
+* @param pool             The endpoint pool
+* @param ipaddr           The backend address
+* @param port             The backend port
+* @param process_name     The TCP/IP process to reach it through
+* @return                 The endpoint's index in the pool, -1 if out of memory
+*****************************************************************************************/
+static int Balancer_Add_Endpoint ( ENDPOINT_POOL *pool, char *ipaddr, TCP_PORT port, INET_NAME process_name )
+{
+    ENDPOINT *endpoint;
+
+    if ( pool->count == pool->capacity )
+    {
+        pool->capacity *= 2;
+        pool->endpoints = ( ENDPOINT ** ) realloc ( pool->endpoints, sizeof ( ENDPOINT * ) * pool->capacity );
+    }
+
+    endpoint = ( ENDPOINT * ) malloc ( sizeof ( ENDPOINT ) );
+    if ( !endpoint )
+        return -1;
+    memset ( endpoint, 0, sizeof ( ENDPOINT ) );
+    strncpy ( endpoint->ipaddr, ipaddr, sizeof ( SERVER_ADDR ) - 1 );
+    strncpy ( endpoint->process_name, process_name, sizeof ( INET_NAME ) - 1 );
+    endpoint->port = port;
+
+    pool->endpoints[pool->count] = endpoint;
+    return pool->count++;
+}
+
+/******************************************************************************************
+*
+* @fn                     Balancer_Candidate
+*
+* FUNCTION:               Whether an endpoint may be picked
+*
+* @param pool             The endpoint pool
+* @param tried            One flag per endpoint, set for those to leave out; or 0
+* @param i                The endpoint's index
+* @param skip_ejected     SUCCESS to leave out ejected endpoints
+* @return                 SUCCESS if it may be picked
+*****************************************************************************************/
+static BOOLEAN Balancer_Candidate ( ENDPOINT_POOL *pool, char *tried, int i, int skip_ejected )
+{
+    if ( tried && tried[i] )
+        return FAIL;
+
+    return !( skip_ejected && pool->endpoints[i]->ejected );
+}
+
+/******************************************************************************************
+*
+* @fn                     Balancer_Pick_Index
+*
+* FUNCTION:               Chooses an endpoint from those not yet tried. Ejected
+*                         endpoints are passed over; if every candidate is ejected
+*                         they are all considered again, since failing every request
+*                         outright is no better than trying one.
+*
+* @param pool             The endpoint pool
+* @param tried            One flag per endpoint, set for those to leave out; or 0
+* @return                 The endpoint's index, -1 if there is no candidate
+*****************************************************************************************/
+static int Balancer_Pick_Index ( ENDPOINT_POOL *pool, char *tried )
+{
+    int best;
+    int other;
+    int candidates;
+    int skip_ejected;
+    int i;
+
+    for ( skip_ejected = 1, candidates = 0; skip_ejected >= 0 && candidates == 0; skip_ejected-- )
+    {
+        for ( i = 0; i < pool->count; i++ )
+        {
+            if ( Balancer_Candidate ( pool, tried, i, skip_ejected ) )
+                candidates++;
+        }
+    }
+    /* the loop steps once past the pass that found candidates */
+    skip_ejected++;
+
+    if ( candidates == 0 )
+        return -1;
+
+    if ( pool->policy == BALANCE_P2C && candidates > 1 )
+    {
+        best = -1;
+        other = -1;
+        while ( best < 0 || other < 0 || best == other )
+        {
+            i = ( int ) ( Next_Random ( &pool->seed ) * pool->count ) % pool->count;
+            if ( !Balancer_Candidate ( pool, tried, i, skip_ejected ) )
+                continue;
+            if ( best < 0 )
+                best = i;
+            else
+                other = i;
+        }
+
+        return pool->endpoints[other]->outstanding < pool->endpoints[best]->outstanding ? other : best;
+    }
+
+    for ( i = 0, best = -1; i < pool->count; i++ )
+    {
+        if ( !Balancer_Candidate ( pool, tried, i, skip_ejected ) )
+            continue;
+        if ( best < 0 || pool->endpoints[i]->outstanding < pool->endpoints[best]->outstanding )
+            best = i;
+    }
+
+    return best;
+}
+
+/******************************************************************************************
+*
+* @fn                     Balancer_Pick
+*
+* FUNCTION:               Chooses the endpoint for the next connection or request
+*                         (see Balancer_Pick_Index)
+*
+* @param pool             The endpoint pool
+* @return                 The endpoint, 0 if the pool is empty
+*****************************************************************************************/
+static ENDPOINT *Balancer_Pick ( ENDPOINT_POOL *pool )
+{
+    int i;
+
+    i = Balancer_Pick_Index ( pool, 0 );
+
+    return i < 0 ? 0 : pool->endpoints[i];
+}
+
+/******************************************************************************************
+*
+* @fn                     Balancer_Begin
+*
+* FUNCTION:               Notes a request (or connection) going to an endpoint
+*
+* @param endpoint         The endpoint from Balancer_Pick
+* @return                 void
+*****************************************************************************************/
+static void Balancer_Begin ( ENDPOINT *endpoint )
+{
+    endpoint->outstanding++;
+    endpoint->requests++;
+}
+
+/******************************************************************************************
+*
+* @fn                     Balancer_Record
+*
+* FUNCTION:               Records whether an attempt on an endpoint worked, ejecting
+*                         it after too many failures in a row
+*
+* @param pool             The endpoint pool
+* @param endpoint         The endpoint
+* @param ok               SUCCESS if the attempt worked
+* @return                 void
+*****************************************************************************************/
+static void Balancer_Record ( ENDPOINT_POOL *pool, ENDPOINT *endpoint, BOOLEAN ok )
+{
+    if ( ok )
+    {
+        endpoint->consecutive_failures = 0;
+        return;
+    }
+
+    endpoint->failures++;
+    endpoint->consecutive_failures++;
+
+    if ( !endpoint->ejected && endpoint->consecutive_failures >= pool->eject_after )
+    {
+        endpoint->ejected = SUCCESS;
+        endpoint->ejections++;
+        endpoint->next_probe_at = Get_Timestamp ( ) + pool->probe_interval_us;
+    }
+}
+
+/******************************************************************************************
+*
+* @fn                     Balancer_End
+*
+* FUNCTION:               Notes that a request (or connection) begun on an endpoint
+*                         has finished, and whether it worked
+*
+* @param pool             The endpoint pool
+* @param endpoint         The endpoint passed to Balancer_Begin
+* @param ok               SUCCESS if the request worked
+* @return                 void
+*****************************************************************************************/
+static void Balancer_End ( ENDPOINT_POOL *pool, ENDPOINT *endpoint, BOOLEAN ok )
+{
+    if ( endpoint->outstanding > 0 )
+        endpoint->outstanding--;
+
+    Balancer_Record ( pool, endpoint, ok );
+}
+
+/******************************************************************************************
+*
+* @fn                     Balancer_Open
+*
+* FUNCTION:               Opens a waited connection to one endpoint, through that
+*                         endpoint's TCP/IP process
+*
+* NOTE:                   The connection must be clean (see Clean_Conn_Info). The
+*                         connect waits for the connection's connect timeout, or the
+*                         pool's when the connection has none.
+*
+* @param pool             The endpoint pool
+* @param endpoint         The endpoint
+* @param connection       Receives the connection
+* @return                 The error code returned
+*****************************************************************************************/
+static int Balancer_Open ( ENDPOINT_POOL *pool, ENDPOINT *endpoint, TCP_CONNECTION_INFO *connection )
+{
+    TIMEOUT timeout;
+
+    int socket_num;
+
+    strcpy ( connection->ipaddr, endpoint->ipaddr );
+    strcpy ( connection->process_name, endpoint->process_name );
+    connection->port = endpoint->port;
+
+    /* the inet name applies to sockets created from here on */
+    Set_Inet_Name ( endpoint->process_name );
+    Set_SockAddr ( connection, AF_INET );
+    connection->sockaddr_len = sizeof ( struct sockaddr_in );
+
+    /* Create_Socket allocates connection->sock, so store the number afterwards */
+    socket_num = Create_Socket ( connection, AF_INET, SOCK_STREAM, 0 );
+    if ( socket_num < 0 )
+        return -1;
+    *connection->sock = socket_num;
+
+    timeout = connection->timeout_opts.connect_to > 0 ? connection->timeout_opts.connect_to : pool->connect_to;
+    if ( Make_Connect_Timed ( connection, timeout ) < 0 )
+    {
+        Close_Sock ( connection );
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************************
+*
+* @fn                     Balancer_Connect
+*
+* FUNCTION:               Picks an endpoint and connects to it. The connection counts
+*                         as outstanding on the endpoint until Balancer_End is called
+*                         for it. A failed connect counts against the endpoint and
+*                         the next choice among the endpoints not yet tried is made.
+*
+* NOTE:                   The connection must be clean (see Clean_Conn_Info); its
+*                         timeout_opts and tuning are kept.
+*
+* @param pool             The endpoint pool
+* @param connection       Receives the connection
+* @return                 The endpoint connected to, 0 if none could be reached
+*****************************************************************************************/
+static ENDPOINT *Balancer_Connect ( ENDPOINT_POOL *pool, TCP_CONNECTION_INFO *connection )
+{
+    ENDPOINT    *endpoint;
+    char        *tried;
+    int         i;
+
+    if ( pool->count == 0 )
+        return 0;
+
+    tried = ( char * ) calloc ( pool->count, 1 );
+    if ( !tried )
+        return 0;
+
+    endpoint = 0;
+    while ( ( i = Balancer_Pick_Index ( pool, tried ) ) >= 0 )
+    {
+        tried[i] = 1;
+
+        if ( Balancer_Open ( pool, pool->endpoints[i], connection ) == 0 )
+        {
+            endpoint = pool->endpoints[i];
+            Balancer_Record ( pool, endpoint, SUCCESS );
+            Balancer_Begin ( endpoint );
+            break;
+        }
+
+        Balancer_Record ( pool, pool->endpoints[i], FAIL );
+        Clean_Conn_Info ( connection );
+    }
+
+    free ( tried );
+    return endpoint;
+}
+
+/******************************************************************************************
+*
+* @fn                     Balancer_Probe
+*
+* FUNCTION:               Tries a connection to each ejected endpoint whose probe is
+*                         due, reinstating those that answer. Each probe waits at
+*                         most pool->connect_to. Call it periodically, e.g. on the
+*                         same timer as Reap_Idle.
+*
+* @param pool             The endpoint pool
+* @return                 The number of endpoints reinstated
+*****************************************************************************************/
+static int Balancer_Probe ( ENDPOINT_POOL *pool )
+{
+    TCP_CONNECTION_INFO probe;
+    ENDPOINT            *endpoint;
+    TIMESTAMP           now;
+    int                 reinstated;
+    int                 i;
+
+    now = Get_Timestamp ( );
+
+    for ( i = 0, reinstated = 0; i < pool->count; i++ )
+    {
+        endpoint = pool->endpoints[i];
+        if ( !endpoint->ejected || endpoint->next_probe_at > now )
+            continue;
+
+        memset ( &probe, 0, sizeof ( probe ) );
+        if ( Balancer_Open ( pool, endpoint, &probe ) == 0 )
+        {
+            Shutdown_Sock ( &probe, 2 );
+            Close_Sock ( &probe );
+            endpoint->ejected = FAIL;
+            endpoint->consecutive_failures = 0;
+            reinstated++;
+        }
+        else
+            endpoint->next_probe_at = now + pool->probe_interval_us;
+
+        Clean_Conn_Info ( &probe );
+    }
+
+    return reinstated;
+}
+
+/******************************************************************************************
+*
+* @fn                     Balancer_Free
+*
+* FUNCTION:               Releases an endpoint pool
+*
+* @param pool             The endpoint pool
+* @return                 void
+*****************************************************************************************/
+static void Balancer_Free ( ENDPOINT_POOL *pool )
+{
+    int i;
+
+    for ( i = 0; i < pool->count; i++ )
+        free ( pool->endpoints[i] );
+    free ( pool->endpoints );
+    free ( pool );
+}
+
+/***************************************************************************************
+*						ADMISSION CONTROL
+*
+*   A server loop built on Set_Listen/New_Accept stamps each request with Get_Timestamp
+*   when it is received and queued, keeping that stamp with the request, and calls
+*   Admission_Check when it starts to work on it. The connection's last_activity is no
+*   substitute: any later send or receive on the connection moves it. Checks follow
+*   CoDel: a standing queue longer than target for a whole interval puts the controller
+*   into its dropping state, where requests are shed at intervals shrinking with the
+*   square root of the drops so far. While dropping, the loop can also stop accepting
+*   (Admission_Accepting) or turn new connections away (Admission_On_Accept), so
+*   overload is refused at the door instead of queued. If nothing has been checked for
+*   an interval the queue has drained, and dropping ends.
+***************************************************************************************/
+
+/******************************************************************************************
+*
+* @fn                     Admission_Init
+*
+* FUNCTION:               Sets up an admission controller
+*
+* NOTE:                   CoDel's usual values are a 5ms target over a 100ms interval;
+*                         pick a target just above the service's normal queueing delay.
+*
+* @param ctrl             The controller
+* @param target_us        Acceptable standing queueing delay
+* @param interval_us      How long the delay may stay above target before shedding
+* @param actions          SHED_REJECT, SHED_PAUSE_ACCEPT and/or SHED_CLOSE_NEWEST
+* @param reject_msg       The canned response for SHED_REJECT; may be 0
+* @param reject_len       Its length
+* @return                 void
+*****************************************************************************************/
+static void Admission_Init ( ADMISSION_CTRL *ctrl, TIMESTAMP target_us, TIMESTAMP interval_us
+                           , int actions, char *reject_msg, int reject_len )
+{
+    memset ( ctrl, 0, sizeof ( ADMISSION_CTRL ) );
+
+    ctrl->target_us = target_us;
+    ctrl->interval_us = interval_us;
+    ctrl->actions = actions;
+    ctrl->reject_msg = reject_msg;
+    ctrl->reject_len = reject_len;
+}
+
+/******************************************************************************************
+*
+* @fn                     Admission_Next_Drop
+*
+* FUNCTION:               CoDel's control law: the next drop comes interval/sqrt(count)
+*                         after the last one
+*
+* @param ctrl             The controller
+* @param from             The time of the last drop
+* @return                 The time of the next drop
+*****************************************************************************************/
+static TIMESTAMP Admission_Next_Drop ( ADMISSION_CTRL *ctrl, TIMESTAMP from )
+{
+    return from + ( TIMESTAMP ) ( ctrl->interval_us / sqrt ( ( double ) ctrl->drop_count ) );
+}
+
+/******************************************************************************************
+*
+* @fn                     Admission_Check
+*
+* FUNCTION:               Decides whether to serve a request that arrived at arrival_ts
+*                         or shed it. A shed request should be answered with
+*                         Admission_Reject (or just dropped) without doing its work.
+*
+* @param ctrl             The controller
+* @param arrival_ts       When the request was received and queued (Get_Timestamp
+*                         clock), stamped once and kept with the request
+* @return                 SUCCESS to serve it, FAIL to shed it
+*****************************************************************************************/
+static BOOLEAN Admission_Check ( ADMISSION_CTRL *ctrl, TIMESTAMP arrival_ts )
+{
+    TIMESTAMP   now;
+    TIMESTAMP   delay;
+    BOOLEAN     above;
+    BOOLEAN     shed;
+
+    now = Get_Timestamp ( );
+    ctrl->last_check = now;
+    delay = now - arrival_ts;
+    ctrl->stats.last_delay_us = delay;
+    if ( delay > ctrl->stats.max_delay_us )
+        ctrl->stats.max_delay_us = delay;
+
+    /* has the delay been above target for a whole interval? */
+    above = FAIL;
+    if ( delay < ctrl->target_us )
+        ctrl->first_above_time = 0;
+    else if ( ctrl->first_above_time == 0 )
+        ctrl->first_above_time = now + ctrl->interval_us;
+    else if ( now >= ctrl->first_above_time )
+        above = SUCCESS;
+
+    shed = FAIL;
+    if ( ctrl->stats.dropping )
+    {
+        if ( !above )
+            ctrl->stats.dropping = FAIL;
+        else if ( now >= ctrl->drop_next )
+        {
+            shed = SUCCESS;
+            ctrl->drop_count++;
+            ctrl->drop_next = Admission_Next_Drop ( ctrl, ctrl->drop_next );
+        }
+    }
+    else if ( above )
+    {
+        shed = SUCCESS;
+        ctrl->stats.dropping = SUCCESS;
+        ctrl->stats.dropping_entered++;
+
+        /* back into dropping soon after leaving it: carry on near the old rate */
+        if ( ctrl->drop_count > 2 && now - ctrl->drop_next < 8 * ctrl->interval_us )
+            ctrl->drop_count -= 2;
+        else
+            ctrl->drop_count = 1;
+        ctrl->drop_next = Admission_Next_Drop ( ctrl, now );
+    }
+
+    if ( shed )
+        ctrl->stats.shed++;
+    else
+        ctrl->stats.admitted++;
+
+    return shed ? FAIL : SUCCESS;
+}
+
+/******************************************************************************************
+*
+* @fn                     Admission_Idle_Exit
+*
+* FUNCTION:               Leaves the dropping state when no request has been checked
+*                         for a whole interval: with nothing reaching Admission_Check
+*                         there is no queue left to shed, and a loop that has stopped
+*                         accepting would otherwise never accept again.
+*
+* @param ctrl             The controller
+* @return                 void
+*****************************************************************************************/
+static void Admission_Idle_Exit ( ADMISSION_CTRL *ctrl )
+{
+    if ( ctrl->stats.dropping && Get_Timestamp ( ) - ctrl->last_check >= ctrl->interval_us )
+    {
+        ctrl->stats.dropping = FAIL;
+        ctrl->first_above_time = 0;
+    }
+}
+
+/******************************************************************************************
+*
+* @fn                     Admission_Accepting
+*
+* FUNCTION:               Whether the server loop should accept new connections now.
+*                         With SHED_PAUSE_ACCEPT, accepting stops while shedding and
+*                         new clients wait in the listen queue (or are refused by the
+*                         stack once it is full).
+*
+* @param ctrl             The controller
+* @return                 SUCCESS to accept
+*****************************************************************************************/
+static BOOLEAN Admission_Accepting ( ADMISSION_CTRL *ctrl )
+{
+    Admission_Idle_Exit ( ctrl );
+
+    if ( ( ctrl->actions & SHED_PAUSE_ACCEPT ) && ctrl->stats.dropping )
+    {
+        ctrl->stats.accepts_paused++;
+        return FAIL;
+    }
+
+    return SUCCESS;
+}
+
+/******************************************************************************************
+*
+* @fn                     Admission_Reject
+*
+* FUNCTION:               Answers a shed request with the canned response, if the
+*                         controller has SHED_REJECT and a response to send
+*
+* @param ctrl             The controller
+* @param connection       The connection the shed request came in on
+* @return                 The status of the send, 0 if nothing was sent
+*****************************************************************************************/
+static int Admission_Reject ( ADMISSION_CTRL *ctrl, TCP_CONNECTION_INFO *connection )
+{
+    if ( !( ctrl->actions & SHED_REJECT ) || !ctrl->reject_msg )
+        return 0;
+
+    ctrl->stats.rejected++;
+
+    return New_Send ( connection, ctrl->reject_msg, ctrl->reject_len );
+}
+
+/******************************************************************************************
+*
+* @fn                     Admission_On_Accept
+*
+* FUNCTION:               Screens a connection that has just been accepted. With
+*                         SHED_CLOSE_NEWEST, while shedding, it is closed straight away
+*                         (after the canned response, if SHED_REJECT is also set) and
+*                         its connection information cleaned.
+*
+* @param ctrl             The controller
+* @param connection       The newly accepted connection
+* @return                 SUCCESS to keep the connection, FAIL if it was closed
+*****************************************************************************************/
+static BOOLEAN Admission_On_Accept ( ADMISSION_CTRL *ctrl, TCP_CONNECTION_INFO *connection )
+{
+    Admission_Idle_Exit ( ctrl );
+
+    if ( !( ctrl->actions & SHED_CLOSE_NEWEST ) || !ctrl->stats.dropping )
+        return SUCCESS;
+
+    Admission_Reject ( ctrl, connection );
+
+    Shutdown_Sock ( connection, 2 );
+    Close_Sock ( connection );
+    Clean_Conn_Info ( connection );
+    ctrl->stats.closed++;
+
+    return FAIL;
+}
+
+/***************************************************************************************
+*						HOT RESTART
+*
+*   A restart without closing the listening sockets. The old process calls
+*   Handoff_Serve, which waits on a Unix socket for its replacement. The new process
+*   calls Handoff_Receive and is sent every listener (and any established connections
+*   the old process chooses to give up) with SCM_RIGHTS, each with its connection
+*   information. The accept queue belongs to the socket, not the process, so nothing
+*   queued is lost. Only once the new process has acknowledged does the old one close
+*   its copies; until then a failed handoff leaves it serving as before. It then
+*   finishes the requests it still has, calling Handoff_Drain from its loop, and exits.
+*
+*   Guardian has no descriptor passing; there both ends return ERR_HANDOFF and the
+*   usual answer is a process pair taking over the listener instead.
+***************************************************************************************/
+
+/******************************************************************************************
+*
+* @fn                     Handoff_Close_All
+*
+* FUNCTION:               Closes, cleans and frees every connection in a registry, as
+*                         Reap_Idle would, leaving it empty
+*
+* @param registry         The connections
+* @return                 void
+*****************************************************************************************/
+static void Handoff_Close_All ( CONN_REGISTRY *registry )
+{
+    TCP_CONNECTION_INFO *connection;
+
+    while ( registry->count > 0 )
+    {
+        connection = registry->conns[--registry->count];
+        Close_Sock ( connection );
+        Clean_Conn_Info ( connection );
+        if ( registry->on_reap )
+            registry->on_reap ( connection );
+        free ( connection );
+    }
+}
+
+#ifdef SCM_RIGHTS
+
+/* a new process that gives up part way must not take the old one with it */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/******************************************************************************************
+*
+* @fn                     Handoff_Send_One
+*
+* FUNCTION:               Sends one handoff record, with a descriptor attached if
+*                         there is one
+*
+* @param channel          The Unix socket to the new process
+* @param record           The record
+* @param socket_num       The descriptor to pass, -1 for none
+* @return                 0 on success, -1 on error
+*****************************************************************************************/
+static int Handoff_Send_One ( int channel, HANDOFF_RECORD *record, int socket_num )
+{
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr  *cmsg;
+    union
+    {
+        struct cmsghdr  align;
+        char            space[CMSG_SPACE ( sizeof ( int ) )];
+    } control;
+    int             sent;
+    int             total;
+
+    memset ( &msg, 0, sizeof ( msg ) );
+    iov.iov_base = ( char * ) record;
+    iov.iov_len = sizeof ( HANDOFF_RECORD );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if ( socket_num >= 0 )
+    {
+        memset ( &control, 0, sizeof ( control ) );
+        msg.msg_control = control.space;
+        msg.msg_controllen = sizeof ( control.space );
+        cmsg = CMSG_FIRSTHDR ( &msg );
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN ( sizeof ( int ) );
+        memcpy ( CMSG_DATA ( cmsg ), &socket_num, sizeof ( int ) );
+    }
+
+    /* the descriptor rides on the first byte; the rest may need more sends */
+    do
+    {
+        sent = sendmsg ( channel, &msg, MSG_NOSIGNAL );
+    } while ( sent < 0 && errno == EINTR );
+    if ( sent <= 0 )
+        return -1;
+
+    for ( total = sent; total < ( int ) sizeof ( HANDOFF_RECORD ); total += sent )
+    {
+        sent = send ( channel, ( char * ) record + total, sizeof ( HANDOFF_RECORD ) - total, MSG_NOSIGNAL );
+        if ( sent < 0 && errno == EINTR )
+            sent = 0;
+        else if ( sent <= 0 )
+            return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************************
+*
+* @fn                     Handoff_Recv_One
+*
+* FUNCTION:               Receives one handoff record and the descriptor with it
+*
+* @param channel          The Unix socket to the old process
+* @param record           Receives the record
+* @param socket_num       Receives the descriptor, -1 if none came
+* @return                 0 on success, -1 on error or if the old process went away
+*****************************************************************************************/
+static int Handoff_Recv_One ( int channel, HANDOFF_RECORD *record, int *socket_num )
+{
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr  *cmsg;
+    union
+    {
+        struct cmsghdr  align;
+        char            space[CMSG_SPACE ( sizeof ( int ) )];
+    } control;
+    int             received;
+    int             total;
+
+    *socket_num = -1;
+
+    memset ( &msg, 0, sizeof ( msg ) );
+    iov.iov_base = ( char * ) record;
+    iov.iov_len = sizeof ( HANDOFF_RECORD );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof ( control.space );
+
+    do
+    {
+        received = recvmsg ( channel, &msg, 0 );
+    } while ( received < 0 && errno == EINTR );
+    if ( received <= 0 )
+        return -1;
+
+    for ( cmsg = CMSG_FIRSTHDR ( &msg ); cmsg; cmsg = CMSG_NXTHDR ( &msg, cmsg ) )
+    {
+        if ( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS )
+            memcpy ( socket_num, CMSG_DATA ( cmsg ), sizeof ( int ) );
+    }
+
+    for ( total = received; total < ( int ) sizeof ( HANDOFF_RECORD ); total += received )
+    {
+        received = recv ( channel, ( char * ) record + total, sizeof ( HANDOFF_RECORD ) - total, 0 );
+        if ( received < 0 && errno == EINTR )
+            received = 0;
+        else if ( received <= 0 )
+            break;
+    }
+
+    if ( total < ( int ) sizeof ( HANDOFF_RECORD ) || record->magic != HANDOFF_MAGIC || ( msg.msg_flags & MSG_CTRUNC ) )
+    {
+        if ( *socket_num >= 0 )
+            close ( *socket_num );
+        *socket_num = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************************
+*
+* @fn                     Handoff_Pack
+*
+* FUNCTION:               Fills in the handoff record for a connection
+*
+* @param connection       The connection being handed off
+* @param kind             HANDOFF_LISTENER or HANDOFF_ESTABLISHED
+* @param record           Receives the record
+* @return                 void
+*****************************************************************************************/
+static void Handoff_Pack ( TCP_CONNECTION_INFO *connection, int kind, HANDOFF_RECORD *record )
+{
+    memset ( record, 0, sizeof ( HANDOFF_RECORD ) );
+
+    record->magic = HANDOFF_MAGIC;
+    record->kind = kind;
+    memcpy ( record->ipaddr, connection->ipaddr, sizeof ( SERVER_ADDR ) );
+    record->port = connection->port;
+    memcpy ( record->process_name, connection->process_name, sizeof ( INET_NAME ) );
+    record->sockaddr_len = connection->sockaddr_len;
+    record->flags = connection->flags;
+    record->queue_len = connection->queue_len;
+    record->sock_shutdown_how = connection->sock_shutdown_how;
+    record->timeout_opts = connection->timeout_opts;
+    record->spin_opts = connection->spin_opts;
+    record->frame_opts = connection->frame_opts;
+
+    if ( connection->tuning )
+        memcpy ( record->tuning, connection->tuning->name, TUNING_NAME_LEN - 1 );
+    if ( connection->compress )
+        record->compress_threshold = connection->compress->threshold;
+    if ( connection->sockaddr )
+    {
+        record->has_sockaddr = SUCCESS;
+        record->sockaddr = *connection->sockaddr;
+    }
+}
+
+/******************************************************************************************
+*
+* @fn                     Handoff_Unpack
+*
+* FUNCTION:               Builds a connection from a handoff record and the descriptor
+*                         that came with it
+*
+* @param record           The record
+* @param socket_num       The descriptor
+* @return                 The connection, malloc'd; 0 if the tuning profile is unknown
+*                         here
+*****************************************************************************************/
+static TCP_CONNECTION_INFO *Handoff_Unpack ( HANDOFF_RECORD *record, int socket_num )
+{
+    TCP_CONNECTION_INFO *connection;
+
+    connection = ( TCP_CONNECTION_INFO * ) malloc ( sizeof ( TCP_CONNECTION_INFO ) );
+    memset ( connection, 0, sizeof ( TCP_CONNECTION_INFO ) );
+
+    if ( record->tuning[0] )
+    {
+        record->tuning[TUNING_NAME_LEN - 1] = '\0';
+        connection->tuning = Find_Tuning_Profile ( record->tuning );
+        if ( !connection->tuning )
+        {
+            free ( connection );
+            return 0;
+        }
+    }
+
+    memcpy ( connection->ipaddr, record->ipaddr, sizeof ( SERVER_ADDR ) );
+    connection->port = record->port;
+    memcpy ( connection->process_name, record->process_name, sizeof ( INET_NAME ) );
+    connection->sockaddr_len = record->sockaddr_len;
+    connection->flags = record->flags;
+    connection->queue_len = record->queue_len;
+    connection->sock_shutdown_how = record->sock_shutdown_how;
+    connection->timeout_opts = record->timeout_opts;
+    connection->spin_opts = record->spin_opts;
+    connection->frame_opts = record->frame_opts;
+
+    connection->sock = ( int * ) malloc ( sizeof ( int ) );
+    *connection->sock = socket_num;
+
+    if ( record->has_sockaddr )
+    {
+        connection->sockaddr = ( struct sockaddr_in * ) malloc ( sizeof ( struct sockaddr_in ) );
+        *connection->sockaddr = record->sockaddr;
+    }
+    if ( record->compress_threshold > 0 )
+        Compress_Enable ( connection, record->compress_threshold );
+
+    return connection;
+}
+
+/******************************************************************************************
+*
+* @fn                     Handoff_Peer_Trusted
+*
+* FUNCTION:               Whether the process at the other end of the handoff socket
+*                         runs as the same user as this one. Sockets are only ever
+*                         handed to, or taken from, the same service.
+*
+* NOTE:                   Where the stack can't say who the peer is, the socket file's
+*                         permissions (owner only) are what keep others out.
+*
+* @param channel          The Unix socket to the other process
+* @return                 SUCCESS if the peer may take part
+*****************************************************************************************/
+static BOOLEAN Handoff_Peer_Trusted ( int channel )
+{
+#ifdef SO_PEERCRED
+    struct ucred    peer;
+    socklen_t       peer_len;
+
+    peer_len = sizeof ( peer );
+    if ( getsockopt ( channel, SOL_SOCKET, SO_PEERCRED, ( char * ) &peer, &peer_len ) < 0 )
+        return FAIL;
+
+    return peer.uid == geteuid ( ) ? SUCCESS : FAIL;
+#else
+    return SUCCESS;
+#endif
+}
+
+/******************************************************************************************
+*
+* @fn                     Handoff_Set_Timeout
+*
+* FUNCTION:               Bounds every send and receive on the handoff socket, so a
+*                         peer that stops part way can't hang the other process
+*
+* @param channel          The Unix socket to the other process
+* @param wait_us          The longest any one send or receive may take
+* @return                 0 on success, -1 on error
+*****************************************************************************************/
+static int Handoff_Set_Timeout ( int channel, TIMESTAMP wait_us )
+{
+    struct timeval wait;
+
+    wait.tv_sec = ( long ) ( wait_us / 1000000 );
+    wait.tv_usec = ( long ) ( wait_us % 1000000 );
+
+    if ( setsockopt ( channel, SOL_SOCKET, SO_RCVTIMEO, ( char * ) &wait, sizeof ( wait ) ) < 0
+      || setsockopt ( channel, SOL_SOCKET, SO_SNDTIMEO, ( char * ) &wait, sizeof ( wait ) ) < 0 )
+        return -1;
+
+    return 0;
+}
+
+/******************************************************************************************
+*
+* @fn                     Handoff_Serve
+*
+* FUNCTION:               Old process side of a hot restart. Waits for the new process
+*                         on the Unix socket at "path", sends it the listeners and the
+*                         connections in "established", and once it has acknowledged
+*                         them closes its own copies: listeners with Close_Sock (the
+*                         caller still owns the records), established connections
+*                         closed, cleaned and freed as Reap_Idle would.
+*
+* NOTE:                   Connections still mid-request should be left out of
+*                         "established" and finished here, see Handoff_Drain. A handoff
+*                         that fails part way leaves everything open and owned here.
+*                         The socket is created owner-only, and a new process running
+*                         as another user is turned away; put "path" in a directory
+*                         only the service's user can write to (mode 0700), so nobody
+*                         else can put their own socket there first.
+*
+* @param path             The Unix socket path both processes agree on
+* @param listeners        The listening connections
+* @param listener_count   How many
+* @param established      Connections to give to the new process; may be 0
+* @param wait_us          How long to wait for the new process to connect, and
+*                         then for each step of the exchange
+* @return                 The number of sockets handed over, ERR_HANDOFF on failure
+*****************************************************************************************/
+static int Handoff_Serve ( char *path, TCP_CONNECTION_INFO **listeners, int listener_count, CONN_REGISTRY *established, TIMESTAMP wait_us )
+{
+    struct sockaddr_un  address;
+    struct pollfd       ready;
+    HANDOFF_RECORD      record;
+    TIMESTAMP           wait_ms;
+    mode_t              mask;
+    int                 server;
+    int                 channel;
+    int                 handed;
+    int                 status;
+    int                 i;
+    char                ack;
+
+    if ( strlen ( path ) >= sizeof ( address.sun_path ) )
+        return ERR_HANDOFF;
+
+    memset ( &address, 0, sizeof ( address ) );
+    address.sun_family = AF_UNIX;
+    strcpy ( address.sun_path, path );
+
+    unlink ( path );
+    server = socket ( AF_UNIX, SOCK_STREAM, 0 );
+    if ( server < 0 )
+        return ERR_HANDOFF;
+
+    /* owner only from the moment it exists, not just after the chmod */
+    mask = umask ( 0077 );
+    status = bind ( server, ( struct sockaddr * ) &address, sizeof ( address ) );
+    umask ( mask );
+    if ( status < 0 || chmod ( path, 0600 ) < 0 || listen ( server, 1 ) < 0 )
+    {
+        close ( server );
+        unlink ( path );
+        return ERR_HANDOFF;
+    }
+
+    /* poll, not select: a server handing off thousands of connections has
+     * descriptors numbered past FD_SETSIZE */
+    ready.fd = server;
+    ready.events = POLLIN;
+    ready.revents = 0;
+    wait_ms = ( wait_us + 999 ) / 1000;
+    if ( wait_ms > 0x7fffffff )
+        wait_ms = 0x7fffffff;
+
+    channel = -1;
+    if ( poll ( &ready, 1, ( int ) wait_ms ) > 0 )
+        channel = accept ( server, 0, 0 );
+
+    close ( server );
+    unlink ( path );
+    if ( channel < 0 )
+        return ERR_HANDOFF;
+    if ( !Handoff_Peer_Trusted ( channel ) || Handoff_Set_Timeout ( channel, wait_us ) < 0 )
+    {
+        close ( channel );
+        return ERR_HANDOFF;
+    }
+
+    handed = 0;
+    for ( i = 0; i < listener_count; i++ )
+    {
+        Handoff_Pack ( listeners[i], HANDOFF_LISTENER, &record );
+        if ( Handoff_Send_One ( channel, &record, *listeners[i]->sock ) < 0 )
+            break;
+        handed++;
+    }
+    for ( i = 0; established && handed == listener_count + i && i < established->count; i++ )
+    {
+        Handoff_Pack ( established->conns[i], HANDOFF_ESTABLISHED, &record );
+        if ( Handoff_Send_One ( channel, &record, *established->conns[i]->sock ) < 0 )
+            break;
+        handed++;
+    }
+
+    memset ( &record, 0, sizeof ( HANDOFF_RECORD ) );
+    record.magic = HANDOFF_MAGIC;
+    record.kind = HANDOFF_END;
+
+    /* the new process holds its copies now; ours only go once it says so */
+    if ( handed != listener_count + ( established ? established->count : 0 )
+      || Handoff_Send_One ( channel, &record, -1 ) < 0
+      || recv ( channel, &ack, 1, 0 ) != 1 )
+    {
+        close ( channel );
+        return ERR_HANDOFF;
+    }
+    close ( channel );
+
+    for ( i = 0; i < listener_count; i++ )
+        Close_Sock ( listeners[i] );
+
+    if ( established )
+        Handoff_Close_All ( established );
+
+    return handed;
+}
+
+/******************************************************************************************
+*
+* @fn                     Handoff_Receive
+*
+* FUNCTION:               New process side of a hot restart. Connects to the old process
+*                         at "path" and takes over its sockets: listeners are returned
+*                         in "listeners", ready for New_Accept, and established
+*                         connections are added to "established".
+*
+* NOTE:                   Tuning profiles are matched by name, so load the same
+*                         profiles (Load_Tuning_Profiles) before calling this. If
+*                         anything doesn't fit, nothing is acknowledged and the old
+*                         process carries on; start cold in that case. Sockets are
+*                         only taken from a process running as the same user, and
+*                         each step waits at most HANDOFF_STEP_US.
+*
+* @param path             The Unix socket path both processes agree on
+* @param listeners        Receives the listening connections, malloc'd
+* @param max_listeners    The room in listeners
+* @param established      Receives established connections; may be 0 if none are
+*                         expected
+* @return                 The number of listeners, ERR_HANDOFF on failure
+*****************************************************************************************/
+static int Handoff_Receive ( char *path, TCP_CONNECTION_INFO **listeners, int max_listeners, CONN_REGISTRY *established )
+{
+    struct sockaddr_un  address;
+    HANDOFF_RECORD      record;
+    TCP_CONNECTION_INFO **taken;
+    TCP_CONNECTION_INFO *connection;
+    int                 channel;
+    int                 socket_num;
+    int                 taken_count;
+    int                 taken_size;
+    int                 listener_count;
+    int                 status;
+    int                 i;
+    char                ack;
+
+    if ( strlen ( path ) >= sizeof ( address.sun_path ) )
+        return ERR_HANDOFF;
+
+    memset ( &address, 0, sizeof ( address ) );
+    address.sun_family = AF_UNIX;
+    strcpy ( address.sun_path, path );
+
+    channel = socket ( AF_UNIX, SOCK_STREAM, 0 );
+    if ( channel < 0 )
+        return ERR_HANDOFF;
+    if ( connect ( channel, ( struct sockaddr * ) &address, sizeof ( address ) ) < 0
+      || !Handoff_Peer_Trusted ( channel )
+      || Handoff_Set_Timeout ( channel, HANDOFF_STEP_US ) < 0 )
+    {
+        close ( channel );
+        return ERR_HANDOFF;
+    }
+
+    taken_count = 0;
+    taken_size = 16;
+    taken = ( TCP_CONNECTION_INFO ** ) malloc ( sizeof ( TCP_CONNECTION_INFO * ) * taken_size );
+    listener_count = 0;
+    status = ERR_HANDOFF;
+
+    while ( Handoff_Recv_One ( channel, &record, &socket_num ) == 0 )
+    {
+        if ( record.kind == HANDOFF_END )
+        {
+            status = 0;
+            break;
+        }
+
+        /* a kind this build doesn't know is a mismatched peer: take nothing from it */
+        connection = 0;
+        if ( socket_num >= 0
+          && ( ( record.kind == HANDOFF_ESTABLISHED && established != 0 )
+            || ( record.kind == HANDOFF_LISTENER && listener_count < max_listeners ) ) )
+            connection = Handoff_Unpack ( &record, socket_num );
+        if ( !connection )
+        {
+            if ( socket_num >= 0 )
+                close ( socket_num );
+            break;
+        }
+
+        if ( record.kind == HANDOFF_LISTENER )
+        {
+            listeners[listener_count++] = connection;
+            continue;
+        }
+
+        if ( taken_count == taken_size )
+        {
+            taken_size *= 2;
+            taken = ( TCP_CONNECTION_INFO ** ) realloc ( taken, sizeof ( TCP_CONNECTION_INFO * ) * taken_size );
+        }
+        taken[taken_count++] = connection;
+    }
+
+    ack = 1;
+    if ( status == 0 && send ( channel, &ack, 1, MSG_NOSIGNAL ) != 1 )
+        status = ERR_HANDOFF;
+    close ( channel );
+
+    /* not acknowledged: the old process keeps everything, so drop our copies */
+    if ( status != 0 )
+    {
+        for ( i = 0; i < listener_count + taken_count; i++ )
+        {
+            connection = i < listener_count ? listeners[i] : taken[i - listener_count];
+            Close_Sock ( connection );
+            Clean_Conn_Info ( connection );
+            free ( connection );
+        }
+        free ( taken );
+        return ERR_HANDOFF;
+    }
+
+    for ( i = 0; i < taken_count; i++ )
+        Registry_Add ( established, taken[i] );
+
+    free ( taken );
+    return listener_count;
+}
+
+#else
+
+static int Handoff_Serve ( char *path, TCP_CONNECTION_INFO **listeners, int listener_count, CONN_REGISTRY *established, TIMESTAMP wait_us )
+{
+    return ERR_HANDOFF;
+}
+
+static int Handoff_Receive ( char *path, TCP_CONNECTION_INFO **listeners, int max_listeners, CONN_REGISTRY *established )
+{
+    return ERR_HANDOFF;
+}
+
+#endif
+
+/******************************************************************************************
+*
+* @fn                     Handoff_Drain
+*
+* FUNCTION:               Run from the old process's loop after Handoff_Serve, while it
+*                         finishes the requests it kept. Connections that have been
+*                         quiet for "quiet_us" have finished and are closed; once
+*                         "deadline" passes, every one left is closed, busy or not.
+*
+* @param registry         The connections the old process kept
+* @param quiet_us         How long a connection must be idle to count as done
+* @param deadline         When to stop waiting (a Get_Timestamp value)
+* @return                 The number of connections still open; exit at 0
+*****************************************************************************************/
+static int Handoff_Drain ( CONN_REGISTRY *registry, TIMESTAMP quiet_us, TIMESTAMP deadline )
+{
+    if ( Get_Timestamp ( ) >= deadline )
+        Handoff_Close_All ( registry );
+    else
+        Reap_Idle ( registry, quiet_us, registry->count, 0 );
+
+    return registry->count;
+}
+
+/***************************************************************************************
+*						THREAD-PER-CORE RUNTIME
+*
+*   Shared-nothing: each core is a thread pinned to one CPU, running its own poll loop
+*   over its own listener and connections. With SO_REUSEPORT every core listens on the
+*   same port and the stack spreads new connections across them; a connection then
+*   stays on the core that accepted it. A core's registry, receive pool and accept
+*   batch are allocated by its own thread after it is pinned, so on a NUMA machine
+*   they come from that CPU's node. Cores only talk through bounded queues, one per
+*   pair, and wake each other through a pipe.
+*
+*   The process-wide pieces (traffic capture, tuning profiles, the default receive
+*   pool) are locked, so the cores may use them, but each core's connections draw on
+*   the core's own pool. Without SO_REUSEPORT only the first core listens, and deals
+*   the connections it accepts out to the cores in turn. Guardian has no threads; there
+*   Runtime_Start returns 0 and the Guardian model, one process per CPU, is the
+*   equivalent.
+***************************************************************************************/
+#ifndef __TANDEM
+
+/******************************************************************************************
+*
+* @fn                     Runtime_Close
+*
+* FUNCTION:               Closes one of a core's connections. Must be called on that
+*                         core. The connection is freed once the current pass of the
+*                         core's loop is over, so a callback may close a connection
+*                         the loop has yet to get to; its socket then reads as -1.
+*
+* @param core             The core that owns the connection
+* @param connection       The connection
+* @return                 void
+*****************************************************************************************/
+static void Runtime_Close ( CORE *core, TCP_CONNECTION_INFO *connection )
+{
+    /* already closed this pass, and waiting to be freed */
+    if ( *connection->sock < 0 )
+        return;
+
+    Registry_Remove ( core->registry, connection );
+    Shutdown_Sock ( connection, 2 );
+    Close_Sock ( connection );
+    Registry_Add ( core->closing, connection );
+    core->stats.closed++;
+}
+
+/******************************************************************************************
+*
+* @fn                     Runtime_Reclaim
+*
+* FUNCTION:               Frees the connections closed during the last pass of a
+*                         core's loop
+*
+* @param core             The core
+* @return                 void
+*****************************************************************************************/
+static void Runtime_Reclaim ( CORE *core )
+{
+    TCP_CONNECTION_INFO *connection;
+
+    while ( core->closing->count > 0 )
+    {
+        connection = core->closing->conns[--core->closing->count];
+        Clean_Conn_Info ( connection );
+        free ( connection );
+    }
+}
+
+/******************************************************************************************
+*
+* @fn                     Runtime_Adopt
+*
+* FUNCTION:               Makes an accepted connection one of a core's own
+*
+* @param core             The core
+* @param connection       The connection, malloc'd
+* @return                 void
+*****************************************************************************************/
+static void Runtime_Adopt ( CORE *core, TCP_CONNECTION_INFO *connection )
+{
+    connection->recv_pool = core->recv_pool;
+    connection->last_activity = 0;
+    Registry_Add ( core->registry, connection );
+    core->stats.accepted++;
+
+    if ( core->runtime->opts.on_accept )
+        core->runtime->opts.on_accept ( core, connection );
+}
+
+/******************************************************************************************
+*
+* @fn                     Runtime_Post
+*
+* FUNCTION:               Queues a message for another core and wakes it. Only a core
+*                         may post, from its own thread.
+*
+* @param from             The sending core
+* @param to               The index of the receiving core
+* @param type             The message type, for the application
+* @param data             The payload; the receiver owns it once this succeeds
+* @return                 SUCCESS, or FAIL if the receiver's queue is full
+*****************************************************************************************/
+static BOOLEAN Runtime_Post ( CORE *from, int to, int type, void *data )
+{
+    CORE        *target;
+    CORE_RING   *ring;
+    uint32_t    tail;
+    char        wake;
+
+    target = &from->runtime->cores[to];
+    ring = &target->inbox[from->index];
+
+    tail = ring->tail;
+    if ( tail - __atomic_load_n ( &ring->head, __ATOMIC_ACQUIRE ) > ring->mask )
+    {
+        from->stats.queue_full++;
+        return FAIL;
+    }
+
+    ring->slots[tail & ring->mask].from = from->index;
+    ring->slots[tail & ring->mask].type = type;
+    ring->slots[tail & ring->mask].data = data;
+    __atomic_store_n ( &ring->tail, tail + 1, __ATOMIC_RELEASE );
+    from->stats.msgs_out++;
+
+    /* the pipe may already be full of wake-ups, which is just as good */
+    wake = 1;
+    if ( write ( target->wake[1], &wake, 1 ) < 0 )
+    {
+        /* nothing to do; a pending wake-up already covers this message */
+    }
+
+    return SUCCESS;
+}
+
+/******************************************************************************************
+*
+* @fn                     Runtime_Drain_Inbox
+*
+* FUNCTION:               Hands every queued message to on_message
+*
+* @param core             The core
+* @return                 void
+*****************************************************************************************/
+static void Runtime_Drain_Inbox ( CORE *core )
+{
+    CORE_RING   *ring;
+    CORE_MSG    msg;
+    uint32_t    head;
+    char        wake[64];
+    int         i;
+
+    while ( read ( core->wake[0], wake, sizeof ( wake ) ) > 0 )
+        ;
+
+    for ( i = 0; i < core->runtime->count; i++ )
+    {
+        ring = &core->inbox[i];
+        head = ring->head;
+
+        while ( head != __atomic_load_n ( &ring->tail, __ATOMIC_ACQUIRE ) )
+        {
+            msg = ring->slots[head & ring->mask];
+            __atomic_store_n ( &ring->head, ++head, __ATOMIC_RELEASE );
+            core->stats.msgs_in++;
+
+            if ( msg.type == RUNTIME_MSG_CONNECTION )
+                Runtime_Adopt ( core, ( TCP_CONNECTION_INFO * ) msg.data );
+            else if ( core->runtime->opts.on_message )
+                core->runtime->opts.on_message ( core, &msg );
+        }
+    }
+}
+
+/******************************************************************************************
+*
+* @fn                     Runtime_Accept
+*
+* FUNCTION:               Takes every connection waiting on the core's listener.
+*                         Without SO_REUSEPORT this core is the only one listening,
+*                         and deals the connections out to every core in turn; one
+*                         whose core's queue is full is kept here.
+*
+* @param core             The core
+* @return                 void
+*****************************************************************************************/
+static void Runtime_Accept ( CORE *core )
+{
+    TCP_CONNECTION_INFO *connection;
+    int                 accepted;
+    int                 i;
+#ifndef SO_REUSEPORT
+    int                 target;
+#endif
+
+    do
+    {
+        accepted = New_Accept_Batch ( &core->listener, core->accept_batch, core->accept_batch->capacity );
+
+        for ( i = 0; i < accepted; i++ )
+        {
+            connection = ( TCP_CONNECTION_INFO * ) malloc ( sizeof ( TCP_CONNECTION_INFO ) );
+            Accept_Batch_Take ( core->accept_batch, i, connection );
+
+#ifndef SO_REUSEPORT
+            target = core->next_core;
+            core->next_core = ( core->next_core + 1 ) % core->runtime->count;
+            if ( target != core->index && Runtime_Post ( core, target, RUNTIME_MSG_CONNECTION, connection ) )
+                continue;
+#endif
+            Runtime_Adopt ( core, connection );
+        }
+    } while ( accepted == core->accept_batch->capacity );
+}
+
+/******************************************************************************************
+*
+* @fn                     Runtime_Core_Main
+*
+* FUNCTION:               The thread for one core: pins itself, builds its own state,
+*                         waits for the other cores, then polls until told to stop
+*
+* @param arg              The core
+* @return                 0
+*****************************************************************************************/
+static void *Runtime_Core_Main ( void *arg )
+{
+    CORE                *core;
+    RUNTIME             *runtime;
+    TCP_CONNECTION_INFO **polled;
+    struct pollfd       *fds;
+    TIMESTAMP           next_reap;
+    int                 capacity;
+    int                 count;
+    int                 first;
+    int                 i;
+#ifdef CPU_SET
+    cpu_set_t           cpus;
+#endif
+
+    core = ( CORE * ) arg;
+    runtime = core->runtime;
+
+#ifdef CPU_SET
+    if ( runtime->opts.pin )
+    {
+        CPU_ZERO ( &cpus );
+        CPU_SET ( core->cpu, &cpus );
+        pthread_setaffinity_np ( pthread_self ( ), sizeof ( cpus ), &cpus );
+    }
+#endif
+
+    /* allocated after pinning, so first touch puts them on this CPU's node */
+    core->registry = Registry_Create ( 64 );
+    core->closing = Registry_Create ( 16 );
+    core->recv_pool = Recv_Pool_Create ( RECV_POOL_MAX_FREE );
+    core->accept_batch = Accept_Batch_Create ( 32 );
+    core->inbox = ( CORE_RING * ) malloc ( sizeof ( CORE_RING ) * runtime->count );
+    memset ( core->inbox, 0, sizeof ( CORE_RING ) * runtime->count );
+    for ( i = 0; i < runtime->count; i++ )
+    {
+        core->inbox[i].mask = runtime->opts.ring_size - 1;
+        core->inbox[i].slots = ( CORE_MSG * ) malloc ( sizeof ( CORE_MSG ) * runtime->opts.ring_size );
+    }
+
+    capacity = 64;
+    polled = ( TCP_CONNECTION_INFO ** ) malloc ( sizeof ( TCP_CONNECTION_INFO * ) * capacity );
+    fds = ( struct pollfd * ) malloc ( sizeof ( struct pollfd ) * ( capacity + 2 ) );
+
+    /* nobody may post before every inbox exists */
+    __atomic_add_fetch ( &runtime->ready, 1, __ATOMIC_ACQ_REL );
+    while ( __atomic_load_n ( &runtime->ready, __ATOMIC_ACQUIRE ) < runtime->count
+         && !__atomic_load_n ( &runtime->stop, __ATOMIC_ACQUIRE ) )
+        Sleep_Micros ( 100 );
+
+    if ( runtime->opts.on_start && !__atomic_load_n ( &runtime->stop, __ATOMIC_ACQUIRE ) )
+        runtime->opts.on_start ( core );
+
+    next_reap = Get_Timestamp ( ) + runtime->opts.idle_timeout_us;
+
+    while ( !__atomic_load_n ( &runtime->stop, __ATOMIC_ACQUIRE ) )
+    {
+        Runtime_Reclaim ( core );
+
+        if ( core->registry->count > capacity )
+        {
+            capacity = core->registry->capacity;
+            polled = ( TCP_CONNECTION_INFO ** ) realloc ( polled, sizeof ( TCP_CONNECTION_INFO * ) * capacity );
+            fds = ( struct pollfd * ) realloc ( fds, sizeof ( struct pollfd ) * ( capacity + 2 ) );
+        }
+
+        fds[0].fd = core->wake[0];
+        fds[0].events = POLLIN;
+        first = 1;
+        if ( core->listener.sock )
+        {
+            fds[1].fd = *core->listener.sock;
+            fds[1].events = POLLIN;
+            first = 2;
+        }
+
+        /* a snapshot: callbacks may close connections, which stay allocated until
+         * Runtime_Reclaim, so one closed this pass is seen here with sock -1 */
+        count = core->registry->count;
+        for ( i = 0; i < count; i++ )
+        {
+            polled[i] = core->registry->conns[i];
+            fds[first + i].fd = *polled[i]->sock;
+            fds[first + i].events = POLLIN;
+        }
+
+        core->stats.loops++;
+        if ( poll ( fds, first + count, runtime->opts.poll_ms ) < 0 && errno != EINTR )
+            break;
+
+        if ( fds[0].revents )
+            Runtime_Drain_Inbox ( core );
+        if ( first == 2 && fds[1].revents )
+            Runtime_Accept ( core );
+
+        for ( i = 0; i < count; i++ )
+        {
+            if ( !fds[first + i].revents || *polled[i]->sock < 0 )
+                continue;
+
+            polled[i]->last_activity = Get_Timestamp ( );
+            if ( !runtime->opts.on_readable || runtime->opts.on_readable ( core, polled[i] ) < 0 )
+                Runtime_Close ( core, polled[i] );
+        }
+
+        if ( runtime->opts.idle_timeout_us > 0 && Get_Timestamp ( ) >= next_reap )
+        {
+            core->stats.closed += Reap_Idle ( core->registry, runtime->opts.idle_timeout_us, core->registry->count, 0 );
+            next_reap = Get_Timestamp ( ) + runtime->opts.idle_timeout_us / 2;
+        }
+    }
+
+    if ( runtime->opts.on_stop )
+        runtime->opts.on_stop ( core );
+
+    while ( core->registry->count > 0 )
+        Runtime_Close ( core, core->registry->conns[core->registry->count - 1] );
+    Runtime_Reclaim ( core );
+
+    Registry_Free ( core->registry );
+    Registry_Free ( core->closing );
+    Recv_Pool_Free ( core->recv_pool );
+    Accept_Batch_Free ( core->accept_batch );
+    free ( polled );
+    free ( fds );
+
+    return 0;
+}
+
+/******************************************************************************************
+*
+* @fn                     Runtime_Listen
+*
+* FUNCTION:               Opens a core's listener on the runtime's address and port
+*
+* @param runtime          The runtime
+* @param core             The core
+* @return                 0 on success, -1 on error
+*****************************************************************************************/
+static int Runtime_Listen ( RUNTIME *runtime, CORE *core )
+{
+    TCP_CONNECTION_INFO *listener;
+    int                 socket_num;
+    int                 on;
+
+    listener = &core->listener;
+    strcpy ( listener->ipaddr, runtime->opts.ipaddr );
+    listener->port = runtime->opts.port;
+
+    socket_num = Create_Socket ( listener, AF_INET, SOCK_STREAM, 0 );
+    *listener->sock = socket_num;
+    if ( socket_num < 0 )
+        return -1;
+
+    on = 1;
+    setsockopt ( socket_num, SOL_SOCKET, SO_REUSEADDR, ( char * ) &on, sizeof ( on ) );
+#ifdef SO_REUSEPORT
+    if ( setsockopt ( socket_num, SOL_SOCKET, SO_REUSEPORT, ( char * ) &on, sizeof ( on ) ) < 0 )
+        return -1;
+#endif
+
+    Set_SockAddr ( listener, AF_INET );
+    Tcp_Set_Options ( listener, 0, runtime->opts.queue_len, sizeof ( struct sockaddr_in ) );
+
+    if ( Set_Bind ( listener ) < 0 || Set_Listen ( listener ) < 0 )
+        return -1;
+
+    return 0;
+}
+
+/******************************************************************************************
+*
+* @fn                     Runtime_Discard_Ring
+*
+* FUNCTION:               Closes the connections still queued on a stopped core, dealt
+*                         to it after it had finished
+*
+* @param ring             One of the core's inbox queues
+* @return                 void
+*****************************************************************************************/
+static void Runtime_Discard_Ring ( CORE_RING *ring )
+{
+    TCP_CONNECTION_INFO *connection;
+    CORE_MSG            *msg;
+
+    for ( ; ring->head != ring->tail; ring->head++ )
+    {
+        msg = &ring->slots[ring->head & ring->mask];
+        if ( msg->type != RUNTIME_MSG_CONNECTION )
+            continue;
+
+        connection = ( TCP_CONNECTION_INFO * ) msg->data;
+        Close_Sock ( connection );
+        Clean_Conn_Info ( connection );
+        free ( connection );
+    }
+}
+
+/******************************************************************************************
+*
+* @fn                     Runtime_Stop
+*
+* FUNCTION:               Stops every core, waits for its thread to finish (after its
+*                         on_stop, with its connections closed) and frees the runtime
+*
+* @param runtime          The runtime from Runtime_Start
+* @return                 void
+*****************************************************************************************/
+static void Runtime_Stop ( RUNTIME *runtime )
+{
+    CORE        *core;
+    pthread_t   *threads;
+    int         i;
+    int         j;
+    char        wake;
+
+    threads = ( pthread_t * ) runtime->threads;
+    __atomic_store_n ( &runtime->stop, 1, __ATOMIC_RELEASE );
+
+    wake = 1;
+    for ( i = 0; i < runtime->started; i++ )
+    {
+        if ( write ( runtime->cores[i].wake[1], &wake, 1 ) < 0 )
+        {
+            /* the core is already awake and will see stop */
+        }
+    }
+    for ( i = 0; i < runtime->started; i++ )
+        pthread_join ( threads[i], 0 );
+
+    for ( i = 0; i < runtime->count; i++ )
+    {
+        core = &runtime->cores[i];
+        if ( core->listener.sock )
+        {
+            Close_Sock ( &core->listener );
+            Clean_Conn_Info ( &core->listener );
+        }
+        if ( core->wake[0] >= 0 )
+            close ( core->wake[0] );
+        if ( core->wake[1] >= 0 )
+            close ( core->wake[1] );
+        if ( core->inbox )
+        {
+            for ( j = 0; j < runtime->count; j++ )
+            {
+                Runtime_Discard_Ring ( &core->inbox[j] );
+                free ( core->inbox[j].slots );
+            }
+            free ( core->inbox );
+        }
+    }
+
+    free ( runtime->cores );
+    free ( threads );
+    free ( runtime );
+}
+
+/******************************************************************************************
+*
+* @fn                     Runtime_Start
+*
+* FUNCTION:               Starts one pinned thread per core, each with its own listener
+*                         on opts->ipaddr / opts->port, and returns once they are all
+*                         running
+*
+* NOTE:                   Port 0 picks a free port, shared by every core; it can be
+*                         read back from the first core's listener. Without
+*                         SO_REUSEPORT only the first core listens and hands work out
+*                         with Runtime_Post.
+*
+* @param opts             How to run, and the callbacks
+* @return                 The runtime, 0 if it could not be started
+*****************************************************************************************/
+static RUNTIME *Runtime_Start ( RUNTIME_OPTS *opts )
+{
+    RUNTIME         *runtime;
+    CORE            *core;
+    pthread_t       *threads;
+    int             cpu_list[RUNTIME_MAX_CORES];
+    int             cpu_count;
+    int             i;
+#ifdef CPU_SET
+    cpu_set_t       allowed;
+#endif
+
+    cpu_count = 0;
+#ifdef CPU_SET
+    if ( sched_getaffinity ( 0, sizeof ( allowed ), &allowed ) == 0 )
+    {
+        for ( i = 0; i < CPU_SETSIZE && cpu_count < RUNTIME_MAX_CORES; i++ )
+        {
+            if ( CPU_ISSET ( i, &allowed ) )
+                cpu_list[cpu_count++] = i;
+        }
+    }
+#endif
+    if ( cpu_count == 0 )
+    {
+        cpu_count = ( int ) sysconf ( _SC_NPROCESSORS_ONLN );
+        for ( i = 0; i < cpu_count && i < RUNTIME_MAX_CORES; i++ )
+            cpu_list[i] = i;
+    }
+
+    runtime = ( RUNTIME * ) malloc ( sizeof ( RUNTIME ) );
+    memset ( runtime, 0, sizeof ( RUNTIME ) );
+    runtime->opts = *opts;
+
+    runtime->count = opts->cores > 0 ? opts->cores : cpu_count;
+    if ( runtime->count > RUNTIME_MAX_CORES )
+        runtime->count = RUNTIME_MAX_CORES;
+    if ( runtime->opts.ring_size <= 0 )
+        runtime->opts.ring_size = RUNTIME_RING_SIZE;
+    while ( runtime->opts.ring_size & ( runtime->opts.ring_size - 1 ) )
+        runtime->opts.ring_size &= runtime->opts.ring_size - 1;
+    if ( runtime->opts.poll_ms <= 0 )
+        runtime->opts.poll_ms = 100;
+
+    /* settle the lazily chosen routines before several threads race to choose them */
+    Delim_Scan_Impl ( );
+    Crc32c ( 0, "", 0 );
+
+    runtime->cores = ( CORE * ) malloc ( sizeof ( CORE ) * runtime->count );
+    memset ( runtime->cores, 0, sizeof ( CORE ) * runtime->count );
+    threads = ( pthread_t * ) malloc ( sizeof ( pthread_t ) * runtime->count );
+    runtime->threads = threads;
+
+    for ( i = 0; i < runtime->count; i++ )
+    {
+        core = &runtime->cores[i];
+        core->index = i;
+        core->cpu = cpu_list[i % cpu_count];
+        core->runtime = runtime;
+        core->user = opts->user;
+        core->wake[0] = core->wake[1] = -1;
+    }
+
+    for ( i = 0; i < runtime->count; i++ )
+    {
+        core = &runtime->cores[i];
+        if ( pipe ( core->wake ) < 0 )
+            break;
+        fcntl ( core->wake[0], F_SETFL, O_NONBLOCK );
+        fcntl ( core->wake[1], F_SETFL, O_NONBLOCK );
+
+#ifndef SO_REUSEPORT
+        if ( i > 0 )
+            continue;
+#endif
+        if ( Runtime_Listen ( runtime, core ) < 0 )
+            break;
+
+        /* the rest share whatever port the first one got */
+        if ( i == 0 && runtime->opts.port == 0 && Get_Sock_Name ( &core->listener ) >= 0 )
+            runtime->opts.port = ntohs ( core->listener.sockaddr->sin_port );
+    }
+
+    if ( i == runtime->count )
+    {
+        for ( ; runtime->started < runtime->count; runtime->started++ )
+        {
+            if ( pthread_create ( &threads[runtime->started], 0, Runtime_Core_Main, &runtime->cores[runtime->started] ) != 0 )
+                break;
+        }
+    }
+
+    if ( runtime->started < runtime->count )
+    {
+        Runtime_Stop ( runtime );
+        return 0;
+    }
+
+    while ( __atomic_load_n ( &runtime->ready, __ATOMIC_ACQUIRE ) < runtime->count )
+        Sleep_Micros ( 100 );
+
+    return runtime;
+}
+
+#else
+
+static RUNTIME *Runtime_Start ( RUNTIME_OPTS *opts )
+{
+    return 0;
+}
+
+static BOOLEAN Runtime_Post ( CORE *from, int to, int type, void *data )
+{
+    return FAIL;
+}
+
+static void Runtime_Close ( CORE *core, TCP_CONNECTION_INFO *connection )
+{
+}
+
+static void Runtime_Stop ( RUNTIME *runtime )
+{
+}
+
+#endif
+
+/***************************************************************************************
+*						CAPTURE REPLAY
+***************************************************************************************/
+typedef struct _replay_conn
+{
+    int32_t             orig_id;
+    TCP_CONNECTION_INFO info;
+    TIMESTAMP           sent_at;
+    BOOLEAN             awaiting;
+    BOOLEAN             broken;
+} REPLAY_CONN;
+
+/******************************************************************************************
+*
+* @fn                     Replay_Await
+*
+* FUNCTION:               Waits for the operation outstanding on a replay connection.
+*                         A connection whose operation fails or times out is closed,
+*                         which cancels the operation, and takes no further part.
+*
+* @param conn             The replay connection
+* @param timeout          AWAITIOX timelimit
+* @param count            Returns the count transferred
+* @return                 The FILE_GETINFO_ error
+*****************************************************************************************/
+static short Replay_Await ( REPLAY_CONN *conn, TIMEOUT timeout, int *count )
+{
+    short           file_num;
+    short           error;
+    long            buffer_addr;
+    unsigned short  count_trnsfr;
+    signed long     tag;
+
+    file_num = ( short ) *conn->info.sock;
+    AWAITIOX ( &file_num, &buffer_addr, &count_trnsfr, &tag, timeout );
+    FILE_GETINFO_ ( file_num, &error );
+
+    *count = 0;
+    if ( error == 0 )
+    {
+        Complete_NW ( &conn->info, buffer_addr, count_trnsfr );
+        *count = count_trnsfr;
+    }
+    else
+    {
+        Close_Sock ( &conn->info );
+        conn->broken = SUCCESS;
+    }
+
+    return error;
+}
+
+/******************************************************************************************
+*
+* @fn                     Replay_Open
+*
+* FUNCTION:               Finds the replay connection standing in for a captured
+*                         connection, connecting a new one to the target if this
+*                         is the first time the captured connection is seen.
+*
+* @param target           The target server (ipaddr, port, process_name)
+* @param conns            The table of replay connections
+* @param conn_count       The number of entries in use in conns
+* @param orig_id          The connection id recorded in the capture
+* @return                 The replay connection, 0 on failure
+*****************************************************************************************/
+static REPLAY_CONN *Replay_Open ( TCP_CONNECTION_INFO *target, REPLAY_CONN *conns, int *conn_count, int32_t orig_id )
+{
+    REPLAY_CONN *conn;
+    signed long tag;
+    int         count;
+    int         i;
+
+    for ( i = 0; i < *conn_count; i++ )
+    {
+        if ( conns[i].orig_id == orig_id )
+            return &conns[i];
+    }
+
+    if ( *conn_count == REPLAY_MAX_CONNS )
+        return 0;
+
+    conn = &conns[*conn_count];
+    memset ( conn, 0, sizeof ( REPLAY_CONN ) );
+    conn->orig_id = orig_id;
+
+    strcpy ( conn->info.ipaddr, target->ipaddr );
+    strcpy ( conn->info.process_name, target->process_name );
+    conn->info.port = target->port;
+    conn->info.timeout_opts = target->timeout_opts;
+
+    /* nowait, so every wait on the target is bounded by its timeout_opts */
+    Set_SockAddr ( &conn->info, AF_INET );
+    Tcp_Set_Options ( &conn->info, 0, 0, sizeof ( struct sockaddr_in ) );
+    conn->info.sock = ( int * ) malloc ( sizeof ( int ) );
+    *conn->info.sock = Get_Sock_NW ( &conn->info, AF_INET, SOCK_STREAM, 0, 0 );
+    if ( *conn->info.sock < 0 )
+    {
+        Clean_Conn_Info ( &conn->info );
+        return 0;
+    }
+
+    tag = *conn_count;
+    if ( Make_Connect_NW ( &conn->info, &tag ) < 0
+      || Replay_Await ( conn, conn->info.timeout_opts.connect_to, &count ) != 0 )
+    {
+        Close_Sock ( &conn->info );
+        Clean_Conn_Info ( &conn->info );
+        return 0;
+    }
+
+    ( *conn_count )++;
+
+    return conn;
+}
+
+/******************************************************************************************
+*
+* @fn                     Replay_Capture
+*
+* FUNCTION:               Re-issues the traffic in a capture file against a target
+*                         server. Every captured connection is given its own connection
+*                         to the target. Sends are replayed as recorded; a captured
+*                         receive is replayed by reading the same number of bytes back,
+*                         and the time since the preceding send is taken as latency.
+*                         Each send and receive waits at most target->timeout_opts
+*                         send_to and recv_to; a connection that times out is dropped.
+*
+* NOTE:                   speed 0 replays as fast as possible, 1 at the captured pace,
+*                         and N compresses the captured gaps N times. Pass REPLAY_FLIP
+*                         to replay a server-side capture, whose receives are the
+*                         requests to send.
+*
+* @param target           The target server (ipaddr, port, process_name, timeout_opts)
+* @param file_name        The capture file written by Capture_Start
+* @param speed            The replay speed multiplier
+* @param flags            0 or REPLAY_FLIP
+* @param stats            Receives the throughput and latency figures
+* @return                 0 on success, -1 if the file could not be read
+*****************************************************************************************/
+static int Replay_Capture ( TCP_CONNECTION_INFO *target, char *file_name, int speed, int flags, REPLAY_STATS *stats )
+{
+    FILE            *file;
+    CAPTURE_RECORD  record;
+    unsigned char   header[CAPTURE_HEADER_SIZE];
+    REPLAY_CONN     *conns;
+    REPLAY_CONN     *conn;
+    int             conn_count;
+    char            magic[8];
+    char            *payload;
+    int             payload_size;
+    int             done;
+    int             count;
+    int             direction;
+    signed long     tag;
+    TIMESTAMP       first_ts;
+    TIMESTAMP       start;
+    TIMESTAMP       now;
+    TIMESTAMP       latency;
+    int             i;
+
+    memset ( stats, 0, sizeof ( REPLAY_STATS ) );
+
+    file = fopen ( file_name, "rb" );
+    if ( !file )
+        return -1;
+
+    if ( fread ( magic, 1, sizeof ( magic ), file ) != sizeof ( magic )
+      || memcmp ( magic, CAPTURE_MAGIC, sizeof ( magic ) ) != 0 )
+    {
+        fclose ( file );
+        return -1;
+    }
+
+    conns = ( REPLAY_CONN * ) malloc ( sizeof ( REPLAY_CONN ) * REPLAY_MAX_CONNS );
+    conn_count = 0;
+    payload_size = 4096;
+    payload = ( char * ) malloc ( payload_size );
+    first_ts = 0;
+    start = Get_Timestamp ( );
+
+    while ( fread ( header, 1, CAPTURE_HEADER_SIZE, file ) == CAPTURE_HEADER_SIZE )
+    {
+        Capture_Get_Header ( header, &record );
+        if ( record.length < 0 )
+            break;
+
+        if ( CAPTURE_PAD ( record.length ) > payload_size )
+        {
+            payload_size = CAPTURE_PAD ( record.length );
+            payload = ( char * ) realloc ( payload, payload_size );
+        }
+        if ( fread ( payload, 1, CAPTURE_PAD ( record.length ), file ) != ( size_t ) CAPTURE_PAD ( record.length ) )
+            break;
+
+        /* hold each record back until its (scaled) point in the capture */
+        if ( first_ts == 0 )
+            first_ts = record.timestamp;
+        if ( speed > 0 )
+            Sleep_Micros ( start + ( record.timestamp - first_ts ) / speed - Get_Timestamp ( ) );
+
+        conn = Replay_Open ( target, conns, &conn_count, record.conn_id );
+        if ( !conn || conn->broken )
+        {
+            stats->errors++;
+            continue;
+        }
+
+        direction = record.direction;
+        if ( flags & REPLAY_FLIP )
+            direction = direction == CAPTURE_SEND ? CAPTURE_RECV : CAPTURE_SEND;
+
+        tag = conn - conns;
+        if ( direction == CAPTURE_SEND )
+        {
+            conn->sent_at = Get_Timestamp ( );
+            conn->awaiting = SUCCESS;
+
+            /* the stack may take it in more than one piece */
+            for ( done = 0; done < record.length; done += count )
+            {
+                if ( New_Send_NW ( &conn->info, payload + done, record.length - done, &tag ) < 0
+                  || Replay_Await ( conn, conn->info.timeout_opts.send_to, &count ) != 0 )
+                    break;
+            }
+            if ( done < record.length )
+            {
+                stats->errors++;
+                continue;
+            }
+            stats->messages_sent++;
+            stats->bytes_sent += record.length;
+        }
+        else
+        {
+            /* TCP may hand the response back in more pieces than were captured */
+            for ( done = 0; done < record.length; done += count )
+            {
+                if ( New_Recv_NW ( &conn->info, payload + done, record.length - done, &tag, 0 ) < 0
+                  || Replay_Await ( conn, conn->info.timeout_opts.recv_to, &count ) != 0
+                  || count == 0 )
+                    break;
+            }
+            if ( done < record.length )
+            {
+                stats->errors++;
+                continue;
+            }
+            stats->messages_recv++;
+            stats->bytes_recv += done;
+
+            if ( conn->awaiting )
+            {
+                now = Get_Timestamp ( );
+                latency = now - conn->sent_at;
+                conn->awaiting = FAIL;
+
+                if ( stats->latency_samples == 0 || latency < stats->latency_min_us )
+                    stats->latency_min_us = latency;
+                if ( latency > stats->latency_max_us )
+                    stats->latency_max_us = latency;
+                stats->latency_total_us += latency;
+                stats->latency_samples++;
+            }
+        }
+    }
+
+    stats->elapsed_us = Get_Timestamp ( ) - start;
+    if ( stats->elapsed_us > 0 )
+    {
+        stats->messages_per_sec = ( stats->messages_sent + stats->messages_recv ) * 1000000.0 / stats->elapsed_us;
+        stats->bytes_per_sec = ( stats->bytes_sent + stats->bytes_recv ) * 1000000.0 / stats->elapsed_us;
+    }
+
+    for ( i = 0; i < conn_count; i++ )
+    {
+        if ( !conns[i].broken )
+        {
+            Shutdown_Sock ( &conns[i].info, 2 );
+            Close_Sock ( &conns[i].info );
+        }
+        Clean_Conn_Info ( &conns[i].info );
+    }
+
+    free ( payload );
+    free ( conns );
+    fclose ( file );
+
+    return 0;
+}
+
+/***************************************************************************************
+*						LATENCY HISTOGRAMS
+***************************************************************************************/
+
+/******************************************************************************************
+*
+* @fn                     Histogram_Index
+*
+* FUNCTION:               Maps a value to its slot. Values under 256 map to themselves;
+*                         above that, each power of two gets HISTOGRAM_SUB_BUCKETS slots.
+*
+* @param value            The value in microseconds
+* @return                 The slot in counts[]
+*****************************************************************************************/
+static int Histogram_Index ( TIMESTAMP value )
+{
+    int shift;
+
+    if ( value < 0 )
+        value = 0;
+    if ( value < 2 * HISTOGRAM_SUB_BUCKETS )
+        return ( int ) value;
+
+    for ( shift = 1; ( value >> shift ) >= 2 * HISTOGRAM_SUB_BUCKETS; shift++ )
+        ;
+
+    if ( ( shift + 1 ) * HISTOGRAM_SUB_BUCKETS >= HISTOGRAM_COUNTS )
+        return HISTOGRAM_COUNTS - 1;
+
+    return ( shift + 1 ) * HISTOGRAM_SUB_BUCKETS + ( int ) ( value >> shift ) - HISTOGRAM_SUB_BUCKETS;
+}
+
+/******************************************************************************************
+*
+* @fn                     Histogram_Value
+*
+* FUNCTION:               The reverse of Histogram_Index: the highest value that
+*                         maps to a slot.
+*
+* @param index            The slot in counts[]
+* @return                 The value in microseconds
+*****************************************************************************************/
+static TIMESTAMP Histogram_Value ( int index )
+{
+    int shift;
+
+    if ( index < 2 * HISTOGRAM_SUB_BUCKETS )
+        return index;
+
+    shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+
+    return ( ( ( TIMESTAMP ) ( HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS ) + 1 ) << shift ) - 1;
+}
+
+/******************************************************************************************
+*
+* @fn                     Histogram_Reset
+*
+* FUNCTION:               Clears all recorded values
+*
+* @param histogram        The histogram to clear
+* @return                 void
+*****************************************************************************************/
+static void Histogram_Reset ( LATENCY_HISTOGRAM *histogram )
+{
+    memset ( histogram, 0, sizeof ( LATENCY_HISTOGRAM ) );
+}
+
+/******************************************************************************************
+*
+* @fn                     Histogram_Record
+*
+* FUNCTION:               Records a single latency
+*
+* @param histogram        The histogram to record into
+* @param value            The latency in microseconds
+* @return                 void
+*****************************************************************************************/
+static void Histogram_Record ( LATENCY_HISTOGRAM *histogram, TIMESTAMP value )
+{
+    histogram->counts[Histogram_Index ( value )]++;
+
+    if ( histogram->total_count == 0 || value < histogram->min )
+        histogram->min = value;
+    if ( value > histogram->max )
+        histogram->max = value;
+
+    histogram->total_count++;
+}
+
+/******************************************************************************************
+*
+* @fn                     Histogram_Record_Corrected
+*
+* FUNCTION:               Records a latency taken by a closed-loop caller that sends
+*                         every "expected_interval". A stall longer than the interval
+*                         held back the requests that should have gone out meanwhile,
+*                         so those are back-filled with the latencies they would have
+*                         seen.
+*
+* NOTE:                   Not needed for latencies taken from the intended send time,
+*                         as Loadgen_Run does; those are already corrected.
+*
+* @param histogram        The histogram to record into
+* @param value            The latency in microseconds
+* @param expected_interval The caller's normal gap between requests
+* @return                 void
+*****************************************************************************************/
+static void Histogram_Record_Corrected ( LATENCY_HISTOGRAM *histogram, TIMESTAMP value, TIMESTAMP expected_interval )
+{
+    TIMESTAMP missing;
+
+    Histogram_Record ( histogram, value );
+
+    if ( expected_interval <= 0 )
+        return;
+
+    for ( missing = value - expected_interval; missing >= expected_interval; missing -= expected_interval )
+        Histogram_Record ( histogram, missing );
+}
+
+/******************************************************************************************
+*
+* @fn                     Histogram_Percentile
+*
+* FUNCTION:               The latency at or below which the given percent of the
+*                         recorded values fall
+*
+* @param histogram        The histogram to query
+* @param percentile       0.0 to 100.0
+* @return                 The latency in microseconds
+*****************************************************************************************/
+static TIMESTAMP Histogram_Percentile ( LATENCY_HISTOGRAM *histogram, double percentile )
+{
+    long long   wanted;
+    long long   seen;
+    int         i;
+
+    if ( histogram->total_count == 0 )
+        return 0;
+
+    wanted = ( long long ) ( percentile / 100.0 * histogram->total_count + 0.5 );
+    if ( wanted < 1 )
+        wanted = 1;
+
+    for ( i = 0, seen = 0; i < HISTOGRAM_COUNTS; i++ )
+    {
+        seen += histogram->counts[i];
+        if ( seen >= wanted )
+            return Histogram_Value ( i ) < histogram->max ? Histogram_Value ( i ) : histogram->max;
+    }
+
+    return histogram->max;
+}
+
+/******************************************************************************************
+*
+* @fn                     Histogram_Print
+*
+* FUNCTION:               Writes the percentile distribution in the HdrHistogram
+*                         ".hgrm" text layout, values in milliseconds, so it can be fed
+*                         to the usual plotting tools.
+*
+* @param histogram        The histogram to print
+* @param out              Where to write it
+* @return                 void
+*****************************************************************************************/
+static void Histogram_Print ( LATENCY_HISTOGRAM *histogram, FILE *out )
+{
+    long long   seen;
+    double      percentile;
+    double      sum;
+    int         i;
+
+    fprintf ( out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)" );
+
+    for ( i = 0, seen = 0, sum = 0; i < HISTOGRAM_COUNTS; i++ )
+    {
+        if ( histogram->counts[i] == 0 )
+            continue;
+
+        seen += histogram->counts[i];
+        sum += ( double ) Histogram_Value ( i ) * histogram->counts[i];
+        percentile = ( double ) seen / histogram->total_count;
+
+        if ( seen < histogram->total_count )
+            fprintf ( out, "%12.3f %14.12f %10lld %14.2f\n"
+                    , Histogram_Value ( i ) / 1000.0, percentile, seen, 1.0 / ( 1.0 - percentile ) );
+        else
+            fprintf ( out, "%12.3f %14.12f %10lld\n", histogram->max / 1000.0, percentile, seen );
+    }
+
+    if ( histogram->total_count > 0 )
+        fprintf ( out, "#[Mean    = %12.3f, Max     = %12.3f]\n#[Min     = %12.3f, Total count    = %12lld]\n"
+                , sum / histogram->total_count / 1000.0, histogram->max / 1000.0
+                , histogram->min / 1000.0, histogram->total_count );
+}
+
+/***************************************************************************************
+*						OPEN-LOOP LOAD GENERATOR
+*
+*   Requests are due on a fixed schedule regardless of how the server keeps up. A due
+*   request goes out on the next idle connection; if none is idle it waits in a backlog,
+*   and its latency still counts from when it was due. That is what keeps a stalled
+*   server from hiding its own tail latency (coordinated omission).
+***************************************************************************************/
+#define LOADGEN_IDLE        0
+#define LOADGEN_SENDING     1
+#define LOADGEN_RECEIVING   2
+
+typedef struct _loadgen_conn
+{
+    TCP_CONNECTION_INFO info;
+    int                 state;
+    TIMESTAMP           intended;
+    TIMESTAMP           actual;
+    int                 sent;
+    int                 received;
+} LOADGEN_CONN;
+
+/******************************************************************************************
+*
+* @fn                     Loadgen_Interval
+*
+* FUNCTION:               The gap until the next request is due
+*
+* @param opts             The load description
+* @param seed             The generator state
+* @return                 The gap in microseconds
+*****************************************************************************************/
+static double Loadgen_Interval ( LOADGEN_OPTS *opts, unsigned long long *seed )
+{
+    if ( opts->arrival == LOADGEN_POISSON )
+        return -log ( Next_Random ( seed ) ) * 1000000.0 / opts->rate;
+
+    return 1000000.0 / opts->rate;
+}
+
+/******************************************************************************************
+*
+* @fn                     Loadgen_Run
+*
+* FUNCTION:               Drives the target with the load described by opts across
+*                         nowait connections, and collects latency and throughput.
+*                         The target must send back response_len bytes for every
+*                         request it receives.
+*
+* NOTE:                   The connections are nowait sockets created with target->flags.
+*                         Completions are taken with AWAITIOX on -1, so no other nowait
+*                         I/O should be outstanding in the process while this runs;
+*                         the capture file's writes are recognised and left alone.
+*
+* @param target           The server to drive (ipaddr, port, process_name, flags)
+* @param opts             The load to generate
+* @param stats            Receives the results; call Loadgen_Free_Stats when done
+* @return                 0 on success, -1 if the connections could not be opened
+*****************************************************************************************/
+static int Loadgen_Run ( TCP_CONNECTION_INFO *target, LOADGEN_OPTS *opts, LOADGEN_STATS *stats )
+{
+    LOADGEN_CONN        *conns;
+    LOADGEN_CONN        *conn;
+    TIMESTAMP           *backlog;
+    int                 backlog_head;
+    int                 backlog_count;
+    char                *response;
+    unsigned long long  seed;
+    double              next_due;
+    TIMESTAMP           start;
+    TIMESTAMP           end;
+    TIMESTAMP           drain_end;
+    TIMESTAMP           now;
+    TIMESTAMP           wait;
+    TIMESTAMP           nap;
+    signed long         timeout;
+    int                 in_flight;
+    int                 conn_count;
+    int                 second;
+    short               file_num;
+    short               error;
+    long                buffer_addr;
+    unsigned short      count;
+    signed long         tag;
+    int                 i;
+
+    memset ( stats, 0, sizeof ( LOADGEN_STATS ) );
+
+    conn_count = opts->connections;
+    if ( conn_count < 1 || conn_count > LOADGEN_MAX_CONNS || opts->rate <= 0 )
+        return -1;
+
+    conns = ( LOADGEN_CONN * ) malloc ( sizeof ( LOADGEN_CONN ) * conn_count );
+    memset ( conns, 0, sizeof ( LOADGEN_CONN ) * conn_count );
+
+    for ( i = 0; i < conn_count; i++ )
+    {
+        conn = &conns[i];
+        strcpy ( conn->info.ipaddr, target->ipaddr );
+        strcpy ( conn->info.process_name, target->process_name );
+        conn->info.port = target->port;
+        conn->info.timeout_opts = target->timeout_opts;
+
+        Set_SockAddr ( &conn->info, AF_INET );
+        Tcp_Set_Options ( &conn->info, target->flags, 0, sizeof ( struct sockaddr_in ) );
+        conn->info.sock = ( int * ) malloc ( sizeof ( int ) );
+        *conn->info.sock = Get_Sock_NW ( &conn->info, AF_INET, SOCK_STREAM, 0, 0 );
+
+        tag = i;
+        error = -1;
+        if ( *conn->info.sock >= 0 && Make_Connect_NW ( &conn->info, &tag ) >= 0 )
+        {
+            file_num = ( short ) *conn->info.sock;
+            AWAITIOX ( &file_num, &buffer_addr, &count, &tag, target->timeout_opts.connect_to );
+            FILE_GETINFO_ ( file_num, &error );
+        }
+
+        if ( error != 0 )
+        {
+            for ( ; i >= 0; i-- )
+            {
+                Close_Sock ( &conns[i].info );
+                Clean_Conn_Info ( &conns[i].info );
+            }
+            free ( conns );
+            return -1;
+        }
+    }
+
+    backlog = ( TIMESTAMP * ) malloc ( sizeof ( TIMESTAMP ) * LOADGEN_MAX_BACKLOG );
+    backlog_head = 0;
+    backlog_count = 0;
+    response = ( char * ) malloc ( opts->response_len > 0 ? opts->response_len : 1 );
+    seed = opts->seed ? opts->seed : 88172645463325252ULL;
+    in_flight = 0;
+
+    stats->seconds = opts->duration_secs + 1;
+    stats->per_second = ( long * ) malloc ( sizeof ( long ) * stats->seconds );
+    memset ( stats->per_second, 0, sizeof ( long ) * stats->seconds );
+
+    start = Get_Timestamp ( );
+    end = start + ( TIMESTAMP ) opts->duration_secs * 1000000;
+    drain_end = end + ( TIMESTAMP ) ( opts->drain_secs > 0 ? opts->drain_secs : LOADGEN_DRAIN_SECS ) * 1000000;
+    next_due = ( double ) start;
+
+    for ( ;; )
+    {
+        now = Get_Timestamp ( );
+
+        /* queue everything that has come due */
+        while ( next_due <= now && next_due < end )
+        {
+            if ( backlog_count == LOADGEN_MAX_BACKLOG )
+                stats->overflows++;
+            else
+            {
+                backlog[( backlog_head + backlog_count ) % LOADGEN_MAX_BACKLOG] = ( TIMESTAMP ) next_due;
+                backlog_count++;
+            }
+            next_due += Loadgen_Interval ( opts, &seed );
+        }
+        if ( backlog_count > stats->backlog_max )
+            stats->backlog_max = backlog_count;
+
+        /* hand the backlog to idle connections, oldest first */
+        for ( i = 0; i < conn_count && backlog_count > 0; i++ )
+        {
+            conn = &conns[i];
+            if ( conn->state != LOADGEN_IDLE )
+                continue;
+
+            conn->intended = backlog[backlog_head];
+            backlog_head = ( backlog_head + 1 ) % LOADGEN_MAX_BACKLOG;
+            backlog_count--;
+
+            tag = i;
+            conn->actual = Get_Timestamp ( );
+            if ( New_Send_NW ( &conn->info, opts->request, opts->request_len, &tag ) < 0 )
+            {
+                stats->errors++;
+                continue;
+            }
+            conn->state = LOADGEN_SENDING;
+            conn->sent = 0;
+            conn->received = 0;
+            stats->sent++;
+            in_flight++;
+        }
+
+        if ( now >= end && in_flight == 0 && backlog_count == 0 )
+            break;
+        if ( now >= drain_end )
+            break;
+
+        /* wait for a completion, but no later than the next due request */
+        wait = ( TIMESTAMP ) next_due - now;
+        if ( backlog_count > 0 || next_due >= end )
+            wait = -1;
+        if ( in_flight == 0 )
+        {
+            Sleep_Micros ( wait );
+            continue;
+        }
+
+        /* recv_to bounds a single wait (0, unset, is no bound); the drain deadline
+         * bounds the run */
+        timeout = wait < 0 ? target->timeout_opts.recv_to : ( signed long ) ( wait / 10000 );
+        if ( wait < 0 && timeout == 0 )
+            timeout = -1;
+        if ( timeout < 0 || ( TIMESTAMP ) timeout * 10000 > drain_end - now )
+            timeout = ( signed long ) ( ( drain_end - now + 9999 ) / 10000 );
+
+        /* a timelimit of 0 only checks, and AWAITIOX can't wait less than a
+         * centisecond; with less than that to go, check once and sleep out the rest
+         * rather than spin on the box being measured */
+        nap = timeout == 0 && wait > 0 ? wait : 0;
+
+        file_num = -1;
+        AWAITIOX ( &file_num, &buffer_addr, &count, &tag, timeout );
+        FILE_GETINFO_ ( file_num, &error );
+
+        if ( error == ERR_TIMEOUT )
+        {
+            Sleep_Micros ( nap );
+            continue;
+        }
+        if ( Capture_Take_Completion ( file_num, error ) )
+            continue;
+        if ( tag < 0 || tag >= conn_count )
+            continue;
+
+        conn = &conns[tag];
+        if ( error == 0 )
+            Complete_NW ( &conn->info, buffer_addr, count );
+        if ( error != 0 || ( conn->state == LOADGEN_RECEIVING && count == 0 ) )
+        {
+            /* a broken connection takes no further part in the run */
+            stats->errors++;
+            conn->state = LOADGEN_SENDING + LOADGEN_RECEIVING;
+            in_flight--;
+            continue;
+        }
+
+        /* the stack may take only part of a request; send the rest */
+        if ( conn->state == LOADGEN_SENDING )
+        {
+            conn->sent += count;
+            if ( conn->sent < opts->request_len )
+            {
+                if ( New_Send_NW ( &conn->info, opts->request + conn->sent
+                                 , opts->request_len - conn->sent, &tag ) < 0 )
+                {
+                    stats->errors++;
+                    conn->state = LOADGEN_SENDING + LOADGEN_RECEIVING;
+                    in_flight--;
+                }
+                continue;
+            }
+        }
+
+        if ( conn->state == LOADGEN_RECEIVING )
+            conn->received += count;
+
+        if ( conn->received < opts->response_len )
+        {
+            conn->state = LOADGEN_RECEIVING;
+            if ( New_Recv_NW ( &conn->info, response, opts->response_len - conn->received, &tag, 0 ) < 0 )
+            {
+                stats->errors++;
+                conn->state = LOADGEN_SENDING + LOADGEN_RECEIVING;
+                in_flight--;
+            }
+            continue;
+        }
+
+        now = Get_Timestamp ( );
+        Histogram_Record ( &stats->corrected, now - conn->intended );
+        Histogram_Record ( &stats->uncorrected, now - conn->actual );
+        stats->completed++;
+
+        second = ( int ) ( ( now - start ) / 1000000 );
+        if ( second < stats->seconds )
+            stats->per_second[second]++;
+
+        conn->state = LOADGEN_IDLE;
+        in_flight--;
+    }
+
+    stats->elapsed_us = Get_Timestamp ( ) - start;
+
+    for ( i = 0; i < conn_count; i++ )
+    {
+        Close_Sock ( &conns[i].info );
+        Clean_Conn_Info ( &conns[i].info );
+    }
+
+    free ( response );
+    free ( backlog );
+    free ( conns );
+
+    return 0;
+}
+
+/******************************************************************************************
+*
+* @fn                     Loadgen_Report
+*
+* FUNCTION:               Writes a summary, the throughput for each second of the run,
+*                         and the corrected latency distribution
+*
+* @param stats            The results of Loadgen_Run
+* @param out              Where to write the report
+* @return                 void
+*****************************************************************************************/
+static void Loadgen_Report ( LOADGEN_STATS *stats, FILE *out )
+{
+    int i;
+
+    fprintf ( out, "sent %ld, completed %ld, errors %ld, backlog overflows %ld, max backlog %ld\n"
+            , stats->sent, stats->completed, stats->errors, stats->overflows, stats->backlog_max );
+    fprintf ( out, "throughput %.1f/s over %.3fs\n"
+            , stats->elapsed_us > 0 ? stats->completed * 1000000.0 / stats->elapsed_us : 0.0
+            , stats->elapsed_us / 1000000.0 );
+    fprintf ( out, "p50 %lld us, p99 %lld us, p99.9 %lld us (uncorrected p99 %lld us)\n\n"
+            , Histogram_Percentile ( &stats->corrected, 50.0 )
+            , Histogram_Percentile ( &stats->corrected, 99.0 )
+            , Histogram_Percentile ( &stats->corrected, 99.9 )
+            , Histogram_Percentile ( &stats->uncorrected, 99.0 ) );
+
+    for ( i = 0; i < stats->seconds; i++ )
+        fprintf ( out, "second %4d: %ld/s\n", i, stats->per_second[i] );
+
+    fprintf ( out, "\n" );
+    Histogram_Print ( &stats->corrected, out );
+}
+
+/******************************************************************************************
+*
+* @fn                     Loadgen_Free_Stats
+*
+* FUNCTION:               Releases the memory Loadgen_Run allocated in stats
+*
+* @param stats            The results of Loadgen_Run
+* @return                 void
+*****************************************************************************************/
+static void Loadgen_Free_Stats ( LOADGEN_STATS *stats )
+{
+    if ( stats->per_second != 0 )
+    {
+        free ( stats->per_second );
+        stats->per_second = 0;
+    }
+    stats->seconds = 0;
+}
+
+/***************************************************************************************
+*						STARTUP CONFIGURATION
+*
+*   A process's network set-up can be declared in one file and made ready before the
+*   first request arrives, rather than being allocated and connected on demand. The
+*   file is "key = value" lines in sections:
+*
+*       [timeouts]                  recv, send, socket, connect, bind, accept and
+*       recv = 500                  variable, as in TIMEOUT_OPTS: centiseconds,
+*                                   -1 to wait indefinitely
+*
+*       [pool]                      max_free for the default receive pool, and
+*       max_free = 64               prewarm.<bytes> = how many buffers of that
+*       prewarm.1024 = 32           size class to allocate up front
+*
+*       [tuning]                    profiles, as for Load_Tuning_Profiles
+*       feed.nodelay = 1
+*
+*       [listener public]           ipaddr, port, queue_len, process, tuning
+*       port = 5000
+*
+*       [endpoints backend]         endpoint = ip:port [process], once per endpoint;
+*       endpoint = 10.0.0.1:7000    policy (least or p2c), eject_after, probe_ms,
+*       preconnect = 2              preconnect (connections per endpoint), process,
+*                                   tuning
+*
+*   intialize_tcp loads the file named by NSCC_CONFIG and runs Config_Prewarm before
+*   returning. It can't fail on their account, so the caller checks tcp->config:
+*   "status" non-zero means the file was unreadable or had a bad line and nothing was
+*   pre-warmed; stats.listener_failures and stats.connect_failures count what
+*   Config_Prewarm could not open.
+***************************************************************************************/
+
+/******************************************************************************************
+*
+* @fn                     Config_Set_Timeout
+*
+* FUNCTION:               Sets one of the [timeouts] options. -1 waits
+*                         indefinitely, as it does for AWAITIOX.
+*
+* @param timeouts         The timeouts
+* @param key              The option
+* @param value            The value, as text
+* @return                 0 on success, -1 for an unknown option or a bad value
+*****************************************************************************************/
+static int Config_Set_Timeout ( TIMEOUT_OPTS *timeouts, char *key, char *value )
+{
+    TIMEOUT timeout;
+    long    number;
+
+    if ( !Parse_Number ( value, -1, CONFIG_MAX_NUMBER, &number ) )
+        return -1;
+    timeout = ( TIMEOUT ) number;
+
+    if      ( strcmp ( key, "recv" ) == 0 )     timeouts->recv_to = timeout;
+    else if ( strcmp ( key, "send" ) == 0 )     timeouts->send_to = timeout;
+    else if ( strcmp ( key, "socket" ) == 0 )   timeouts->socket_to = timeout;
+    else if ( strcmp ( key, "connect" ) == 0 )  timeouts->connect_to = timeout;
+    else if ( strcmp ( key, "bind" ) == 0 )     timeouts->bind_to = timeout;
+    else if ( strcmp ( key, "accept" ) == 0 )   timeouts->accept_to = timeout;
+    else if ( strcmp ( key, "variable" ) == 0 ) timeouts->variable_to = timeout;
+    else
+        return -1;
+
+    return 0;
+}
+
+/******************************************************************************************
+*
+* @fn                     Config_Set_Pool
+*
+* FUNCTION:               Sets one of the [pool] options
+*
+* @param config           The configuration
+* @param key              The option
+* @param value            The value, as text
+* @return                 0 on success, -1 for an unknown option or a bad value
+*****************************************************************************************/
+static int Config_Set_Pool ( TCP_CONFIG *config, char *key, char *value )
+{
+    long    bytes;
+    long    number;
+
+    if ( !Parse_Number ( value, 0, CONFIG_MAX_NUMBER, &number ) )
+        return -1;
+
+    if ( strcmp ( key, "max_free" ) == 0 )
+    {
+        RECV_POOL_LOCK ( &default_recv_pool );
+        default_recv_pool.max_free = ( int ) number;
+        RECV_POOL_UNLOCK ( &default_recv_pool );
+        return 0;
+    }
+
+    if ( strncmp ( key, "prewarm.", 8 ) != 0 || !Parse_Number ( key + 8, 1, CONFIG_MAX_NUMBER, &bytes ) )
+        return -1;
+
+    config->prewarm[Recv_Class_For ( ( int ) bytes )] = ( int ) number;
+
+    return 0;
+}
+
+/******************************************************************************************
+*
+* @fn                     Config_Set_Listener
+*
+* FUNCTION:               Sets one option of a [listener] section
+*
+* @param listener         The listener
+* @param key              The option
+* @param value            The value, as text
+* @return                 0 on success, -1 for an unknown option, a bad value or an
+*                         unknown tuning profile
+*****************************************************************************************/
+static int Config_Set_Listener ( CONFIG_LISTENER *listener, char *key, char *value )
+{
+    long number;
+
+    if ( strcmp ( key, "ipaddr" ) == 0 )
+        strncpy ( listener->conn.ipaddr, value, sizeof ( SERVER_ADDR ) - 1 );
+    else if ( strcmp ( key, "port" ) == 0 )
+    {
+        if ( !Parse_Number ( value, 0, 65535, &number ) )
+            return -1;
+        listener->conn.port = ( TCP_PORT ) number;
+    }
+    else if ( strcmp ( key, "queue_len" ) == 0 )
+    {
+        if ( !Parse_Number ( value, 1, CONFIG_MAX_NUMBER, &number ) )
+            return -1;
+        listener->conn.queue_len = ( int ) number;
+    }
+    else if ( strcmp ( key, "process" ) == 0 )
+        strncpy ( listener->conn.process_name, value, sizeof ( INET_NAME ) - 1 );
+    else if ( strcmp ( key, "tuning" ) == 0 )
+        return Set_Tuning_Profile ( &listener->conn, value );
+    else
+        return -1;
+
+    return 0;
+}
+
+/******************************************************************************************
+*
+* @fn                     Config_Set_Endpoints
+*
+* FUNCTION:               Sets one option of an [endpoints] section
+*
+* @param pool             The endpoint pool
+* @param key              The option
+* @param value            The value, as text
+* @return                 0 on success, -1 for an unknown option or a bad value
+*****************************************************************************************/
+static int Config_Set_Endpoints ( CONFIG_POOL *pool, char *key, char *value )
+{
+    SERVER_ADDR     ipaddr;
+    INET_NAME       process_name;
+    unsigned int    port;
+    long            number;
+
+    if ( strcmp ( key, "endpoint" ) == 0 )
+    {
+        memset ( process_name, 0, sizeof ( process_name ) );
+        strcpy ( process_name, pool->process_name );
+        if ( sscanf ( value, "%19[^: ]:%u %8s", ipaddr, &port, process_name ) < 2 || port > 65535 )
+            return -1;
 
-    status = send_nw ( *connection->sock
-            , buffer_ptr
-            , buffer_length
-            , connection->flags
-            , &tag );
+        Balancer_Add_Endpoint ( pool->pool, ipaddr, ( TCP_PORT ) port, process_name );
+    }
+    else if ( strcmp ( key, "policy" ) == 0 )
+    {
+        if ( strcmp ( value, "p2c" ) == 0 )
+            pool->pool->policy = BALANCE_P2C;
+        else if ( strcmp ( value, "least" ) == 0 )
+            pool->pool->policy = BALANCE_LEAST_OUTSTANDING;
+        else
+            return -1;
+    }
+    else if ( strcmp ( key, "eject_after" ) == 0 )
+    {
+        if ( !Parse_Number ( value, 0, CONFIG_MAX_NUMBER, &number ) )
+            return -1;
+        pool->pool->eject_after = ( int ) number;
+    }
+    else if ( strcmp ( key, "probe_ms" ) == 0 )
+    {
+        if ( !Parse_Number ( value, 0, CONFIG_MAX_NUMBER, &number ) )
+            return -1;
+        pool->pool->probe_interval_us = number * 1000LL;
+    }
+    else if ( strcmp ( key, "preconnect" ) == 0 )
+    {
+        if ( !Parse_Number ( value, 0, CONFIG_MAX_PRECONNECT, &number ) )
+            return -1;
+        pool->preconnect = ( int ) number;
+    }
+    else if ( strcmp ( key, "process" ) == 0 )
+        strncpy ( pool->process_name, value, sizeof ( INET_NAME ) - 1 );
+    else if ( strcmp ( key, "tuning" ) == 0 )
+    {
+        pool->tuning = Find_Tuning_Profile ( value );
+        if ( !pool->tuning )
+            return -1;
+    }
+    else
+        return -1;
 
-    return status;
+    return 0;
 }
 
-/*********************************************************************************
+/******************************************************************************************
 *
-* @fn                     New_Recv
+* @fn                     Config_Load
 *
-* FUNCTION:               Receives data on a connected socket
+* FUNCTION:               Reads a configuration file into config. Nothing is opened or
+*                         allocated up front yet; that is Config_Prewarm.
 *
-* NOTE:
+* NOTE:                   A [tuning] section must come before the listeners and
+*                         endpoints that name its profiles.
 *
-* @param connection       The connection information used to create the socket
-* @param buffer_ptr       Points to the data to be sent..
-* @param buffer_length    The size of the buffer pointed to by buffer_ptr.
-* @param nrcvd            the number of bytes received by the recv function.
-*                         This is the return value for recv.A zero length message
-*                         indicates end of file (EOF).
-* @return                 The error code returned
-* *******************************************************************************/
-static int New_Recv (TCP_CONNECTION_INFO *connection, char *buffer_ptr, int buff_length, int nrcvd )
+* @param file_name        The file to read
+* @param config           Receives the configuration; must start zeroed
+* @return                 0 on success, otherwise the line number of the first bad
+*                         line (-1 if the file can't be opened); also left in status
+*****************************************************************************************/
+static int Config_Load ( char *file_name, TCP_CONFIG *config )
 {
-    int status;
-
-    nrcvd = recv ( *connection->sock
-                  , buffer_ptr
-                  , buff_length
-                  , connection->flags );
+    FILE            *file;
+    CONFIG_LISTENER *listener;
+    CONFIG_POOL     *pool;
+    char            line[256];
+    char            section[CONFIG_NAME_LEN];
+    char            name[CONFIG_NAME_LEN];
+    char            *text;
+    char            *key;
+    char            *value;
+    int             line_num;
+    int             status;
 
-    if ( nrcvd < 0 )
+    file = fopen ( file_name, "r" );
+    if ( !file )
+    {
+        config->status = -1;
         return -1;
+    }
+
+    section[0] = '\0';
+    listener = 0;
+    pool = 0;
+
+    for ( line_num = 1; fgets ( line, sizeof ( line ), file ); line_num++ )
+    {
+        text = Trim ( line );
+
+        if ( *text == '[' )
+        {
+            name[0] = '\0';
+            status = sscanf ( text, "[%31[^] ] %31[^]]]", section, name ) < 1 ? -1 : 0;
+
+            if ( status == 0 && strcmp ( section, "listener" ) == 0 )
+            {
+                if ( config->listener_count == CONFIG_MAX_LISTENERS )
+                    status = -1;
+                else
+                {
+                    listener = &config->listeners[config->listener_count++];
+                    strcpy ( listener->name, name );
+                    listener->conn.queue_len = 5;
+                    strcpy ( listener->conn.ipaddr, "0.0.0.0" );
+                }
+            }
+            else if ( status == 0 && strcmp ( section, "endpoints" ) == 0 )
+            {
+                if ( config->pool_count == CONFIG_MAX_POOLS )
+                    status = -1;
+                else
+                {
+                    pool = &config->pools[config->pool_count++];
+                    strcpy ( pool->name, name );
+                    pool->pool = Balancer_Create ( BALANCE_P2C, 3, 1000000 );
+                }
+            }
+            else if ( status == 0 && strcmp ( section, "timeouts" ) != 0 && strcmp ( section, "pool" ) != 0
+                   && strcmp ( section, "tuning" ) != 0 )
+                status = -1;
+
+            if ( status < 0 )
+            {
+                section[0] = '\0';
+                if ( config->status == 0 )
+                    config->status = line_num;
+            }
+            continue;
+        }
+
+        if ( !Parse_Config_Line ( text, &key, &value ) )
+            continue;
+
+        if ( strcmp ( section, "timeouts" ) == 0 )
+            status = Config_Set_Timeout ( &config->timeout_opts, key, value );
+        else if ( strcmp ( section, "pool" ) == 0 )
+            status = Config_Set_Pool ( config, key, value );
+        else if ( strcmp ( section, "tuning" ) == 0 )
+            status = Set_Tuning_Option ( key, value );
+        else if ( strcmp ( section, "listener" ) == 0 )
+            status = Config_Set_Listener ( listener, key, value );
+        else if ( strcmp ( section, "endpoints" ) == 0 )
+            status = Config_Set_Endpoints ( pool, key, value );
+        else
+            status = -1;
+
+        if ( status < 0 && config->status == 0 )
+            config->status = line_num;
+    }
+
+    fclose ( file );
+
+    return config->status;
 }
 
-/*******************************************************************************
-*
-* @fn                     New_Recv_NW
+/******************************************************************************************
 *
-* FUNCTION:               This is a NOWAIT operation.
-*                         Receives data on a connected socket.
+* @fn                     Config_Open_Listener
 *
-* NOTE:
+* FUNCTION:               Creates, binds and listens on a configured listener
 *
-* @param connection       The connection information used to create the socket
-* @param buffer_ptr       Points to the data to be sent..
-* @param buffer_length    The size of the buffer pointed to by buffer_ptr.
-* @param length           The size of the buffer pointed to by buffer_ptr.
-* @param tag              The tag parameter to be used for the nowait operation.
-* @param nrcvd            the number of bytes received by the recv function.
-*                         This is the return value for recv.A zero length message
-*                         indicates end of file (EOF).
-* @return                 The error code returned
-* *****************************************************************************/
-static int New_Recv_NW (TCP_CONNECTION_INFO *connection, char *buffer_ptr, int length, signed long *tag, int nrcvd)
+* @param config           The configuration, for its timeouts
+* @param listener         The listener
+* @return                 0 on success, -1 on error
+*****************************************************************************************/
+static int Config_Open_Listener ( TCP_CONFIG *config, CONFIG_LISTENER *listener )
 {
-    int status;
+    TCP_CONNECTION_INFO *connection;
+    int                 socket_num;
+    int                 on;
 
-    nrcvd = recv_nw ( *connection->sock
-                     , buffer_ptr
-                     , length
-                     , connection->flags
-                     , &tag );
+    connection = &listener->conn;
+    connection->timeout_opts = config->timeout_opts;
 
-    if ( nrcvd < 0 )
+    if ( connection->process_name[0] )
+        Set_Inet_Name ( connection->process_name );
+    Set_SockAddr ( connection, AF_INET );
+    connection->sockaddr_len = sizeof ( struct sockaddr_in );
+
+    socket_num = Create_Socket ( connection, AF_INET, SOCK_STREAM, 0 );
+    if ( socket_num < 0 )
+    {
+        *connection->sock = -1;
         return -1;
+    }
+    *connection->sock = socket_num;
+
+    /* a restarted process must not wait out the old one's TIME_WAITs */
+    on = 1;
+    setsockopt ( socket_num, SOL_SOCKET, SO_REUSEADDR, ( char * ) &on, sizeof ( on ) );
+
+    if ( Set_Bind ( connection ) < 0 || Set_Listen ( connection ) < 0 )
+    {
+        Close_Sock ( connection );
+        return -1;
+    }
+
+    return 0;
 }
 
-/*********************************************************************************
+/******************************************************************************************
 *
-* @fn                   Shutdown_Sock
+* @fn                     Config_Prewarm
 *
-* FUNCTION:             shuts down data transfer, partially
-*                       or completely, on an actively connected
-*                       TCP socket
+* FUNCTION:               Makes the configuration ready before the first request: fills
+*                         the default receive pool, opens every listener and opens each
+*                         endpoint pool's pre-connected connections. Records how long
+*                         it all took in config->stats.
 *
-* NOTE:                 for the "how"
-*                       0 = stops recieving data over socket
-*                       1 = stops sending data over socket
-*                       3 = stops sends and recieves over socket
+* NOTE:                   An endpoint that can't be reached is counted against it in
+*                         the balancer and skipped; startup carries on without it.
 *
-* @param connection     The connection information used to create the socket
-* @param how            Specifies what kind of operations on the socket are to
-*                       be shut down
-* @return               The error code returned
-* *******************************************************************************/
-static int Shutdown_Sock (TCP_CONNECTION_INFO *connection, int how )
+* @param config           A configuration read by Config_Load
+* @return                 0 on success, -1 if a listener could not be opened
+*****************************************************************************************/
+static int Config_Prewarm ( TCP_CONFIG *config )
 {
-    int status;
+    CONFIG_POOL         *pool;
+    TCP_CONNECTION_INFO *connection;
+    int                 status;
+    int                 i;
+    int                 j;
+    int                 k;
 
-    status = shutdown( *connection->sock, how );
+    if ( config->stats.started_at == 0 )
+        config->stats.started_at = Get_Timestamp ( );
+
+    for ( i = 0; i < RECV_POOL_CLASSES; i++ )
+    {
+        if ( config->prewarm[i] > 0 )
+            config->stats.buffers_prewarmed += Recv_Pool_Prewarm ( 0, i, config->prewarm[i] ) / recv_class_sizes[i];
+    }
+
+    status = 0;
+    for ( i = 0; i < config->listener_count; i++ )
+    {
+        if ( Config_Open_Listener ( config, &config->listeners[i] ) == 0 )
+            config->stats.listeners_opened++;
+        else
+        {
+            config->stats.listener_failures++;
+            status = -1;
+        }
+    }
+
+    for ( i = 0; i < config->pool_count; i++ )
+    {
+        pool = &config->pools[i];
+        if ( pool->preconnect <= 0 || pool->pool->count == 0 )
+            continue;
+
+        pool->ready = ( TCP_CONNECTION_INFO * ) malloc ( sizeof ( TCP_CONNECTION_INFO ) * pool->preconnect * pool->pool->count );
+        pool->ready_endpoint = ( int * ) malloc ( sizeof ( int ) * pool->preconnect * pool->pool->count );
+
+        for ( j = 0; j < pool->pool->count; j++ )
+        {
+            for ( k = 0; k < pool->preconnect; k++ )
+            {
+                connection = &pool->ready[pool->ready_count];
+                memset ( connection, 0, sizeof ( TCP_CONNECTION_INFO ) );
+                connection->timeout_opts = config->timeout_opts;
+                connection->tuning = pool->tuning;
+
+                if ( Balancer_Open ( pool->pool, pool->pool->endpoints[j], connection ) < 0 )
+                {
+                    Balancer_Record ( pool->pool, pool->pool->endpoints[j], FAIL );
+                    Clean_Conn_Info ( connection );
+                    config->stats.connect_failures++;
+                    break;
+                }
+
+                Balancer_Record ( pool->pool, pool->pool->endpoints[j], SUCCESS );
+                pool->ready_endpoint[pool->ready_count++] = j;
+                config->stats.connections_opened++;
+            }
+        }
+    }
+
+    config->stats.ready_at = Get_Timestamp ( );
+    config->stats.ready_us = config->stats.ready_at - config->stats.started_at;
 
     return status;
 }
 
-/*********************************************************************************
-*
-* @fn                   Shutdown_Sock
+/******************************************************************************************
 *
-* FUNCTION:             shuts down data transfer, partially
-*                       or completely, on an actively connected
-*                       TCP socket
+* @fn                     Config_Find_Listener
 *
-* NOTE:                 for the "how"
-*                       0 = stops recieving data over socket
-*                       1 = stops sending data over socket
-*                       3 = stops sends and recieves over socket
+* FUNCTION:               Looks a configured listener up by name
 *
-* @param connection     The connection information used to create the socket
-* @param how            Specifies what kind of operations on the socket are to
-*                       be shut down
-* @param tag            The tag parameter to be used for the nowait operation.
-* @return               The error code returned
-* *******************************************************************************/
-static int Shutdown_Sock_NW (TCP_CONNECTION_INFO *connection, int how, signed long *tag )
+* @param config           The configuration
+* @param name             The name from its [listener name] section
+* @return                 The listening connection, 0 if there is none by that name
+*****************************************************************************************/
+static TCP_CONNECTION_INFO *Config_Find_Listener ( TCP_CONFIG *config, char *name )
 {
-    int status;
+    int i;
 
-    status = shutdown_nw ( *connection->sock
-                         , how
-                         , &tag );
+    for ( i = 0; i < config->listener_count; i++ )
+    {
+        if ( strcmp ( config->listeners[i].name, name ) == 0 )
+            return &config->listeners[i].conn;
+    }
 
-    return status;
+    return 0;
 }
 
-/*********************************************************************************
-*
-* @fn                     Close_Sock
+/******************************************************************************************
 *
-* FUNCTION:               closes the socket/fd. & sets it
-*                         back to NULL
+* @fn                     Config_Find_Pool
 *
-* NOTE:
+* FUNCTION:               Looks a configured endpoint pool up by name
 *
-* @param connection       The connection information used to create the socket
-* @return                 The error code returned
-* *******************************************************************************/
-static int Close_Sock (TCP_CONNECTION_INFO *connection )
+* @param config           The configuration
+* @param name             The name from its [endpoints name] section
+* @return                 The pool, 0 if there is none by that name
+*****************************************************************************************/
+static CONFIG_POOL *Config_Find_Pool ( TCP_CONFIG *config, char *name )
 {
-    int status;
+    int i;
 
-    if ( !connection->sock )
+    for ( i = 0; i < config->pool_count; i++ )
     {
-        *connection->sock = 0;
-        memset ( &connection->sock
-               , 0
-               , sizeof ( *connection->sock ) );
-
-        status = 0;
-        return status;
+        if ( strcmp ( config->pools[i].name, name ) == 0 )
+            return &config->pools[i];
     }
 
-    /* We use the nonstop call here you can use close(), but sometimes its finickey*/
-    status = FILE_CLOSE_ ( ( signed short ) *connection->sock );
-
-    memset ( &connection->sock
-           , 0
-           , sizeof ( *connection->sock ) );
-
-    return status;
+    return 0;
 }
 
-/*********************************************************************************
+/******************************************************************************************
 *
-* @fn                     Get_Sock_Name
+* @fn                     Config_Take_Connection
 *
-* FUNCTION:               Get the address and port
-*                         number to which a socket isbound
+* FUNCTION:               Gets a connection to the endpoint the balancer picks: one
+*                         opened by Config_Prewarm if there is one left for that
+*                         endpoint, otherwise a new one through Balancer_Connect. As
+*                         with Balancer_Connect, it is outstanding on the endpoint
+*                         until Balancer_End.
 *
-* NOTE:
+* NOTE:                   A pre-connected connection may have sat unused long enough
+*                         for the endpoint to close it; those are found with
+*                         Conn_Is_Dead and discarded rather than handed out.
 *
-* @param connection       The connection information used to create the socket
-* @return                 The error code returned
-* *******************************************************************************/
-static int Get_Sock_Name (TCP_CONNECTION_INFO *connection )
+* @param pool             The configured endpoint pool
+* @param connection       Receives the connection; must be clean
+* @return                 The endpoint connected to, 0 if none could be reached
+*****************************************************************************************/
+static ENDPOINT *Config_Take_Connection ( CONFIG_POOL *pool, TCP_CONNECTION_INFO *connection )
 {
-    int status;
+    ENDPOINT    *endpoint;
+    int         i;
 
-    status = getsockname ( *connection->sock
-                         , ( struct sockaddr * ) connection->sockaddr
-                         , &connection->sockaddr_len );
+    endpoint = Balancer_Pick ( pool->pool );
+    if ( !endpoint )
+        return 0;
 
-    return status;
+    for ( i = pool->ready_count - 1; i >= 0; i-- )
+    {
+        if ( pool->pool->endpoints[pool->ready_endpoint[i]] != endpoint )
+            continue;
+
+        *connection = pool->ready[i];
+        pool->ready_count--;
+        pool->ready[i] = pool->ready[pool->ready_count];
+        pool->ready_endpoint[i] = pool->ready_endpoint[pool->ready_count];
+
+        if ( Conn_Is_Dead ( connection ) )
+        {
+            Shutdown_Sock ( connection, 2 );
+            Close_Sock ( connection );
+            Clean_Conn_Info ( connection );
+            memset ( connection, 0, sizeof ( TCP_CONNECTION_INFO ) );
+            continue;
+        }
+
+        Balancer_Begin ( endpoint );
+        return endpoint;
+    }
+
+    connection->tuning = pool->tuning;
+
+    return Balancer_Connect ( pool->pool, connection );
 }
 
-/*********************************************************************************
-*
-* @fn                     Get_Sock_Name_NW
+/******************************************************************************************
 *
-* FUNCTION:               Get the address and port
-*                         number to which a socket isbound
+* @fn                     Startup_Record_Request
 *
-* NOTE:
+* FUNCTION:               Called when a request completes; the first call records how
+*                         long after startup it came and how long it took
 *
-* @param connection       The connection information used to create the socket
-* @param tag              The tag parameter to be used for the nowait operation.
-* @return                 The error code returned
-* *******************************************************************************/
-static int Get_Sock_Name_NW ( TCP_CONNECTION_INFO *connection, signed long *tag )
+* @param config           The configuration
+* @param began            When the request started (a Get_Timestamp value)
+* @return                 void
+*****************************************************************************************/
+static void Startup_Record_Request ( TCP_CONFIG *config, TIMESTAMP began )
 {
-    int status;
-
-    status = getsockname_nw ( *connection->sock
-                            , ( struct sockaddr * ) connection->sockaddr
-                            , &connection->sockaddr_len
-                            , &tag );
+    if ( config->stats.first_latency_us != 0 )
+        return;
 
-    return status;
+    config->stats.first_request_us = began - config->stats.ready_at;
+    config->stats.first_latency_us = Get_Timestamp ( ) - began;
+    if ( config->stats.first_latency_us == 0 )
+        config->stats.first_latency_us = 1;
 }
 
 /******************************************************************************************
 *
-* @fn                     Clean_Conn_Info
+* @fn                     Startup_Report
 *
-* FUNCTION:               Clean up memory allocated for sockaddr structure and socket.
-*                         Will also zero out some other elements, for the next transaction.
+* FUNCTION:               Writes the startup figures in readable form
 *
-* @param connection       The connection information used to create the socket
+* @param config           The configuration
+* @param out              Where to write
 * @return                 void
-******************************************************************************************/
-static void Clean_Conn_Info ( TCP_CONNECTION_INFO *connection )
+*****************************************************************************************/
+static void Startup_Report ( TCP_CONFIG *config, FILE *out )
 {
-    if (connection->sockaddr != 0)
-    {
-        free(connection->sockaddr);
-        connection->sockaddr = 0;
-    }
-    if (connection->sock != 0)
-    {
-        free(connection->sock);
-        connection->sock = 0;
-    }
+    STARTUP_STATS *stats;
 
-    /* cleanup all data which is set each time a socket is created */
-    connection->queue_len = '\0';
-    connection->flags = '\0';
-    connection->sockaddr_len = '\0';
-    connection->tag = '\0';
+    stats = &config->stats;
+
+    fprintf ( out, "ready in %lld us: %ld buffers prewarmed, %d listeners (%d failed), %d connections (%d failed)\n"
+            , stats->ready_us, stats->buffers_prewarmed, stats->listeners_opened, stats->listener_failures
+            , stats->connections_opened, stats->connect_failures );
+
+    if ( stats->first_latency_us != 0 )
+        fprintf ( out, "first request %lld us after ready, took %lld us\n"
+                , stats->first_request_us, stats->first_latency_us );
 }
 
 /******************************************************************************************
 *
-* @fn                     Tcp_Set_Options
+* @fn                     Config_Free
 *
-* FUNCTION:               Set's the rest of the addition elements for later use in calling
-*                         process
+* FUNCTION:               Closes the configured listeners and any pre-connected
+*                         connections not taken, and releases the configuration
 *
-* @param connection       The connection information used to create the socket
-* @param flags
-* @param queue_length
-* @param sockaddr_len
+* @param config           The configuration
 * @return                 void
 *****************************************************************************************/
-static void Tcp_Set_Options ( TCP_CONNECTION_INFO *connection, int flags, int queue_length, long sockaddr_len)
+static void Config_Free ( TCP_CONFIG *config )
 {
-    /* pre-set some additional data for later use in calling process */
-    connection->flags = flags;
-    connection->queue_len = queue_length;
-    connection->sockaddr_len = sockaddr_len;
+    CONFIG_POOL *pool;
+    int         i;
+    int         j;
+
+    for ( i = 0; i < config->listener_count; i++ )
+    {
+        /* one that never opened, or failed to, has no socket to close */
+        if ( config->listeners[i].conn.sock && *config->listeners[i].conn.sock >= 0 )
+            Close_Sock ( &config->listeners[i].conn );
+        Clean_Conn_Info ( &config->listeners[i].conn );
+    }
+
+    for ( i = 0; i < config->pool_count; i++ )
+    {
+        pool = &config->pools[i];
+        for ( j = 0; j < pool->ready_count; j++ )
+        {
+            Shutdown_Sock ( &pool->ready[j], 2 );
+            Close_Sock ( &pool->ready[j] );
+            Clean_Conn_Info ( &pool->ready[j] );
+        }
+        free ( pool->ready );
+        free ( pool->ready_endpoint );
+        Balancer_Free ( pool->pool );
+    }
+
+    free ( config );
 }
 
 #pragma PAGE "init_tcpip"
@@ -770,13 +7953,19 @@ static void Tcp_Set_Options ( TCP_CONNECTION_INFO *connection, int flags, int qu
 *                       will inherit the properties of each standard socket / nonstop socket
 *                       function call. Aka will look at the address of those standard functions.
 *
+* NOTE:                 With NSCC_CONFIG set, the configuration is loaded and pre-warmed
+*                       here; check tcp->config->status and tcp->config->stats for how
+*                       that went, as this still returns the TCP structure.
+*
 * @return                 void
 *****************************************************************************************/
 TCP* intialize_tcp ( )
 {
     TCP               *tcp;
-    BOOLEAN            status;
-    ERROR_MESSAGE      error_text;
+    TIMESTAMP          started_at;
+    char              *config_file;
+
+    started_at = Get_Timestamp ( );
 
     /* allocate memory */
     tcp = ( TCP * ) malloc ( sizeof ( TCP ) );
@@ -807,9 +7996,108 @@ TCP* intialize_tcp ( )
     tcp->clean_conn_info = Clean_Conn_Info;
     tcp->set_options = Tcp_Set_Options;
     tcp->set_sockaddr = Set_SockAddr;
+    tcp->capture_start = Capture_Start;
+    tcp->capture_stop = Capture_Stop;
+    tcp->complete_nw = Complete_NW;
+    tcp->capture_get_stats = Capture_Get_Stats;
+    tcp->capture_take_completion = Capture_Take_Completion;
+    tcp->replay_capture = Replay_Capture;
+    tcp->histogram_reset = Histogram_Reset;
+    tcp->histogram_record = Histogram_Record;
+    tcp->histogram_record_corrected = Histogram_Record_Corrected;
+    tcp->histogram_percentile = Histogram_Percentile;
+    tcp->histogram_print = Histogram_Print;
+    tcp->loadgen_run = Loadgen_Run;
+    tcp->loadgen_report = Loadgen_Report;
+    tcp->loadgen_free_stats = Loadgen_Free_Stats;
+    tcp->set_spin_opts = Set_Spin_Opts;
+    tcp->new_recv_spin = New_Recv_Spin;
+    tcp->await_spin = Await_Spin;
+    tcp->await_completion_spin = Await_Completion_Spin;
+    tcp->accept_batch_create = Accept_Batch_Create;
+    tcp->new_accept_batch = New_Accept_Batch;
+    tcp->accept_batch_take = Accept_Batch_Take;
+    tcp->accept_batch_free = Accept_Batch_Free;
+    tcp->registry_create = Registry_Create;
+    tcp->registry_add = Registry_Add;
+    tcp->registry_remove = Registry_Remove;
+    tcp->registry_free = Registry_Free;
+    tcp->set_keepalive = Set_Keepalive;
+    tcp->reap_idle = Reap_Idle;
+    tcp->load_tuning_profiles = Load_Tuning_Profiles;
+    tcp->set_tuning_profile = Set_Tuning_Profile;
+    tcp->recv_pool_create = Recv_Pool_Create;
+    tcp->recv_pool_get_stats = Recv_Pool_Get_Stats;
+    tcp->new_recv_managed = New_Recv_Managed;
+    tcp->recv_buffer_trim = Recv_Buffer_Trim;
+    tcp->registry_trim_buffers = Registry_Trim_Buffers;
+    tcp->balancer_create = Balancer_Create;
+    tcp->balancer_add_endpoint = Balancer_Add_Endpoint;
+    tcp->balancer_pick = Balancer_Pick;
+    tcp->balancer_begin = Balancer_Begin;
+    tcp->balancer_end = Balancer_End;
+    tcp->balancer_connect = Balancer_Connect;
+    tcp->balancer_probe = Balancer_Probe;
+    tcp->balancer_free = Balancer_Free;
+    tcp->breaker_init = Breaker_Init;
+    tcp->breaker_allow = Breaker_Allow;
+    tcp->breaker_record = Breaker_Record;
+    tcp->reconnect_delay = Reconnect_Delay;
+    tcp->make_connect_managed = Make_Connect_Managed;
+    tcp->admission_init = Admission_Init;
+    tcp->admission_check = Admission_Check;
+    tcp->admission_accepting = Admission_Accepting;
+    tcp->admission_on_accept = Admission_On_Accept;
+    tcp->admission_reject = Admission_Reject;
+    tcp->delim_ring_create = Delim_Ring_Create;
+    tcp->delim_ring_free = Delim_Ring_Free;
+    tcp->new_recv_delim = New_Recv_Delim;
+    tcp->delim_next = Delim_Next;
+    tcp->delim_scan_impl = Delim_Scan_Impl;
+    tcp->crc32c = Crc32c;
+    tcp->new_send_frame = New_Send_Frame;
+    tcp->new_send_framev = New_Send_Framev;
+    tcp->new_recv_frame = New_Recv_Frame;
+    tcp->frame_negotiate = Frame_Negotiate;
+    tcp->compress_enable = Compress_Enable;
+    tcp->compress_get_stats = Compress_Get_Stats;
+    tcp->handoff_serve = Handoff_Serve;
+    tcp->handoff_receive = Handoff_Receive;
+    tcp->handoff_drain = Handoff_Drain;
+    tcp->runtime_start = Runtime_Start;
+    tcp->runtime_post = Runtime_Post;
+    tcp->runtime_close = Runtime_Close;
+    tcp->runtime_stop = Runtime_Stop;
+    tcp->recv_pool_free = Recv_Pool_Free;
+    tcp->recv_pool_prewarm = Recv_Pool_Prewarm;
+    tcp->config_load = Config_Load;
+    tcp->config_prewarm = Config_Prewarm;
+    tcp->config_find_listener = Config_Find_Listener;
+    tcp->config_find_pool = Config_Find_Pool;
+    tcp->config_take_connection = Config_Take_Connection;
+    tcp->startup_record_request = Startup_Record_Request;
+    tcp->startup_report = Startup_Report;
+    tcp->config_free = Config_Free;
 
     /* allocate memory for connection structure */
     tcp->tcp_connect = ( TCP_CONNECTION_INFO * ) malloc ( sizeof ( TCP_CONNECTION_INFO ) );
+    memset ( tcp->tcp_connect, 0, sizeof ( TCP_CONNECTION_INFO ) );
+
+    /* read the startup configuration, if there is one, and get it ready now */
+    tcp->config = 0;
+    config_file = getenv ( CONFIG_ENV );
+    if ( config_file && *config_file )
+    {
+        tcp->config = ( TCP_CONFIG * ) malloc ( sizeof ( TCP_CONFIG ) );
+        memset ( tcp->config, 0, sizeof ( TCP_CONFIG ) );
+        tcp->config->stats.started_at = started_at;
+
+        if ( Config_Load ( config_file, tcp->config ) == 0 )
+        {
+            tcp->tcp_connect->timeout_opts = tcp->config->timeout_opts;
+            Config_Prewarm ( tcp->config );
+        }
+    }
 
     return tcp;
 }
@@ -18,6 +18,22 @@
 *		VERSION		DATE	     COMMENTS
 *		-------    ------       ---------------------------------------------------
 *		1.0.0	  1/28/18		Initial Release 
+*		1.1.0	 10/18/26		Traffic capture and time-scaled replay
+*		1.2.0	 10/18/26		Open-loop load generator, latency histograms
+*		1.3.0	 10/18/26		Busy-poll receive mode with adaptive backoff
+*		1.4.0	 10/18/26		Batched accept draining
+*		1.5.0	 10/18/26		Idle-connection reaper and keepalive settings
+*		1.6.0	 10/18/26		Socket tuning profiles
+*		1.7.0	 10/18/26		Adaptive, pooled receive buffers
+*		1.8.0	 10/18/26		Client-side endpoint load balancer
+*		1.9.0	 10/18/26		Managed reconnect with backoff and circuit breaker
+*		1.10.0	 10/18/26		Overload admission control and load shedding
+*		1.11.0	 10/18/26		Delimiter framing with SIMD scanning
+*		1.12.0	 10/18/26		Length framing with CRC32C integrity checking
+*		1.13.0	 10/18/26		Negotiated per-message compression
+*		1.14.0	 10/18/26		Hot restart by handing sockets to a new process
+*		1.15.0	 10/18/26		Thread-per-core runtime
+*		1.16.0	 10/18/26		Startup configuration loader with pre-warming
 *************************************************************************************/
 
 #ifndef _NSCCH_INCLUDE_
@@ -32,20 +48,72 @@
 #include <inet.h>
 #include <time.h>
 #include <stdint.h>
+#include <math.h>
+#include <errno.h>
 #include <cextdecs>
 #include <route.h>
 #include <if.h>
 #include <in.h>
 #include <in6.h>
 #include <ioctl.h>
+#include <tcp.h>
+#include <poll.h>
 #else
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* accept4 */
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
 /* fill in what you would like here....*/
+
+/* Guardian procedures, emulated over POSIX sockets in test/guardian_posix.c, which
+ * numbers files no higher than GUARDIAN_MAX_FILES; a file number is a short */
+#define GUARDIAN_MAX_FILES  32768
+int   socket_set_inet_name ( char *process_name );
+int   socket_nw ( int domain, int type, int protocol, int flags, int sync );
+int   bind_nw ( int sock, struct sockaddr *addr, int addr_len, long tag );
+int   connect_nw ( int sock, struct sockaddr *addr, int addr_len, long tag );
+int   accept_nw ( int sock, struct sockaddr *addr, long *addr_len, long tag );
+int   accept_nw1 ( int sock, struct sockaddr *addr, long *addr_len, long tag, short queue_len );
+int   accept_nw2 ( int new_sock, struct sockaddr *addr, long tag );
+int   accept_nw3 ( int new_sock, struct sockaddr *addr, struct sockaddr *me, long tag );
+int   send_nw ( int sock, char *buffer, int length, int flags, long tag );
+int   recv_nw ( int sock, char *buffer, int length, int flags, long tag );
+int   shutdown_nw ( int sock, int how, long tag );
+int   getsockname_nw ( int sock, struct sockaddr *addr, long *addr_len, long tag );
+int   setsockopt_nw ( int sock, int level, int option, char *value, int value_len, long tag );
+short AWAITIOX ( short *file_num, long *buffer_addr, unsigned short *count_trnsfr, long *tag, long timeout );
+short FILE_GETINFO_ ( short file_num, short *error );
+short FILE_CLOSE_ ( short file_num );
+short FILE_CREATE_ ( char *file_name, short max_len, short *name_len );
+short FILE_OPEN_ ( char *file_name, short name_len, short *file_num, short access, short exclusion, short nowait );
+short POSITION ( short file_num, long position );
+short WRITEX ( short file_num, char *buffer, unsigned short count, unsigned short *count_written, long tag );
+#endif
+
+/* SSE2/AVX2 delimiter scanning, chosen at run time */
+#if defined ( __GNUC__ ) && ( defined ( __x86_64__ ) || defined ( __i386__ ) )
+#define NSCC_X86_SIMD
+#include <immintrin.h>
 #endif
 
 
@@ -75,6 +143,12 @@ typedef char			ERROR_MESSAGE[128];
  * The timeout value for NoWait operations
  * */
 typedef signed long     TIMEOUT;
+/**
+ * @var TIMESTAMP
+ * A point in time, or an interval, in microseconds
+ * (JULIANTIMESTAMP on Guardian)
+ * */
+typedef long long       TIMESTAMP;
 
 /**
  * @enum BOOLEAN
@@ -99,6 +173,275 @@ typedef enum {
  * The error returned from FILE_GETINFO_ when a socket times out
  * */
 #define                 ERR_TIMEOUT   40
+/**
+ * @def ERR_CIRCUIT_OPEN
+ * Library-defined, above the file-system error range: returned
+ * without trying when an endpoint's circuit breaker is open
+ * */
+#define                 ERR_CIRCUIT_OPEN 9001
+/**
+ * @def ERR_CHECKSUM
+ * Library-defined: a framed message arrived with a CRC32C
+ * trailer that does not match its contents
+ * */
+#define                 ERR_CHECKSUM     9002
+/**
+ * @def ERR_FRAME_SIZE
+ * Library-defined: a framed message is larger than the buffer
+ * given to receive it
+ * */
+#define                 ERR_FRAME_SIZE   9003
+/**
+ * @def ERR_DECOMPRESS
+ * Library-defined: a compressed frame could not be expanded
+ * */
+#define                 ERR_DECOMPRESS   9004
+/**
+ * @def ERR_HANDOFF
+ * Library-defined: sockets could not be handed to (or taken
+ * from) another process, or the platform can't pass them
+ * */
+#define                 ERR_HANDOFF      9005
+/**
+ * @def ERR_FRAME_FLAGS
+ * Library-defined: a framed message came compressed on a
+ * connection that did not agree compression in Frame_Negotiate
+ * */
+#define                 ERR_FRAME_FLAGS  9006
+
+/**
+ * @def SPIN_MIN_BUDGET_US
+ * The least an adaptive spin budget shrinks to, so a connection
+ * whose traffic picks up can still find out
+ * */
+#define                 SPIN_MIN_BUDGET_US  5
+/**
+ * @def TUNING_DEFAULT
+ * A tuning option left at this value is not applied, so the
+ * stack default stays in force
+ * */
+#define                 TUNING_DEFAULT      -1
+/**
+ * @def TUNING_MAX_PROFILES / TUNING_NAME_LEN
+ * Room for the built-in profiles plus those loaded from a file
+ * */
+#define                 TUNING_MAX_PROFILES 16
+#define                 TUNING_NAME_LEN     32
+
+/**
+ * @def RECV_POOL_CLASSES / RECV_POOL_MAX_FREE
+ * Managed receive buffers come in 256, 1K, 4K, 16K and 64K
+ * size classes; by default a pool keeps up to 64 free buffers
+ * of each class before giving memory back to the heap
+ * */
+#define                 RECV_POOL_CLASSES   5
+#define                 RECV_POOL_MAX_FREE  64
+/**
+ * @def RECV_AVG_SCALE
+ * Average message sizes are kept in 1/16ths of a byte, so the
+ * average still moves when messages differ by only a few bytes
+ * */
+#define                 RECV_AVG_SCALE      16
+
+/**
+ * @def BALANCE_LEAST_OUTSTANDING / BALANCE_P2C
+ * How the balancer picks an endpoint: the one with the fewest
+ * outstanding requests, or the better of two picked at random
+ * (power of two choices), which avoids every caller piling on
+ * the same momentarily idle endpoint
+ * */
+#define                 BALANCE_LEAST_OUTSTANDING 0
+#define                 BALANCE_P2C               1
+
+/**
+ * @def BALANCE_CONNECT_TO
+ * Centiseconds the balancer waits for a connect, for probes and
+ * for connections with no connect timeout of their own
+ * */
+#define                 BALANCE_CONNECT_TO        300
+
+/**
+ * @def BREAKER_CLOSED / BREAKER_OPEN / BREAKER_HALF_OPEN
+ * Circuit breaker states: connecting normally, failing fast
+ * while the peer is down, and letting one trial through to
+ * see whether it is back
+ * */
+#define                 BREAKER_CLOSED    0
+#define                 BREAKER_OPEN      1
+#define                 BREAKER_HALF_OPEN 2
+
+/**
+ * @def RECONNECT_MIN_DELAY_US
+ * The shortest wait between reconnect attempts, so a policy with
+ * no base_us still doesn't retry in a tight loop
+ * */
+#define                 RECONNECT_MIN_DELAY_US 1000
+
+/**
+ * @def SHED_REJECT / SHED_PAUSE_ACCEPT / SHED_CLOSE_NEWEST
+ * What the server loop does while admission control is
+ * shedding; may be combined. Reject shed requests with a
+ * canned response, stop accepting, or close connections as
+ * soon as they are accepted
+ * */
+#define                 SHED_REJECT       1
+#define                 SHED_PAUSE_ACCEPT 2
+#define                 SHED_CLOSE_NEWEST 4
+
+/**
+ * @def DELIM_LINE / DELIM_BYTE / DELIM_STX_ETX
+ * Delimiter framing modes: lines ending in LF (a CR before it
+ * is dropped, so CR/LF works too), messages ending in a chosen
+ * byte, or messages wrapped in STX ... ETX
+ * */
+#define                 DELIM_LINE    0
+#define                 DELIM_BYTE    1
+#define                 DELIM_STX_ETX 2
+#define                 DELIM_STX     0x02
+#define                 DELIM_ETX     0x03
+
+/**
+ * @def HANDOFF_END / HANDOFF_LISTENER / HANDOFF_ESTABLISHED
+ * What a handoff record carries: nothing (the last record), a
+ * listening socket, or an established connection
+ * */
+#define                 HANDOFF_END         0
+#define                 HANDOFF_LISTENER    1
+#define                 HANDOFF_ESTABLISHED 2
+#define                 HANDOFF_MAGIC       0x4E534348
+
+/**
+ * @def HANDOFF_STEP_US
+ * The longest the new process waits on any one step of a
+ * handoff before giving up and starting cold
+ * */
+#define                 HANDOFF_STEP_US     5000000
+
+/**
+ * @def RUNTIME_MAX_CORES / RUNTIME_RING_SIZE
+ * The most cores the thread-per-core runtime runs on, and the
+ * default depth (a power of two) of each core-to-core queue
+ * */
+#define                 RUNTIME_MAX_CORES   256
+#define                 RUNTIME_RING_SIZE   1024
+
+/**
+ * @def RUNTIME_MSG_CONNECTION
+ * The message type the runtime uses itself to hand an accepted
+ * connection to another core; it never reaches on_message.
+ * Application message types should be 0 or more
+ * */
+#define                 RUNTIME_MSG_CONNECTION -1
+
+/**
+ * @def CONFIG_ENV / CONFIG_MAX_LISTENERS / CONFIG_MAX_POOLS / CONFIG_NAME_LEN
+ * intialize_tcp loads the configuration file named by the
+ * NSCC_CONFIG environment variable, if set. Limits on the
+ * listeners and endpoint pools it may declare, on any number
+ * in it, and on the connections pre-opened to each endpoint
+ * */
+#define                 CONFIG_ENV           "NSCC_CONFIG"
+#define                 CONFIG_MAX_LISTENERS 16
+#define                 CONFIG_MAX_POOLS     16
+#define                 CONFIG_NAME_LEN      32
+#define                 CONFIG_MAX_NUMBER    2147483647L
+#define                 CONFIG_MAX_PRECONNECT 1024
+
+/**
+ * @def FRAME_F_CRC32C
+ * Frame flag: the payload is followed by a 4 byte CRC32C of it.
+ * Set in a connection's frame_opts to checksum what it sends;
+ * received frames are checked whenever they carry the flag
+ * */
+#define                 FRAME_F_CRC32C  0x00000001
+/**
+ * @def FRAME_F_COMPRESSED
+ * Frame flag: the payload is the original length (4 bytes,
+ * network order) followed by an LZ4-format block. Only sent
+ * once Frame_Negotiate has found the peer supports it
+ * */
+#define                 FRAME_F_COMPRESSED 0x00000002
+/**
+ * @def FRAME_HELLO_MAGIC
+ * Opens the feature exchange done by Frame_Negotiate
+ * */
+#define                 FRAME_HELLO_MAGIC  0x4E534346
+/**
+ * @def COMPRESS_THRESHOLD / COMPRESS_HASH_BITS
+ * Payloads smaller than the threshold are not worth compressing.
+ * The match finder hashes into 2^COMPRESS_HASH_BITS slots
+ * */
+#define                 COMPRESS_THRESHOLD 512
+#define                 COMPRESS_HASH_BITS 12
+/**
+ * @def FRAME_COALESCE
+ * Frames up to this size are assembled and sent with a single
+ * send; larger ones are sent piece by piece without copying
+ * */
+#define                 FRAME_COALESCE  4096
+
+/**
+ * @def CAPTURE_SEND / CAPTURE_RECV
+ * The direction of a captured payload, as seen from this process
+ * */
+#define                 CAPTURE_SEND  1
+#define                 CAPTURE_RECV  2
+/**
+ * @def CAPTURE_BUFFER_SIZE
+ * Size of each of the two capture staging buffers. Must be even
+ * and no larger than the 57344 byte WRITEX limit. A payload that
+ * does not fit in one is written through them piece by piece
+ * */
+#define                 CAPTURE_BUFFER_SIZE 32768
+/**
+ * @def CAPTURE_MAGIC
+ * Written once at the head of a newly created capture file
+ * */
+#define                 CAPTURE_MAGIC "NSCCCAP2"
+/**
+ * @def CAPTURE_HEADER_SIZE
+ * The bytes a CAPTURE_RECORD takes in the capture file
+ * */
+#define                 CAPTURE_HEADER_SIZE 20
+/**
+ * @def REPLAY_FLIP
+ * Replay flag: swap the captured directions, so a capture taken
+ * on the server side drives a server from the client side
+ * */
+#define                 REPLAY_FLIP   0x1
+/**
+ * @def REPLAY_MAX_CONNS
+ * The most distinct captured connections a replay will re-open
+ * */
+#define                 REPLAY_MAX_CONNS 64
+
+/**
+ * @def HISTOGRAM_SUB_BUCKETS / HISTOGRAM_COUNTS
+ * Latency histograms are log-linear: values below 256us are kept
+ * exactly, above that each power of two is split into 128 slots,
+ * giving better than 1% precision up to 2^40us.
+ * */
+#define                 HISTOGRAM_SUB_BUCKETS 128
+#define                 HISTOGRAM_COUNTS      4480
+/**
+ * @def LOADGEN_CONSTANT / LOADGEN_POISSON
+ * The arrival schedule used by the load generator
+ * */
+#define                 LOADGEN_CONSTANT 0
+#define                 LOADGEN_POISSON  1
+/**
+ * @def LOADGEN_MAX_CONNS / LOADGEN_MAX_BACKLOG
+ * Limits on load generator connections, and on requests that
+ * are due but still waiting for a free connection
+ * */
+#define                 LOADGEN_MAX_CONNS   256
+#define                 LOADGEN_MAX_BACKLOG 65536
+/**
+ * @def LOADGEN_DRAIN_SECS
+ * How long a load generator run waits for outstanding responses
+ * once the last request is due, unless drain_secs says otherwise
+ * */
+#define                 LOADGEN_DRAIN_SECS  5
 
 
 /***************************************************************
@@ -127,6 +470,225 @@ typedef struct _timeout_opts
     TIMEOUT     variable_to;
 } TIMEOUT_OPTS;
 
+/***************************************************************
+*
+*	@struct		SOCK_TUNING
+*	Purpose:	A named set of socket options, applied by
+*				Get_Sock / Get_Sock_NW to every socket created for
+*				a connection that has selected it. Built in are
+*				"default", "low-latency", "bulk-throughput" and
+*				"many-idle"; more can be loaded from a file with
+*				Load_Tuning_Profiles.
+*
+*				Each option is TUNING_DEFAULT or the value to set.
+*
+***************************************************************/
+typedef struct _sock_tuning
+{
+    char        name[TUNING_NAME_LEN];
+    int         nodelay;
+    int         sndbuf;
+    int         rcvbuf;
+    int         quickack;
+    int         user_timeout_ms;
+    int         linger_on;
+    int         linger_secs;
+    int         fastopen;
+    int         keepalive_idle;
+    int         keepalive_interval;
+    int         keepalive_probes;
+} SOCK_TUNING;
+
+/***************************************************************
+*
+*	@struct		SPIN_OPTS
+*	Purpose:	Opts a connection, or an AWAITIOX loop, into busy
+*				polling. While "enabled", a receive or completion
+*				is polled without blocking for up to a budget of
+*				at most "idle_budget_us"; only then does the caller
+*				block. The budget adapts to the traffic: it grows
+*				while data turns up soon after spinning gives up,
+*				and shrinks while waits run far past it.
+*
+*				"busy_poll_us" is handed to SO_BUSY_POLL where the
+*				stack has it (it is ignored elsewhere), so the
+*				kernel also polls the device queue.
+*
+***************************************************************/
+typedef struct _spin_opts
+{
+    BOOLEAN     enabled;
+    TIMESTAMP   idle_budget_us;
+    int         busy_poll_us;
+} SPIN_OPTS;
+
+/***************************************************************
+*
+*	@struct		SPIN_STATS
+*	Purpose:	Where busy polling spent its time. "spin_hits"
+*				counts waits satisfied while spinning and
+*				"block_hits" those that ran out of budget and
+*				blocked; together with the times they show what
+*				the CPU spent is buying. "budget_us" is the spin
+*				budget currently in use.
+*
+***************************************************************/
+typedef struct _spin_stats
+{
+    TIMESTAMP   spin_us;
+    TIMESTAMP   blocked_us;
+    long        spin_hits;
+    long        block_hits;
+    long        polls;
+    TIMESTAMP   budget_us;
+} SPIN_STATS;
+
+/***************************************************************
+*
+*	@struct		RECV_POOL
+*	Purpose:	Shared free lists of receive buffers, one per size
+*				class, that managed connections borrow from. A
+*				connection with no pool of its own uses the
+*				process-wide default. "avg_msg" averages the
+*				messages of every connection using the pool (in
+*				RECV_AVG_SCALE units) and sizes the first buffer
+*				of a connection that has no history yet.
+*
+***************************************************************/
+typedef struct _recv_pool
+{
+    void        *free_list[RECV_POOL_CLASSES];
+    long        free_count[RECV_POOL_CLASSES];
+    long        in_use[RECV_POOL_CLASSES];
+    long long   bytes_in_use;
+    long long   bytes_cached;
+    int         max_free;
+    int         avg_msg;
+} RECV_POOL;
+
+/***************************************************************
+*
+*	@struct		RECV_BUFFER
+*	Purpose:	The receive buffer a managed connection currently
+*				holds, if any, and the running average of the
+*				message sizes it has seen, in RECV_AVG_SCALE units.
+*
+***************************************************************/
+typedef struct _recv_buffer
+{
+    char        *data;
+    int         size;
+    int         size_class;
+    int         avg_msg;
+    TIMESTAMP   last_used;
+} RECV_BUFFER;
+
+/***************************************************************
+*
+*	@struct		RECONNECT_POLICY
+*	Purpose:	How Make_Connect_Managed retries. The wait before
+*				retry n is base_us * multiplier^n, capped at
+*				max_us, of which the "jitter" fraction (0.0 - 1.0)
+*				is randomised so callers don't retry in step.
+*				After failure_threshold failures in a row the
+*				breaker opens for open_us. One call makes at
+*				most max_attempts attempts (0 for no limit but
+*				the breaker's); with neither limit set it makes
+*				a single attempt.
+*
+***************************************************************/
+typedef struct _reconnect_policy
+{
+    TIMESTAMP   base_us;
+    TIMESTAMP   max_us;
+    double      multiplier;
+    double      jitter;
+    int         failure_threshold;
+    TIMESTAMP   open_us;
+    int         max_attempts;
+} RECONNECT_POLICY;
+
+/***************************************************************
+*
+*	@struct		CIRCUIT_BREAKER
+*	Purpose:	The health of one endpoint as seen by its callers.
+*				Connections to the same endpoint should share one
+*				breaker. "on_restore" (optional) is called with
+*				"context" when a connection succeeds after the
+*				endpoint had been failing.
+*
+***************************************************************/
+struct _tcp_connection_info;
+
+typedef struct _circuit_breaker
+{
+    RECONNECT_POLICY    policy;
+    int                 state;
+    int                 consecutive_failures;
+    TIMESTAMP           opened_at;
+    BOOLEAN             trial_pending;
+    unsigned long long  seed;
+    long                attempts;
+    long                failures;
+    long                rejected;
+    long                restores;
+    void(*on_restore)   (struct _tcp_connection_info *, void *);
+    void                *context;
+} CIRCUIT_BREAKER;
+
+/***************************************************************
+*
+*	@struct		COMPRESS_STATS
+*	Purpose:	What compression is doing for one connection.
+*				"bytes_in" is the payload handed to the framed
+*				send path and "bytes_out" what went on the wire
+*				for it, so bytes_in / bytes_out is the ratio.
+*				"cpu_us" is the CPU time spent compressing and
+*				decompressing: the calling thread's off Guardian,
+*				the process's on it.
+*
+***************************************************************/
+typedef struct _compress_stats
+{
+    long long   bytes_in;
+    long long   bytes_out;
+    long        compressed;
+    long        incompressible;
+    long        skipped;
+    long        decompressed;
+    TIMESTAMP   cpu_us;
+} COMPRESS_STATS;
+
+/***************************************************************
+*
+*	@struct		COMPRESS_CTX
+*	Purpose:	Per-connection compression state, kept between
+*				messages so nothing is allocated per message: the
+*				match finder's hash table and the scratch buffers,
+*				which only ever grow. Sending and receiving have
+*				their own, so a send and a receive in progress at
+*				once never share a buffer. "base" lets the table be
+*				reused without clearing it for every message.
+*				After several incompressible payloads in a row,
+*				"skip" messages go out without being tried.
+*
+***************************************************************/
+typedef struct _compress_ctx
+{
+    uint32_t        table[1 << COMPRESS_HASH_BITS];
+    uint32_t        base;
+    char            *scratch;
+    int             scratch_size;
+    char            *recv_scratch;
+    int             recv_scratch_size;
+    char            *gather;
+    int             gather_size;
+    int             threshold;
+    int             misses;
+    int             skip;
+    COMPRESS_STATS  stats;
+} COMPRESS_CTX;
+
 /***************************************************************
 *
 *	@struct		TCP_CONNECTION_INFO
@@ -150,8 +712,626 @@ typedef struct _tcp_connection_info
     struct sockaddr_in	*sockaddr;
     int				    sock_shutdown_how;
     TIMEOUT_OPTS        timeout_opts;
+    SPIN_OPTS           spin_opts;
+    SPIN_STATS          spin_stats;
+    TIMESTAMP           last_activity;
+    SOCK_TUNING         *tuning;
+    RECV_POOL           *recv_pool;
+    RECV_BUFFER         recv_buf;
+    CIRCUIT_BREAKER     *breaker;
+    uint32_t            frame_opts;
+    COMPRESS_CTX        *compress;
+    int32_t             capture_id;
+    char                *nw_send_buffer;
+    char                *nw_recv_buffer;
 } TCP_CONNECTION_INFO;
 
+/***************************************************************
+*
+*	@struct		HANDOFF_RECORD
+*	Purpose:	The state of one socket as it is passed from an
+*				old server process to its replacement, alongside
+*				the descriptor itself. Both ends are the same
+*				build on the same host, so it goes in host order.
+*				Pointers can't cross, so the tuning profile goes
+*				by name and compression by its threshold (0 for
+*				none); receive buffers are not carried over.
+*
+***************************************************************/
+typedef struct _handoff_record
+{
+    uint32_t            magic;
+    int                 kind;
+    SERVER_ADDR         ipaddr;
+    TCP_PORT            port;
+    INET_NAME           process_name;
+    long                sockaddr_len;
+    int                 flags;
+    int                 queue_len;
+    int                 sock_shutdown_how;
+    TIMEOUT_OPTS        timeout_opts;
+    SPIN_OPTS           spin_opts;
+    char                tuning[TUNING_NAME_LEN];
+    uint32_t            frame_opts;
+    int                 compress_threshold;
+    BOOLEAN             has_sockaddr;
+    struct sockaddr_in  sockaddr;
+} HANDOFF_RECORD;
+
+/***************************************************************
+*
+*	@struct		ACCEPT_BATCH
+*	Purpose:	Holds the connections drained by one call to
+*				New_Accept_Batch. The records, with their sock and
+*				sockaddr, are allocated once up front so a burst
+*				of connections costs no allocation while it is
+*				being drained.
+*
+*				Entries are only good until the next drain; use
+*				Accept_Batch_Take to keep one.
+*
+***************************************************************/
+typedef struct _accept_batch
+{
+    TCP_CONNECTION_INFO *conns;
+    int                 capacity;
+    int                 count;
+    long                batches;
+    long                accepted;
+} ACCEPT_BATCH;
+
+/***************************************************************
+*
+*	@struct		REAP_STATS
+*	Purpose:	What the idle reaper did. "reclaimed_bytes" counts
+*				the connection records freed plus whatever the
+*				registry's on_reap callback reports releasing.
+*
+***************************************************************/
+typedef struct _reap_stats
+{
+    long                scanned;
+    long                idle_closed;
+    long                dead_closed;
+    long long           reclaimed_bytes;
+} REAP_STATS;
+
+/***************************************************************
+*
+*	@struct		CONN_REGISTRY
+*	Purpose:	The set of live connections a process is looking
+*				after, swept by Reap_Idle. "on_reap" is called for
+*				each connection just before it is freed and returns
+*				the number of bytes its owner released with it.
+*
+***************************************************************/
+typedef struct _conn_registry
+{
+    TCP_CONNECTION_INFO **conns;
+    int                 count;
+    int                 capacity;
+    int                 cursor;
+    long(*on_reap)      (TCP_CONNECTION_INFO *);
+    REAP_STATS          totals;
+} CONN_REGISTRY;
+
+/***************************************************************
+*
+*	@struct		CORE_MSG
+*	Purpose:	A message from one runtime core to another.
+*				"data" is handed over with it; the receiving core
+*				owns it from then on.
+*
+***************************************************************/
+typedef struct _core_msg
+{
+    int                 from;
+    int                 type;
+    void                *data;
+} CORE_MSG;
+
+/***************************************************************
+*
+*	@struct		CORE_RING
+*	Purpose:	A bounded single-producer, single-consumer queue
+*				of messages from one core to another. "head" is
+*				only written by the receiving core and "tail" by
+*				the sending one; they are kept on separate cache
+*				lines so the two cores don't fight over one.
+*
+***************************************************************/
+typedef struct _core_ring
+{
+    CORE_MSG            *slots;
+    uint32_t            mask;
+    uint32_t            head;
+    char                pad[64 - sizeof ( uint32_t )];
+    uint32_t            tail;
+} CORE_RING;
+
+/***************************************************************
+*
+*	@struct		CORE_STATS
+*	Purpose:	What one runtime core has done. "queue_full"
+*				counts messages it could not post because the
+*				other core's queue was full.
+*
+***************************************************************/
+typedef struct _core_stats
+{
+    long                loops;
+    long                accepted;
+    long                closed;
+    long                msgs_in;
+    long                msgs_out;
+    long                queue_full;
+} CORE_STATS;
+
+struct _core;
+
+/***************************************************************
+*
+*	@struct		RUNTIME_OPTS
+*	Purpose:	How to run the thread-per-core runtime, and the
+*				callbacks each core's loop makes:
+*				  on_start    once, on the core, before the loop
+*				  on_accept   for each connection it accepts
+*				  on_readable when a connection has data (or has
+*				              closed); return -1 to have it closed
+*				  on_message  for each message from another core
+*				  on_stop     once, on the core, after the loop
+*				Any of them may be 0. "cores" 0 means one per CPU
+*				the process may run on.
+*
+***************************************************************/
+typedef struct _runtime_opts
+{
+    int                 cores;
+    BOOLEAN             pin;
+    SERVER_ADDR         ipaddr;
+    TCP_PORT            port;
+    int                 queue_len;
+    int                 ring_size;
+    int                 poll_ms;
+    TIMESTAMP           idle_timeout_us;
+    void(*on_start)     (struct _core *);
+    void(*on_accept)    (struct _core *, TCP_CONNECTION_INFO *);
+    int(*on_readable)   (struct _core *, TCP_CONNECTION_INFO *);
+    void(*on_message)   (struct _core *, CORE_MSG *);
+    void(*on_stop)      (struct _core *);
+    void                *user;
+} RUNTIME_OPTS;
+
+/***************************************************************
+*
+*	@struct		CORE
+*	Purpose:	One core of the runtime: a thread pinned to a CPU
+*				with its own listener, connections, receive buffer
+*				pool and poll loop. Nothing in it is touched by
+*				another core except its inbox, which has one queue
+*				per sending core. "user" is the application's own
+*				per-core state. "closing" holds connections closed
+*				during the current pass of the loop until it ends;
+*				"next_core" is where a core that listens for all
+*				of them deals its next connection.
+*
+***************************************************************/
+typedef struct _core
+{
+    int                 index;
+    int                 cpu;
+    struct _runtime     *runtime;
+    TCP_CONNECTION_INFO listener;
+    CONN_REGISTRY       *registry;
+    RECV_POOL           *recv_pool;
+    ACCEPT_BATCH        *accept_batch;
+    CORE_RING           *inbox;
+    int                 wake[2];
+    CONN_REGISTRY       *closing;
+    int                 next_core;
+    void                *user;
+    CORE_STATS          stats;
+} CORE;
+
+/***************************************************************
+*
+*	@struct		RUNTIME
+*	Purpose:	A running set of cores, from Runtime_Start
+*
+***************************************************************/
+typedef struct _runtime
+{
+    RUNTIME_OPTS        opts;
+    CORE                *cores;
+    int                 count;
+    int                 started;
+    int                 ready;
+    int                 stop;
+    void                *threads;
+} RUNTIME;
+
+/***************************************************************
+*
+*	@struct		ENDPOINT
+*	Purpose:	One backend the balancer can route to: an address
+*				and port reached through a given TCP/IP process.
+*				An endpoint that fails "eject_after" times in a
+*				row is ejected until a probe connects again.
+*
+***************************************************************/
+typedef struct _endpoint
+{
+    SERVER_ADDR         ipaddr;
+    TCP_PORT            port;
+    INET_NAME           process_name;
+    long                outstanding;
+    long                consecutive_failures;
+    BOOLEAN             ejected;
+    TIMESTAMP           next_probe_at;
+    long                requests;
+    long                failures;
+    long                ejections;
+} ENDPOINT;
+
+/***************************************************************
+*
+*	@struct		ENDPOINT_POOL
+*	Purpose:	The set of endpoints a client balances over, and
+*				how it does so.
+*
+***************************************************************/
+typedef struct _endpoint_pool
+{
+    ENDPOINT            **endpoints;
+    int                 count;
+    int                 capacity;
+    int                 policy;
+    int                 eject_after;
+    TIMESTAMP           probe_interval_us;
+    TIMEOUT             connect_to;
+    unsigned long long  seed;
+} ENDPOINT_POOL;
+
+/***************************************************************
+*
+*	@struct		ADMISSION_STATS
+*	Purpose:	The shedding decisions admission control has made,
+*				so it can be checked that goodput ("admitted")
+*				holds up past saturation.
+*
+***************************************************************/
+typedef struct _admission_stats
+{
+    long                admitted;
+    long                shed;
+    long                rejected;
+    long                accepts_paused;
+    long                closed;
+    long                dropping_entered;
+    BOOLEAN             dropping;
+    TIMESTAMP           last_delay_us;
+    TIMESTAMP           max_delay_us;
+} ADMISSION_STATS;
+
+/***************************************************************
+*
+*	@struct		ADMISSION_CTRL
+*	Purpose:	CoDel-style admission control for a server loop.
+*				Requests are stamped when they arrive and checked
+*				when the loop gets to them. Once the queueing delay
+*				has stayed above "target_us" for "interval_us",
+*				requests are shed, at a rate that rises until the
+*				delay comes back under target, or until no request
+*				has been checked for an interval.
+*
+***************************************************************/
+typedef struct _admission_ctrl
+{
+    TIMESTAMP           target_us;
+    TIMESTAMP           interval_us;
+    int                 actions;
+    char                *reject_msg;
+    int                 reject_len;
+    TIMESTAMP           first_above_time;
+    TIMESTAMP           drop_next;
+    long                drop_count;
+    TIMESTAMP           last_check;
+    ADMISSION_STATS     stats;
+} ADMISSION_CTRL;
+
+/***************************************************************
+*
+*	@struct		DELIM_RING
+*	Purpose:	A receive ring for delimiter-framed peers. Data is
+*				received straight into the ring and messages are
+*				handed out as views into it, so nothing is copied.
+*				"head" and "tail" only ever count up; the ring size
+*				is a power of two and positions are taken modulo it.
+*				"scanned" remembers how far past head is known to
+*				hold no delimiter, so a partial message is not
+*				scanned again on every receive.
+*
+***************************************************************/
+typedef struct _delim_ring
+{
+    char                *data;
+    unsigned long       size;
+    unsigned long       head;
+    unsigned long       tail;
+    unsigned long       scanned;
+    int                 mode;
+    char                delim;
+    long                messages;
+    long                overflows;
+} DELIM_RING;
+
+/***************************************************************
+*
+*	@struct		MSG_VIEW
+*	Purpose:	One message in a DELIM_RING, delimiters removed. A
+*				message that wraps round the end of the ring comes
+*				in two parts; otherwise len[1] is 0. The view is
+*				good until the next receive into the ring.
+*
+***************************************************************/
+typedef struct _msg_view
+{
+    char                *part[2];
+    int                 len[2];
+    int                 total;
+} MSG_VIEW;
+
+/***************************************************************
+*
+*	@struct		FRAME_HDR
+*	Purpose:	Leads every message on the framed path: the payload
+*				length and the FRAME_F_ flags, both in network
+*				order.
+*
+***************************************************************/
+typedef struct _frame_hdr
+{
+    uint32_t            length;
+    uint32_t            flags;
+} FRAME_HDR;
+
+/***************************************************************
+*
+*	@struct		FRAME_IOV
+*	Purpose:	One piece of a payload handed to New_Send_Framev,
+*				so a message can be sent from several buffers
+*				without first being copied into one.
+*
+***************************************************************/
+typedef struct _frame_iov
+{
+    char                *base;
+    int                 length;
+} FRAME_IOV;
+
+/***************************************************************
+*
+*	@struct		CAPTURE_RECORD
+*	Purpose:	The header written ahead of every captured
+*				payload. The payload follows immediately and is
+*				padded to an even byte count, so records never
+*				straddle an odd boundary in the unstructured file.
+*
+*				In the file the fields are written one after the
+*				other, big-endian and without padding, taking
+*				CAPTURE_HEADER_SIZE bytes, so a capture taken on
+*				one system can be replayed from another. "conn_id"
+*				numbers connections in the order they were first
+*				captured; socket numbers are reused too quickly.
+*
+***************************************************************/
+typedef struct _capture_record
+{
+    int64_t             timestamp;
+    int32_t             conn_id;
+    int16_t             direction;
+    int16_t             reserved;
+    int32_t             length;
+} CAPTURE_RECORD;
+
+/***************************************************************
+*
+*	@struct		CAPTURE_STATS
+*	Purpose:	Running counters for the capture file. "dropped"
+*				counts payloads that were not recorded because
+*				both staging buffers were still in flight;
+*				"errors" counts buffer writes the file system
+*				failed, whose records are lost.
+*
+***************************************************************/
+typedef struct _capture_stats
+{
+    long                records;
+    long long           bytes;
+    long                dropped;
+    long                writes;
+    long                errors;
+} CAPTURE_STATS;
+
+/***************************************************************
+*
+*	@struct		REPLAY_STATS
+*	Purpose:	The results of a capture replay. Latency is taken
+*				from a replayed send to the completion of the
+*				receive that followed it in the capture.
+*
+***************************************************************/
+typedef struct _replay_stats
+{
+    long                messages_sent;
+    long                messages_recv;
+    long long           bytes_sent;
+    long long           bytes_recv;
+    long                errors;
+    TIMESTAMP           elapsed_us;
+    TIMESTAMP           latency_min_us;
+    TIMESTAMP           latency_max_us;
+    TIMESTAMP           latency_total_us;
+    long                latency_samples;
+    double              messages_per_sec;
+    double              bytes_per_sec;
+} REPLAY_STATS;
+
+/***************************************************************
+*
+*	@struct		LATENCY_HISTOGRAM
+*	Purpose:	A fixed-size log-linear histogram of latencies in
+*				microseconds, in the spirit of HdrHistogram. Around
+*				35K, so allocate it rather than placing it on the
+*				stack.
+*
+***************************************************************/
+typedef struct _latency_histogram
+{
+    long long           counts[HISTOGRAM_COUNTS];
+    long long           total_count;
+    TIMESTAMP           min;
+    TIMESTAMP           max;
+} LATENCY_HISTOGRAM;
+
+/***************************************************************
+*
+*	@struct		LOADGEN_OPTS
+*	Purpose:	Describes the load to generate. Requests are sent
+*				at "rate" per second across "connections", on a
+*				fixed (LOADGEN_CONSTANT) or random (LOADGEN_POISSON)
+*				schedule, whether or not earlier requests have been
+*				answered. Each request is answered by exactly
+*				"response_len" bytes. Responses still outstanding
+*				"drain_secs" after the run are abandoned.
+*
+***************************************************************/
+typedef struct _loadgen_opts
+{
+    int                 connections;
+    double              rate;
+    int                 arrival;
+    int                 duration_secs;
+    char                *request;
+    int                 request_len;
+    int                 response_len;
+    unsigned long long  seed;
+    int                 drain_secs;
+} LOADGEN_OPTS;
+
+/***************************************************************
+*
+*	@struct		LOADGEN_STATS
+*	Purpose:	The results of a load generator run.
+*
+*				"corrected" measures from the time each request was
+*				scheduled to go out, so time spent queued behind a
+*				slow server is counted. "uncorrected" measures from
+*				the time it actually went out, as a closed-loop
+*				benchmark would. "per_second" holds the number of
+*				responses completed in each second of the run and is
+*				freed by Loadgen_Free_Stats.
+*
+***************************************************************/
+typedef struct _loadgen_stats
+{
+    LATENCY_HISTOGRAM   corrected;
+    LATENCY_HISTOGRAM   uncorrected;
+    long                sent;
+    long                completed;
+    long                errors;
+    long                overflows;
+    long                backlog_max;
+    TIMESTAMP           elapsed_us;
+    long                *per_second;
+    int                 seconds;
+} LOADGEN_STATS;
+
+/***************************************************************
+*
+*	@struct		STARTUP_STATS
+*	Purpose:	How long the process took to get ready, and what
+*				its first request then cost. "ready_us" runs from
+*				intialize_tcp being called to the end of
+*				pre-warming; "first_request_us" from then to the
+*				first request, which took "first_latency_us".
+*
+***************************************************************/
+typedef struct _startup_stats
+{
+    TIMESTAMP           started_at;
+    TIMESTAMP           ready_at;
+    TIMESTAMP           ready_us;
+    TIMESTAMP           first_request_us;
+    TIMESTAMP           first_latency_us;
+    long                buffers_prewarmed;
+    int                 listeners_opened;
+    int                 listener_failures;
+    int                 connections_opened;
+    int                 connect_failures;
+} STARTUP_STATS;
+
+/***************************************************************
+*
+*	@struct		CONFIG_LISTENER
+*	Purpose:	A named listener from the configuration, opened
+*				(bound and listening) by Config_Prewarm
+*
+***************************************************************/
+typedef struct _config_listener
+{
+    char                name[CONFIG_NAME_LEN];
+    TCP_CONNECTION_INFO conn;
+} CONFIG_LISTENER;
+
+/***************************************************************
+*
+*	@struct		CONFIG_POOL
+*	Purpose:	A named set of endpoints from the configuration,
+*				balanced over by "pool". Config_Prewarm opens
+*				"preconnect" connections to each endpoint; they
+*				wait in "ready" (with the endpoint each is to in
+*				"ready_endpoint") for Config_Take_Connection.
+*
+***************************************************************/
+typedef struct _config_pool
+{
+    char                name[CONFIG_NAME_LEN];
+    ENDPOINT_POOL       *pool;
+    SOCK_TUNING         *tuning;
+    INET_NAME           process_name;
+    int                 preconnect;
+    TCP_CONNECTION_INFO *ready;
+    int                 *ready_endpoint;
+    int                 ready_count;
+} CONFIG_POOL;
+
+/***************************************************************
+*
+*	@struct		TCP_CONFIG
+*	Purpose:	A process's network set-up as read from its
+*				configuration file: timeouts, receive pool sizes
+*				and how many buffers of each class to allocate up
+*				front, tuning profiles, listeners and endpoint
+*				pools. "status" is 0, or the first bad line of
+*				the file (-1 if it could not be read). The one
+*				intialize_tcp loads is pre-warmed only when
+*				"status" is 0; check it, and the failure counts
+*				in "stats", before relying on the set-up.
+*
+***************************************************************/
+typedef struct _tcp_config
+{
+    int                 status;
+    TIMEOUT_OPTS        timeout_opts;
+    int                 prewarm[RECV_POOL_CLASSES];
+    CONFIG_LISTENER     listeners[CONFIG_MAX_LISTENERS];
+    int                 listener_count;
+    CONFIG_POOL         pools[CONFIG_MAX_POOLS];
+    int                 pool_count;
+    STARTUP_STATS       stats;
+} TCP_CONFIG;
+
 /***************************************************************
 *
 *	@struct		TCP
@@ -165,6 +1345,7 @@ typedef struct _tcp_connection_info
 typedef	struct _tcp
 {
     TCP_CONNECTION_INFO				*tcp_connect;
+    TCP_CONFIG						*config;
     void(*set_inet_name)			(INET_NAME);
     int(*get_sock)					(TCP_CONNECTION_INFO *, int, int, int);
     int(*get_sock_nw)				(TCP_CONNECTION_INFO *, int, int, int, int);
@@ -190,19 +1371,94 @@ typedef	struct _tcp
     void(*clean_conn_info)			(TCP_CONNECTION_INFO *);
     void(*set_options)	     		(TCP_CONNECTION_INFO *, int, int, long);
     void(*set_sockaddr)				(TCP_CONNECTION_INFO *, short);
+    int(*capture_start)				(char *);
+    int(*capture_stop)				(void);
+    void(*complete_nw)				(TCP_CONNECTION_INFO *, long, int);
+    void(*capture_get_stats)		(CAPTURE_STATS *);
+    BOOLEAN(*capture_take_completion)	(short, short);
+    int(*replay_capture)			(TCP_CONNECTION_INFO *, char *, int, int, REPLAY_STATS *);
+    void(*histogram_reset)			(LATENCY_HISTOGRAM *);
+    void(*histogram_record)			(LATENCY_HISTOGRAM *, TIMESTAMP);
+    void(*histogram_record_corrected)	(LATENCY_HISTOGRAM *, TIMESTAMP, TIMESTAMP);
+    TIMESTAMP(*histogram_percentile)	(LATENCY_HISTOGRAM *, double);
+    void(*histogram_print)			(LATENCY_HISTOGRAM *, FILE *);
+    int(*loadgen_run)				(TCP_CONNECTION_INFO *, LOADGEN_OPTS *, LOADGEN_STATS *);
+    void(*loadgen_report)			(LOADGEN_STATS *, FILE *);
+    void(*loadgen_free_stats)		(LOADGEN_STATS *);
+    int(*set_spin_opts)				(TCP_CONNECTION_INFO *, SPIN_OPTS *);
+    int(*new_recv_spin)				(TCP_CONNECTION_INFO *, char *, int);
+    short(*await_spin)				(short *, long *, unsigned short *, signed long *, signed long, SPIN_OPTS *, SPIN_STATS *);
+    short(*await_completion_spin)	(TCP_CONNECTION_INFO *, unsigned short *, signed long *);
+    ACCEPT_BATCH*(*accept_batch_create)	(int);
+    int(*new_accept_batch)			(TCP_CONNECTION_INFO *, ACCEPT_BATCH *, int);
+    void(*accept_batch_take)		(ACCEPT_BATCH *, int, TCP_CONNECTION_INFO *);
+    void(*accept_batch_free)		(ACCEPT_BATCH *);
+    CONN_REGISTRY*(*registry_create)	(int);
+    void(*registry_add)				(CONN_REGISTRY *, TCP_CONNECTION_INFO *);
+    void(*registry_remove)			(CONN_REGISTRY *, TCP_CONNECTION_INFO *);
+    void(*registry_free)			(CONN_REGISTRY *);
+    int(*set_keepalive)				(TCP_CONNECTION_INFO *, int, int, int);
+    int(*reap_idle)					(CONN_REGISTRY *, TIMESTAMP, int, REAP_STATS *);
+    int(*load_tuning_profiles)		(char *);
+    int(*set_tuning_profile)		(TCP_CONNECTION_INFO *, char *);
+    RECV_POOL*(*recv_pool_create)	(int);
+    void(*recv_pool_get_stats)		(RECV_POOL *, long long *, long long *);
+    int(*new_recv_managed)			(TCP_CONNECTION_INFO *, char **);
+    long(*recv_buffer_trim)			(TCP_CONNECTION_INFO *, TIMESTAMP);
+    long long(*registry_trim_buffers)	(CONN_REGISTRY *, TIMESTAMP);
+    ENDPOINT_POOL*(*balancer_create)	(int, int, TIMESTAMP);
+    int(*balancer_add_endpoint)		(ENDPOINT_POOL *, char *, TCP_PORT, INET_NAME);
+    ENDPOINT*(*balancer_pick)		(ENDPOINT_POOL *);
+    void(*balancer_begin)			(ENDPOINT *);
+    void(*balancer_end)				(ENDPOINT_POOL *, ENDPOINT *, BOOLEAN);
+    ENDPOINT*(*balancer_connect)	(ENDPOINT_POOL *, TCP_CONNECTION_INFO *);
+    int(*balancer_probe)			(ENDPOINT_POOL *);
+    void(*balancer_free)			(ENDPOINT_POOL *);
+    void(*breaker_init)				(CIRCUIT_BREAKER *, RECONNECT_POLICY *);
+    BOOLEAN(*breaker_allow)			(CIRCUIT_BREAKER *);
+    void(*breaker_record)			(CIRCUIT_BREAKER *, TCP_CONNECTION_INFO *, BOOLEAN);
+    TIMESTAMP(*reconnect_delay)		(CIRCUIT_BREAKER *);
+    int(*make_connect_managed)		(TCP_CONNECTION_INFO *);
+    void(*admission_init)			(ADMISSION_CTRL *, TIMESTAMP, TIMESTAMP, int, char *, int);
+    BOOLEAN(*admission_check)		(ADMISSION_CTRL *, TIMESTAMP);
+    BOOLEAN(*admission_accepting)	(ADMISSION_CTRL *);
+    BOOLEAN(*admission_on_accept)	(ADMISSION_CTRL *, TCP_CONNECTION_INFO *);
+    int(*admission_reject)			(ADMISSION_CTRL *, TCP_CONNECTION_INFO *);
+    DELIM_RING*(*delim_ring_create)	(int, int, char);
+    void(*delim_ring_free)			(DELIM_RING *);
+    int(*new_recv_delim)			(TCP_CONNECTION_INFO *, DELIM_RING *);
+    int(*delim_next)				(DELIM_RING *, MSG_VIEW *);
+    const char*(*delim_scan_impl)	(void);
+    uint32_t(*crc32c)				(uint32_t, const char *, unsigned long);
+    int(*new_send_frame)			(TCP_CONNECTION_INFO *, char *, int);
+    int(*new_send_framev)			(TCP_CONNECTION_INFO *, FRAME_IOV *, int);
+    int(*new_recv_frame)			(TCP_CONNECTION_INFO *, char *, int, int *);
+    int(*frame_negotiate)			(TCP_CONNECTION_INFO *, uint32_t);
+    void(*compress_enable)			(TCP_CONNECTION_INFO *, int);
+    void(*compress_get_stats)		(TCP_CONNECTION_INFO *, COMPRESS_STATS *);
+    int(*handoff_serve)				(char *, TCP_CONNECTION_INFO **, int, CONN_REGISTRY *, TIMESTAMP);
+    int(*handoff_receive)			(char *, TCP_CONNECTION_INFO **, int, CONN_REGISTRY *);
+    int(*handoff_drain)				(CONN_REGISTRY *, TIMESTAMP, TIMESTAMP);
+    RUNTIME*(*runtime_start)		(RUNTIME_OPTS *);
+    BOOLEAN(*runtime_post)			(CORE *, int, int, void *);
+    void(*runtime_close)			(CORE *, TCP_CONNECTION_INFO *);
+    void(*runtime_stop)				(RUNTIME *);
+    void(*recv_pool_free)			(RECV_POOL *);
+    long(*recv_pool_prewarm)		(RECV_POOL *, int, int);
+    int(*config_load)				(char *, TCP_CONFIG *);
+    int(*config_prewarm)			(TCP_CONFIG *);
+    TCP_CONNECTION_INFO*(*config_find_listener)	(TCP_CONFIG *, char *);
+    CONFIG_POOL*(*config_find_pool)	(TCP_CONFIG *, char *);
+    ENDPOINT*(*config_take_connection)	(CONFIG_POOL *, TCP_CONNECTION_INFO *);
+    void(*startup_record_request)	(TCP_CONFIG *, TIMESTAMP);
+    void(*startup_report)			(TCP_CONFIG *, FILE *);
+    void(*config_free)				(TCP_CONFIG *);
 } TCP;
 
 /**********************************************************
 *		Function Prototype Definition(s)
 **********************************************************/
 TCP *intialize_tcp ( void );
-static void await_completion ( signed long      *sock_fn
-                             , short            *buffer_addr
-                             , signed short     buffer_size
-                             , char             *count_trnsfr
-                             , signed long      *tag
-                             , signed long      timeout
-                             , short            *error_code);
 
 enum
 {
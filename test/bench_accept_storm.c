@@ -0,0 +1,232 @@
+/*****************************************************************************************
+*
+*   bench_accept_storm.c
+*
+*   Connect-storm recovery: "clients" connections arrive at once, as after a failover,
+*   and the time until the server has accepted every one of them is measured, once
+*   accepting one connection per wakeup with New_Accept and once draining with
+*   New_Accept_Batch.
+*
+*   usage: bench_accept_storm [clients] [batch]
+*
+*****************************************************************************************/
+#include "nscc.h"
+#include <sys/resource.h>
+
+#define STORM_CLIENTS   2000
+#define STORM_BATCH     64
+#define STORM_BACKLOG   4096
+
+typedef struct _storm
+{
+    int                 port;
+    int                 clients;
+    int                 *socks;
+    int                 connected;
+} STORM;
+
+static TCP *tcp;
+
+static TIMESTAMP Now_Us ( void )
+{
+    struct timeval now;
+
+    gettimeofday ( &now, 0 );
+    return ( TIMESTAMP ) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+/* every client connects at once, without waiting for the others */
+static void *Storm_Clients ( void *arg )
+{
+    STORM               *storm;
+    struct sockaddr_in  addr;
+    int                 nonblocking;
+    int                 i;
+
+    storm = ( STORM * ) arg;
+
+    memset ( &addr, 0, sizeof ( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons ( storm->port );
+    addr.sin_addr.s_addr = inet_addr ( "127.0.0.1" );
+
+    for ( i = 0; i < storm->clients; i++ )
+    {
+        storm->socks[i] = socket ( AF_INET, SOCK_STREAM, 0 );
+        if ( storm->socks[i] < 0 )
+            break;
+
+        nonblocking = 1;
+        ioctl ( storm->socks[i], FIONBIO, ( char * ) &nonblocking );
+        connect ( storm->socks[i], ( struct sockaddr * ) &addr, sizeof ( addr ) );
+        storm->connected++;
+    }
+
+    return 0;
+}
+
+static int Open_Listener ( TCP_CONNECTION_INFO *listener )
+{
+    struct sockaddr_in  bound;
+    socklen_t           bound_len;
+    int                 on;
+
+    memset ( listener, 0, sizeof ( TCP_CONNECTION_INFO ) );
+    strcpy ( listener->ipaddr, "127.0.0.1" );
+    listener->port = 0;
+    listener->queue_len = STORM_BACKLOG;
+    listener->sockaddr_len = sizeof ( struct sockaddr_in );
+    tcp->set_sockaddr ( listener, AF_INET );
+
+    on = tcp->get_sock ( listener, AF_INET, SOCK_STREAM, 0 );
+    if ( on < 0 )
+        return -1;
+    *listener->sock = on;
+
+    on = 1;
+    setsockopt ( *listener->sock, SOL_SOCKET, SO_REUSEADDR, ( char * ) &on, sizeof ( on ) );
+
+    if ( tcp->set_bind ( listener ) < 0 || tcp->set_listen ( listener ) < 0 )
+        return -1;
+
+    bound_len = sizeof ( bound );
+    getsockname ( *listener->sock, ( struct sockaddr * ) &bound, &bound_len );
+    return ntohs ( bound.sin_port );
+}
+
+/* one accept per wakeup, each accepted socket made non-blocking by hand */
+static int Accept_Single ( TCP_CONNECTION_INFO *listener, int *accepted, int clients, long *wakeups )
+{
+    struct pollfd   ready;
+    int             from_len;
+    int             nonblocking;
+    int             sock;
+
+    ready.fd = *listener->sock;
+    ready.events = POLLIN;
+
+    while ( *accepted < clients )
+    {
+        if ( poll ( &ready, 1, 5000 ) <= 0 )
+            return -1;
+        ( *wakeups )++;
+
+        from_len = sizeof ( struct sockaddr_in );
+        sock = tcp->new_accept ( listener, &from_len );
+        if ( sock < 0 )
+            continue;
+
+        nonblocking = 1;
+        ioctl ( sock, FIONBIO, ( char * ) &nonblocking );
+        close ( sock );
+        ( *accepted )++;
+    }
+
+    return 0;
+}
+
+/* drain everything pending on each wakeup */
+static int Accept_Batched ( TCP_CONNECTION_INFO *listener, int *accepted, int clients, int size, long *wakeups )
+{
+    struct pollfd   ready;
+    ACCEPT_BATCH    *batch;
+    int             count;
+    int             i;
+
+    batch = tcp->accept_batch_create ( size );
+
+    ready.fd = *listener->sock;
+    ready.events = POLLIN;
+
+    while ( *accepted < clients )
+    {
+        if ( poll ( &ready, 1, 5000 ) <= 0 )
+            break;
+        ( *wakeups )++;
+
+        count = tcp->new_accept_batch ( listener, batch, size );
+        for ( i = 0; i < count; i++ )
+            close ( *batch->conns[i].sock );
+        if ( count > 0 )
+            *accepted += count;
+    }
+
+    tcp->accept_batch_free ( batch );
+    return *accepted < clients ? -1 : 0;
+}
+
+static int Run ( char *name, int clients, int size )
+{
+    TCP_CONNECTION_INFO listener;
+    pthread_t           client_thread;
+    STORM               storm;
+    TIMESTAMP           start;
+    TIMESTAMP           elapsed;
+    long                wakeups;
+    int                 accepted;
+    int                 status;
+    int                 i;
+
+    memset ( &storm, 0, sizeof ( storm ) );
+    storm.port = Open_Listener ( &listener );
+    if ( storm.port <= 0 )
+    {
+        perror ( "listener" );
+        return -1;
+    }
+    storm.clients = clients;
+    storm.socks = ( int * ) malloc ( sizeof ( int ) * clients );
+
+    accepted = 0;
+    wakeups = 0;
+    start = Now_Us ( );
+    pthread_create ( &client_thread, 0, Storm_Clients, &storm );
+
+    if ( size > 1 )
+        status = Accept_Batched ( &listener, &accepted, clients, size, &wakeups );
+    else
+        status = Accept_Single ( &listener, &accepted, clients, &wakeups );
+
+    elapsed = Now_Us ( ) - start;
+    pthread_join ( client_thread, 0 );
+
+    printf ( "%-8s %6d clients  %8.2f ms to accept all  %8.0f accepts/s  %6ld wakeups%s\n"
+           , name
+           , accepted
+           , elapsed / 1000.0
+           , accepted * 1000000.0 / ( elapsed > 0 ? elapsed : 1 )
+           , wakeups
+           , status < 0 ? "  (incomplete)" : "" );
+
+    for ( i = 0; i < storm.connected; i++ )
+        close ( storm.socks[i] );
+    free ( storm.socks );
+    tcp->close_sock ( &listener );
+    tcp->clean_conn_info ( &listener );
+
+    return status;
+}
+
+int main ( int argc, char **argv )
+{
+    struct rlimit   files;
+    int             clients;
+    int             size;
+
+    clients = argc > 1 ? atoi ( argv[1] ) : STORM_CLIENTS;
+    size = argc > 2 ? atoi ( argv[2] ) : STORM_BATCH;
+
+    /* both ends of every connection are in this process */
+    getrlimit ( RLIMIT_NOFILE, &files );
+    files.rlim_cur = files.rlim_max;
+    setrlimit ( RLIMIT_NOFILE, &files );
+    if ( ( rlim_t ) clients * 2 + 16 > files.rlim_cur )
+        clients = ( int ) ( files.rlim_cur - 16 ) / 2;
+
+    tcp = intialize_tcp ( );
+
+    if ( Run ( "single", clients, 1 ) < 0 || Run ( "batch", clients, size ) < 0 )
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,228 @@
+/*****************************************************************************************
+*
+*   bench_frame.c
+*
+*   What framing and its checksum cost per message size. For each size from 64 bytes
+*   to 64K, a thread sends frames with New_Send_Frame over a Unix socket pair while
+*   this one takes them with New_Recv_Frame, once plain and once with FRAME_F_CRC32C,
+*   and prints the microseconds per message and what the checksum added. Then the two
+*   CRC32C implementations, the SSE4.2 instruction (where the processor has it) and
+*   the slicing-by-8 table, are timed on their own over the same sizes, in GB/s.
+*
+*   A socket pair keeps the network stack out of the figures, so the framing and the
+*   checksum are a larger share of each message here than they would be over TCP.
+*   The CRC implementations are static, so this includes nscc.c rather than linking
+*   nscc.o.
+*
+*   usage: bench_frame [megabytes]
+*
+*****************************************************************************************/
+#include "nscc.c"
+
+#define BENCH_MAX_SIZE      65536
+#define BENCH_MAX_MESSAGES  100000
+
+typedef uint32_t ( *CRC_UPDATE ) ( uint32_t, const char *, unsigned long );
+
+typedef struct _sender
+{
+    TCP_CONNECTION_INFO *connection;
+    char                *payload;
+    int                 size;
+    int                 count;
+    int                 failed;
+} SENDER;
+
+static TCP *tcp;
+
+static int sizes[] = { 64, 256, 1024, 4096, 16384, 65536 };
+
+static TIMESTAMP Now_Us ( void )
+{
+    struct timeval now;
+
+    gettimeofday ( &now, 0 );
+    return ( TIMESTAMP ) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static void *Sender ( void *arg )
+{
+    SENDER  *sender;
+    int     i;
+
+    sender = ( SENDER * ) arg;
+    for ( i = 0; i < sender->count; i++ )
+    {
+        if ( tcp->new_send_frame ( sender->connection, sender->payload, sender->size ) < 0 )
+        {
+            sender->failed = 1;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/* a connection over one end of a socket pair */
+static void Connection_Init ( TCP_CONNECTION_INFO *connection, int sock, uint32_t frame_opts )
+{
+    int buffer_size;
+
+    memset ( connection, 0, sizeof ( TCP_CONNECTION_INFO ) );
+    connection->sock = ( int * ) malloc ( sizeof ( int ) );
+    *connection->sock = sock;
+    connection->frame_opts = frame_opts;
+
+    buffer_size = 4 * BENCH_MAX_SIZE;
+    setsockopt ( sock, SOL_SOCKET, SO_SNDBUF, ( char * ) &buffer_size, sizeof ( buffer_size ) );
+    setsockopt ( sock, SOL_SOCKET, SO_RCVBUF, ( char * ) &buffer_size, sizeof ( buffer_size ) );
+}
+
+/* count frames of size bytes through a socket pair; returns us per message, -1 on error */
+static double Time_Frames ( int size, int count, uint32_t frame_opts, char *payload, char *received )
+{
+    TCP_CONNECTION_INFO sending;
+    TCP_CONNECTION_INFO receiving;
+    SENDER              sender;
+    pthread_t           thread;
+    TIMESTAMP           start;
+    TIMESTAMP           elapsed;
+    int                 pair[2];
+    int                 length;
+    int                 status;
+    int                 i;
+
+    if ( socketpair ( AF_UNIX, SOCK_STREAM, 0, pair ) < 0 )
+        return -1;
+    Connection_Init ( &sending, pair[0], frame_opts );
+    Connection_Init ( &receiving, pair[1], frame_opts );
+
+    sender.connection = &sending;
+    sender.payload = payload;
+    sender.size = size;
+    sender.count = count;
+    sender.failed = 0;
+
+    status = 0;
+    start = Now_Us ( );
+    pthread_create ( &thread, 0, Sender, &sender );
+    for ( i = 0; i < count && status == 0; i++ )
+    {
+        status = tcp->new_recv_frame ( &receiving, received, BENCH_MAX_SIZE, &length );
+        if ( status == 0 && length != size )
+            status = -1;
+    }
+    if ( status != 0 )
+        shutdown ( pair[1], SHUT_RDWR );
+    pthread_join ( thread, 0 );
+    elapsed = Now_Us ( ) - start;
+
+    tcp->close_sock ( &sending );
+    tcp->close_sock ( &receiving );
+    tcp->clean_conn_info ( &sending );
+    tcp->clean_conn_info ( &receiving );
+
+    if ( status != 0 || sender.failed || memcmp ( payload, received, size ) != 0 )
+        return -1;
+
+    return ( double ) elapsed / count;
+}
+
+/* one CRC32C implementation over size bytes, repeated to total bytes; returns GB/s.
+ * Each pass carries on from the last one's CRC, so none can be skipped */
+static double Time_Crc ( CRC_UPDATE update, const char *data, int size, long long total, uint32_t *crc )
+{
+    TIMESTAMP   start;
+    TIMESTAMP   elapsed;
+    long long   done;
+
+    *crc = ~0u;
+    start = Now_Us ( );
+    for ( done = 0; done < total; done += size )
+        *crc = update ( *crc, data, size );
+    elapsed = Now_Us ( ) - start;
+
+    return ( double ) total / ( elapsed > 0 ? elapsed : 1 ) / 1000.0;
+}
+
+int main ( int argc, char **argv )
+{
+    char        *payload;
+    char        *received;
+    long long   total;
+    double      plain_us;
+    double      crc_us;
+    double      table_gbs;
+    uint32_t    table_crc;
+    int         megabytes;
+    int         count;
+    int         status;
+    int         i;
+
+    megabytes = argc > 1 ? atoi ( argv[1] ) : 64;
+    if ( megabytes < 1 )
+        megabytes = 1;
+    total = ( long long ) megabytes * 1048576;
+
+    tcp = intialize_tcp ( );
+
+    payload = ( char * ) malloc ( BENCH_MAX_SIZE );
+    received = ( char * ) malloc ( BENCH_MAX_SIZE );
+    for ( i = 0; i < BENCH_MAX_SIZE; i++ )
+        payload[i] = ( char ) ( i * 131 + ( i >> 8 ) );
+
+    /* builds the tables and picks the implementation */
+    tcp->crc32c ( 0, "", 0 );
+
+    status = 0;
+    printf ( "frames, %d MB per size\n", megabytes );
+    for ( i = 0; i < ( int ) ( sizeof ( sizes ) / sizeof ( sizes[0] ) ) && status == 0; i++ )
+    {
+        count = ( int ) ( total / sizes[i] );
+        if ( count > BENCH_MAX_MESSAGES )
+            count = BENCH_MAX_MESSAGES;
+
+        plain_us = Time_Frames ( sizes[i], count, 0, payload, received );
+        crc_us = Time_Frames ( sizes[i], count, FRAME_F_CRC32C, payload, received );
+        if ( plain_us < 0 || crc_us < 0 )
+        {
+            fprintf ( stderr, "bench_frame: %d byte frames failed\n", sizes[i] );
+            status = 1;
+            break;
+        }
+
+        printf ( "%6d B  plain %8.2f us  crc32c %8.2f us  checksum adds %6.1f%%\n"
+               , sizes[i]
+               , plain_us
+               , crc_us
+               , ( crc_us - plain_us ) * 100.0 / plain_us );
+    }
+
+    printf ( "crc32c, %d MB per size\n", megabytes );
+    for ( i = 0; i < ( int ) ( sizeof ( sizes ) / sizeof ( sizes[0] ) ) && status == 0; i++ )
+    {
+        table_gbs = Time_Crc ( Crc32c_Table_Update, payload, sizes[i], total, &table_crc );
+        printf ( "%6d B  slicing-by-8 %6.2f GB/s", sizes[i], table_gbs );
+#ifdef NSCC_X86_SIMD
+        if ( __builtin_cpu_supports ( "sse4.2" ) )
+        {
+            double      hardware_gbs;
+            uint32_t    hardware_crc;
+
+            hardware_gbs = Time_Crc ( Crc32c_SSE42_Update, payload, sizes[i], total, &hardware_crc );
+            printf ( "  sse4.2 %6.2f GB/s", hardware_gbs );
+            if ( hardware_crc != table_crc )
+            {
+                fprintf ( stderr, "\nbench_frame: the implementations disagree\n" );
+                status = 1;
+            }
+        }
+#endif
+        printf ( "\n" );
+    }
+
+    free ( payload );
+    free ( received );
+
+    return status;
+}
@@ -0,0 +1,194 @@
+/*****************************************************************************************
+*
+*   bench_runtime.c
+*
+*   Thread-per-core scaling: an echo server on the runtime with 1, 2, 4 ... cores (up
+*   to the CPUs the process may use, or "max_cores"), driven by "clients" connections
+*   each doing request/response round trips for "seconds". Prints requests per second
+*   and the accepted connections per core for each core count.
+*
+*   The clients run in this process too, so they compete with the cores for CPU; the
+*   figures are for comparing core counts with each other, not absolute.
+*
+*   usage: bench_runtime [max_cores] [clients] [seconds]
+*
+*****************************************************************************************/
+#include "nscc.h"
+
+#define BENCH_MSG       64
+
+typedef struct _client
+{
+    int                 port;
+    TIMESTAMP           until;
+    long                requests;
+    int                 failed;
+} CLIENT;
+
+static TCP *tcp;
+
+static TIMESTAMP Now_Us ( void )
+{
+    struct timeval now;
+
+    gettimeofday ( &now, 0 );
+    return ( TIMESTAMP ) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+/* echo whatever arrived; 0 bytes means the client has gone */
+static int Echo ( CORE *core, TCP_CONNECTION_INFO *connection )
+{
+    char    buffer[4096];
+    int     nrcvd;
+
+    ( void ) core;
+
+    nrcvd = ( int ) recv ( *connection->sock, buffer, sizeof ( buffer ), 0 );
+    if ( nrcvd <= 0 )
+        return nrcvd < 0 && errno == EAGAIN ? 0 : -1;
+
+    return send ( *connection->sock, buffer, nrcvd, 0 ) == nrcvd ? 0 : -1;
+}
+
+static void *Client ( void *arg )
+{
+    CLIENT              *client;
+    struct sockaddr_in  addr;
+    char                message[BENCH_MSG];
+    char                reply[BENCH_MSG];
+    int                 sock;
+    int                 got;
+    int                 n;
+    int                 on;
+
+    client = ( CLIENT * ) arg;
+
+    memset ( &addr, 0, sizeof ( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons ( ( unsigned short ) client->port );
+    addr.sin_addr.s_addr = inet_addr ( "127.0.0.1" );
+
+    sock = socket ( AF_INET, SOCK_STREAM, 0 );
+    on = 1;
+    setsockopt ( sock, IPPROTO_TCP, TCP_NODELAY, ( char * ) &on, sizeof ( on ) );
+    if ( connect ( sock, ( struct sockaddr * ) &addr, sizeof ( addr ) ) < 0 )
+    {
+        client->failed = 1;
+        close ( sock );
+        return 0;
+    }
+
+    memset ( message, 'x', sizeof ( message ) );
+    while ( Now_Us ( ) < client->until )
+    {
+        if ( send ( sock, message, sizeof ( message ), 0 ) != sizeof ( message ) )
+            break;
+        for ( got = 0; got < BENCH_MSG; got += n )
+        {
+            n = ( int ) recv ( sock, reply + got, BENCH_MSG - got, 0 );
+            if ( n <= 0 )
+                break;
+        }
+        if ( got < BENCH_MSG )
+        {
+            client->failed = 1;
+            break;
+        }
+        client->requests++;
+    }
+
+    close ( sock );
+    return 0;
+}
+
+static int Run ( int cores, int clients, int seconds )
+{
+    RUNTIME_OPTS    opts;
+    RUNTIME         *runtime;
+    CLIENT          *client;
+    pthread_t       *threads;
+    TIMESTAMP       start;
+    TIMESTAMP       elapsed;
+    long            requests;
+    int             failed;
+    int             i;
+
+    memset ( &opts, 0, sizeof ( opts ) );
+    opts.cores = cores;
+    opts.pin = SUCCESS;
+    strcpy ( opts.ipaddr, "127.0.0.1" );
+    opts.port = 0;
+    opts.queue_len = 1024;
+    opts.poll_ms = 10;
+    opts.on_readable = Echo;
+
+    runtime = tcp->runtime_start ( &opts );
+    if ( !runtime )
+    {
+        fprintf ( stderr, "runtime_start failed for %d cores\n", cores );
+        return -1;
+    }
+
+    client = ( CLIENT * ) malloc ( sizeof ( CLIENT ) * clients );
+    threads = ( pthread_t * ) malloc ( sizeof ( pthread_t ) * clients );
+    memset ( client, 0, sizeof ( CLIENT ) * clients );
+
+    start = Now_Us ( );
+    for ( i = 0; i < clients; i++ )
+    {
+        client[i].port = runtime->opts.port;
+        client[i].until = start + ( TIMESTAMP ) seconds * 1000000;
+        pthread_create ( &threads[i], 0, Client, &client[i] );
+    }
+
+    requests = 0;
+    failed = 0;
+    for ( i = 0; i < clients; i++ )
+    {
+        pthread_join ( threads[i], 0 );
+        requests += client[i].requests;
+        failed += client[i].failed;
+    }
+    elapsed = Now_Us ( ) - start;
+
+    printf ( "%3d cores  %10.0f req/s  accepted per core:", cores, requests * 1000000.0 / elapsed );
+    for ( i = 0; i < runtime->count; i++ )
+        printf ( " %ld", runtime->cores[i].stats.accepted );
+    printf ( "%s\n", failed ? "  (some clients failed)" : "" );
+
+    tcp->runtime_stop ( runtime );
+    free ( client );
+    free ( threads );
+
+    return failed ? -1 : 0;
+}
+
+int main ( int argc, char **argv )
+{
+    int max_cores;
+    int clients;
+    int seconds;
+    int cores;
+    int status;
+
+    max_cores = argc > 1 ? atoi ( argv[1] ) : ( int ) sysconf ( _SC_NPROCESSORS_ONLN );
+    clients = argc > 2 ? atoi ( argv[2] ) : 32;
+    seconds = argc > 3 ? atoi ( argv[3] ) : 2;
+    if ( max_cores < 1 )
+        max_cores = 1;
+
+    tcp = intialize_tcp ( );
+
+    status = 0;
+    for ( cores = 1; status == 0; cores *= 2 )
+    {
+        if ( cores > max_cores )
+            cores = max_cores;
+
+        status = Run ( cores, clients, seconds );
+        if ( cores == max_cores )
+            break;
+    }
+
+    return status < 0 ? 1 : 0;
+}
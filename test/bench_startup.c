@@ -0,0 +1,241 @@
+/*****************************************************************************************
+*
+*   bench_startup.c
+*
+*   Time to first request: a configuration naming a listener and a backend endpoint is
+*   loaded and readied, then one request is made to the backend, an echo server in this
+*   process. "cold" has no pre-warming, so the first request pays for its connection;
+*   "prewarmed" allocates receive buffers and opens connections to the backend while
+*   starting. The response is taken with New_Recv_Managed, so it is received into a
+*   pre-warmed buffer if there is one. Prints how long getting ready took, how long the
+*   first request took, and the sum, the time from start to the first response.
+*
+*   Every run is a fresh child process, so nothing one run allocated or cached (the
+*   default receive pool above all) is there for the next.
+*
+*   The backend is on loopback, where a connect is cheap; against a remote endpoint the
+*   first request of a cold start pays a full round trip more.
+*
+*   usage: bench_startup [runs]
+*
+*****************************************************************************************/
+#include "nscc.h"
+#include <sys/wait.h>
+
+#define BENCH_MSG       512
+
+static TCP *tcp;
+
+static TIMESTAMP Now_Us ( void )
+{
+    struct timeval now;
+
+    gettimeofday ( &now, 0 );
+    return ( TIMESTAMP ) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+/* echoes one connection until its client closes it */
+static void *Echo_Connection ( void *arg )
+{
+    char    buffer[4096];
+    int     sock;
+    int     n;
+
+    sock = ( int ) ( long ) arg;
+    while ( ( n = ( int ) read ( sock, buffer, sizeof ( buffer ) ) ) > 0 )
+    {
+        if ( write ( sock, buffer, n ) != n )
+            break;
+    }
+
+    close ( sock );
+    return 0;
+}
+
+static void *Backend ( void *arg )
+{
+    pthread_t   thread;
+    int         listener;
+    int         sock;
+
+    listener = *( int * ) arg;
+    while ( ( sock = accept ( listener, 0, 0 ) ) >= 0 )
+    {
+        pthread_create ( &thread, 0, Echo_Connection, ( void * ) ( long ) sock );
+        pthread_detach ( thread );
+    }
+
+    return 0;
+}
+
+/* the backend: returns its port */
+static int Backend_Start ( int *listener )
+{
+    struct sockaddr_in  addr;
+    socklen_t           addr_len;
+    pthread_t           thread;
+
+    *listener = socket ( AF_INET, SOCK_STREAM, 0 );
+
+    memset ( &addr, 0, sizeof ( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr ( "127.0.0.1" );
+
+    if ( bind ( *listener, ( struct sockaddr * ) &addr, sizeof ( addr ) ) < 0 || listen ( *listener, 64 ) < 0 )
+        return -1;
+
+    addr_len = sizeof ( addr );
+    getsockname ( *listener, ( struct sockaddr * ) &addr, &addr_len );
+
+    pthread_create ( &thread, 0, Backend, listener );
+    pthread_detach ( thread );
+
+    return ntohs ( addr.sin_port );
+}
+
+static int Write_Config ( char *file_name, int backend_port, BOOLEAN prewarm )
+{
+    FILE *file;
+
+    file = fopen ( file_name, "w" );
+    if ( !file )
+        return -1;
+
+    fprintf ( file, "[timeouts]\nrecv = 500\nconnect = 100\n\n" );
+    if ( prewarm )
+        fprintf ( file, "[pool]\nmax_free = 64\nprewarm.%d = 32\n\n", BENCH_MSG );
+    fprintf ( file, "[listener public]\nipaddr = 127.0.0.1\nport = 0\nqueue_len = 64\n\n" );
+    fprintf ( file, "[endpoints backend]\nendpoint = 127.0.0.1:%d\npreconnect = %d\n", backend_port, prewarm ? 4 : 0 );
+
+    fclose ( file );
+    return 0;
+}
+
+static int Run ( char *name, char *file_name )
+{
+    TCP_CONFIG          *config;
+    TCP_CONNECTION_INFO connection;
+    CONFIG_POOL         *pool;
+    ENDPOINT            *endpoint;
+    char                message[BENCH_MSG];
+    char                *reply;
+    TIMESTAMP           began;
+    int                 got;
+    int                 n;
+
+    config = ( TCP_CONFIG * ) malloc ( sizeof ( TCP_CONFIG ) );
+    memset ( config, 0, sizeof ( TCP_CONFIG ) );
+    config->stats.started_at = Now_Us ( );
+
+    if ( tcp->config_load ( file_name, config ) != 0 || tcp->config_prewarm ( config ) != 0 )
+    {
+        fprintf ( stderr, "%s: configuration failed (status %d)\n", name, config->status );
+        tcp->config_free ( config );
+        return -1;
+    }
+
+    /* the first request */
+    began = Now_Us ( );
+    pool = tcp->config_find_pool ( config, "backend" );
+    memset ( &connection, 0, sizeof ( connection ) );
+    endpoint = tcp->config_take_connection ( pool, &connection );
+    if ( !endpoint )
+    {
+        fprintf ( stderr, "%s: backend unreachable\n", name );
+        tcp->config_free ( config );
+        return -1;
+    }
+
+    memset ( message, 'x', sizeof ( message ) );
+    got = 0;
+    if ( send ( *connection.sock, message, sizeof ( message ), 0 ) == sizeof ( message ) )
+    {
+        for ( ; got < BENCH_MSG; got += n )
+        {
+            n = tcp->new_recv_managed ( &connection, &reply );
+            if ( n <= 0 )
+                break;
+        }
+    }
+    tcp->startup_record_request ( config, began );
+    tcp->balancer_end ( pool->pool, endpoint, got == BENCH_MSG ? SUCCESS : FAIL );
+
+    printf ( "%-10s ready %8lld us  first request %8lld us  start to first response %8lld us  (%ld buffers, %d connections)\n"
+           , name
+           , config->stats.ready_us
+           , config->stats.first_latency_us
+           , config->stats.ready_us + config->stats.first_request_us + config->stats.first_latency_us
+           , config->stats.buffers_prewarmed
+           , config->stats.connections_opened );
+
+    tcp->close_sock ( &connection );
+    tcp->clean_conn_info ( &connection );
+    tcp->config_free ( config );
+
+    return got == BENCH_MSG ? 0 : -1;
+}
+
+/* one run in a child process of its own; the backend stays in this one */
+static int Run_Fresh ( char *name, char *file_name )
+{
+    pid_t   child;
+    int     status;
+
+    fflush ( stdout );
+    child = fork ( );
+    if ( child < 0 )
+        return -1;
+    if ( child == 0 )
+    {
+        tcp = intialize_tcp ( );
+        status = Run ( name, file_name );
+        fflush ( stdout );
+        _exit ( status < 0 ? 1 : 0 );
+    }
+
+    if ( waitpid ( child, &status, 0 ) < 0 || !WIFEXITED ( status ) || WEXITSTATUS ( status ) != 0 )
+        return -1;
+
+    return 0;
+}
+
+int main ( int argc, char **argv )
+{
+    char    cold[64];
+    char    warm[64];
+    int     backend;
+    int     port;
+    int     runs;
+    int     status;
+    int     i;
+
+    runs = argc > 1 ? atoi ( argv[1] ) : 3;
+
+    port = Backend_Start ( &backend );
+    if ( port <= 0 )
+    {
+        perror ( "backend" );
+        return 1;
+    }
+
+    sprintf ( cold, "/tmp/bench_startup_cold.%d", ( int ) getpid ( ) );
+    sprintf ( warm, "/tmp/bench_startup_warm.%d", ( int ) getpid ( ) );
+    if ( Write_Config ( cold, port, FAIL ) < 0 || Write_Config ( warm, port, SUCCESS ) < 0 )
+    {
+        perror ( "config" );
+        return 1;
+    }
+
+    status = 0;
+    for ( i = 0; i < runs && status == 0; i++ )
+    {
+        status = Run_Fresh ( "cold", cold );
+        if ( status == 0 )
+            status = Run_Fresh ( "prewarmed", warm );
+    }
+
+    unlink ( cold );
+    unlink ( warm );
+
+    return status < 0 ? 1 : 0;
+}
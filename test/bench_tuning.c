@@ -0,0 +1,288 @@
+/*****************************************************************************************
+*
+*   bench_tuning.c
+*
+*   What each built-in tuning profile does to a loopback connection. For every profile
+*   the listener and the client socket are created with Get_Sock under that profile (an
+*   accepted socket inherits the listener's options), then the client does "count"
+*   ping-pong round trips of 64 bytes against an echo, and streams "megabytes" to a sink
+*   that acknowledges the end with one byte. Prints the average and p99 round trip and
+*   the streaming throughput.
+*
+*   Loopback has no loss and almost no delay, so keepalive and user timeout settings
+*   never come into play and buffer sizes matter less than on a real link; the figures
+*   show the cost of each profile's options on the local stack, not across a network.
+*
+*   usage: bench_tuning [count] [megabytes]
+*
+*****************************************************************************************/
+#include "nscc.h"
+
+#define BENCH_MSG       64
+#define BENCH_CHUNK     65536
+
+static TCP *tcp;
+
+static char *profiles[] = { "default", "low-latency", "bulk-throughput", "many-idle" };
+
+static TIMESTAMP Now_Us ( void )
+{
+    struct timeval now;
+
+    gettimeofday ( &now, 0 );
+    return ( TIMESTAMP ) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static int Compare_Us ( const void *a, const void *b )
+{
+    TIMESTAMP x;
+    TIMESTAMP y;
+
+    x = *( const TIMESTAMP * ) a;
+    y = *( const TIMESTAMP * ) b;
+    return x < y ? -1 : x > y;
+}
+
+/* the first connection accepted is echoed, the second is a sink */
+static void *Server ( void *arg )
+{
+    TCP_CONNECTION_INFO *listener;
+    char                *buffer;
+    int                 from_len;
+    int                 sock;
+    int                 n;
+
+    listener = ( TCP_CONNECTION_INFO * ) arg;
+    buffer = ( char * ) malloc ( BENCH_CHUNK );
+
+    from_len = sizeof ( struct sockaddr_in );
+    sock = tcp->new_accept ( listener, &from_len );
+    if ( sock >= 0 )
+    {
+        while ( ( n = ( int ) read ( sock, buffer, BENCH_CHUNK ) ) > 0 )
+        {
+            if ( write ( sock, buffer, n ) != n )
+                break;
+        }
+        close ( sock );
+    }
+
+    from_len = sizeof ( struct sockaddr_in );
+    sock = tcp->new_accept ( listener, &from_len );
+    if ( sock >= 0 )
+    {
+        while ( read ( sock, buffer, BENCH_CHUNK ) > 0 )
+            ;
+        buffer[0] = 'k';
+        if ( write ( sock, buffer, 1 ) != 1 )
+            perror ( "sink" );
+        close ( sock );
+    }
+
+    free ( buffer );
+    return 0;
+}
+
+static int Open_Listener ( TCP_CONNECTION_INFO *listener, char *profile )
+{
+    struct sockaddr_in  bound;
+    socklen_t           bound_len;
+    int                 sock;
+
+    memset ( listener, 0, sizeof ( TCP_CONNECTION_INFO ) );
+    strcpy ( listener->ipaddr, "127.0.0.1" );
+    listener->port = 0;
+    listener->queue_len = 8;
+    listener->sockaddr_len = sizeof ( struct sockaddr_in );
+    tcp->set_sockaddr ( listener, AF_INET );
+
+    if ( tcp->set_tuning_profile ( listener, profile ) < 0 )
+        return -1;
+    sock = tcp->get_sock ( listener, AF_INET, SOCK_STREAM, 0 );
+    if ( sock < 0 )
+        return -1;
+    *listener->sock = sock;
+
+    if ( tcp->set_bind ( listener ) < 0 || tcp->set_listen ( listener ) < 0 )
+        return -1;
+
+    bound_len = sizeof ( bound );
+    getsockname ( *listener->sock, ( struct sockaddr * ) &bound, &bound_len );
+    return ntohs ( bound.sin_port );
+}
+
+static int Connect ( TCP_CONNECTION_INFO *client, char *profile, int port )
+{
+    int sock;
+
+    memset ( client, 0, sizeof ( TCP_CONNECTION_INFO ) );
+    strcpy ( client->ipaddr, "127.0.0.1" );
+    client->port = ( TCP_PORT ) port;
+    client->sockaddr_len = sizeof ( struct sockaddr_in );
+    tcp->set_sockaddr ( client, AF_INET );
+
+    if ( tcp->set_tuning_profile ( client, profile ) < 0 )
+        return -1;
+    sock = tcp->get_sock ( client, AF_INET, SOCK_STREAM, 0 );
+    *client->sock = sock;
+    if ( sock < 0 )
+        return -1;
+
+    return tcp->make_connect ( client );
+}
+
+/* round trips of BENCH_MSG bytes; fills in the average and p99 */
+static int Ping_Pong ( int sock, int count, double *avg_us, double *p99_us )
+{
+    TIMESTAMP   *took;
+    TIMESTAMP   start;
+    TIMESTAMP   total;
+    char        message[BENCH_MSG];
+    int         got;
+    int         n;
+    int         i;
+
+    took = ( TIMESTAMP * ) malloc ( sizeof ( TIMESTAMP ) * count );
+    memset ( message, 'x', sizeof ( message ) );
+
+    total = 0;
+    for ( i = 0; i < count; i++ )
+    {
+        start = Now_Us ( );
+        if ( send ( sock, message, sizeof ( message ), 0 ) != sizeof ( message ) )
+            break;
+        for ( got = 0; got < BENCH_MSG; got += n )
+        {
+            n = ( int ) recv ( sock, message + got, BENCH_MSG - got, 0 );
+            if ( n <= 0 )
+                break;
+        }
+        if ( got < BENCH_MSG )
+            break;
+        took[i] = Now_Us ( ) - start;
+        total += took[i];
+    }
+
+    if ( i < count )
+    {
+        free ( took );
+        return -1;
+    }
+
+    qsort ( took, count, sizeof ( TIMESTAMP ), Compare_Us );
+    *avg_us = ( double ) total / count;
+    *p99_us = ( double ) took[( count * 99 ) / 100];
+
+    free ( took );
+    return 0;
+}
+
+/* megabytes to the sink, timed until its acknowledgement */
+static int Stream ( int sock, int megabytes, double *mb_per_sec )
+{
+    char        *chunk;
+    TIMESTAMP   start;
+    TIMESTAMP   elapsed;
+    long long   left;
+    int         n;
+
+    chunk = ( char * ) malloc ( BENCH_CHUNK );
+    memset ( chunk, 'y', BENCH_CHUNK );
+
+    start = Now_Us ( );
+    for ( left = ( long long ) megabytes * 1048576; left > 0; left -= n )
+    {
+        n = ( int ) send ( sock, chunk, left < BENCH_CHUNK ? ( int ) left : BENCH_CHUNK, 0 );
+        if ( n <= 0 )
+            break;
+    }
+    shutdown ( sock, SHUT_WR );
+    n = left > 0 ? -1 : ( int ) recv ( sock, chunk, 1, 0 );
+    elapsed = Now_Us ( ) - start;
+
+    free ( chunk );
+    if ( n != 1 )
+        return -1;
+
+    *mb_per_sec = megabytes * 1000000.0 / ( elapsed > 0 ? elapsed : 1 );
+    return 0;
+}
+
+static int Run ( char *profile, int count, int megabytes )
+{
+    TCP_CONNECTION_INFO listener;
+    TCP_CONNECTION_INFO client;
+    pthread_t           server;
+    double              avg_us;
+    double              p99_us;
+    double              mb_per_sec;
+    int                 port;
+    int                 status;
+
+    avg_us = 0;
+    p99_us = 0;
+    mb_per_sec = 0;
+    port = Open_Listener ( &listener, profile );
+    if ( port <= 0 )
+    {
+        fprintf ( stderr, "%s: listener failed\n", profile );
+        return -1;
+    }
+    pthread_create ( &server, 0, Server, &listener );
+
+    status = Connect ( &client, profile, port );
+    if ( status == 0 )
+        status = Ping_Pong ( *client.sock, count, &avg_us, &p99_us );
+    tcp->close_sock ( &client );
+    tcp->clean_conn_info ( &client );
+
+    if ( status == 0 )
+        status = Connect ( &client, profile, port );
+    if ( status == 0 )
+        status = Stream ( *client.sock, megabytes, &mb_per_sec );
+    tcp->close_sock ( &client );
+    tcp->clean_conn_info ( &client );
+
+    /* let the server out of a pending accept if a connect failed */
+    shutdown ( *listener.sock, SHUT_RDWR );
+    pthread_join ( server, 0 );
+    tcp->close_sock ( &listener );
+    tcp->clean_conn_info ( &listener );
+
+    if ( status < 0 )
+    {
+        fprintf ( stderr, "%s: failed\n", profile );
+        return -1;
+    }
+
+    printf ( "%-16s ping-pong avg %7.1f us  p99 %7.1f us  stream %9.1f MB/s\n"
+           , profile
+           , avg_us
+           , p99_us
+           , mb_per_sec );
+
+    return 0;
+}
+
+int main ( int argc, char **argv )
+{
+    int count;
+    int megabytes;
+    int status;
+    int i;
+
+    count = argc > 1 ? atoi ( argv[1] ) : 20000;
+    megabytes = argc > 2 ? atoi ( argv[2] ) : 256;
+    if ( count < 1 )
+        count = 1;
+    if ( megabytes < 1 )
+        megabytes = 1;
+
+    tcp = intialize_tcp ( );
+
+    status = 0;
+    for ( i = 0; i < ( int ) ( sizeof ( profiles ) / sizeof ( profiles[0] ) ) && status == 0; i++ )
+        status = Run ( profiles[i], count, megabytes );
+
+    return status < 0 ? 1 : 0;
+}
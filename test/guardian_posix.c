@@ -0,0 +1,842 @@
+/*****************************************************************************************
+*
+*   guardian_posix.c
+*
+*   The Guardian procedures nscc calls, emulated over POSIX sockets and files, so the
+*   library can be built and exercised off NonStop. It is linked into the tests and
+*   benchmarks here and is never part of the library: on Guardian the real procedures
+*   are used, and an application off Guardian links this or its own implementation.
+*
+*****************************************************************************************/
+#include "nscc.h"
+
+/***************************************************************************************
+*						GUARDIAN PROCEDURES ON POSIX
+*
+*   Off Guardian the nowait socket and file-system procedures are emulated so the
+*   library builds and runs unchanged. A nowait call only records the operation;
+*   AWAITIOX polls the files with outstanding operations and performs whichever
+*   becomes ready first, reporting it the way Guardian would: the completed file,
+*   buffer, count and tag, with the error kept for FILE_GETINFO_. Errors are the
+*   errno values, ERR_TIMEOUT when the timelimit expires and ERR_UNINIT_NW when
+*   there is nothing outstanding to wait for.
+*
+*   NOTE: accept_nw completes by accepting the connection; accept_nw2 then moves
+*         it onto the new socket, so options set on that socket beforehand are lost.
+***************************************************************************************/
+enum
+{
+    GUARDIAN_DONE,
+    GUARDIAN_CONNECT,
+    GUARDIAN_ACCEPT,
+    GUARDIAN_SEND,
+    GUARDIAN_RECV,
+    GUARDIAN_WRITE
+};
+
+typedef struct _guardian_io
+{
+    int                 file_num;
+    int                 op;
+    char                *buffer;
+    int                 length;
+    int                 flags;
+    long                tag;
+    struct sockaddr     *addr;
+    long                *addr_len;
+    int                 count;
+    int                 error;
+    struct _guardian_io *next;
+} GUARDIAN_IO;
+
+typedef struct _guardian_accepted
+{
+    int                         sock;
+    struct _guardian_accepted   *next;
+} GUARDIAN_ACCEPTED;
+
+static pthread_mutex_t      guardian_lock = PTHREAD_MUTEX_INITIALIZER;
+static GUARDIAN_IO          *guardian_io;
+static GUARDIAN_ACCEPTED    *guardian_accepted;
+static short                guardian_error[GUARDIAN_MAX_FILES];
+static short                guardian_any_error;
+static char                 guardian_nowait[GUARDIAN_MAX_FILES];
+
+/***************************************************************
+*
+* @fn                       Guardian_Set_Error
+*
+* FUNCTION:                 Keeps the last error of a file for
+*                           FILE_GETINFO_.
+*
+* @param file_num           The file, -1 for the any-file error
+* @param error              The error
+* @return void
+***************************************************************/
+static void Guardian_Set_Error ( int file_num, int error )
+{
+    if ( file_num >= 0 && file_num < GUARDIAN_MAX_FILES )
+        guardian_error[file_num] = ( short ) error;
+    else
+        guardian_any_error = ( short ) error;
+}
+
+/***************************************************************
+*
+* @fn                       Guardian_Queue
+*
+* FUNCTION:                 Appends an operation to the outstanding list.
+*
+* @param io                 The operation, 0 when its allocation failed
+* @return int               0, -1 with errno set when io is 0
+***************************************************************/
+static int Guardian_Queue ( GUARDIAN_IO *io )
+{
+    GUARDIAN_IO **tail;
+
+    if ( !io )
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    pthread_mutex_lock ( &guardian_lock );
+    for ( tail = &guardian_io; *tail; tail = &( *tail )->next )
+        ;
+    *tail = io;
+    pthread_mutex_unlock ( &guardian_lock );
+
+    return 0;
+}
+
+/***************************************************************
+*
+* @fn                       Guardian_New
+*
+* FUNCTION:                 Allocates a nowait operation on a file.
+*                           An operation that already finished is
+*                           made GUARDIAN_DONE with its error.
+*
+* @param file_num           The file the operation is on
+* @param op                 The GUARDIAN_* operation
+* @param tag                The caller's tag
+* @param error              The error of a finished operation
+* @return GUARDIAN_IO*      The operation, 0 when out of memory
+***************************************************************/
+static GUARDIAN_IO *Guardian_New ( int file_num, int op, long tag, int error )
+{
+    GUARDIAN_IO *io;
+
+    io = ( GUARDIAN_IO * ) malloc ( sizeof ( GUARDIAN_IO ) );
+    if ( !io )
+        return 0;
+
+    memset ( io, 0, sizeof ( GUARDIAN_IO ) );
+    io->file_num = file_num;
+    io->op = op;
+    io->tag = tag;
+    io->error = error;
+
+    return io;
+}
+
+/***************************************************************
+*
+* @fn                       Guardian_Post
+*
+* FUNCTION:                 Queues an operation that needs nothing
+*                           but its file, tag and error.
+*
+* @return int               0, -1 with errno set when out of memory
+***************************************************************/
+static int Guardian_Post ( int file_num, int op, long tag, int error )
+{
+    return Guardian_Queue ( Guardian_New ( file_num, op, tag, error ) );
+}
+
+/***************************************************************
+*
+* @fn                       Guardian_Post_Buffer
+*
+* FUNCTION:                 Queues a transfer into or out of a buffer.
+*
+* @return int               0, -1 with errno set when out of memory
+***************************************************************/
+static int Guardian_Post_Buffer ( int file_num, int op, char *buffer, int length, int flags, long tag )
+{
+    GUARDIAN_IO *io;
+
+    io = Guardian_New ( file_num, op, tag, 0 );
+    if ( io )
+    {
+        io->buffer = buffer;
+        io->length = length;
+        io->flags = flags;
+    }
+
+    return Guardian_Queue ( io );
+}
+
+/***************************************************************
+*
+* @fn                       Guardian_Perform
+*
+* FUNCTION:                 Tries an outstanding operation whose file
+*                           polled ready. Called with guardian_lock held.
+*
+* @param io                 The operation
+* @return BOOLEAN           SUCCESS once it has completed, FAIL when it
+*                           would still block
+***************************************************************/
+static BOOLEAN Guardian_Perform ( GUARDIAN_IO *io )
+{
+    GUARDIAN_ACCEPTED   *accepted;
+    GUARDIAN_ACCEPTED   **tail;
+    struct sockaddr_in  peer;
+    socklen_t           len;
+    int                 result;
+    int                 fl;
+
+    result = 0;
+
+    switch ( io->op )
+    {
+    case GUARDIAN_CONNECT:
+        len = sizeof ( result );
+        if ( getsockopt ( io->file_num, SOL_SOCKET, SO_ERROR, ( char * ) &result, &len ) < 0 )
+            result = errno;
+        io->error = result;
+        break;
+
+    case GUARDIAN_ACCEPT:
+        len = sizeof ( peer );
+        fl = fcntl ( io->file_num, F_GETFL );
+        fcntl ( io->file_num, F_SETFL, fl | O_NONBLOCK );
+        result = accept ( io->file_num, ( struct sockaddr * ) &peer, &len );
+        io->error = result < 0 ? errno : 0;
+        fcntl ( io->file_num, F_SETFL, fl );
+
+        if ( result < 0 && ( io->error == EAGAIN || io->error == EWOULDBLOCK ) )
+            return FAIL;
+        if ( result < 0 )
+            break;
+
+        accepted = ( GUARDIAN_ACCEPTED * ) malloc ( sizeof ( GUARDIAN_ACCEPTED ) );
+        if ( !accepted )
+        {
+            close ( result );
+            io->error = ENOMEM;
+            break;
+        }
+        accepted->sock = result;
+        accepted->next = 0;
+        for ( tail = &guardian_accepted; *tail; tail = &( *tail )->next )
+            ;
+        *tail = accepted;
+
+        if ( io->addr && io->addr_len )
+        {
+            if ( ( long ) len > *io->addr_len )
+                len = ( socklen_t ) *io->addr_len;
+            memcpy ( io->addr, &peer, len );
+            *io->addr_len = len;
+        }
+        break;
+
+    case GUARDIAN_SEND:
+    case GUARDIAN_RECV:
+        if ( io->op == GUARDIAN_SEND )
+            result = send ( io->file_num, io->buffer, io->length, io->flags | MSG_DONTWAIT | MSG_NOSIGNAL );
+        else
+            result = recv ( io->file_num, io->buffer, io->length, io->flags | MSG_DONTWAIT );
+
+        if ( result < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+            return FAIL;
+        io->error = result < 0 ? errno : 0;
+        io->count = result < 0 ? 0 : result;
+        break;
+
+    case GUARDIAN_WRITE:
+        result = write ( io->file_num, io->buffer, io->length );
+        io->error = result < 0 ? errno : 0;
+        io->count = result < 0 ? 0 : result;
+        break;
+    }
+
+    io->op = GUARDIAN_DONE;
+
+    return SUCCESS;
+}
+
+/***************************************************************
+*
+* @fn                       AWAITIOX
+*
+* FUNCTION:                 Waits for an outstanding nowait operation
+*                           on a file, or on any file, to complete.
+*
+* @param file_num           The file to wait on, or -1 for any; returns
+*                           the file that completed
+* @param buffer_addr        Returns the buffer of the completed operation
+* @param count_trnsfr       Returns the count of bytes transferred
+* @param tag                Returns the tag of the completed operation
+* @param timeout            In centiseconds; 0 only checks, -1 waits forever
+* @return short             0; the error is kept for FILE_GETINFO_
+***************************************************************/
+short AWAITIOX ( short *file_num, long *buffer_addr, unsigned short *count_trnsfr, long *tag, long timeout )
+{
+    GUARDIAN_IO     *io;
+    GUARDIAN_IO     **link;
+    struct pollfd   *fds;
+    int             fd_count;
+    int             fd_max;
+    int             wanted;
+    int             wait_ms;
+    int             i;
+    struct timeval  now;
+    long long       deadline;
+    long long       remaining;
+
+    wanted = *file_num;
+    gettimeofday ( &now, NULL );
+    deadline = ( long long ) now.tv_sec * 1000 + now.tv_usec / 1000 + ( long long ) timeout * 10;
+    fds = 0;
+    fd_max = 0;
+
+    for ( ;; )
+    {
+        pthread_mutex_lock ( &guardian_lock );
+
+        /* anything that already finished is reported first */
+        for ( link = &guardian_io; *link; link = &( *link )->next )
+        {
+            if ( ( *link )->op == GUARDIAN_DONE && ( wanted < 0 || ( *link )->file_num == wanted ) )
+                break;
+        }
+
+        if ( *link )
+        {
+            io = *link;
+            *link = io->next;
+            pthread_mutex_unlock ( &guardian_lock );
+
+            *file_num = ( short ) io->file_num;
+            *buffer_addr = ( long ) io->buffer;
+            *count_trnsfr = ( unsigned short ) io->count;
+            *tag = io->tag;
+            Guardian_Set_Error ( io->file_num, io->error );
+            free ( io );
+            free ( fds );
+            return 0;
+        }
+
+        fd_count = 0;
+        for ( io = guardian_io; io; io = io->next )
+        {
+            if ( wanted >= 0 && io->file_num != wanted )
+                continue;
+
+            if ( fd_count == fd_max )
+            {
+                fd_max = fd_max ? fd_max * 2 : 16;
+                fds = ( struct pollfd * ) realloc ( fds, sizeof ( struct pollfd ) * fd_max );
+            }
+            fds[fd_count].fd = io->file_num;
+            fds[fd_count].events = ( io->op == GUARDIAN_RECV || io->op == GUARDIAN_ACCEPT ) ? POLLIN : POLLOUT;
+            fds[fd_count].revents = 0;
+            fd_count++;
+        }
+        pthread_mutex_unlock ( &guardian_lock );
+
+        if ( fd_count == 0 )
+        {
+            Guardian_Set_Error ( wanted, ERR_UNINIT_NW );
+            free ( fds );
+            return 0;
+        }
+
+        wait_ms = -1;
+        if ( timeout >= 0 )
+        {
+            gettimeofday ( &now, NULL );
+            remaining = deadline - ( ( long long ) now.tv_sec * 1000 + now.tv_usec / 1000 );
+            wait_ms = remaining > 0 ? ( int ) remaining : 0;
+        }
+
+        if ( poll ( fds, fd_count, wait_ms ) > 0 )
+        {
+            pthread_mutex_lock ( &guardian_lock );
+            for ( io = guardian_io; io; io = io->next )
+            {
+                if ( io->op == GUARDIAN_DONE || ( wanted >= 0 && io->file_num != wanted ) )
+                    continue;
+                for ( i = 0; i < fd_count; i++ )
+                {
+                    if ( fds[i].fd == io->file_num && fds[i].revents )
+                        break;
+                }
+                if ( i < fd_count && Guardian_Perform ( io ) )
+                    break;
+            }
+            pthread_mutex_unlock ( &guardian_lock );
+            continue;
+        }
+
+        if ( wait_ms >= 0 )
+        {
+            gettimeofday ( &now, NULL );
+            if ( ( long long ) now.tv_sec * 1000 + now.tv_usec / 1000 >= deadline )
+            {
+                Guardian_Set_Error ( wanted, ERR_TIMEOUT );
+                free ( fds );
+                return 0;
+            }
+        }
+    }
+}
+
+/***************************************************************
+*
+* @fn                       FILE_GETINFO_
+*
+* FUNCTION:                 Returns the last error on a file.
+*
+* @param file_num           The file, -1 after an AWAITIOX on any file
+*                           that timed out
+* @param error              Receives the error
+* @return short             0
+***************************************************************/
+short FILE_GETINFO_ ( short file_num, short *error )
+{
+    if ( file_num >= 0 )
+        *error = guardian_error[file_num];
+    else
+        *error = guardian_any_error;
+
+    return 0;
+}
+
+/***************************************************************
+*
+* @fn                       FILE_CLOSE_
+*
+* FUNCTION:                 Closes a file, cancelling anything still
+*                           outstanding on it.
+*
+* @param file_num           The file to close
+* @return short             0, or the errno of the close
+***************************************************************/
+short FILE_CLOSE_ ( short file_num )
+{
+    GUARDIAN_IO **link;
+    GUARDIAN_IO *io;
+
+    pthread_mutex_lock ( &guardian_lock );
+    link = &guardian_io;
+    while ( *link )
+    {
+        io = *link;
+        if ( io->file_num == file_num )
+        {
+            *link = io->next;
+            free ( io );
+        }
+        else
+            link = &io->next;
+    }
+    pthread_mutex_unlock ( &guardian_lock );
+
+    if ( file_num >= 0 )
+    {
+        guardian_error[file_num] = 0;
+        guardian_nowait[file_num] = 0;
+    }
+
+    return close ( file_num ) < 0 ? ( short ) errno : 0;
+}
+
+/***************************************************************
+*
+* @fn                       FILE_CREATE_
+*
+* FUNCTION:                 Creates a file; error 10 when it exists.
+*
+* @param file_name          The file name, not null terminated
+* @param max_len            The length of file_name
+* @param name_len           The length of file_name
+* @return short             0, 10, or the errno of the open
+***************************************************************/
+short FILE_CREATE_ ( char *file_name, short max_len, short *name_len )
+{
+    char    path[256];
+    int     fd;
+    int     len;
+
+    len = *name_len < max_len ? *name_len : max_len;
+    if ( len < 0 || len >= ( int ) sizeof ( path ) )
+        return ENAMETOOLONG;
+    memcpy ( path, file_name, len );
+    path[len] = '\0';
+
+    fd = open ( path, O_CREAT | O_EXCL | O_WRONLY, 0644 );
+    if ( fd < 0 )
+        return errno == EEXIST ? 10 : ( short ) errno;
+
+    close ( fd );
+
+    return 0;
+}
+
+/***************************************************************
+*
+* @fn                       FILE_OPEN_
+*
+* FUNCTION:                 Opens a file for read-write (access 0),
+*                           read (1) or write (2).
+*
+* @param file_name          The file name, not null terminated
+* @param name_len           The length of file_name
+* @param file_num           Receives the file number
+* @param access             The access mode
+* @param exclusion          Ignored
+* @param nowait             A nowait depth above 0 makes WRITEX nowait
+* @return short             0, or the errno of the open
+***************************************************************/
+short FILE_OPEN_ ( char *file_name, short name_len, short *file_num, short access, short exclusion, short nowait )
+{
+    char    path[256];
+    int     fd;
+
+    ( void ) exclusion;
+
+    if ( name_len < 0 || name_len >= ( int ) sizeof ( path ) )
+        return ENAMETOOLONG;
+    memcpy ( path, file_name, name_len );
+    path[name_len] = '\0';
+
+    fd = open ( path, access == 1 ? O_RDONLY : access == 2 ? O_WRONLY : O_RDWR );
+    if ( fd < 0 )
+        return ( short ) errno;
+    if ( fd >= GUARDIAN_MAX_FILES )
+    {
+        close ( fd );
+        return EMFILE;
+    }
+
+    guardian_nowait[fd] = nowait > 0;
+    *file_num = ( short ) fd;
+
+    return 0;
+}
+
+/***************************************************************
+*
+* @fn                       POSITION
+*
+* FUNCTION:                 Sets the position of a file; -1 is end of file.
+*
+* @param file_num           The file
+* @param position           The byte offset, or -1
+* @return short             0, or the errno of the seek
+***************************************************************/
+short POSITION ( short file_num, long position )
+{
+    off_t   result;
+
+    if ( position == -1L )
+        result = lseek ( file_num, 0, SEEK_END );
+    else
+        result = lseek ( file_num, ( off_t ) position, SEEK_SET );
+
+    return result < 0 ? ( short ) errno : 0;
+}
+
+/***************************************************************
+*
+* @fn                       WRITEX
+*
+* FUNCTION:                 Writes to a file; on a file opened nowait
+*                           the write completes through AWAITIOX.
+*
+* @param file_num           The file
+* @param buffer             The data
+* @param count              The number of bytes
+* @param count_written      Receives the count when waited; may be 0
+* @param tag                The tag of a nowait write
+* @return short             0, or the errno
+***************************************************************/
+short WRITEX ( short file_num, char *buffer, unsigned short count, unsigned short *count_written, long tag )
+{
+    int result;
+
+    if ( file_num >= 0 && guardian_nowait[file_num] )
+        return Guardian_Post_Buffer ( file_num, GUARDIAN_WRITE, buffer, count, 0, tag ) < 0 ? ( short ) errno : 0;
+
+    result = write ( file_num, buffer, count );
+    Guardian_Set_Error ( file_num, result < 0 ? errno : 0 );
+    if ( count_written )
+        *count_written = ( unsigned short ) ( result < 0 ? 0 : result );
+
+    return result < 0 ? ( short ) errno : 0;
+}
+
+/***************************************************************
+*
+* @fn                       socket_set_inet_name
+*
+* FUNCTION:                 There is only one stack off Guardian.
+*
+* @param process_name       Ignored
+* @return int               0
+***************************************************************/
+int socket_set_inet_name ( char *process_name )
+{
+    ( void ) process_name;
+
+    return 0;
+}
+
+/***************************************************************
+*
+* @fn                       socket_nw
+*
+* FUNCTION:                 Creates a socket for nowait operations.
+*
+* @param domain             The address family
+* @param type               The socket type
+* @param protocol           The protocol
+* @param flags              Ignored
+* @param sync               Ignored
+* @return int               The socket, -1 with errno set
+***************************************************************/
+int socket_nw ( int domain, int type, int protocol, int flags, int sync )
+{
+    int sock;
+
+    ( void ) flags;
+    ( void ) sync;
+
+    sock = socket ( domain, type, protocol );
+    if ( sock >= GUARDIAN_MAX_FILES )
+    {
+        close ( sock );
+        errno = EMFILE;
+        return -1;
+    }
+    if ( sock >= 0 )
+        guardian_nowait[sock] = 1;
+
+    return sock;
+}
+
+/***************************************************************
+*
+* @fn                       bind_nw
+*
+* FUNCTION:                 Binds a socket; completes at once.
+*
+* @return int               0, -1 with errno set
+***************************************************************/
+int bind_nw ( int sock, struct sockaddr *addr, int addr_len, long tag )
+{
+    int error;
+
+    error = bind ( sock, addr, ( socklen_t ) addr_len ) < 0 ? errno : 0;
+
+    return Guardian_Post ( sock, GUARDIAN_DONE, tag, error );
+}
+
+/***************************************************************
+*
+* @fn                       connect_nw
+*
+* FUNCTION:                 Starts connecting; AWAITIOX completes it
+*                           once the socket is writable.
+*
+* @return int               0, -1 with errno set
+***************************************************************/
+int connect_nw ( int sock, struct sockaddr *addr, int addr_len, long tag )
+{
+    int fl;
+    int error;
+
+    fl = fcntl ( sock, F_GETFL );
+    fcntl ( sock, F_SETFL, fl | O_NONBLOCK );
+    error = connect ( sock, addr, ( socklen_t ) addr_len ) < 0 ? errno : 0;
+    fcntl ( sock, F_SETFL, fl );
+
+    if ( error == EINPROGRESS )
+        return Guardian_Post ( sock, GUARDIAN_CONNECT, tag, 0 );
+
+    return Guardian_Post ( sock, GUARDIAN_DONE, tag, error );
+}
+
+/***************************************************************
+*
+* @fn                       accept_nw
+*
+* FUNCTION:                 Waits for a connection on a listening
+*                           socket; follow with accept_nw2.
+*
+* @return int               0, -1 with errno set
+***************************************************************/
+int accept_nw ( int sock, struct sockaddr *addr, long *addr_len, long tag )
+{
+    GUARDIAN_IO *io;
+
+    io = Guardian_New ( sock, GUARDIAN_ACCEPT, tag, 0 );
+    if ( io )
+    {
+        io->addr = addr;
+        io->addr_len = addr_len;
+    }
+
+    return Guardian_Queue ( io );
+}
+
+/***************************************************************
+*
+* @fn                       accept_nw1
+*
+* FUNCTION:                 accept_nw that also sets the listen queue.
+*
+* @return int               0, -1 with errno set
+***************************************************************/
+int accept_nw1 ( int sock, struct sockaddr *addr, long *addr_len, long tag, short queue_len )
+{
+    if ( listen ( sock, queue_len ) < 0 )
+        return -1;
+
+    return accept_nw ( sock, addr, addr_len, tag );
+}
+
+/***************************************************************
+*
+* @fn                       accept_nw2
+*
+* FUNCTION:                 Moves the connection taken by the last
+*                           completed accept_nw onto new_sock.
+*
+* @return int               0, -1 with errno set
+***************************************************************/
+int accept_nw2 ( int new_sock, struct sockaddr *addr, long tag )
+{
+    GUARDIAN_ACCEPTED   *accepted;
+    int                 error;
+
+    ( void ) addr;
+
+    pthread_mutex_lock ( &guardian_lock );
+    accepted = guardian_accepted;
+    if ( accepted )
+        guardian_accepted = accepted->next;
+    pthread_mutex_unlock ( &guardian_lock );
+
+    if ( !accepted )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    error = dup2 ( accepted->sock, new_sock ) < 0 ? errno : 0;
+    close ( accepted->sock );
+    free ( accepted );
+
+    return Guardian_Post ( new_sock, GUARDIAN_DONE, tag, error );
+}
+
+/***************************************************************
+*
+* @fn                       accept_nw3
+*
+* FUNCTION:                 accept_nw2; the local address is not checked.
+*
+* @return int               0, -1 with errno set
+***************************************************************/
+int accept_nw3 ( int new_sock, struct sockaddr *addr, struct sockaddr *me, long tag )
+{
+    ( void ) me;
+
+    return accept_nw2 ( new_sock, addr, tag );
+}
+
+/***************************************************************
+*
+* @fn                       send_nw
+*
+* FUNCTION:                 Queues a send; AWAITIOX sends what the
+*                           socket takes and reports that count.
+*
+* @return int               0, -1 with errno set
+***************************************************************/
+int send_nw ( int sock, char *buffer, int length, int flags, long tag )
+{
+    return Guardian_Post_Buffer ( sock, GUARDIAN_SEND, buffer, length, flags, tag );
+}
+
+/***************************************************************
+*
+* @fn                       recv_nw
+*
+* FUNCTION:                 Queues a receive; AWAITIOX reports the count.
+*
+* @return int               0, -1 with errno set
+***************************************************************/
+int recv_nw ( int sock, char *buffer, int length, int flags, long tag )
+{
+    return Guardian_Post_Buffer ( sock, GUARDIAN_RECV, buffer, length, flags, tag );
+}
+
+/***************************************************************
+*
+* @fn                       shutdown_nw
+*
+* FUNCTION:                 Shuts a socket down; completes at once.
+*
+* @return int               0, -1 with errno set
+***************************************************************/
+int shutdown_nw ( int sock, int how, long tag )
+{
+    int error;
+
+    error = shutdown ( sock, how ) < 0 ? errno : 0;
+
+    return Guardian_Post ( sock, GUARDIAN_DONE, tag, error );
+}
+
+/***************************************************************
+*
+* @fn                       getsockname_nw
+*
+* FUNCTION:                 Gets the bound address; completes at once.
+*
+* @return int               0, -1 with errno set
+***************************************************************/
+int getsockname_nw ( int sock, struct sockaddr *addr, long *addr_len, long tag )
+{
+    socklen_t   len;
+    int         error;
+
+    len = ( socklen_t ) *addr_len;
+    error = getsockname ( sock, addr, &len ) < 0 ? errno : 0;
+    *addr_len = len;
+
+    return Guardian_Post ( sock, GUARDIAN_DONE, tag, error );
+}
+
+/***************************************************************
+*
+* @fn                       setsockopt_nw
+*
+* FUNCTION:                 Sets a socket option; completes at once.
+*
+* @return int               0, -1 with errno set
+***************************************************************/
+int setsockopt_nw ( int sock, int level, int option, char *value, int value_len, long tag )
+{
+    int error;
+
+    error = setsockopt ( sock, level, option, value, ( socklen_t ) value_len ) < 0 ? errno : 0;
+
+    return Guardian_Post ( sock, GUARDIAN_DONE, tag, error );
+}
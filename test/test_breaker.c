@@ -0,0 +1,161 @@
+/*****************************************************************************************
+*
+*   test_breaker.c
+*
+*   Managed reconnect against a local listener that is stopped and started again to
+*   simulate a backend going down and coming back: the breaker opens after
+*   failure_threshold failures, fails fast while open, lets exactly one half-open trial
+*   through, and closes again (calling on_restore) once the listener is back.
+*
+*****************************************************************************************/
+#include "nscc.h"
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if ( !( cond ) )                                                    \
+        {                                                                   \
+            fprintf ( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond ); \
+            exit ( 1 );                                                     \
+        }                                                                   \
+    } while ( 0 )
+
+static TCP  *tcp;
+static int  restored;
+
+static void On_Restore ( TCP_CONNECTION_INFO *connection, void *context )
+{
+    ( void ) connection;
+    ( *( int * ) context )++;
+}
+
+/* starts listening on "port" (0 for any), returns the port or -1 */
+static int Listener_Start ( int *sock, int port )
+{
+    struct sockaddr_in  addr;
+    socklen_t           addr_len;
+    int                 on;
+
+    *sock = socket ( AF_INET, SOCK_STREAM, 0 );
+    on = 1;
+    setsockopt ( *sock, SOL_SOCKET, SO_REUSEADDR, ( char * ) &on, sizeof ( on ) );
+
+    memset ( &addr, 0, sizeof ( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons ( ( unsigned short ) port );
+    addr.sin_addr.s_addr = inet_addr ( "127.0.0.1" );
+
+    if ( bind ( *sock, ( struct sockaddr * ) &addr, sizeof ( addr ) ) < 0 || listen ( *sock, 16 ) < 0 )
+        return -1;
+
+    addr_len = sizeof ( addr );
+    getsockname ( *sock, ( struct sockaddr * ) &addr, &addr_len );
+    return ntohs ( addr.sin_port );
+}
+
+static void Listener_Stop ( int *sock )
+{
+    close ( *sock );
+    *sock = -1;
+}
+
+static void Wait_Ms ( int ms )
+{
+    usleep ( ms * 1000 );
+}
+
+int main ( void )
+{
+    TCP_CONNECTION_INFO connection;
+    RECONNECT_POLICY    policy;
+    CIRCUIT_BREAKER     breaker;
+    TIMESTAMP           delay;
+    int                 listener;
+    int                 port;
+    int                 i;
+
+    tcp = intialize_tcp ( );
+
+    /* find a free port, then take the backend down */
+    port = Listener_Start ( &listener, 0 );
+    CHECK ( port > 0 );
+    Listener_Stop ( &listener );
+
+    memset ( &policy, 0, sizeof ( policy ) );
+    policy.base_us = 1000;
+    policy.max_us = 8000;
+    policy.multiplier = 2.0;
+    policy.jitter = 0.2;
+    policy.failure_threshold = 3;
+    policy.open_us = 100000;
+
+    tcp->breaker_init ( &breaker, &policy );
+    breaker.on_restore = On_Restore;
+    breaker.context = &restored;
+
+    memset ( &connection, 0, sizeof ( connection ) );
+    strcpy ( connection.ipaddr, "127.0.0.1" );
+    connection.port = ( TCP_PORT ) port;
+    connection.breaker = &breaker;
+
+    /* outage: three attempts, then the breaker opens */
+    CHECK ( tcp->make_connect_managed ( &connection ) == -1 );
+    CHECK ( breaker.state == BREAKER_OPEN );
+    CHECK ( breaker.failures == 3 );
+
+    /* while open, fail fast without trying */
+    CHECK ( tcp->make_connect_managed ( &connection ) == ERR_CIRCUIT_OPEN );
+    CHECK ( breaker.failures == 3 );
+    CHECK ( breaker.rejected == 1 );
+
+    /* half-open admits one trial until it is recorded */
+    Wait_Ms ( 110 );
+    CHECK ( tcp->breaker_allow ( &breaker ) );
+    CHECK ( breaker.state == BREAKER_HALF_OPEN );
+    for ( i = 0; i < 5; i++ )
+        CHECK ( !tcp->breaker_allow ( &breaker ) );
+    tcp->breaker_record ( &breaker, &connection, FAIL );
+    CHECK ( breaker.state == BREAKER_OPEN );
+
+    /* the backend comes back: the next trial connects and restores */
+    CHECK ( Listener_Start ( &listener, port ) == port );
+    Wait_Ms ( 110 );
+    CHECK ( tcp->make_connect_managed ( &connection ) == 0 );
+    CHECK ( breaker.state == BREAKER_CLOSED );
+    CHECK ( breaker.consecutive_failures == 0 );
+    CHECK ( restored == 1 );
+    CHECK ( breaker.restores == 1 );
+
+    /* and goes down again */
+    tcp->close_sock ( &connection );
+    Listener_Stop ( &listener );
+    CHECK ( tcp->make_connect_managed ( &connection ) == -1 );
+    CHECK ( breaker.state == BREAKER_OPEN );
+
+    /* an attempt cap stops the retries before the breaker would */
+    policy.failure_threshold = 100;
+    policy.max_attempts = 4;
+    tcp->breaker_init ( &breaker, &policy );
+    CHECK ( tcp->make_connect_managed ( &connection ) == -1 );
+    CHECK ( breaker.attempts == 4 );
+    CHECK ( breaker.state == BREAKER_CLOSED );
+
+    /* with no limit at all a call makes a single attempt */
+    policy.failure_threshold = 0;
+    policy.max_attempts = 0;
+    tcp->breaker_init ( &breaker, &policy );
+    CHECK ( tcp->make_connect_managed ( &connection ) == -1 );
+    CHECK ( breaker.attempts == 1 );
+
+    /* no base delay still waits between attempts */
+    policy.base_us = 0;
+    policy.jitter = 0.0;
+    tcp->breaker_init ( &breaker, &policy );
+    delay = tcp->reconnect_delay ( &breaker );
+    CHECK ( delay >= RECONNECT_MIN_DELAY_US );
+
+    tcp->close_sock ( &connection );
+    tcp->clean_conn_info ( &connection );
+
+    printf ( "test_breaker: ok\n" );
+    return 0;
+}
@@ -0,0 +1,223 @@
+/*****************************************************************************************
+*
+*   test_lz4_interop.c
+*
+*   Compressed frames are meant to be LZ4 blocks any LZ4 decoder can read. Frames sent
+*   by New_Send_Frame are decoded with the reference library's LZ4_decompress_safe, and
+*   blocks made by LZ4_compress_default are received with New_Recv_Frame.
+*
+*   Built against the system liblz4 when the Makefile finds one (HAVE_LZ4); without it
+*   the test reports that it was skipped.
+*
+*****************************************************************************************/
+#include "nscc.h"
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if ( !( cond ) )                                                    \
+        {                                                                   \
+            fprintf ( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond ); \
+            exit ( 1 );                                                     \
+        }                                                                   \
+    } while ( 0 )
+
+#ifdef HAVE_LZ4
+
+/* lz4.h is not always installed alongside the library */
+int LZ4_compress_default ( const char *src, char *dst, int src_size, int dst_capacity );
+int LZ4_decompress_safe ( const char *src, char *dst, int compressed_size, int dst_capacity );
+
+#define MAX_MSG     ( 256 * 1024 )
+
+static TCP *tcp;
+
+static void Read_Exact ( int sock, char *buffer, int length )
+{
+    int got;
+    int n;
+
+    for ( got = 0; got < length; got += n )
+    {
+        n = ( int ) read ( sock, buffer + got, length - got );
+        CHECK ( n > 0 );
+    }
+}
+
+static void Write_Exact ( int sock, char *buffer, int length )
+{
+    int put;
+    int n;
+
+    for ( put = 0; put < length; put += n )
+    {
+        n = ( int ) write ( sock, buffer + put, length - put );
+        CHECK ( n > 0 );
+    }
+}
+
+/* text-like data: repeats at varying distances, with some noise */
+static void Fill ( char *buffer, int length, unsigned int seed )
+{
+    static const char *words[] = { "ACCOUNT ", "BALANCE=", "000120.55 ", "$ZTC0 ", "\n", "TXN-", "OK " };
+    int fill;
+    int i;
+
+    for ( fill = 0; fill < length; )
+    {
+        seed = seed * 1103515245 + 12345;
+        if ( ( seed >> 16 ) % 8 == 0 )
+        {
+            buffer[fill++] = ( char ) ( seed >> 24 );
+            continue;
+        }
+        for ( i = 0; words[( seed >> 16 ) % 7][i] && fill < length; i++ )
+            buffer[fill++] = words[( seed >> 16 ) % 7][i];
+    }
+}
+
+/* frames can be bigger than the socket buffer, so one end of each exchange runs here */
+typedef struct _writer
+{
+    TCP_CONNECTION_INFO *connection;
+    int                 sock;
+    char                *buffer;
+    int                 length;
+} WRITER;
+
+static void *Writer ( void *arg )
+{
+    WRITER *writer;
+
+    writer = ( WRITER * ) arg;
+    if ( writer->connection )
+        CHECK ( tcp->new_send_frame ( writer->connection, writer->buffer, writer->length ) == 0 );
+    else
+        Write_Exact ( writer->sock, writer->buffer, writer->length );
+
+    return 0;
+}
+
+static void Connection_On ( TCP_CONNECTION_INFO *connection, int sock )
+{
+    memset ( connection, 0, sizeof ( TCP_CONNECTION_INFO ) );
+    connection->sock = ( int * ) malloc ( sizeof ( int ) );
+    *connection->sock = sock;
+    tcp->compress_enable ( connection, COMPRESS_THRESHOLD );
+    connection->frame_opts = FRAME_F_COMPRESSED;
+}
+
+/* ours to theirs: every compressed frame must decode with the reference decoder */
+static int Send_To_Reference ( TCP_CONNECTION_INFO *sender, int peer, char *message, int length, char *payload, char *decoded )
+{
+    FRAME_HDR   header;
+    WRITER      writer;
+    pthread_t   thread;
+    uint32_t    original;
+    int         size;
+
+    writer.connection = sender;
+    writer.buffer = message;
+    writer.length = length;
+    pthread_create ( &thread, 0, Writer, &writer );
+
+    Read_Exact ( peer, ( char * ) &header, sizeof ( header ) );
+    size = ( int ) ntohl ( header.length );
+    CHECK ( size > 0 && size <= MAX_MSG + ( int ) sizeof ( uint32_t ) );
+    Read_Exact ( peer, payload, size );
+    pthread_join ( thread, 0 );
+
+    if ( !( ntohl ( header.flags ) & FRAME_F_COMPRESSED ) )
+    {
+        CHECK ( size == length && memcmp ( payload, message, length ) == 0 );
+        return 0;
+    }
+
+    memcpy ( &original, payload, sizeof ( original ) );
+    CHECK ( ( int ) ntohl ( original ) == length );
+    CHECK ( LZ4_decompress_safe ( payload + sizeof ( uint32_t ), decoded, size - ( int ) sizeof ( uint32_t ), MAX_MSG ) == length );
+    CHECK ( memcmp ( decoded, message, length ) == 0 );
+
+    return 1;
+}
+
+/* theirs to ours: a reference-compressed block must expand through New_Recv_Frame */
+static void Recv_From_Reference ( TCP_CONNECTION_INFO *receiver, int peer, char *message, int length, char *payload, char *decoded )
+{
+    FRAME_HDR   header;
+    WRITER      writer;
+    pthread_t   thread;
+    uint32_t    original;
+    int         size;
+    int         msg_length;
+
+    size = LZ4_compress_default ( message, payload + sizeof ( FRAME_HDR ) + sizeof ( uint32_t ), length, MAX_MSG * 2 );
+    CHECK ( size > 0 );
+
+    header.length = htonl ( ( uint32_t ) ( size + sizeof ( uint32_t ) ) );
+    header.flags = htonl ( FRAME_F_COMPRESSED );
+    original = htonl ( ( uint32_t ) length );
+    memcpy ( payload, &header, sizeof ( header ) );
+    memcpy ( payload + sizeof ( header ), &original, sizeof ( original ) );
+
+    writer.connection = 0;
+    writer.sock = peer;
+    writer.buffer = payload;
+    writer.length = ( int ) ( sizeof ( header ) + sizeof ( uint32_t ) ) + size;
+    pthread_create ( &thread, 0, Writer, &writer );
+
+    CHECK ( tcp->new_recv_frame ( receiver, decoded, MAX_MSG, &msg_length ) == 0 );
+    pthread_join ( thread, 0 );
+    CHECK ( msg_length == length && memcmp ( decoded, message, length ) == 0 );
+}
+
+int main ( void )
+{
+    static const int    sizes[] = { 512, 600, 4096, 65535, 65536, 70000, MAX_MSG };
+    TCP_CONNECTION_INFO ours;
+    int                 pair[2];
+    char                *message;
+    char                *payload;
+    char                *decoded;
+    int                 compressed;
+    int                 i;
+    int                 round;
+
+    tcp = intialize_tcp ( );
+
+    CHECK ( socketpair ( AF_UNIX, SOCK_STREAM, 0, pair ) == 0 );
+    Connection_On ( &ours, pair[0] );
+
+    message = ( char * ) malloc ( MAX_MSG );
+    payload = ( char * ) malloc ( MAX_MSG * 2 + 64 );
+    decoded = ( char * ) malloc ( MAX_MSG );
+
+    /* several rounds, so later messages meet hash slots left by earlier ones */
+    compressed = 0;
+    for ( round = 0; round < 4; round++ )
+    {
+        for ( i = 0; i < ( int ) ( sizeof ( sizes ) / sizeof ( sizes[0] ) ); i++ )
+        {
+            Fill ( message, sizes[i], ( unsigned int ) ( round * 31 + i ) );
+
+            compressed += Send_To_Reference ( &ours, pair[1], message, sizes[i], payload, decoded );
+            Recv_From_Reference ( &ours, pair[1], message, sizes[i], payload, decoded );
+        }
+    }
+    CHECK ( compressed > 0 );
+
+    tcp->close_sock ( &ours );
+    close ( pair[1] );
+
+    printf ( "test_lz4_interop: ok (%d frames decoded by liblz4)\n", compressed );
+    return 0;
+}
+
+#else
+
+int main ( void )
+{
+    printf ( "test_lz4_interop: skipped, no liblz4 found\n" );
+    return 0;
+}
+
+#endif